@@ -0,0 +1,303 @@
+#include "CompressionCache.h"
+#include "Hash.h"
+#include "lz4.h"
+#include "lz4hc.h"
+#include <cstdio>
+#include <cstring>
+#include <cerrno>
+#include <algorithm>
+
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <Windows.h>
+#else
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <dirent.h>
+#include <unistd.h>
+#include <utime.h>
+#endif
+
+namespace
+{
+	// what's at the start of every file in the cache
+	struct EntryHeader
+	{
+		char Magic[4];
+		uint32_t UncompressedSize;
+		uint32_t CompressedSize;
+		uint32_t Unused;
+	};
+
+	struct Entry
+	{
+		std::string Name;
+		uint64_t Size;
+		uint64_t LastUsed;
+	};
+
+	const char EntryMagic[4] = { 'E', 'G', 'G', 'C' };
+
+	// everything in the cache has this in its name, so Prune() leaves anything else alone
+	const char* const EntryCodec = "lz4hc";
+
+	bool isEntryName(const char* name)
+	{
+		return strstr(name, EntryCodec) != nullptr && strstr(name, ".tmp") == nullptr;
+	}
+
+	FILE* openFile(const char* path, const char* mode)
+	{
+#ifdef _WIN32
+		FILE* fp;
+		if (fopen_s(&fp, path, mode) != 0)
+			return nullptr;
+		return fp;
+#else
+		return fopen(path, mode);
+#endif
+	}
+
+	// bumps the file's modification time, which is what Prune() goes by
+	void touch(const char* path)
+	{
+#ifdef _WIN32
+		HANDLE file = CreateFileA(path, FILE_WRITE_ATTRIBUTES, FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE, nullptr, OPEN_EXISTING, 0, nullptr);
+		if (file == INVALID_HANDLE_VALUE)
+			return;
+
+		FILETIME now;
+		GetSystemTimeAsFileTime(&now);
+		SetFileTime(file, nullptr, nullptr, &now);
+		CloseHandle(file);
+#else
+		utime(path, nullptr);
+#endif
+	}
+}
+
+CompressionCache::CompressionCache()
+{
+	m_maxBytes = 0;
+	m_numHits = 0;
+	m_numMisses = 0;
+	m_numRejected = 0;
+	m_bytesHit = 0;
+	m_bytesMissed = 0;
+	m_numPruned = 0;
+	m_bytesPruned = 0;
+	m_nextTemporary = 0;
+}
+
+bool CompressionCache::Open(const char* directory, uint64_t maxBytes)
+{
+	m_directory = directory;
+	m_maxBytes = maxBytes;
+
+	while (m_directory.size() > 1 && (m_directory.back() == '/' || m_directory.back() == '\\'))
+		m_directory.pop_back();
+
+#ifdef _WIN32
+	if (CreateDirectoryA(m_directory.c_str(), nullptr) == FALSE && GetLastError() != ERROR_ALREADY_EXISTS)
+		return false;
+#else
+	if (mkdir(m_directory.c_str(), 0777) != 0 && errno != EEXIST)
+		return false;
+#endif
+
+	return true;
+}
+
+int CompressionCache::Compress(const uint8_t* data, uint32_t size, uint8_t* output, uint32_t outputSize, int level)
+{
+	if (size == 0)
+		return 0;
+
+	std::string path = getPath(Hasher::Hash(data, size), size, level);
+
+	int compressedSize = 0;
+	if (load(path, data, size, output, outputSize, &compressedSize))
+	{
+		{
+			std::lock_guard<std::mutex> lock(m_lock);
+			m_numHits++;
+			m_bytesHit += size;
+		}
+		touch(path.c_str());
+		return compressedSize;
+	}
+
+	{
+		std::lock_guard<std::mutex> lock(m_lock);
+		m_numMisses++;
+		m_bytesMissed += size;
+	}
+
+	compressedSize = LZ4_compress_HC((const char*)data, (char*)output, size, outputSize, level);
+	if (compressedSize > 0)
+		store(path, output, compressedSize, size);
+
+	return compressedSize;
+}
+
+std::string CompressionCache::getPath(uint64_t hash, uint32_t size, int level)
+{
+	char name[64];
+	snprintf(name, sizeof(name), "/%016llx-%08x-%s%d", (unsigned long long)hash, size, EntryCodec, level);
+	return m_directory + name;
+}
+
+bool CompressionCache::load(const std::string& path, const uint8_t* data, uint32_t size, uint8_t* output, uint32_t outputSize, int* compressedSize)
+{
+	FILE* fp = openFile(path.c_str(), "rb");
+	if (fp == nullptr)
+		return false;
+
+	EntryHeader header;
+	bool ok = fread(&header, sizeof(header), 1, fp) == 1 &&
+		memcmp(header.Magic, EntryMagic, 4) == 0 &&
+		header.UncompressedSize == size &&
+		header.CompressedSize > 0 &&
+		header.CompressedSize <= outputSize &&
+		fread(output, 1, header.CompressedSize, fp) == header.CompressedSize;
+	fclose(fp);
+
+	if (ok)
+	{
+		// make sure it really is this file before it goes in the archive
+		std::vector<uint8_t> scratch(size);
+		int r = LZ4_decompress_safe((const char*)output, (char*)scratch.data(), (int)header.CompressedSize, (int)size);
+		ok = r == (int)size && memcmp(scratch.data(), data, size) == 0;
+	}
+
+	if (ok == false)
+	{
+		std::lock_guard<std::mutex> lock(m_lock);
+		m_numRejected++;
+		return false;
+	}
+
+	*compressedSize = (int)header.CompressedSize;
+	return true;
+}
+
+void CompressionCache::store(const std::string& path, const uint8_t* compressed, int compressedSize, uint32_t size)
+{
+	// Write it somewhere else first, so another build never sees half of it. The number
+	// keeps two threads that are storing the same data out of each other's way.
+	char suffix[48];
+	unsigned int number = m_nextTemporary++;
+#ifdef _WIN32
+	snprintf(suffix, sizeof(suffix), ".%lu.%u.tmp", GetCurrentProcessId(), number);
+#else
+	snprintf(suffix, sizeof(suffix), ".%ld.%u.tmp", (long)getpid(), number);
+#endif
+	std::string temporaryPath = path + suffix;
+
+	FILE* fp = openFile(temporaryPath.c_str(), "wb");
+	if (fp == nullptr)
+		return;
+
+	EntryHeader header;
+	memcpy(header.Magic, EntryMagic, 4);
+	header.UncompressedSize = size;
+	header.CompressedSize = (uint32_t)compressedSize;
+	header.Unused = 0;
+
+	bool ok = fwrite(&header, sizeof(header), 1, fp) == 1 &&
+		fwrite(compressed, 1, compressedSize, fp) == (size_t)compressedSize;
+	ok = fclose(fp) == 0 && ok;
+
+#ifdef _WIN32
+	ok = ok && MoveFileExA(temporaryPath.c_str(), path.c_str(), MOVEFILE_REPLACE_EXISTING) != FALSE;
+#else
+	ok = ok && rename(temporaryPath.c_str(), path.c_str()) == 0;
+#endif
+
+	if (ok == false)
+		remove(temporaryPath.c_str());
+}
+
+void CompressionCache::Prune()
+{
+	std::vector<Entry> entries;
+	uint64_t totalBytes = 0;
+
+#ifdef _WIN32
+	WIN32_FIND_DATAA data;
+	HANDLE find = FindFirstFileA((m_directory + "\\*").c_str(), &data);
+	if (find == INVALID_HANDLE_VALUE)
+		return;
+
+	do
+	{
+		if ((data.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY) || isEntryName(data.cFileName) == false)
+			continue;
+
+		Entry entry;
+		entry.Name = data.cFileName;
+		entry.Size = ((uint64_t)data.nFileSizeHigh << 32) | data.nFileSizeLow;
+		entry.LastUsed = ((uint64_t)data.ftLastWriteTime.dwHighDateTime << 32) | data.ftLastWriteTime.dwLowDateTime;
+		entries.push_back(entry);
+		totalBytes += entry.Size;
+	} while (FindNextFileA(find, &data));
+
+	FindClose(find);
+#else
+	DIR* dir = opendir(m_directory.c_str());
+	if (dir == nullptr)
+		return;
+
+	while (dirent* d = readdir(dir))
+	{
+		if (isEntryName(d->d_name) == false)
+			continue;
+
+		std::string path = m_directory + "/" + d->d_name;
+		struct stat st;
+		if (stat(path.c_str(), &st) != 0 || S_ISREG(st.st_mode) == false)
+			continue;
+
+		Entry entry;
+		entry.Name = d->d_name;
+		entry.Size = (uint64_t)st.st_size;
+		entry.LastUsed = (uint64_t)st.st_mtime;
+		entries.push_back(entry);
+		totalBytes += entry.Size;
+	}
+
+	closedir(dir);
+#endif
+
+	if (totalBytes <= m_maxBytes)
+		return;
+
+	// oldest first
+	std::sort(entries.begin(), entries.end(), [](const Entry& a, const Entry& b) { return a.LastUsed < b.LastUsed; });
+
+	for (size_t i = 0; i < entries.size() && totalBytes > m_maxBytes; i++)
+	{
+		std::string path = m_directory + "/" + entries[i].Name;
+		if (remove(path.c_str()) != 0)
+			continue;
+
+		totalBytes -= entries[i].Size;
+		m_numPruned++;
+		m_bytesPruned += entries[i].Size;
+	}
+}
+
+void CompressionCache::PrintReport()
+{
+	uint32_t numLookups = m_numHits + m_numMisses;
+	double hitRate = numLookups > 0 ? m_numHits * 100.0 / numLookups : 0;
+
+	printf("Compression cache: %u hits, %u misses (%.1f%% hit rate), %llu bytes not compressed again, %llu bytes compressed\n",
+		m_numHits, m_numMisses, hitRate, (unsigned long long)m_bytesHit, (unsigned long long)m_bytesMissed);
+
+	if (m_numRejected > 0)
+		printf("Compression cache: %u entries didn't match their input and were compressed again\n", m_numRejected);
+	if (m_numPruned > 0)
+		printf("Compression cache: pruned %u entries (%llu bytes)\n", m_numPruned, (unsigned long long)m_bytesPruned);
+}
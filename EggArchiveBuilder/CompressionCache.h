@@ -0,0 +1,59 @@
+#ifndef COMPRESSIONCACHE_H
+#define COMPRESSIONCACHE_H
+
+#include <cstdint>
+#include <string>
+#include <vector>
+#include <mutex>
+#include <atomic>
+
+// Keeps what LZ4_compress_HC produced for every input the builder has seen,
+// in a directory that's shared between builds. Entries are named after a
+// hash of the uncompressed data, its size, the codec and the level, so
+// unchanged files get their compressed bytes copied out of the cache instead
+// of being compressed again.
+//
+// Cached data is always decompressed and compared against the input before
+// it's used, so a hash collision or a damaged cache file costs a compression,
+// not a broken archive.
+//
+// Compress() can be called from more than one thread at once.
+class CompressionCache
+{
+public:
+	CompressionCache();
+
+	// Creates the directory if it's not there. maxBytes is how big Prune() lets it get.
+	bool Open(const char* directory, uint64_t maxBytes);
+
+	// Works like LZ4_compress_HC(), but uses the cache. Returns the compressed size, or 0 if it didn't fit.
+	int Compress(const uint8_t* data, uint32_t size, uint8_t* output, uint32_t outputSize, int level);
+
+	// Deletes the least recently used entries until the cache fits in maxBytes
+	void Prune();
+
+	// prints the hit rate and how much compressing was saved
+	void PrintReport();
+
+private:
+	std::string getPath(uint64_t hash, uint32_t size, int level);
+	bool load(const std::string& path, const uint8_t* data, uint32_t size, uint8_t* output, uint32_t outputSize, int* compressedSize);
+	void store(const std::string& path, const uint8_t* compressed, int compressedSize, uint32_t size);
+
+	std::string m_directory;
+	uint64_t m_maxBytes;
+	std::atomic<unsigned int> m_nextTemporary;
+
+	// guards the counts
+	std::mutex m_lock;
+
+	uint32_t m_numHits;
+	uint32_t m_numMisses;
+	uint32_t m_numRejected;
+	uint64_t m_bytesHit;
+	uint64_t m_bytesMissed;
+	uint32_t m_numPruned;
+	uint64_t m_bytesPruned;
+};
+
+#endif // COMPRESSIONCACHE_H
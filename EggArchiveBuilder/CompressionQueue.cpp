@@ -0,0 +1,147 @@
+#include "CompressionQueue.h"
+#include "CompressionCache.h"
+#include "Hash.h"
+#include "Trace.h"
+#include "lz4.h"
+#include "lz4hc.h"
+
+CompressionQueue::CompressionQueue()
+{
+	m_cache = nullptr;
+	m_bytes = 0;
+	m_maxBytes = 0;
+	m_stopping = false;
+}
+
+CompressionQueue::~CompressionQueue()
+{
+	Stop();
+}
+
+void CompressionQueue::Start(CompressionCache* cache, unsigned int numThreads, uint64_t maxBytes)
+{
+	m_cache = cache;
+	m_maxBytes = maxBytes;
+	m_bytes = 0;
+	m_stopping = false;
+
+	if (numThreads == 0)
+		numThreads = 1;
+
+	for (unsigned int i = 0; i < numThreads; i++)
+		m_threads.push_back(std::thread(&CompressionQueue::workerThread, this));
+}
+
+void CompressionQueue::Stop()
+{
+	{
+		std::lock_guard<std::mutex> lock(m_lock);
+		m_stopping = true;
+	}
+	m_workCondition.notify_all();
+
+	for (size_t i = 0; i < m_threads.size(); i++)
+		m_threads[i].join();
+	m_threads.clear();
+
+	for (size_t i = 0; i < m_jobs.size(); i++)
+		delete m_jobs[i];
+	m_jobs.clear();
+	m_waiting.clear();
+	m_bytes = 0;
+}
+
+void CompressionQueue::Add(CompressionJob* job)
+{
+	job->Done = false;
+	job->Failed = false;
+	job->Hash = 0;
+	job->Compressed.clear();
+	job->Bytes = job->Data.size() + job->DecompressedSize;
+
+	{
+		std::lock_guard<std::mutex> lock(m_lock);
+		m_jobs.push_back(job);
+		m_waiting.push_back(job);
+		m_bytes += job->Bytes;
+	}
+	m_workCondition.notify_one();
+}
+
+bool CompressionQueue::IsFull()
+{
+	std::lock_guard<std::mutex> lock(m_lock);
+	return m_jobs.empty() == false && (m_bytes >= m_maxBytes || m_jobs.size() >= MaxJobs);
+}
+
+CompressionJob* CompressionQueue::Next()
+{
+	std::unique_lock<std::mutex> lock(m_lock);
+	if (m_jobs.empty())
+		return nullptr;
+
+	CompressionJob* job = m_jobs.front();
+	m_doneCondition.wait(lock, [job]() { return job->Done; });
+
+	m_jobs.pop_front();
+	m_bytes -= job->Bytes;
+	return job;
+}
+
+void CompressionQueue::workerThread()
+{
+	for (;;)
+	{
+		CompressionJob* job;
+		{
+			std::unique_lock<std::mutex> lock(m_lock);
+			m_workCondition.wait(lock, [this]() { return m_stopping || m_waiting.empty() == false; });
+			if (m_stopping)
+				return;
+
+			job = m_waiting.front();
+			m_waiting.pop_front();
+		}
+
+		int entry = job->SolidBlock ? -1 : (int)job->Files[0];
+
+		if (job->DecompressedSize > 0)
+		{
+			uint64_t decompressStart = Trace::Now();
+			std::vector<uint8_t> decompressed(job->DecompressedSize);
+			int r = LZ4_decompress_safe((const char*)job->Data.data(), (char*)decompressed.data(), (int)job->Data.size(), (int)job->DecompressedSize);
+			job->Failed = r != (int)job->DecompressedSize;
+			job->Data.swap(decompressed);
+			Trace::Record("decompress", decompressStart, entry, job->DecompressedSize);
+		}
+
+		uint32_t size = (uint32_t)job->Data.size();
+
+		uint64_t hashStart = Trace::Now();
+		job->Hash = Hasher::Hash(job->Data.data(), size);
+		Trace::Record("hash", hashStart, entry, size);
+
+		if (job->Compress && job->Failed == false && size > 0)
+		{
+			uint64_t compressStart = Trace::Now();
+			job->Compressed.resize(LZ4_compressBound(size));
+
+			int r;
+			if (m_cache != nullptr)
+				r = m_cache->Compress(job->Data.data(), size, job->Compressed.data(), (uint32_t)job->Compressed.size(), 0);
+			else
+				r = LZ4_compress_HC((const char*)job->Data.data(), (char*)job->Compressed.data(), size, (int)job->Compressed.size(), 0);
+
+			job->Compressed.resize(r > 0 ? r : 0);
+			Trace::Record(job->SolidBlock ? "compress block" : "compress", compressStart, entry, size);
+		}
+
+		{
+			std::lock_guard<std::mutex> lock(m_lock);
+			job->Bytes += job->Compressed.capacity();
+			m_bytes += job->Compressed.capacity();
+			job->Done = true;
+		}
+		m_doneCondition.notify_all();
+	}
+}
@@ -0,0 +1,103 @@
+#ifndef COMPRESSIONQUEUE_H
+#define COMPRESSIONQUEUE_H
+
+#include <cstdint>
+#include <vector>
+#include <deque>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+
+class CompressionCache;
+
+// Something for the queue to hash and compress: a file on its own, or a solid block of them
+struct CompressionJob
+{
+	CompressionJob()
+	{
+		SolidBlock = false;
+		Compress = false;
+		DecompressedSize = 0;
+		Hash = 0;
+		Failed = false;
+		Done = false;
+		Bytes = 0;
+	}
+
+	// filled in by whoever adds the job
+	std::vector<uint8_t> Data;
+	std::vector<uint32_t> Files;
+	bool SolidBlock;
+
+	// whether to try compressing it at all. It gets hashed either way.
+	bool Compress;
+
+	// If Data is LZ4 compressed already, how big it is decompressed, otherwise 0.
+	// The queue decompresses it into Data before it does anything else.
+	uint32_t DecompressedSize;
+
+	// Filled in by the queue. Compressed is empty if compressing didn't work.
+	std::vector<uint8_t> Compressed;
+	uint64_t Hash;
+
+	// set if Data didn't decompress to DecompressedSize
+	bool Failed;
+
+	bool Done;
+
+	// how much of the queue's limit it takes up
+	uint64_t Bytes;
+};
+
+// Hashes and compresses jobs on a pool of threads while the caller gets on
+// with reading the next ones, and hands them back in the order they were added.
+//
+// The queue only holds on to so many bytes at a time. Once it's full, the
+// caller has to take the oldest job with Next() before it adds another, so
+// memory stays bounded however much goes through it.
+class CompressionQueue
+{
+public:
+	CompressionQueue();
+	~CompressionQueue();
+
+	// cache can be null. maxBytes is how much the queue holds (counting what it's compressed) before it's full.
+	void Start(CompressionCache* cache, unsigned int numThreads, uint64_t maxBytes);
+
+	// Stops the threads and deletes any jobs that weren't taken
+	void Stop();
+
+	// The queue owns the job until Next() gives it back
+	void Add(CompressionJob* job);
+
+	// Whether the caller has to take a job before it adds another. A job that's
+	// bigger than maxBytes can still go in when the queue is empty.
+	bool IsFull();
+
+	// Waits for the oldest job to be done and hands it back, or returns null if there aren't any.
+	// The caller deletes it.
+	CompressionJob* Next();
+
+	// how many jobs are held at once, however small they are
+	static const uint32_t MaxJobs = 4096;
+
+private:
+	void workerThread();
+
+	CompressionCache* m_cache;
+	std::vector<std::thread> m_threads;
+
+	std::mutex m_lock;
+	std::condition_variable m_workCondition;
+	std::condition_variable m_doneCondition;
+
+	// every job that hasn't been taken, in order, and the ones no thread has started yet
+	std::deque<CompressionJob*> m_jobs;
+	std::deque<CompressionJob*> m_waiting;
+
+	uint64_t m_bytes;
+	uint64_t m_maxBytes;
+	bool m_stopping;
+};
+
+#endif // COMPRESSIONQUEUE_H
@@ -0,0 +1,173 @@
+#include "DirectoryIndex.h"
+#include <cstring>
+#include <string>
+
+namespace
+{
+	struct Directory
+	{
+		std::string Name;
+		uint32_t Parent;
+		uint32_t FirstFile;
+		uint32_t NumFiles;
+		std::vector<uint32_t> Children;
+	};
+
+	const uint32_t NoParent = 0xffffffff;
+
+	char fold(char c)
+	{
+		return c >= 'A' && c <= 'Z' ? c + ('a' - 'A') : c;
+	}
+
+	// whether name is inside directory, ignoring case the same way the sort does
+	bool isInside(const char* name, const std::string& directory)
+	{
+		for (size_t i = 0; i < directory.size(); i++)
+		{
+			if (name[i] == 0 || fold(name[i]) != fold(directory[i]))
+				return false;
+		}
+
+		return name[directory.size()] == '/';
+	}
+
+	void appendUint32(std::vector<uint8_t>* data, uint32_t value)
+	{
+		uint8_t bytes[4];
+		memcpy(bytes, &value, 4);
+		data->insert(data->end(), bytes, bytes + 4);
+	}
+}
+
+void BuildDirectoryIndex(const char* const* names, uint32_t numNames, std::vector<uint8_t>* section)
+{
+	// Everything under a directory sorts together, so one pass with a stack of the
+	// directories the last name was in finds them all, along with their runs.
+	std::vector<Directory> directories(1);
+	directories[0].Parent = NoParent;
+	directories[0].FirstFile = 0;
+	directories[0].NumFiles = numNames;
+
+	std::vector<uint32_t> open(1, 0);
+	for (uint32_t i = 0; i < numNames; i++)
+	{
+		const char* name = names[i];
+
+		size_t depth = 1;
+		while (depth < open.size() && isInside(name, directories[open[depth]].Name))
+			depth++;
+
+		while (open.size() > depth)
+		{
+			Directory& closed = directories[open.back()];
+			closed.NumFiles = i - closed.FirstFile;
+			open.pop_back();
+		}
+
+		const std::string& parentName = directories[open.back()].Name;
+		const char* start = name + (open.size() > 1 ? parentName.size() + 1 : 0);
+		for (const char* slash = strchr(start, '/'); slash != nullptr; slash = strchr(slash + 1, '/'))
+		{
+			Directory directory;
+			directory.Name.assign(name, slash - name);
+			directory.Parent = open.back();
+			directory.FirstFile = i;
+			directory.NumFiles = 0;
+
+			uint32_t index = (uint32_t)directories.size();
+			directories[open.back()].Children.push_back(index);
+			directories.push_back(directory);
+			open.push_back(index);
+		}
+	}
+
+	while (open.size() > 1)
+	{
+		Directory& closed = directories[open.back()];
+		closed.NumFiles = numNames - closed.FirstFile;
+		open.pop_back();
+	}
+
+	// breadth first, so each directory's children are next to each other
+	std::vector<uint32_t> order(1, 0);
+	std::vector<uint32_t> newIndex(directories.size(), 0);
+	for (size_t i = 0; i < order.size(); i++)
+	{
+		const std::vector<uint32_t>& children = directories[order[i]].Children;
+		for (size_t j = 0; j < children.size(); j++)
+		{
+			newIndex[children[j]] = (uint32_t)order.size();
+			order.push_back(children[j]);
+		}
+	}
+
+	uint32_t numDirectories = (uint32_t)directories.size();
+	section->clear();
+	appendUint32(section, numDirectories);
+	appendUint32(section, 0);
+
+	uint32_t nameOffset = 8 + numDirectories * sizeof(DirectoryEntry);
+	for (uint32_t i = 0; i < numDirectories; i++)
+	{
+		const Directory& directory = directories[order[i]];
+		appendUint32(section, nameOffset);
+		appendUint32(section, directory.Parent == NoParent ? NoParent : newIndex[directory.Parent]);
+		appendUint32(section, directory.Children.empty() ? 0 : newIndex[directory.Children[0]]);
+		appendUint32(section, (uint32_t)directory.Children.size());
+		appendUint32(section, directory.FirstFile);
+		appendUint32(section, directory.NumFiles);
+
+		nameOffset += (uint32_t)directory.Name.size() + 1;
+	}
+
+	for (uint32_t i = 0; i < numDirectories; i++)
+	{
+		const std::string& name = directories[order[i]].Name;
+		section->insert(section->end(), name.c_str(), name.c_str() + name.size() + 1);
+	}
+}
+
+bool FindDirectory(const std::vector<uint8_t>& section, const char* path, uint32_t* firstFile, uint32_t* numFiles)
+{
+	if (section.size() < 8)
+		return false;
+
+	uint32_t numDirectories;
+	memcpy(&numDirectories, section.data(), 4);
+	if (numDirectories > (section.size() - 8) / sizeof(DirectoryEntry))
+		return false;
+
+	// "sounds/ui/" and "/sounds/ui" are the same as "sounds/ui"
+	while (*path == '/')
+		path++;
+	size_t length = strlen(path);
+	while (length > 0 && path[length - 1] == '/')
+		length--;
+
+	for (uint32_t i = 0; i < numDirectories; i++)
+	{
+		DirectoryEntry entry;
+		memcpy(&entry, &section[8 + i * sizeof(DirectoryEntry)], sizeof(entry));
+		if (entry.NameOffset >= section.size())
+			return false;
+
+		const char* name = (const char*)&section[entry.NameOffset];
+		size_t nameLength = strnlen(name, section.size() - entry.NameOffset);
+		if (nameLength != length)
+			continue;
+
+		bool same = true;
+		for (size_t j = 0; j < length && same; j++)
+			same = fold(name[j]) == fold(path[j]);
+
+		if (same)
+		{
+			*firstFile = entry.FirstFile;
+			*numFiles = entry.NumFiles;
+			return true;
+		}
+	}
+
+	return false;
+}
@@ -0,0 +1,39 @@
+#ifndef DIRECTORYINDEX_H
+#define DIRECTORYINDEX_H
+
+#include <cstdint>
+#include <vector>
+
+// The DIRS section is a tree of every directory in the egg (split on '/'), so
+// listing one doesn't mean looking at every filename. The names are sorted, so
+// everything in a directory and its subdirectories is one run of the TOC, and
+// each directory just says where its run is and where its subdirectories are.
+//
+// The section is a uint32 count of directories and a uint32 that's unused,
+// then a DirectoryEntry for each one and then their names. The top directory
+// is first, and every directory's subdirectories come one after another, in
+// the same order as the files.
+struct DirectoryEntry
+{
+	// relative to the start of the section. The whole path, with no '/' at the end.
+	uint32_t NameOffset;
+
+	// 0xffffffff for the top directory
+	uint32_t Parent;
+
+	uint32_t FirstChild;
+	uint32_t NumChildren;
+
+	// the run of the TOC that's in this directory or under it
+	uint32_t FirstFile;
+	uint32_t NumFiles;
+};
+
+// Builds the section for names, which have to be sorted the same way as the TOC
+void BuildDirectoryIndex(const char* const* names, uint32_t numNames, std::vector<uint8_t>* section);
+
+// Finds a directory (case-insensitive, "" for the top one) and the files that are in it or under it.
+// Returns false if it isn't there.
+bool FindDirectory(const std::vector<uint8_t>& section, const char* path, uint32_t* firstFile, uint32_t* numFiles);
+
+#endif // DIRECTORYINDEX_H
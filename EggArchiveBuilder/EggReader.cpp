@@ -0,0 +1,243 @@
+#include "EggReader.h"
+#include "Hash.h"
+#include "NameTable.h"
+#include "lz4.h"
+#include <cstring>
+
+namespace
+{
+	FILE* openFile(const char* path, const char* mode)
+	{
+#ifdef _WIN32
+		FILE* fp;
+		if (fopen_s(&fp, path, mode) != 0)
+			return nullptr;
+		return fp;
+#else
+		return fopen(path, mode);
+#endif
+	}
+
+	uint32_t readUint32(const uint8_t* p)
+	{
+		uint32_t v;
+		memcpy(&v, p, 4);
+		return v;
+	}
+
+	// The GRPS section is a count of groups and of their files, then 24 bytes for each group (where its name is,
+	// its offset and size, and which of the files after the groups are its), then the files, then the names.
+	// Anything that doesn't add up means no groups, rather than a failure, since the egg can be read without them.
+	void readGroups(const std::vector<uint8_t>& data, uint32_t numFiles, std::vector<EggGroup>* groups)
+	{
+		groups->clear();
+		if (data.size() < 8)
+			return;
+
+		uint32_t numGroups = readUint32(&data[0]);
+		uint32_t numMembers = readUint32(&data[4]);
+		if (numGroups > data.size() / 24 || numMembers > data.size() / 4 || 8 + (uint64_t)numGroups * 24 + (uint64_t)numMembers * 4 > data.size())
+			return;
+
+		const uint8_t* members = &data[8 + numGroups * 24];
+		for (uint32_t i = 0; i < numGroups; i++)
+		{
+			const uint8_t* p = &data[8 + i * 24];
+			uint32_t nameOffset = readUint32(p);
+			uint32_t firstMember = readUint32(p + 12);
+			uint32_t count = readUint32(p + 16);
+			if (nameOffset >= data.size() || firstMember > numMembers || count > numMembers - firstMember)
+			{
+				groups->clear();
+				return;
+			}
+
+			EggGroup group;
+			group.Name.assign((const char*)&data[nameOffset], strnlen((const char*)&data[nameOffset], data.size() - nameOffset));
+			group.Offset = readUint32(p + 4);
+			group.Size = readUint32(p + 8);
+			for (uint32_t j = 0; j < count; j++)
+			{
+				uint32_t file = readUint32(members + (firstMember + j) * 4);
+				if (file >= numFiles)
+				{
+					groups->clear();
+					return;
+				}
+				group.Files.push_back(file);
+			}
+
+			groups->push_back(group);
+		}
+	}
+}
+
+bool ReadAt(FILE* fp, uint64_t offset, uint32_t size, std::vector<uint8_t>* data)
+{
+	data->resize(size);
+	if (size == 0)
+		return true;
+
+	return fseek(fp, (long)offset, SEEK_SET) == 0 && fread(data->data(), 1, size, fp) == size;
+}
+
+bool LoadEgg(const char* path, Egg* egg)
+{
+	egg->File = openFile(path, "rb");
+	egg->CachedBlock = -1;
+	if (egg->File == nullptr)
+	{
+		printf("Unable to open %s\n", path);
+		return false;
+	}
+
+	fseek(egg->File, 0, SEEK_END);
+	egg->Size = (uint64_t)ftell(egg->File);
+
+	std::vector<uint8_t> data;
+	if (ReadAt(egg->File, 0, 32, &data) == false || memcmp(data.data(), "EGGA", 4) != 0)
+	{
+		printf("%s isn't an egg\n", path);
+		return false;
+	}
+	memcpy(egg->Header, data.data(), 32);
+
+	uint16_t flags;
+	memcpy(&flags, egg->Header + 6, 2);
+	uint32_t numFiles = readUint32(egg->Header + 16);
+	uint32_t filenameOffset = readUint32(egg->Header + 20);
+	uint32_t tocOffset = readUint32(egg->Header + 24);
+	uint32_t sectionTableOffset = readUint32(egg->Header + 28);
+
+	// a damaged header could say there are billions of files, which can't all fit
+	if ((uint64_t)tocOffset + (uint64_t)numFiles * sizeof(EggEntry) > egg->Size)
+	{
+		printf("The table of contents of %s doesn't fit in it\n", path);
+		return false;
+	}
+
+	egg->Toc.resize(numFiles);
+	if (numFiles > 0 && (fseek(egg->File, tocOffset, SEEK_SET) != 0 || fread(egg->Toc.data(), sizeof(EggEntry), numFiles, egg->File) != numFiles))
+	{
+		printf("Unable to read the table of contents of %s\n", path);
+		return false;
+	}
+
+	if (ReadNameTable(egg->File, filenameOffset, numFiles, (flags & 0x02) != 0, &egg->Names) == false)
+	{
+		printf("Unable to read the filenames in %s\n", path);
+		return false;
+	}
+
+	if (flags & 0x01)
+	{
+		uint32_t numSections = 0;
+		if (ReadAt(egg->File, sectionTableOffset, 8, &data))
+			numSections = readUint32(data.data());
+
+		for (uint32_t i = 0; i < numSections; i++)
+		{
+			if (ReadAt(egg->File, sectionTableOffset + 8 + i * 16, 16, &data) == false)
+				break;
+
+			uint32_t offset = readUint32(&data[4]);
+			uint32_t size = readUint32(&data[8]);
+			if (memcmp(data.data(), "BLKS", 4) == 0)
+			{
+				egg->Blocks.resize(size / sizeof(EggEntry));
+				if (ReadAt(egg->File, offset, size, &data))
+					memcpy(egg->Blocks.data(), data.data(), egg->Blocks.size() * sizeof(EggEntry));
+			}
+			else if (memcmp(data.data(), "HASH", 4) == 0 && size == numFiles * sizeof(uint64_t))
+			{
+				egg->Hashes.resize(numFiles);
+				if (ReadAt(egg->File, offset, size, &data))
+					memcpy(egg->Hashes.data(), data.data(), size);
+				else
+					egg->Hashes.clear();
+			}
+			else if (memcmp(data.data(), "GRPS", 4) == 0)
+			{
+				if (ReadAt(egg->File, offset, size, &data))
+					readGroups(data, numFiles, &egg->Groups);
+			}
+		}
+	}
+
+	return true;
+}
+
+bool ReadEntry(Egg* egg, uint32_t index, std::vector<uint8_t>* contents, std::vector<uint8_t>* scratch)
+{
+	const EggEntry& entry = egg->Toc[index];
+
+	if (entry.Flags & 0x02)
+	{
+		uint32_t blockIndex = entry.Flags >> 8;
+		if (blockIndex >= egg->Blocks.size())
+			return false;
+
+		const EggEntry& block = egg->Blocks[blockIndex];
+		if (egg->CachedBlock != (int)blockIndex)
+		{
+			egg->CachedBlock = -1;
+			if (ReadAt(egg->File, block.Offset, block.CompressedSize, scratch) == false)
+				return false;
+
+			if (block.Flags & 0x01)
+			{
+				egg->CachedBlockData.resize(block.UncompressedSize);
+				if (LZ4_decompress_safe((const char*)scratch->data(), (char*)egg->CachedBlockData.data(), block.CompressedSize, block.UncompressedSize) != (int)block.UncompressedSize)
+					return false;
+			}
+			else
+				egg->CachedBlockData = *scratch;
+
+			egg->CachedBlock = (int)blockIndex;
+		}
+
+		if (entry.Offset > egg->CachedBlockData.size() || entry.UncompressedSize > egg->CachedBlockData.size() - entry.Offset)
+			return false;
+
+		contents->assign(egg->CachedBlockData.begin() + entry.Offset, egg->CachedBlockData.begin() + entry.Offset + entry.UncompressedSize);
+		return true;
+	}
+
+	if ((entry.Flags & 0x01) == 0)
+		return ReadAt(egg->File, entry.Offset, entry.UncompressedSize, contents);
+
+	if (ReadAt(egg->File, entry.Offset, entry.CompressedSize, scratch) == false)
+		return false;
+
+	contents->resize(entry.UncompressedSize);
+	return LZ4_decompress_safe((const char*)scratch->data(), (char*)contents->data(), entry.CompressedSize, entry.UncompressedSize) == (int)entry.UncompressedSize;
+}
+
+bool HashEntries(Egg* egg, const char* path)
+{
+	if (egg->Hashes.size() == egg->Toc.size())
+		return true;
+
+	printf("%s has no HASH section, so its files have to be read to hash them\n", path);
+
+	std::vector<uint8_t> contents, scratch;
+	egg->Hashes.resize(egg->Toc.size());
+	for (size_t i = 0; i < egg->Toc.size(); i++)
+	{
+		if (ReadEntry(egg, (uint32_t)i, &contents, &scratch) == false)
+		{
+			printf("Unable to read %s out of %s\n", egg->Names[i].c_str(), path);
+			return false;
+		}
+		egg->Hashes[i] = Hasher::Hash(contents.data(), contents.size());
+	}
+
+	return true;
+}
+
+void CloseEgg(Egg* egg)
+{
+	if (egg->File != nullptr)
+		fclose(egg->File);
+	egg->File = nullptr;
+}
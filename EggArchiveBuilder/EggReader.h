@@ -0,0 +1,61 @@
+#ifndef EGGREADER_H
+#define EGGREADER_H
+
+#include <cstdint>
+#include <cstdio>
+#include <string>
+#include <vector>
+
+// A TOC entry, or a solid block in the BLKS section
+struct EggEntry
+{
+	uint32_t Offset;
+	uint32_t CompressedSize;
+	uint32_t UncompressedSize;
+	uint32_t Flags;
+};
+
+// a load group from the GRPS section
+struct EggGroup
+{
+	std::string Name;
+	uint32_t Offset;
+	uint32_t Size;
+
+	// by TOC index
+	std::vector<uint32_t> Files;
+};
+
+// The parts of an egg that diff, patch and repack need. The file contents stay on disk until they're needed.
+struct Egg
+{
+	FILE* File;
+	uint64_t Size;
+	uint8_t Header[32];
+	std::vector<EggEntry> Toc;
+	std::vector<std::string> Names;
+	std::vector<EggEntry> Blocks;
+	std::vector<EggGroup> Groups;
+
+	// of each file's uncompressed contents, from the HASH section (or worked out, for eggs that don't have one)
+	std::vector<uint64_t> Hashes;
+
+	// the solid block that was decompressed last
+	int CachedBlock;
+	std::vector<uint8_t> CachedBlockData;
+};
+
+// Reads the header, the TOC, the filenames and the sections it knows about. Prints what went wrong if it fails.
+bool LoadEgg(const char* path, Egg* egg);
+
+bool ReadAt(FILE* fp, uint64_t offset, uint32_t size, std::vector<uint8_t>* data);
+
+// Reads a file's uncompressed contents
+bool ReadEntry(Egg* egg, uint32_t index, std::vector<uint8_t>* contents, std::vector<uint8_t>* scratch);
+
+// Eggs built before the HASH section existed don't have hashes, so they get worked out the long way
+bool HashEntries(Egg* egg, const char* path);
+
+void CloseEgg(Egg* egg);
+
+#endif // EGGREADER_H
@@ -0,0 +1,142 @@
+#include "Hash.h"
+#include <cstring>
+
+namespace
+{
+	const uint64_t Prime1 = 0x9E3779B185EBCA87ULL;
+	const uint64_t Prime2 = 0xC2B2AE3D27D4EB4FULL;
+	const uint64_t Prime3 = 0x165667B19E3779F9ULL;
+	const uint64_t Prime4 = 0x85EBCA77C2B2AE63ULL;
+	const uint64_t Prime5 = 0x27D4EB2F165667C5ULL;
+
+	uint64_t rotateLeft(uint64_t x, int bits)
+	{
+		return (x << bits) | (x >> (64 - bits));
+	}
+
+	uint64_t read64(const uint8_t* p)
+	{
+		uint64_t v;
+		memcpy(&v, p, 8);
+		return v;
+	}
+
+	uint32_t read32(const uint8_t* p)
+	{
+		uint32_t v;
+		memcpy(&v, p, 4);
+		return v;
+	}
+
+	uint64_t hashRound(uint64_t acc, uint64_t input)
+	{
+		acc += input * Prime2;
+		acc = rotateLeft(acc, 31);
+		return acc * Prime1;
+	}
+
+	uint64_t mergeRound(uint64_t acc, uint64_t value)
+	{
+		acc ^= hashRound(0, value);
+		return acc * Prime1 + Prime4;
+	}
+}
+
+Hasher::Hasher()
+{
+	m_state[0] = Prime1 + Prime2;
+	m_state[1] = Prime2;
+	m_state[2] = 0;
+	m_state[3] = 0 - Prime1;
+	m_totalSize = 0;
+	m_bufferSize = 0;
+}
+
+void Hasher::Update(const void* data, size_t size)
+{
+	const uint8_t* p = (const uint8_t*)data;
+	const uint8_t* end = p + size;
+	m_totalSize += size;
+
+	// top up whatever was left over from last time first
+	if (m_bufferSize > 0)
+	{
+		size_t n = 32 - m_bufferSize < size ? 32 - m_bufferSize : size;
+		memcpy(m_buffer + m_bufferSize, p, n);
+		m_bufferSize += (uint32_t)n;
+		p += n;
+
+		if (m_bufferSize < 32)
+			return;
+
+		for (int i = 0; i < 4; i++)
+			m_state[i] = hashRound(m_state[i], read64(m_buffer + i * 8));
+		m_bufferSize = 0;
+	}
+
+	while (end - p >= 32)
+	{
+		for (int i = 0; i < 4; i++)
+			m_state[i] = hashRound(m_state[i], read64(p + i * 8));
+		p += 32;
+	}
+
+	memcpy(m_buffer, p, end - p);
+	m_bufferSize = (uint32_t)(end - p);
+}
+
+uint64_t Hasher::Finish() const
+{
+	uint64_t hash;
+	if (m_totalSize >= 32)
+	{
+		hash = rotateLeft(m_state[0], 1) + rotateLeft(m_state[1], 7) + rotateLeft(m_state[2], 12) + rotateLeft(m_state[3], 18);
+		for (int i = 0; i < 4; i++)
+			hash = mergeRound(hash, m_state[i]);
+	}
+	else
+	{
+		hash = Prime5;
+	}
+
+	hash += m_totalSize;
+
+	const uint8_t* p = m_buffer;
+	const uint8_t* end = m_buffer + m_bufferSize;
+
+	while (p + 8 <= end)
+	{
+		hash ^= hashRound(0, read64(p));
+		hash = rotateLeft(hash, 27) * Prime1 + Prime4;
+		p += 8;
+	}
+
+	if (p + 4 <= end)
+	{
+		hash ^= read32(p) * Prime1;
+		hash = rotateLeft(hash, 23) * Prime2 + Prime3;
+		p += 4;
+	}
+
+	while (p < end)
+	{
+		hash ^= *p * Prime5;
+		hash = rotateLeft(hash, 11) * Prime1;
+		p++;
+	}
+
+	hash ^= hash >> 33;
+	hash *= Prime2;
+	hash ^= hash >> 29;
+	hash *= Prime3;
+	hash ^= hash >> 32;
+
+	return hash;
+}
+
+uint64_t Hasher::Hash(const void* data, size_t size)
+{
+	Hasher hasher;
+	hasher.Update(data, size);
+	return hasher.Finish();
+}
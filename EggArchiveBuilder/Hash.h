@@ -0,0 +1,26 @@
+#ifndef HASH_H
+#define HASH_H
+
+#include <cstdint>
+#include <cstddef>
+
+// XXH64 with a seed of 0. Feed it data a piece at a time with Update(),
+// or use Hash() when it's all in memory already.
+class Hasher
+{
+public:
+	Hasher();
+
+	void Update(const void* data, size_t size);
+	uint64_t Finish() const;
+
+	static uint64_t Hash(const void* data, size_t size);
+
+private:
+	uint64_t m_state[4];
+	uint64_t m_totalSize;
+	uint8_t m_buffer[32];
+	uint32_t m_bufferSize;
+};
+
+#endif // HASH_H
@@ -0,0 +1,703 @@
+#include "InputReader.h"
+#include <cassert>
+#include <cerrno>
+#include <cstring>
+#include <cstdlib>
+#include <algorithm>
+
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <Windows.h>
+#else
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+#ifdef __linux__
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <linux/io_uring.h>
+#endif
+
+InputReader::InputReader()
+{
+	m_nextToClaim = 0;
+	m_nextToRelease = 0;
+	m_bytesAhead = 0;
+	m_stopping = false;
+	m_usingIoUring = false;
+	m_ring = nullptr;
+}
+
+InputReader::~InputReader()
+{
+	Stop();
+}
+
+bool InputReader::Start(const char* const* paths, uint32_t numPaths)
+{
+	m_files.resize(numPaths);
+	for (uint32_t i = 0; i < numPaths; i++)
+	{
+		m_files[i].Path = paths[i];
+		m_files[i].Data = nullptr;
+		m_files[i].Size = 0;
+		m_files[i].Error = 0;
+		m_files[i].Ready = false;
+	}
+
+#ifdef __linux__
+	if (setupIoUring())
+	{
+		m_usingIoUring = true;
+		m_threads.push_back(std::thread(&InputReader::ioUringThread, this));
+		return true;
+	}
+#endif
+
+	// lots of tiny files means we spend most of our time waiting on the disk,
+	// so use more threads than we have cores
+	uint32_t numThreads = std::thread::hardware_concurrency() * 2;
+	if (numThreads < 4) numThreads = 4;
+	if (numThreads > 32) numThreads = 32;
+	if (numThreads > numPaths) numThreads = numPaths;
+
+	for (uint32_t i = 0; i < numThreads; i++)
+		m_threads.push_back(std::thread(&InputReader::workerThread, this));
+
+	return true;
+}
+
+void InputReader::Stop()
+{
+	{
+		std::lock_guard<std::mutex> lock(m_lock);
+		m_stopping = true;
+	}
+	m_windowCondition.notify_all();
+
+	for (size_t i = 0; i < m_threads.size(); i++)
+		m_threads[i].join();
+	m_threads.clear();
+
+	for (size_t i = 0; i < m_files.size(); i++)
+	{
+		delete[] m_files[i].Data;
+		m_files[i].Data = nullptr;
+	}
+	m_files.clear();
+}
+
+InputFile* InputReader::Acquire(uint32_t index)
+{
+	assert(index < m_files.size());
+
+	std::unique_lock<std::mutex> lock(m_lock);
+	m_readyCondition.wait(lock, [&] { return m_files[index].Ready; });
+
+	return &m_files[index];
+}
+
+void InputReader::Release(InputFile* file)
+{
+	{
+		std::lock_guard<std::mutex> lock(m_lock);
+		assert(file == &m_files[m_nextToRelease]);
+
+		m_bytesAhead -= file->Size;
+		m_nextToRelease++;
+
+		delete[] file->Data;
+		file->Data = nullptr;
+	}
+	m_windowCondition.notify_all();
+}
+
+bool InputReader::canReadAhead(uint32_t index, uint64_t size)
+{
+	// the file the consumer is waiting on is always allowed, no matter how big it is
+	if (index == m_nextToRelease)
+		return true;
+
+	return index < m_nextToRelease + MaxFilesAhead && m_bytesAhead + size <= MaxBytesAhead;
+}
+
+void InputReader::finish(uint32_t index, uint8_t* data, uint32_t size, int error)
+{
+	{
+		std::lock_guard<std::mutex> lock(m_lock);
+		m_files[index].Data = data;
+		m_files[index].Size = size;
+		m_files[index].Error = error;
+		m_files[index].Ready = true;
+	}
+	m_readyCondition.notify_all();
+}
+
+void InputReader::workerThread()
+{
+	const uint32_t numFiles = (uint32_t)m_files.size();
+
+	while (true)
+	{
+		uint32_t index;
+		{
+			std::unique_lock<std::mutex> lock(m_lock);
+			m_windowCondition.wait(lock, [&] {
+				return m_stopping || m_nextToClaim >= numFiles || m_nextToClaim < m_nextToRelease + MaxFilesAhead;
+			});
+
+			if (m_stopping || m_nextToClaim >= numFiles)
+				return;
+
+			index = m_nextToClaim++;
+		}
+
+		const char* path = m_files[index].Path;
+
+#ifdef _WIN32
+		HANDLE fp = CreateFileA(path, GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, nullptr);
+		if (fp == INVALID_HANDLE_VALUE)
+		{
+			finish(index, nullptr, 0, ENOENT);
+			continue;
+		}
+
+		LARGE_INTEGER fileSize;
+		if (GetFileSizeEx(fp, &fileSize) == FALSE || fileSize.QuadPart > UINT32_MAX)
+		{
+			CloseHandle(fp);
+			finish(index, nullptr, 0, EFBIG);
+			continue;
+		}
+		uint32_t size = (uint32_t)fileSize.QuadPart;
+#else
+		int fp = open(path, O_RDONLY);
+		if (fp == -1)
+		{
+			finish(index, nullptr, 0, errno);
+			continue;
+		}
+
+		struct stat sb;
+		int statError = fstat(fp, &sb) == -1 ? errno : 0;
+		if (statError == 0 && sb.st_size > UINT32_MAX)
+			statError = EFBIG;
+		if (statError != 0)
+		{
+			close(fp);
+			finish(index, nullptr, 0, statError);
+			continue;
+		}
+		uint32_t size = (uint32_t)sb.st_size;
+#endif
+
+		{
+			std::unique_lock<std::mutex> lock(m_lock);
+			m_windowCondition.wait(lock, [&] { return m_stopping || canReadAhead(index, size); });
+			if (m_stopping)
+			{
+#ifdef _WIN32
+				CloseHandle(fp);
+#else
+				close(fp);
+#endif
+				return;
+			}
+			m_bytesAhead += size;
+		}
+
+		uint8_t* buffer = size > 0 ? new uint8_t[size] : nullptr;
+		uint32_t totalRead = 0;
+		int error = 0;
+		while (totalRead < size)
+		{
+#ifdef _WIN32
+			DWORD bytesRead;
+			if (ReadFile(fp, buffer + totalRead, size - totalRead, &bytesRead, nullptr) == FALSE)
+			{
+				error = EIO;
+				break;
+			}
+#else
+			ssize_t bytesRead = read(fp, buffer + totalRead, size - totalRead);
+			if (bytesRead < 0)
+			{
+				if (errno == EINTR)
+					continue;
+				error = errno;
+				break;
+			}
+#endif
+			if (bytesRead == 0)
+			{
+				// the file shrank out from under us
+				error = EIO;
+				break;
+			}
+
+			totalRead += (uint32_t)bytesRead;
+		}
+
+#ifdef _WIN32
+		CloseHandle(fp);
+#else
+		close(fp);
+#endif
+
+		if (error != 0)
+		{
+			delete[] buffer;
+			buffer = nullptr;
+		}
+
+		finish(index, buffer, size, error);
+	}
+}
+
+#ifdef __linux__
+
+// We talk to io_uring through the raw syscalls so that the builder
+// doesn't pick up a dependency on liburing.
+
+namespace
+{
+	const uint32_t RingEntries = 256;
+
+	enum IoOp
+	{
+		IoOpOpen,
+		IoOpStat,
+		IoOpRead,
+		IoOpClose
+	};
+
+	struct Ring
+	{
+		int Fd;
+
+		void* SqMemory;
+		size_t SqMemorySize;
+		void* CqMemory;
+		size_t CqMemorySize;
+		io_uring_sqe* Sqes;
+		size_t SqesSize;
+
+		unsigned* SqHead;
+		unsigned* SqTail;
+		unsigned* SqMask;
+		unsigned* SqEntries;
+		unsigned* SqArray;
+
+		unsigned* CqHead;
+		unsigned* CqTail;
+		unsigned* CqMask;
+		unsigned CqEntries;
+		io_uring_cqe* Cqes;
+
+		// entries written but not yet made visible to the kernel
+		unsigned Unpublished;
+		// entries visible to the kernel that it hasn't consumed yet
+		unsigned ToSubmit;
+	};
+
+	// one of these per file inside the read-ahead window
+	struct Slot
+	{
+		int Fd;
+		int Error;
+		int OpsPending;
+		uint32_t BytesRead;
+		uint32_t Size;
+		uint8_t* Buffer;
+		struct statx Stat;
+	};
+
+	int ioUringSetup(unsigned entries, io_uring_params* p)
+	{
+		return (int)syscall(__NR_io_uring_setup, entries, p);
+	}
+
+	int ioUringEnter(int fd, unsigned toSubmit, unsigned minComplete, unsigned flags)
+	{
+		return (int)syscall(__NR_io_uring_enter, fd, toSubmit, minComplete, flags, nullptr, 0);
+	}
+
+	int ioUringRegister(int fd, unsigned opcode, void* arg, unsigned numArgs)
+	{
+		return (int)syscall(__NR_io_uring_register, fd, opcode, arg, numArgs);
+	}
+
+	void destroyRing(Ring* ring)
+	{
+		if (ring->Sqes != nullptr) munmap(ring->Sqes, ring->SqesSize);
+		if (ring->CqMemory != nullptr && ring->CqMemory != ring->SqMemory) munmap(ring->CqMemory, ring->CqMemorySize);
+		if (ring->SqMemory != nullptr) munmap(ring->SqMemory, ring->SqMemorySize);
+		if (ring->Fd != -1) close(ring->Fd);
+
+		delete ring;
+	}
+
+	io_uring_sqe* getSqe(Ring* ring)
+	{
+		unsigned head = __atomic_load_n(ring->SqHead, __ATOMIC_ACQUIRE);
+		unsigned tail = *ring->SqTail + ring->Unpublished;
+		if (tail - head >= *ring->SqEntries)
+			return nullptr;
+
+		unsigned index = tail & *ring->SqMask;
+		ring->SqArray[index] = index;
+		ring->Unpublished++;
+
+		io_uring_sqe* sqe = &ring->Sqes[index];
+		memset(sqe, 0, sizeof(io_uring_sqe));
+		return sqe;
+	}
+
+	uint64_t makeUserData(uint32_t index, IoOp op)
+	{
+		return ((uint64_t)index << 8) | (uint64_t)op;
+	}
+}
+
+bool InputReader::setupIoUring()
+{
+	Ring& ring = *new Ring();
+	ring.Fd = -1;
+
+	io_uring_params params;
+	memset(&params, 0, sizeof(params));
+
+	int fd = ioUringSetup(RingEntries, &params);
+	if (fd < 0)
+	{
+		destroyRing(&ring);
+		return false;
+	}
+	ring.Fd = fd;
+
+	// make sure the kernel knows about all the operations we need (they showed up in 5.6)
+	const unsigned probeOps = 256;
+	size_t probeSize = sizeof(io_uring_probe) + probeOps * sizeof(io_uring_probe_op);
+	io_uring_probe* probe = (io_uring_probe*)calloc(1, probeSize);
+	bool supported = ioUringRegister(fd, IORING_REGISTER_PROBE, probe, probeOps) == 0;
+	const int requiredOps[] = { IORING_OP_OPENAT, IORING_OP_STATX, IORING_OP_READ, IORING_OP_CLOSE };
+	for (int i = 0; supported && i < 4; i++)
+	{
+		if (requiredOps[i] > probe->last_op || (probe->ops[requiredOps[i]].flags & IO_URING_OP_SUPPORTED) == 0)
+			supported = false;
+	}
+	free(probe);
+
+	if (supported == false)
+	{
+		destroyRing(&ring);
+		return false;
+	}
+
+	ring.SqMemorySize = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+	ring.CqMemorySize = params.cq_off.cqes + params.cq_entries * sizeof(io_uring_cqe);
+	if (params.features & IORING_FEAT_SINGLE_MMAP)
+		ring.SqMemorySize = ring.CqMemorySize = std::max(ring.SqMemorySize, ring.CqMemorySize);
+
+	ring.SqMemory = mmap(nullptr, ring.SqMemorySize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQ_RING);
+	if (ring.SqMemory == MAP_FAILED)
+	{
+		ring.SqMemory = nullptr;
+		destroyRing(&ring);
+		return false;
+	}
+
+	if (params.features & IORING_FEAT_SINGLE_MMAP)
+		ring.CqMemory = ring.SqMemory;
+	else
+	{
+		ring.CqMemory = mmap(nullptr, ring.CqMemorySize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_CQ_RING);
+		if (ring.CqMemory == MAP_FAILED)
+		{
+			ring.CqMemory = nullptr;
+			destroyRing(&ring);
+			return false;
+		}
+	}
+
+	ring.SqesSize = params.sq_entries * sizeof(io_uring_sqe);
+	ring.Sqes = (io_uring_sqe*)mmap(nullptr, ring.SqesSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQES);
+	if (ring.Sqes == MAP_FAILED)
+	{
+		ring.Sqes = nullptr;
+		destroyRing(&ring);
+		return false;
+	}
+
+	uint8_t* sq = (uint8_t*)ring.SqMemory;
+	ring.SqHead = (unsigned*)(sq + params.sq_off.head);
+	ring.SqTail = (unsigned*)(sq + params.sq_off.tail);
+	ring.SqMask = (unsigned*)(sq + params.sq_off.ring_mask);
+	ring.SqEntries = (unsigned*)(sq + params.sq_off.ring_entries);
+	ring.SqArray = (unsigned*)(sq + params.sq_off.array);
+
+	uint8_t* cq = (uint8_t*)ring.CqMemory;
+	ring.CqHead = (unsigned*)(cq + params.cq_off.head);
+	ring.CqTail = (unsigned*)(cq + params.cq_off.tail);
+	ring.CqMask = (unsigned*)(cq + params.cq_off.ring_mask);
+	ring.CqEntries = params.cq_entries;
+	ring.Cqes = (io_uring_cqe*)(cq + params.cq_off.cqes);
+
+	m_ring = &ring;
+	return true;
+}
+
+void InputReader::ioUringThread()
+{
+	const uint32_t numFiles = (uint32_t)m_files.size();
+	Ring& ring = *(Ring*)m_ring;
+
+	std::vector<Slot> slots(MaxFilesAhead);
+	for (size_t i = 0; i < slots.size(); i++)
+		slots[i].Fd = -1;
+	std::vector<uint32_t> waitingToRead;
+
+	uint32_t nextToOpen = 0;
+	uint32_t inFlight = 0;
+	bool stopping = false;
+
+	while (true)
+	{
+		uint32_t windowStart, windowEnd;
+		{
+			std::unique_lock<std::mutex> lock(m_lock);
+
+			// reads that didn't fit in the ring last time around (or came back short) still need submitting
+			bool readsLeft = false;
+			for (uint32_t index = m_nextToRelease; index < nextToOpen && readsLeft == false; index++)
+			{
+				const Slot& slot = slots[index % MaxFilesAhead];
+				readsLeft = slot.Buffer != nullptr && slot.OpsPending == 0 && slot.BytesRead < slot.Size;
+			}
+
+			// nothing to do until the consumer frees up some room
+			if (inFlight == 0 && ring.ToSubmit == 0 && readsLeft == false && m_stopping == false)
+			{
+				m_windowCondition.wait(lock, [&] {
+					if (m_stopping)
+						return true;
+					if (nextToOpen < numFiles && nextToOpen < m_nextToRelease + MaxFilesAhead)
+						return true;
+					return waitingToRead.empty() == false && canReadAhead(waitingToRead.front(), slots[waitingToRead.front() % MaxFilesAhead].Size);
+				});
+			}
+
+			stopping = m_stopping;
+			windowStart = m_nextToRelease;
+			windowEnd = std::min(numFiles, m_nextToRelease + MaxFilesAhead);
+
+			// allocate buffers for anything that fits in the budget
+			size_t numAllocated = 0;
+			while (stopping == false && numAllocated < waitingToRead.size())
+			{
+				Slot& slot = slots[waitingToRead[numAllocated] % MaxFilesAhead];
+				if (canReadAhead(waitingToRead[numAllocated], slot.Size) == false)
+					break;
+
+				m_bytesAhead += slot.Size;
+				slot.Buffer = new uint8_t[slot.Size];
+				numAllocated++;
+			}
+			waitingToRead.erase(waitingToRead.begin(), waitingToRead.begin() + numAllocated);
+		}
+
+		if (stopping && inFlight == 0)
+			break;
+
+		if (stopping == false)
+		{
+			// submit reads for anything that has a buffer
+			for (uint32_t index = windowStart; index < nextToOpen; index++)
+			{
+				Slot& slot = slots[index % MaxFilesAhead];
+				if (slot.Buffer == nullptr || slot.OpsPending != 0 || slot.BytesRead == slot.Size)
+					continue;
+				if (inFlight >= ring.CqEntries)
+					break;
+
+				io_uring_sqe* sqe = getSqe(&ring);
+				if (sqe == nullptr)
+					break;
+
+				sqe->opcode = IORING_OP_READ;
+				sqe->fd = slot.Fd;
+				sqe->addr = (uint64_t)(uintptr_t)(slot.Buffer + slot.BytesRead);
+				sqe->len = slot.Size - slot.BytesRead;
+				sqe->off = slot.BytesRead;
+				sqe->user_data = makeUserData(index, IoOpRead);
+				slot.OpsPending = 1;
+				inFlight++;
+			}
+
+			// submit a batch of opens and stats. The statx goes by path so it doesn't have to wait for the open.
+			while (nextToOpen < windowEnd && inFlight + 2 <= ring.CqEntries)
+			{
+				io_uring_sqe* openSqe = getSqe(&ring);
+				if (openSqe == nullptr)
+					break;
+				io_uring_sqe* statSqe = getSqe(&ring);
+				if (statSqe == nullptr)
+				{
+					// give back the open, we'll get it next time around
+					ring.Unpublished--;
+					break;
+				}
+
+				Slot& slot = slots[nextToOpen % MaxFilesAhead];
+				memset(&slot, 0, sizeof(Slot));
+				slot.Fd = -1;
+				slot.OpsPending = 2;
+
+				openSqe->opcode = IORING_OP_OPENAT;
+				openSqe->fd = AT_FDCWD;
+				openSqe->addr = (uint64_t)(uintptr_t)m_files[nextToOpen].Path;
+				openSqe->open_flags = O_RDONLY;
+				openSqe->user_data = makeUserData(nextToOpen, IoOpOpen);
+
+				statSqe->opcode = IORING_OP_STATX;
+				statSqe->fd = AT_FDCWD;
+				statSqe->addr = (uint64_t)(uintptr_t)m_files[nextToOpen].Path;
+				statSqe->len = STATX_SIZE;
+				statSqe->statx_flags = AT_STATX_SYNC_AS_STAT;
+				statSqe->off = (uint64_t)(uintptr_t)&slot.Stat;
+				statSqe->user_data = makeUserData(nextToOpen, IoOpStat);
+
+				inFlight += 2;
+				nextToOpen++;
+			}
+		}
+
+		// publish the new entries and wait for at least one of them to come back
+		__atomic_store_n(ring.SqTail, *ring.SqTail + ring.Unpublished, __ATOMIC_RELEASE);
+		ring.ToSubmit += ring.Unpublished;
+		ring.Unpublished = 0;
+
+		int submitted = ioUringEnter(ring.Fd, ring.ToSubmit, inFlight > 0 ? 1 : 0, IORING_ENTER_GETEVENTS);
+		if (submitted < 0 && errno != EINTR && errno != EAGAIN && errno != EBUSY)
+		{
+			// the ring is broken. Fail everything that's left rather than hang the build.
+			{
+				std::lock_guard<std::mutex> lock(m_lock);
+				for (uint32_t index = windowStart; index < numFiles; index++)
+				{
+					if (m_files[index].Ready == false)
+					{
+						m_files[index].Error = EIO;
+						m_files[index].Ready = true;
+					}
+				}
+			}
+			m_readyCondition.notify_all();
+			break;
+		}
+		if (submitted > 0)
+			ring.ToSubmit -= std::min((unsigned)submitted, ring.ToSubmit);
+
+		unsigned head = *ring.CqHead;
+		while (head != __atomic_load_n(ring.CqTail, __ATOMIC_ACQUIRE))
+		{
+			io_uring_cqe* cqe = &ring.Cqes[head & *ring.CqMask];
+			head++;
+			inFlight--;
+
+			uint32_t index = (uint32_t)(cqe->user_data >> 8);
+			IoOp op = (IoOp)(cqe->user_data & 0xff);
+			if (op == IoOpClose)
+				continue;
+
+			Slot& slot = slots[index % MaxFilesAhead];
+			slot.OpsPending--;
+
+			bool done = false;
+			if (op == IoOpOpen)
+			{
+				if (cqe->res < 0)
+					slot.Error = -cqe->res;
+				else
+					slot.Fd = cqe->res;
+			}
+			else if (op == IoOpStat)
+			{
+				if (cqe->res < 0)
+					slot.Error = -cqe->res;
+				else if (slot.Stat.stx_size > UINT32_MAX)
+					slot.Error = EFBIG;
+				else
+					slot.Size = (uint32_t)slot.Stat.stx_size;
+			}
+			else if (op == IoOpRead)
+			{
+				if (cqe->res < 0 && cqe->res != -EINTR && cqe->res != -EAGAIN)
+					slot.Error = -cqe->res;
+				else if (cqe->res == 0)
+					slot.Error = EIO; // the file shrank out from under us
+				else if (cqe->res > 0)
+					slot.BytesRead += (uint32_t)cqe->res;
+
+				done = slot.Error != 0 || slot.BytesRead == slot.Size;
+			}
+
+			if (slot.OpsPending == 0 && (op == IoOpOpen || op == IoOpStat))
+			{
+				if (slot.Error == 0 && slot.Size > 0)
+					waitingToRead.push_back(index);
+				else
+					done = true;
+			}
+
+			if (done)
+			{
+				if (slot.Fd != -1)
+				{
+					io_uring_sqe* sqe = getSqe(&ring);
+					if (sqe != nullptr)
+					{
+						sqe->opcode = IORING_OP_CLOSE;
+						sqe->fd = slot.Fd;
+						sqe->user_data = makeUserData(index, IoOpClose);
+						inFlight++;
+					}
+					else
+						close(slot.Fd);
+					slot.Fd = -1;
+				}
+
+				// the read-ahead budget was charged when the buffer was allocated
+				uint32_t charged = slot.Buffer != nullptr ? slot.Size : 0;
+				if (slot.Error != 0)
+				{
+					delete[] slot.Buffer;
+					slot.Buffer = nullptr;
+				}
+
+				finish(index, slot.Buffer, charged, slot.Error);
+				slot.Buffer = nullptr;
+			}
+		}
+		__atomic_store_n(ring.CqHead, head, __ATOMIC_RELEASE);
+
+		// keep the read queue in file order so the consumer's next file always goes first
+		std::sort(waitingToRead.begin(), waitingToRead.end());
+	}
+
+	for (size_t i = 0; i < slots.size(); i++)
+	{
+		if (slots[i].Fd != -1)
+			close(slots[i].Fd);
+		delete[] slots[i].Buffer;
+	}
+
+	destroyRing(&ring);
+	m_ring = nullptr;
+}
+
+#endif
@@ -0,0 +1,73 @@
+#ifndef INPUTREADER_H
+#define INPUTREADER_H
+
+#include <cstdint>
+#include <vector>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+
+struct InputFile
+{
+	const char* Path;
+	uint8_t* Data;
+	uint32_t Size;
+
+	// 0 if the file was read successfully, otherwise an errno-style code
+	int Error;
+	bool Ready;
+};
+
+// Reads the builder's input files ahead of the compressor. On Linux the
+// opens, statx calls and reads are submitted in batches through io_uring.
+// Everywhere else (or when io_uring isn't available) a pool of threads
+// does the same work with regular blocking calls.
+//
+// Files must be acquired in order. Each acquired file must be released
+// before the reader will move its read-ahead window past it.
+class InputReader
+{
+public:
+	InputReader();
+	~InputReader();
+
+	bool Start(const char* const* paths, uint32_t numPaths);
+	void Stop();
+
+	// blocks until the file at the given index has been read (or failed)
+	InputFile* Acquire(uint32_t index);
+	void Release(InputFile* file);
+
+	bool UsingIoUring() { return m_usingIoUring; }
+
+	// how far ahead of the consumer the reader is allowed to get
+	static const uint32_t MaxFilesAhead = 512;
+	static const uint64_t MaxBytesAhead = 256 * 1024 * 1024;
+
+private:
+	bool canReadAhead(uint32_t index, uint64_t size);
+	void finish(uint32_t index, uint8_t* data, uint32_t size, int error);
+
+	void workerThread();
+#ifdef __linux__
+	bool setupIoUring();
+	void ioUringThread();
+#endif
+
+	std::vector<InputFile> m_files;
+	std::vector<std::thread> m_threads;
+
+	std::mutex m_lock;
+	std::condition_variable m_readyCondition;
+	std::condition_variable m_windowCondition;
+
+	uint32_t m_nextToClaim;
+	uint32_t m_nextToRelease;
+	uint64_t m_bytesAhead;
+	bool m_stopping;
+
+	bool m_usingIoUring;
+	void* m_ring;
+};
+
+#endif // INPUTREADER_H
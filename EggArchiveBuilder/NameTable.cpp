@@ -0,0 +1,143 @@
+#include "NameTable.h"
+#include <cstring>
+
+// A front coded table starts with this, then a uint32 for each bucket saying where it is
+// (relative to the start of the table), then the buckets.
+struct FrontCodedHeader
+{
+	uint32_t NumBuckets;
+	uint32_t BucketSize;
+
+	// of the whole table, this included
+	uint32_t Size;
+	uint32_t Unused;
+};
+
+bool WriteNameTable(std::vector<uint8_t>* output, const char* const* names, uint32_t numNames, bool frontCoded)
+{
+	if (frontCoded == false)
+	{
+		for (uint32_t i = 0; i < numNames; i++)
+		{
+			size_t length = strlen(names[i]);
+			if (length > 255)
+				return false;
+
+			output->push_back((uint8_t)length);
+			output->insert(output->end(), names[i], names[i] + length + 1);
+		}
+
+		return true;
+	}
+
+	FrontCodedHeader header;
+	header.NumBuckets = (numNames + NameBucketSize - 1) / NameBucketSize;
+	header.BucketSize = NameBucketSize;
+	header.Unused = 0;
+
+	// the header and offsets go in first and get filled in once the buckets are done
+	size_t tableStart = output->size();
+	uint32_t start = sizeof(FrontCodedHeader) + header.NumBuckets * 4;
+	output->resize(tableStart + start);
+	std::vector<uint32_t> offsets(header.NumBuckets);
+
+	for (uint32_t i = 0; i < numNames; i++)
+	{
+		size_t length = strlen(names[i]);
+		if (length > 255)
+			return false;
+
+		if (i % NameBucketSize == 0)
+		{
+			offsets[i / NameBucketSize] = (uint32_t)(output->size() - tableStart);
+			output->push_back((uint8_t)length);
+			output->insert(output->end(), names[i], names[i] + length + 1);
+			continue;
+		}
+
+		size_t shared = 0;
+		while (names[i - 1][shared] != 0 && names[i - 1][shared] == names[i][shared])
+			shared++;
+
+		output->push_back((uint8_t)shared);
+		output->push_back((uint8_t)(length - shared));
+		output->insert(output->end(), names[i] + shared, names[i] + length);
+	}
+
+	header.Size = (uint32_t)(output->size() - tableStart);
+	memcpy(output->data() + tableStart, &header, sizeof(header));
+	if (offsets.empty() == false)
+		memcpy(output->data() + tableStart + sizeof(header), offsets.data(), offsets.size() * 4);
+
+	return true;
+}
+
+bool ReadNameTable(FILE* input, uint32_t offset, uint32_t numNames, bool frontCoded, std::vector<std::string>* names, uint64_t* size)
+{
+	names->resize(numNames);
+	if (fseek(input, offset, SEEK_SET) != 0)
+		return false;
+
+	if (frontCoded == false)
+	{
+		uint64_t tableSize = 0;
+		for (uint32_t i = 0; i < numNames; i++)
+		{
+			char name[257];
+			int length = fgetc(input);
+			if (length == EOF || fread(name, 1, length + 1, input) != (size_t)length + 1 || name[length] != 0)
+				return false;
+
+			(*names)[i].assign(name, length);
+			tableSize += length + 2;
+		}
+
+		if (size != nullptr)
+			*size = tableSize;
+		return true;
+	}
+
+	FrontCodedHeader header;
+	if (fread(&header, sizeof(header), 1, input) != 1 || header.BucketSize == 0
+		|| header.NumBuckets != (numNames + header.BucketSize - 1) / header.BucketSize
+		|| header.Size < sizeof(header) + (uint64_t)header.NumBuckets * 4)
+		return false;
+
+	// the buckets follow on from each other, so the whole thing can just be read straight through
+	std::vector<uint8_t> table(header.Size - sizeof(header));
+	if (table.empty() == false && fread(table.data(), 1, table.size(), input) != table.size())
+		return false;
+
+	const uint8_t* p = table.data() + header.NumBuckets * 4;
+	const uint8_t* end = table.data() + table.size();
+	for (uint32_t i = 0; i < numNames; i++)
+	{
+		std::string& name = (*names)[i];
+		if (i % header.BucketSize == 0)
+		{
+			// lookups go straight to the buckets, so they'd better be where the offsets say
+			uint32_t bucketOffset;
+			memcpy(&bucketOffset, table.data() + i / header.BucketSize * 4, 4);
+			if (bucketOffset != sizeof(header) + (uint32_t)(p - table.data()))
+				return false;
+
+			if (p >= end || end - p < p[0] + 2 || p[p[0] + 1] != 0)
+				return false;
+
+			name.assign((const char*)p + 1, p[0]);
+			p += p[0] + 2;
+			continue;
+		}
+
+		if (end - p < 2 || p[0] > (*names)[i - 1].size() || end - p < p[1] + 2)
+			return false;
+
+		name.assign((*names)[i - 1], 0, p[0]);
+		name.append((const char*)p + 2, p[1]);
+		p += p[1] + 2;
+	}
+
+	if (size != nullptr)
+		*size = header.Size;
+	return true;
+}
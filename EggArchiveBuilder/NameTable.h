@@ -0,0 +1,25 @@
+#ifndef NAMETABLE_H
+#define NAMETABLE_H
+
+#include <cstdint>
+#include <cstdio>
+#include <string>
+#include <vector>
+
+// Filename tables come in two kinds. The plain one is every name in full,
+// each one a uint8 length, the name and a 0. The front coded one (header
+// flag 0x2) splits the names into buckets of NameBucketSize. The first name
+// in each bucket is stored the plain way, so lookups can binary search the
+// buckets without decoding anything. Every other name is just how many
+// characters it shares with the name before it, plus the rest of it.
+
+// how many names there are in each front coded bucket
+const uint32_t NameBucketSize = 32;
+
+// Adds the names (already sorted) to the end of output
+bool WriteNameTable(std::vector<uint8_t>* output, const char* const* names, uint32_t numNames, bool frontCoded);
+
+// Reads either kind of table back. If size isn't null, it gets how many bytes the table takes up.
+bool ReadNameTable(FILE* input, uint32_t offset, uint32_t numNames, bool frontCoded, std::vector<std::string>* names, uint64_t* size = nullptr);
+
+#endif // NAMETABLE_H
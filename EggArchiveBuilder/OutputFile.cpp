@@ -0,0 +1,283 @@
+#include "OutputFile.h"
+#include <cstring>
+#include <cerrno>
+#include <algorithm>
+
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <Windows.h>
+#else
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+namespace
+{
+	// how much gets collected before it's written
+	const size_t StagingSize = 4 * 1024 * 1024;
+
+	// writes at least this big skip the staging buffer and go out with it in the same write
+	const size_t DirectWriteSize = 64 * 1024;
+
+	// the file's space gets reserved at least this far ahead of what's been written
+	const uint64_t ReserveStep = 64 * 1024 * 1024;
+}
+
+OutputFile::OutputFile()
+{
+#ifdef _WIN32
+	m_file = INVALID_HANDLE_VALUE;
+#else
+	m_file = -1;
+#endif
+	m_staged = 0;
+	m_position = 0;
+	m_written = 0;
+	m_reserved = 0;
+	m_canReserve = true;
+	m_failed = false;
+}
+
+OutputFile::~OutputFile()
+{
+	Close();
+}
+
+bool OutputFile::Open(const char* path)
+{
+#ifdef _WIN32
+	m_file = CreateFileA(path, GENERIC_WRITE, 0, nullptr, CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL | FILE_FLAG_SEQUENTIAL_SCAN, nullptr);
+	if (m_file == INVALID_HANDLE_VALUE)
+		return false;
+#else
+	m_file = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0666);
+	if (m_file == -1)
+		return false;
+#endif
+
+	m_staging.resize(StagingSize);
+	m_staged = 0;
+	m_position = 0;
+	m_written = 0;
+	m_reserved = 0;
+	m_canReserve = true;
+	m_failed = false;
+	return true;
+}
+
+bool OutputFile::Close()
+{
+#ifdef _WIN32
+	if (m_file == INVALID_HANDLE_VALUE)
+		return false;
+#else
+	if (m_file == -1)
+		return false;
+#endif
+
+	flush(nullptr, 0);
+
+#ifdef _WIN32
+	// allocation past the end of the file goes away when it's closed
+	CloseHandle(m_file);
+	m_file = INVALID_HANDLE_VALUE;
+#else
+	if (m_reserved > m_written && ftruncate(m_file, (off_t)m_written) != 0)
+		m_failed = true;
+	if (close(m_file) != 0)
+		m_failed = true;
+	m_file = -1;
+#endif
+
+	std::vector<uint8_t>().swap(m_staging);
+	return m_failed == false;
+}
+
+void OutputFile::Write(const void* data, size_t size)
+{
+	if (size >= DirectWriteSize)
+		flush(data, size);
+	else
+	{
+		if (m_staged + size > m_staging.size())
+			flush(nullptr, 0);
+
+		memcpy(m_staging.data() + m_staged, data, size);
+		m_staged += size;
+	}
+
+	m_position += size;
+}
+
+void OutputFile::Pad(uint32_t alignment)
+{
+	static const uint8_t zeros[4096] = {};
+	size_t padding = (size_t)((alignment - (m_position % alignment)) % alignment);
+	while (padding > 0)
+	{
+		size_t chunk = padding < sizeof(zeros) ? padding : sizeof(zeros);
+		Write(zeros, chunk);
+		padding -= chunk;
+	}
+}
+
+void OutputFile::Reserve(uint64_t size)
+{
+	reserveUpTo(m_position + size);
+}
+
+void OutputFile::WriteAt(uint64_t offset, const void* data, size_t size)
+{
+	flush(nullptr, 0);
+	if (m_failed || offset + size > m_written)
+	{
+		m_failed = true;
+		return;
+	}
+
+#ifdef _WIN32
+	OVERLAPPED overlapped = {};
+	overlapped.Offset = (DWORD)offset;
+	overlapped.OffsetHigh = (DWORD)(offset >> 32);
+	DWORD written;
+	if (WriteFile(m_file, data, (DWORD)size, &written, &overlapped) == FALSE || written != size)
+		m_failed = true;
+
+	// that moved the file pointer, so put it back at the end
+	LARGE_INTEGER end;
+	end.QuadPart = (LONGLONG)m_written;
+	SetFilePointerEx(m_file, end, nullptr, FILE_BEGIN);
+#else
+	const uint8_t* p = (const uint8_t*)data;
+	while (size > 0)
+	{
+		ssize_t r = pwrite(m_file, p, size, (off_t)offset);
+		if (r < 0 && errno == EINTR)
+			continue;
+		if (r <= 0)
+		{
+			m_failed = true;
+			return;
+		}
+
+		p += r;
+		offset += r;
+		size -= (size_t)r;
+	}
+#endif
+}
+
+void OutputFile::flush(const void* extra, size_t extraSize)
+{
+	if (m_staged == 0 && extraSize == 0)
+		return;
+
+	uint64_t end = m_written + m_staged + extraSize;
+	if (end > m_reserved)
+		reserveUpTo(std::max(end, m_reserved + std::max(ReserveStep, m_reserved / 4)));
+
+	if (m_failed == false && writeAll(m_staging.data(), m_staged, extra, extraSize) == false)
+		m_failed = true;
+
+	m_written = end;
+	m_staged = 0;
+}
+
+bool OutputFile::writeAll(const void* first, size_t firstSize, const void* second, size_t secondSize)
+{
+#ifdef _WIN32
+	// WriteFileGather() only does page aligned, unbuffered writes, so this is two writes
+	const void* pieces[2] = { first, second };
+	size_t sizes[2] = { firstSize, secondSize };
+	for (int i = 0; i < 2; i++)
+	{
+		const uint8_t* p = (const uint8_t*)pieces[i];
+		size_t left = sizes[i];
+		while (left > 0)
+		{
+			DWORD chunk = left > 0x40000000 ? 0x40000000 : (DWORD)left;
+			DWORD written;
+			if (WriteFile(m_file, p, chunk, &written, nullptr) == FALSE || written == 0)
+				return false;
+
+			p += written;
+			left -= written;
+		}
+	}
+
+	return true;
+#else
+	iovec pieces[2];
+	pieces[0].iov_base = (void*)first;
+	pieces[0].iov_len = firstSize;
+	pieces[1].iov_base = (void*)second;
+	pieces[1].iov_len = secondSize;
+
+	iovec* next = pieces;
+	int count = 2;
+	while (count > 0)
+	{
+		if (next->iov_len == 0)
+		{
+			next++;
+			count--;
+			continue;
+		}
+
+		ssize_t r = writev(m_file, next, count);
+		if (r < 0 && errno == EINTR)
+			continue;
+		if (r <= 0)
+			return false;
+
+		// pick up where a short write left off
+		size_t done = (size_t)r;
+		while (count > 0 && done >= next->iov_len)
+		{
+			done -= next->iov_len;
+			next++;
+			count--;
+		}
+		if (count > 0)
+		{
+			next->iov_base = (uint8_t*)next->iov_base + done;
+			next->iov_len -= done;
+		}
+	}
+
+	return true;
+#endif
+}
+
+void OutputFile::reserveUpTo(uint64_t size)
+{
+	if (size <= m_reserved || m_canReserve == false)
+		return;
+
+#ifdef _WIN32
+	FILE_ALLOCATION_INFO allocation;
+	allocation.AllocationSize.QuadPart = (LONGLONG)size;
+	if (SetFileInformationByHandle(m_file, FileAllocationInfo, &allocation, sizeof(allocation)) == FALSE)
+	{
+		m_canReserve = false;
+		return;
+	}
+#elif defined(__linux__)
+	// The raw call, because posix_fallocate() writes zeros on filesystems that can't do it.
+	// This grows the file, which is why Close() trims it.
+	if (fallocate(m_file, 0, (off_t)m_reserved, (off_t)(size - m_reserved)) != 0)
+	{
+		m_canReserve = false;
+		return;
+	}
+#else
+	m_canReserve = false;
+	return;
+#endif
+
+	m_reserved = size;
+}
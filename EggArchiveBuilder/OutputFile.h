@@ -0,0 +1,65 @@
+#ifndef OUTPUTFILE_H
+#define OUTPUTFILE_H
+
+#include <cstdint>
+#include <cstddef>
+#include <vector>
+
+// Where build() writes the egg. Small writes are collected in a staging
+// buffer, and anything big goes out together with it in one gather write
+// (writev) without being copied first, so the file is written in a few
+// large writes instead of one or more for every input.
+//
+// The file's space is reserved ahead of the writes with fallocate(), in
+// big steps as the file grows and exactly when the caller knows how much
+// is coming, so a big egg doesn't end up in pieces all over the disk.
+// Whatever was reserved and not used is trimmed off by Close().
+class OutputFile
+{
+public:
+	OutputFile();
+	~OutputFile();
+
+	bool Open(const char* path);
+
+	// Flushes everything and trims the file to what was written. Returns false if any write failed.
+	bool Close();
+
+	// where the next byte written will go
+	uint64_t Tell() const { return m_position; }
+
+	void Write(const void* data, size_t size);
+
+	// writes zeros up to the next multiple of alignment, which has to be a power of two
+	void Pad(uint32_t alignment = 8);
+
+	// Asks for room for size more bytes after Tell(), on top of whatever's been written
+	void Reserve(uint64_t size);
+
+	// Overwrites bytes that have already been written, like the header once the index is done
+	void WriteAt(uint64_t offset, const void* data, size_t size);
+
+private:
+	void flush(const void* extra, size_t extraSize);
+	bool writeAll(const void* first, size_t firstSize, const void* second, size_t secondSize);
+	void reserveUpTo(uint64_t size);
+
+#ifdef _WIN32
+	void* m_file;
+#else
+	int m_file;
+#endif
+
+	std::vector<uint8_t> m_staging;
+	size_t m_staged;
+
+	// m_position counts what's still staged, m_written is what's actually in the file
+	uint64_t m_position;
+	uint64_t m_written;
+	uint64_t m_reserved;
+
+	bool m_canReserve;
+	bool m_failed;
+};
+
+#endif // OUTPUTFILE_H
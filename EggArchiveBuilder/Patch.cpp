@@ -0,0 +1,659 @@
+#include "Patch.h"
+#include "Hash.h"
+#include "EggReader.h"
+#include <cstdio>
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <vector>
+#include <map>
+#include <unordered_map>
+#include <algorithm>
+
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <Windows.h>
+#else
+#include <sys/stat.h>
+#endif
+
+namespace
+{
+	// A patch is a PatchHeader and then a list of ops that write the new egg from start to end.
+	// Each op starts with a byte saying what it is:
+	//   OpCopy, uint32 offset, uint32 size - copy size bytes from that offset in the old egg
+	//   OpData, uint32 size, then the bytes - write them as is
+	//   OpEnd - that's everything
+	struct PatchHeader
+	{
+		char Magic[4];
+		uint32_t Version;
+
+		// the old egg's header, which has when it was built in it, so a patch can't be applied to the wrong egg
+		uint8_t OldHeader[32];
+		uint64_t OldSize;
+
+		// of the whole new egg, to check the result against
+		uint64_t NewSize;
+		uint64_t NewHash;
+	};
+
+	enum
+	{
+		OpEnd = 0,
+		OpCopy = 1,
+		OpData = 2,
+	};
+
+	const char PatchMagic[4] = { 'E', 'G', 'G', 'P' };
+	const uint32_t PatchVersion = 1;
+
+	// files and solid blocks smaller than this are sent whole when they change
+	const uint32_t MinDeltaSize = 4096;
+
+	// how long the pieces of the old data are that deltas look for in the new data
+	const uint32_t DeltaBlockSize = 16;
+
+	// gaps between files smaller than this (headers, padding) are sent whole
+	const uint32_t MinGapDeltaSize = 64;
+
+	// how much gets copied at a time when patching, and the most one OpData gets
+	const uint32_t PatchBufferSize = 1024 * 1024;
+
+	// Something in an egg's data area that gets diffed as a whole: a file that's not in a solid block, or a solid block
+	struct Blob
+	{
+		uint32_t Offset;
+		uint32_t Size;
+		int Entry;
+		int Block;
+	};
+
+	FILE* openFile(const char* path, const char* mode)
+	{
+#ifdef _WIN32
+		FILE* fp;
+		if (fopen_s(&fp, path, mode) != 0)
+			return nullptr;
+		return fp;
+#else
+		return fopen(path, mode);
+#endif
+	}
+
+	// Whether two paths lead to the same file, even through a link or a different spelling of the path.
+	// False if either one doesn't exist.
+	bool sameFile(const char* a, const char* b)
+	{
+#ifdef _WIN32
+		BY_HANDLE_FILE_INFORMATION info[2];
+		const char* paths[2] = { a, b };
+		for (int i = 0; i < 2; i++)
+		{
+			HANDLE file = CreateFileA(paths[i], 0, FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE, nullptr, OPEN_EXISTING, FILE_FLAG_BACKUP_SEMANTICS, nullptr);
+			if (file == INVALID_HANDLE_VALUE)
+				return false;
+			BOOL ok = GetFileInformationByHandle(file, &info[i]);
+			CloseHandle(file);
+			if (ok == FALSE)
+				return false;
+		}
+		return info[0].dwVolumeSerialNumber == info[1].dwVolumeSerialNumber
+			&& info[0].nFileIndexHigh == info[1].nFileIndexHigh
+			&& info[0].nFileIndexLow == info[1].nFileIndexLow;
+#else
+		struct stat sa, sb;
+		return stat(a, &sa) == 0 && stat(b, &sb) == 0 && sa.st_dev == sb.st_dev && sa.st_ino == sb.st_ino;
+#endif
+	}
+
+	std::vector<Blob> getBlobs(const Egg& egg)
+	{
+		std::vector<Blob> blobs;
+		for (size_t i = 0; i < egg.Toc.size(); i++)
+		{
+			if ((egg.Toc[i].Flags & 0x02) == 0 && egg.Toc[i].CompressedSize > 0)
+			{
+				Blob blob = { egg.Toc[i].Offset, egg.Toc[i].CompressedSize, (int)i, -1 };
+				blobs.push_back(blob);
+			}
+		}
+
+		for (size_t i = 0; i < egg.Blocks.size(); i++)
+		{
+			Blob blob = { egg.Blocks[i].Offset, egg.Blocks[i].CompressedSize, -1, (int)i };
+			blobs.push_back(blob);
+		}
+
+		std::sort(blobs.begin(), blobs.end(), [](const Blob& a, const Blob& b) { return a.Offset < b.Offset; });
+		return blobs;
+	}
+
+	// Writes the ops. Copies of bytes that follow on from each other in the old egg get merged into one,
+	// and so do bytes that get sent one after the other.
+	class PatchWriter
+	{
+	public:
+		PatchWriter(FILE* fp)
+		{
+			m_file = fp;
+			m_copyOffset = 0;
+			m_copySize = 0;
+			BytesCopied = 0;
+			BytesSent = 0;
+		}
+
+		void Copy(uint32_t offset, uint32_t size)
+		{
+			flushData();
+
+			if (m_copySize > 0 && m_copyOffset + m_copySize == offset && m_copySize + size > m_copySize)
+				m_copySize += size;
+			else
+			{
+				flushCopy();
+				m_copyOffset = offset;
+				m_copySize = size;
+			}
+
+			BytesCopied += size;
+		}
+
+		void Data(const uint8_t* data, uint32_t size)
+		{
+			flushCopy();
+
+			while (size > 0)
+			{
+				uint32_t n = std::min(size, PatchBufferSize - (uint32_t)m_data.size());
+				m_data.insert(m_data.end(), data, data + n);
+				if (m_data.size() == PatchBufferSize)
+					flushData();
+
+				data += n;
+				size -= n;
+				BytesSent += n;
+			}
+		}
+
+		bool Finish()
+		{
+			flushCopy();
+			flushData();
+			fputc(OpEnd, m_file);
+			return ferror(m_file) == 0;
+		}
+
+		uint64_t BytesCopied;
+		uint64_t BytesSent;
+
+	private:
+		void flushCopy()
+		{
+			if (m_copySize == 0)
+				return;
+
+			fputc(OpCopy, m_file);
+			fwrite(&m_copyOffset, 4, 1, m_file);
+			fwrite(&m_copySize, 4, 1, m_file);
+			m_copySize = 0;
+		}
+
+		void flushData()
+		{
+			if (m_data.empty())
+				return;
+
+			uint32_t size = (uint32_t)m_data.size();
+			fputc(OpData, m_file);
+			fwrite(&size, 4, 1, m_file);
+			fwrite(m_data.data(), 1, size, m_file);
+			m_data.clear();
+		}
+
+		FILE* m_file;
+		uint32_t m_copyOffset;
+		uint32_t m_copySize;
+		std::vector<uint8_t> m_data;
+	};
+
+	// Finds where new data matches the old data. The old data is indexed a block at a time, and the
+	// new data is searched with a rolling hash at every position, so anything that's the same for at least
+	// two blocks gets found wherever it moved to. Matches get extended as far as they go both ways.
+	class Delta
+	{
+	public:
+		Delta()
+		{
+			m_old = nullptr;
+			m_oldSize = 0;
+			m_shift = 32;
+			m_power = 1;
+			for (uint32_t i = 1; i < DeltaBlockSize; i++)
+				m_power *= Multiplier;
+		}
+
+		void Index(const uint8_t* old, uint32_t size)
+		{
+			m_old = old;
+			m_oldSize = size;
+
+			uint32_t numBlocks = size / DeltaBlockSize;
+			uint32_t bits = 4;
+			while (bits < 31 && (1u << bits) < numBlocks * 2)
+				bits++;
+			m_shift = 32 - bits;
+			m_table.assign((size_t)1 << bits, 0);
+
+			// later blocks win, which doesn't matter much
+			for (uint32_t i = 0; i < numBlocks; i++)
+				m_table[slot(hashBlock(old + i * DeltaBlockSize))] = i * DeltaBlockSize + 1;
+		}
+
+		// Writes data as copies out of the old data (which starts at oldBase in the old egg) where it matches, and as is everywhere else
+		void Encode(const uint8_t* data, uint32_t size, uint32_t oldBase, PatchWriter* writer)
+		{
+			uint32_t sent = 0;
+			if (m_oldSize >= DeltaBlockSize && size >= DeltaBlockSize)
+			{
+				uint32_t i = 0;
+				uint32_t hash = hashBlock(data);
+				while (true)
+				{
+					uint32_t candidate = m_table[slot(hash)];
+					if (candidate != 0 && memcmp(m_old + candidate - 1, data + i, DeltaBlockSize) == 0)
+					{
+						uint32_t start = i;
+						uint32_t oldStart = candidate - 1;
+						while (start > sent && oldStart > 0 && m_old[oldStart - 1] == data[start - 1])
+						{
+							start--;
+							oldStart--;
+						}
+
+						uint32_t length = i - start + DeltaBlockSize;
+						while (start + length < size && oldStart + length < m_oldSize && m_old[oldStart + length] == data[start + length])
+							length++;
+
+						writer->Data(data + sent, start - sent);
+						writer->Copy(oldBase + oldStart, length);
+						sent = start + length;
+
+						i = sent;
+						if (i + DeltaBlockSize > size)
+							break;
+						hash = hashBlock(data + i);
+						continue;
+					}
+
+					if (i + DeltaBlockSize >= size)
+						break;
+
+					hash = (hash - data[i] * m_power) * Multiplier + data[i + DeltaBlockSize];
+					i++;
+				}
+			}
+
+			writer->Data(data + sent, size - sent);
+		}
+
+	private:
+		static const uint32_t Multiplier = 0x01000193;
+
+		uint32_t hashBlock(const uint8_t* p)
+		{
+			uint32_t hash = 0;
+			for (uint32_t i = 0; i < DeltaBlockSize; i++)
+				hash = hash * Multiplier + p[i];
+			return hash;
+		}
+
+		uint32_t slot(uint32_t hash)
+		{
+			return (hash * 0x9E3779B1u) >> m_shift;
+		}
+
+		const uint8_t* m_old;
+		uint32_t m_oldSize;
+		uint32_t m_shift;
+		uint32_t m_power;
+		std::vector<uint32_t> m_table;
+	};
+}
+
+int diff(const char* oldEgg, const char* newEgg, const char* patchPath)
+{
+	Egg oldArchive, newArchive;
+	oldArchive.File = nullptr;
+	newArchive.File = nullptr;
+	if (LoadEgg(oldEgg, &oldArchive) == false || LoadEgg(newEgg, &newArchive) == false
+		|| HashEntries(&oldArchive, oldEgg) == false || HashEntries(&newArchive, newEgg) == false)
+	{
+		CloseEgg(&oldArchive);
+		CloseEgg(&newArchive);
+		return -1;
+	}
+
+	// the patch has to say what the new egg is supposed to come out as
+	std::vector<uint8_t> buffer(PatchBufferSize);
+	Hasher newHasher;
+	fseek(newArchive.File, 0, SEEK_SET);
+	for (size_t n; (n = fread(buffer.data(), 1, buffer.size(), newArchive.File)) > 0; )
+		newHasher.Update(buffer.data(), n);
+
+	// where everything was in the old egg
+	std::map<std::string, uint32_t> oldByName;
+	std::unordered_map<uint64_t, uint32_t> oldByHash;
+	for (uint32_t i = 0; i < oldArchive.Toc.size(); i++)
+	{
+		oldByName[oldArchive.Names[i]] = i;
+		if ((oldArchive.Toc[i].Flags & 0x02) == 0)
+			oldByHash[oldArchive.Hashes[i]] = i;
+	}
+
+	// solid blocks don't have hashes of their own, so they're found by what they look like compressed
+	std::unordered_map<uint64_t, uint32_t> oldBlocksByHash;
+	for (uint32_t i = 0; i < oldArchive.Blocks.size(); i++)
+	{
+		if (ReadAt(oldArchive.File, oldArchive.Blocks[i].Offset, oldArchive.Blocks[i].CompressedSize, &buffer))
+			oldBlocksByHash[Hasher::Hash(buffer.data(), buffer.size())] = i;
+	}
+
+	// the first file in each of the new egg's blocks, to find the old block to diff against
+	std::vector<int> firstInBlock(newArchive.Blocks.size(), -1);
+	for (uint32_t i = 0; i < newArchive.Toc.size(); i++)
+	{
+		uint32_t block = newArchive.Toc[i].Flags >> 8;
+		if ((newArchive.Toc[i].Flags & 0x02) && block < firstInBlock.size() && firstInBlock[block] < 0)
+			firstInBlock[block] = (int)i;
+	}
+
+	// everything in the old egg after its files (the TOC, names and sections), for diffing what's after the new egg's files against
+	std::vector<Blob> oldBlobs = getBlobs(oldArchive);
+	uint32_t oldIndexStart = 32;
+	for (size_t i = 0; i < oldBlobs.size(); i++)
+		oldIndexStart = std::max(oldIndexStart, oldBlobs[i].Offset + oldBlobs[i].Size);
+
+	std::vector<uint8_t> oldIndex;
+	if (oldIndexStart > oldArchive.Size || ReadAt(oldArchive.File, oldIndexStart, (uint32_t)(oldArchive.Size - oldIndexStart), &oldIndex) == false)
+		oldIndex.clear();
+
+	Delta indexDelta;
+	indexDelta.Index(oldIndex.data(), (uint32_t)oldIndex.size());
+
+	FILE* out = openFile(patchPath, "wb");
+	if (out == nullptr)
+	{
+		printf("Unable to open %s for output\n", patchPath);
+		CloseEgg(&oldArchive);
+		CloseEgg(&newArchive);
+		return -1;
+	}
+
+	PatchHeader header;
+	memcpy(header.Magic, PatchMagic, 4);
+	header.Version = PatchVersion;
+	memcpy(header.OldHeader, oldArchive.Header, 32);
+	header.OldSize = oldArchive.Size;
+	header.NewSize = newArchive.Size;
+	header.NewHash = newHasher.Finish();
+	fwrite(&header, sizeof(header), 1, out);
+
+	PatchWriter writer(out);
+	std::vector<uint8_t> newData, oldData;
+	bool ok = true;
+
+	// the header, padding, and everything after the files
+	auto writeGap = [&](uint32_t start, uint32_t end)
+	{
+		if (ReadAt(newArchive.File, start, end - start, &newData) == false)
+		{
+			ok = false;
+			return;
+		}
+
+		if (end - start < MinGapDeltaSize)
+			writer.Data(newData.data(), end - start);
+		else
+			indexDelta.Encode(newData.data(), end - start, oldIndexStart, &writer);
+	};
+
+	uint32_t numCopied = 0, numDeltas = 0, numSent = 0;
+	uint32_t cursor = 0;
+	std::vector<Blob> newBlobs = getBlobs(newArchive);
+	for (size_t i = 0; i < newBlobs.size() && ok; i++)
+	{
+		const Blob& blob = newBlobs[i];
+		uint32_t end = blob.Offset + blob.Size;
+		if (end <= cursor)
+			continue;
+
+		// shouldn't happen, but there's no need to trust that it doesn't
+		if (blob.Offset < cursor)
+		{
+			writeGap(cursor, end);
+			cursor = end;
+			continue;
+		}
+
+		if (blob.Offset > cursor)
+			writeGap(cursor, blob.Offset);
+
+		if (ReadAt(newArchive.File, blob.Offset, blob.Size, &newData) == false)
+		{
+			ok = false;
+			break;
+		}
+
+		// find the same thing in the old egg, or else something to diff it against
+		const EggEntry* same = nullptr;
+		const EggEntry* base = nullptr;
+		if (blob.Entry >= 0)
+		{
+			const EggEntry& entry = newArchive.Toc[blob.Entry];
+
+			auto byHash = oldByHash.find(newArchive.Hashes[blob.Entry]);
+			if (byHash != oldByHash.end())
+			{
+				const EggEntry& old = oldArchive.Toc[byHash->second];
+				if (old.CompressedSize == entry.CompressedSize && (old.Flags & 0x01) == (entry.Flags & 0x01))
+					same = &old;
+				else
+					base = &old;
+			}
+
+			auto byName = oldByName.find(newArchive.Names[blob.Entry]);
+			if (same == nullptr && byName != oldByName.end() && (oldArchive.Toc[byName->second].Flags & 0x02) == 0)
+				base = &oldArchive.Toc[byName->second];
+		}
+		else
+		{
+			auto byHash = oldBlocksByHash.find(Hasher::Hash(newData.data(), newData.size()));
+			if (byHash != oldBlocksByHash.end() && oldArchive.Blocks[byHash->second].CompressedSize == blob.Size)
+				same = &oldArchive.Blocks[byHash->second];
+			else if (firstInBlock[blob.Block] >= 0)
+			{
+				auto byName = oldByName.find(newArchive.Names[firstInBlock[blob.Block]]);
+				if (byName != oldByName.end() && (oldArchive.Toc[byName->second].Flags & 0x02) && (oldArchive.Toc[byName->second].Flags >> 8) < oldArchive.Blocks.size())
+					base = &oldArchive.Blocks[oldArchive.Toc[byName->second].Flags >> 8];
+			}
+		}
+
+		// hashes can collide, so make sure
+		if (same != nullptr && (ReadAt(oldArchive.File, same->Offset, same->CompressedSize, &oldData) == false || oldData != newData))
+		{
+			base = same;
+			same = nullptr;
+		}
+
+		if (same != nullptr)
+		{
+			writer.Copy(same->Offset, blob.Size);
+			numCopied++;
+		}
+		else if (base != nullptr && blob.Size >= MinDeltaSize && ReadAt(oldArchive.File, base->Offset, base->CompressedSize, &oldData))
+		{
+			Delta delta;
+			delta.Index(oldData.data(), (uint32_t)oldData.size());
+			delta.Encode(newData.data(), blob.Size, base->Offset, &writer);
+			numDeltas++;
+		}
+		else
+		{
+			writer.Data(newData.data(), blob.Size);
+			numSent++;
+		}
+
+		cursor = end;
+	}
+
+	if (ok && cursor < newArchive.Size)
+		writeGap(cursor, (uint32_t)newArchive.Size);
+
+	ok = writer.Finish() && ok;
+	long patchSize = ftell(out);
+	ok = fclose(out) == 0 && ok;
+
+	if (ok == false)
+	{
+		printf("Unable to write %s\n", patchPath);
+		remove(patchPath);
+		CloseEgg(&oldArchive);
+		CloseEgg(&newArchive);
+		return -1;
+	}
+
+	// what changed, file by file
+	uint32_t numUnchanged = 0, numChanged = 0, numAdded = 0;
+	for (uint32_t i = 0; i < newArchive.Toc.size(); i++)
+	{
+		auto old = oldByName.find(newArchive.Names[i]);
+		if (old == oldByName.end())
+			numAdded++;
+		else if (oldArchive.Hashes[old->second] == newArchive.Hashes[i] && oldArchive.Toc[old->second].UncompressedSize == newArchive.Toc[i].UncompressedSize)
+			numUnchanged++;
+		else
+			numChanged++;
+	}
+	uint32_t numRemoved = (uint32_t)oldArchive.Toc.size() - (numUnchanged + numChanged);
+
+	printf("%u files unchanged, %u changed, %u added, %u removed\n", numUnchanged, numChanged, numAdded, numRemoved);
+	printf("%u files and blocks copied from the old egg, %u sent as deltas, %u sent whole\n", numCopied, numDeltas, numSent);
+	printf("Wrote %s: %ld bytes (%llu bytes copied from %s, %llu bytes sent) for a %llu byte egg\n", patchPath, patchSize,
+		(unsigned long long)writer.BytesCopied, oldEgg, (unsigned long long)writer.BytesSent, (unsigned long long)newArchive.Size);
+
+	CloseEgg(&oldArchive);
+	CloseEgg(&newArchive);
+	return 0;
+}
+
+int patch(const char* oldEgg, const char* patchPath, const char* newEgg)
+{
+	if (strcmp(oldEgg, newEgg) == 0 || sameFile(oldEgg, newEgg))
+	{
+		printf("The new egg has to go somewhere other than the old one, since it's read while the new one's written\n");
+		return -1;
+	}
+
+	FILE* patchFile = openFile(patchPath, "rb");
+	if (patchFile == nullptr)
+	{
+		printf("Unable to open %s\n", patchPath);
+		return -1;
+	}
+
+	PatchHeader header;
+	if (fread(&header, sizeof(header), 1, patchFile) != 1 || memcmp(header.Magic, PatchMagic, 4) != 0 || header.Version != PatchVersion)
+	{
+		printf("%s isn't a patch\n", patchPath);
+		fclose(patchFile);
+		return -1;
+	}
+
+	FILE* old = openFile(oldEgg, "rb");
+	if (old == nullptr)
+	{
+		printf("Unable to open %s\n", oldEgg);
+		fclose(patchFile);
+		return -1;
+	}
+
+	uint8_t oldHeader[32];
+	fseek(old, 0, SEEK_END);
+	uint64_t oldSize = (uint64_t)ftell(old);
+	fseek(old, 0, SEEK_SET);
+	if (oldSize != header.OldSize || fread(oldHeader, 1, 32, old) != 32 || memcmp(oldHeader, header.OldHeader, 32) != 0)
+	{
+		printf("%s isn't the egg %s was made from\n", oldEgg, patchPath);
+		fclose(old);
+		fclose(patchFile);
+		return -1;
+	}
+
+	FILE* out = openFile(newEgg, "wb");
+	if (out == nullptr)
+	{
+		printf("Unable to open %s for output\n", newEgg);
+		fclose(old);
+		fclose(patchFile);
+		return -1;
+	}
+
+	// everything goes through here, so memory use doesn't depend on how big anything is
+	std::vector<uint8_t> buffer(PatchBufferSize);
+	Hasher hasher;
+	uint64_t bytesCopied = 0, bytesFromPatch = 0;
+	bool ok = true;
+
+	while (ok)
+	{
+		int op = fgetc(patchFile);
+		if (op == OpEnd)
+			break;
+
+		uint32_t fields[2];
+		uint32_t numFields = op == OpCopy ? 2 : 1;
+		if ((op != OpCopy && op != OpData) || fread(fields, 4, numFields, patchFile) != numFields)
+		{
+			ok = false;
+			break;
+		}
+
+		FILE* source = patchFile;
+		uint32_t size = fields[0];
+		if (op == OpCopy)
+		{
+			source = old;
+			size = fields[1];
+			ok = (uint64_t)fields[0] + size <= oldSize && fseek(old, fields[0], SEEK_SET) == 0;
+			bytesCopied += size;
+		}
+		else
+			bytesFromPatch += size;
+
+		while (ok && size > 0)
+		{
+			uint32_t n = std::min(size, PatchBufferSize);
+			ok = fread(buffer.data(), 1, n, source) == n && fwrite(buffer.data(), 1, n, out) == n;
+			hasher.Update(buffer.data(), n);
+			size -= n;
+		}
+	}
+
+	ok = ok && bytesCopied + bytesFromPatch == header.NewSize && hasher.Finish() == header.NewHash;
+	ok = fclose(out) == 0 && ok;
+	fclose(old);
+	fclose(patchFile);
+
+	if (ok == false)
+	{
+		printf("Unable to apply %s to %s. The patch is damaged or the new egg couldn't be written.\n", patchPath, oldEgg);
+		remove(newEgg);
+		return -1;
+	}
+
+	printf("Wrote %s: %llu bytes copied from %s, %llu bytes from %s\n", newEgg,
+		(unsigned long long)bytesCopied, oldEgg, (unsigned long long)bytesFromPatch, patchPath);
+	return 0;
+}
@@ -0,0 +1,15 @@
+#ifndef PATCH_H
+#define PATCH_H
+
+// Writes a patch that turns oldEgg into newEgg. Files and solid blocks that
+// haven't changed are copied out of the old egg when the patch is applied,
+// big ones that have changed are sent as deltas against their old versions,
+// and everything else is sent as is.
+int diff(const char* oldEgg, const char* newEgg, const char* patchPath);
+
+// Rebuilds the new egg out of the old one and a patch written by diff(). The
+// old egg and the patch are streamed through one fixed-size buffer, and the
+// result is checked against the hash of the new egg that's in the patch.
+int patch(const char* oldEgg, const char* patchPath, const char* newEgg);
+
+#endif // PATCH_H
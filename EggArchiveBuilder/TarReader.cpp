@@ -0,0 +1,382 @@
+#include "TarReader.h"
+#include <cstring>
+
+#ifdef _WIN32
+#include <io.h>
+#include <fcntl.h>
+#endif
+
+namespace
+{
+	const uint32_t BlockSize = 512;
+
+	// pax headers bigger than this are almost certainly garbage
+	const uint64_t MaxPaxHeaderSize = 1024 * 1024;
+
+	// Numbers are octal text, or if the top bit of the first byte is set, big
+	// endian binary (which GNU tar uses for files of 8GB and more).
+	bool parseNumber(const uint8_t* field, size_t length, uint64_t* value)
+	{
+		*value = 0;
+		if (field[0] & 0x80)
+		{
+			// negative numbers don't make sense for anything we look at
+			if (field[0] & 0x40)
+				return false;
+
+			uint64_t result = field[0] & 0x3f;
+			for (size_t i = 1; i < length; i++)
+			{
+				if (result >> 56)
+					return false;
+				result = (result << 8) | field[i];
+			}
+
+			*value = result;
+			return true;
+		}
+
+		size_t i = 0;
+		while (i < length && field[i] == ' ')
+			i++;
+
+		uint64_t result = 0;
+		for (; i < length && field[i] >= '0' && field[i] <= '7'; i++)
+		{
+			if (result >> 61)
+				return false;
+			result = result * 8 + (field[i] - '0');
+		}
+
+		if (i < length && field[i] != ' ' && field[i] != 0)
+			return false;
+
+		*value = result;
+		return true;
+	}
+
+	// the stored checksum is the sum of the header's bytes, with the checksum itself counted as spaces
+	bool checksumMatches(const uint8_t* block)
+	{
+		uint64_t stored;
+		if (parseNumber(block + 148, 8, &stored) == false)
+			return false;
+
+		uint32_t sum = 0;
+		int32_t signedSum = 0;
+		for (uint32_t i = 0; i < BlockSize; i++)
+		{
+			uint8_t c = i >= 148 && i < 156 ? ' ' : block[i];
+			sum += c;
+			signedSum += (int8_t)c;
+		}
+
+		// some old tars summed signed chars
+		return stored == sum || stored == (uint64_t)(uint32_t)signedSum;
+	}
+
+	std::string getField(const uint8_t* field, size_t length)
+	{
+		size_t end = 0;
+		while (end < length && field[end] != 0)
+			end++;
+		return std::string((const char*)field, end);
+	}
+
+	// takes off any leading "./" and '/'
+	void trimName(std::string* name)
+	{
+		size_t start = 0;
+		while (start < name->size() && ((*name)[start] == '/' || ((*name)[start] == '.' && start + 1 < name->size() && (*name)[start + 1] == '/')))
+			start += (*name)[start] == '/' ? 1 : 2;
+		name->erase(0, start);
+	}
+}
+
+TarReader::TarReader()
+{
+	m_file = nullptr;
+	m_ownsFile = false;
+	m_dataLeft = 0;
+	m_paddingLeft = 0;
+	m_numSkipped = 0;
+	m_error = nullptr;
+}
+
+TarReader::~TarReader()
+{
+	if (m_ownsFile && m_file != nullptr)
+		fclose(m_file);
+}
+
+bool TarReader::Open(const char* path)
+{
+	if (strcmp(path, "-") == 0)
+	{
+#ifdef _WIN32
+		_setmode(_fileno(stdin), _O_BINARY);
+#endif
+		m_file = stdin;
+		m_ownsFile = false;
+	}
+	else
+	{
+#ifdef _WIN32
+		if (fopen_s(&m_file, path, "rb") != 0)
+			m_file = nullptr;
+#else
+		m_file = fopen(path, "rb");
+#endif
+		m_ownsFile = true;
+	}
+
+	if (m_file == nullptr)
+		return false;
+
+	// the headers and small files come out of here instead of costing a read each
+	setvbuf(m_file, nullptr, _IOFBF, 1024 * 1024);
+	return true;
+}
+
+bool TarReader::Next(TarEntry* entry)
+{
+	if (m_error != nullptr || skip(m_dataLeft + m_paddingLeft) == false)
+		return false;
+	m_dataLeft = 0;
+	m_paddingLeft = 0;
+
+	// what the GNU long name and pax entries say about the entry after them
+	std::string longName;
+	std::string longLinkName;
+	std::string paxPath;
+	std::string paxLinkPath;
+	uint64_t paxSize = UINT64_MAX;
+
+	uint8_t block[BlockSize];
+	for (;;)
+	{
+		size_t r = fread(block, 1, BlockSize, m_file);
+		if (r == 0 && feof(m_file))
+			return false;  // no end of archive blocks, but nothing's missing either
+		if (r != BlockSize)
+			return fail("The tar file ended in the middle of a header");
+
+		bool empty = true;
+		for (uint32_t i = 0; i < BlockSize && empty; i++)
+			empty = block[i] == 0;
+		if (empty)
+			return false;
+
+		if (checksumMatches(block) == false)
+			return fail("The tar file has a damaged header");
+
+		char type = (char)block[156];
+		bool extension = type == 'L' || type == 'K' || type == 'x';
+
+		uint64_t size;
+		if (parseNumber(block + 124, 12, &size) == false)
+			return fail("The tar file has a header with a bad size");
+		if (paxSize != UINT64_MAX && extension == false)
+			size = paxSize;
+
+		uint64_t padding = (BlockSize - size % BlockSize) % BlockSize;
+
+		if (type == 'L' || type == 'K')
+		{
+			if (readLongName(size, padding, type == 'L' ? &longName : &longLinkName) == false)
+				return false;
+			continue;
+		}
+
+		if (type == 'x')
+		{
+			if (readPaxHeader(size, &paxPath, &paxLinkPath, &paxSize) == false || skip(padding) == false)
+				return false;
+			continue;
+		}
+
+		// hard links are stored with no data, and have a size of 0 whatever the header says
+		bool regular = type == '0' || type == 0 || type == '7';
+		bool hardLink = type == '1';
+		if (hardLink)
+		{
+			size = 0;
+			padding = 0;
+		}
+
+		if (regular == false && hardLink == false)
+		{
+			// Directories are implied by the names, and global pax headers don't matter
+			// to us. Anything else is worth mentioning.
+			if (type != '5' && type != 'g')
+				m_numSkipped++;
+
+			if (skip(size + padding) == false)
+				return false;
+
+			longName.clear();
+			longLinkName.clear();
+			paxPath.clear();
+			paxLinkPath.clear();
+			paxSize = UINT64_MAX;
+			continue;
+		}
+
+		std::string name;
+		if (paxPath.empty() == false)
+			name = paxPath;
+		else if (longName.empty() == false)
+			name = longName;
+		else
+		{
+			name = getField(block, 100);
+
+			// POSIX ustar splits long names, but GNU tar uses the same space for other things
+			if (memcmp(block + 257, "ustar\0", 6) == 0)
+			{
+				std::string prefix = getField(block + 345, 155);
+				if (prefix.empty() == false)
+					name = prefix + "/" + name;
+			}
+		}
+
+		trimName(&name);
+
+		// really old tars mark directories with a '/' at the end instead of a type
+		if (name.empty() || name.back() == '/')
+		{
+			if (skip(size + padding) == false)
+				return false;
+
+			longName.clear();
+			longLinkName.clear();
+			paxPath.clear();
+			paxLinkPath.clear();
+			paxSize = UINT64_MAX;
+			continue;
+		}
+
+		entry->LinkTarget.clear();
+		if (hardLink)
+		{
+			if (paxLinkPath.empty() == false)
+				entry->LinkTarget = paxLinkPath;
+			else if (longLinkName.empty() == false)
+				entry->LinkTarget = longLinkName;
+			else
+				entry->LinkTarget = getField(block + 157, 100);
+
+			trimName(&entry->LinkTarget);
+		}
+
+		entry->Name.swap(name);
+		entry->Size = size;
+		m_dataLeft = size;
+		m_paddingLeft = padding;
+		return true;
+	}
+}
+
+bool TarReader::Read(void* data, uint64_t size)
+{
+	if (m_error != nullptr)
+		return false;
+	if (size > m_dataLeft)
+		return fail("Tried to read past the end of a file in the tar");
+
+	if (size > 0 && fread(data, 1, (size_t)size, m_file) != size)
+		return fail("The tar file ended in the middle of an entry");
+
+	m_dataLeft -= size;
+	return true;
+}
+
+bool TarReader::skip(uint64_t size)
+{
+	uint8_t buffer[16 * 1024];
+	while (size > 0)
+	{
+		size_t chunk = size < sizeof(buffer) ? (size_t)size : sizeof(buffer);
+		if (fread(buffer, 1, chunk, m_file) != chunk)
+			return fail("The tar file ended in the middle of an entry");
+
+		size -= chunk;
+	}
+
+	return true;
+}
+
+bool TarReader::readLongName(uint64_t size, uint64_t padding, std::string* name)
+{
+	if (size > MaxPaxHeaderSize)
+		return fail("The tar file has a name that's too long");
+
+	m_scratch.resize((size_t)size);
+	if (size > 0 && fread(m_scratch.data(), 1, (size_t)size, m_file) != size)
+		return fail("The tar file ended in the middle of an entry");
+
+	*name = getField(m_scratch.data(), (size_t)size);
+	return skip(padding);
+}
+
+bool TarReader::readPaxHeader(uint64_t size, std::string* path, std::string* linkPath, uint64_t* entrySize)
+{
+	if (size > MaxPaxHeaderSize)
+		return fail("The tar file has a pax header that's too big");
+
+	m_scratch.resize((size_t)size);
+	if (size > 0 && fread(m_scratch.data(), 1, (size_t)size, m_file) != size)
+		return fail("The tar file ended in the middle of an entry");
+
+	// each record is "<length> <key>=<value>\n", where length counts the whole record
+	size_t offset = 0;
+	while (offset < m_scratch.size())
+	{
+		size_t length = 0;
+		size_t i = offset;
+		while (i < m_scratch.size() && m_scratch[i] >= '0' && m_scratch[i] <= '9')
+			length = length * 10 + (m_scratch[i++] - '0');
+
+		if (i >= m_scratch.size() || m_scratch[i] != ' ' || length <= i - offset + 1 || offset + length > m_scratch.size())
+			return fail("The tar file has a damaged pax header");
+
+		const char* record = (const char*)&m_scratch[i + 1];
+		size_t recordLength = offset + length - (i + 1);
+		if (recordLength > 0 && record[recordLength - 1] == '\n')
+			recordLength--;
+
+		const char* equals = (const char*)memchr(record, '=', recordLength);
+		if (equals != nullptr)
+		{
+			std::string key(record, equals - record);
+			std::string value(equals + 1, record + recordLength - (equals + 1));
+
+			if (key == "path")
+				*path = value;
+			else if (key == "linkpath")
+				*linkPath = value;
+			else if (key == "size")
+			{
+				uint64_t result = 0;
+				for (size_t j = 0; j < value.size(); j++)
+				{
+					if (value[j] < '0' || value[j] > '9' || (result >> 59))
+						return fail("The tar file has a pax header with a bad size");
+					result = result * 10 + (value[j] - '0');
+				}
+				*entrySize = result;
+			}
+		}
+
+		offset += length;
+	}
+
+	return true;
+}
+
+bool TarReader::fail(const char* error)
+{
+	if (m_error == nullptr)
+		m_error = error;
+	return false;
+}
@@ -0,0 +1,63 @@
+#ifndef TARREADER_H
+#define TARREADER_H
+
+#include <cstdint>
+#include <cstdio>
+#include <string>
+#include <vector>
+
+struct TarEntry
+{
+	// with any leading "./" or '/' taken off
+	std::string Name;
+	uint64_t Size;
+
+	// For a hard link, the name of the file it's a link to, which came earlier in
+	// the tar. Otherwise empty. Hard links don't have any data of their own.
+	std::string LinkTarget;
+};
+
+// Reads the regular files out of a tar stream, front to back, without seeking,
+// so it works on a pipe. Knows ustar, the GNU long name entries and the pax
+// path and size records. Directories, symbolic links and devices are skipped.
+class TarReader
+{
+public:
+	TarReader();
+	~TarReader();
+
+	// "-" reads stdin
+	bool Open(const char* path);
+
+	// Moves on to the next regular file, skipping whatever's left of the one before.
+	// Returns false at the end of the archive, or if it's damaged (see Error()).
+	bool Next(TarEntry* entry);
+
+	// Reads the next size bytes of the current file
+	bool Read(void* data, uint64_t size);
+
+	// why Next() or Read() failed, or null if the archive just ended
+	const char* Error() const { return m_error; }
+
+	// how many entries that weren't regular files got skipped
+	uint32_t NumSkipped() const { return m_numSkipped; }
+
+private:
+	bool skip(uint64_t size);
+	bool readLongName(uint64_t size, uint64_t padding, std::string* name);
+	bool readPaxHeader(uint64_t size, std::string* path, std::string* linkPath, uint64_t* entrySize);
+	bool fail(const char* error);
+
+	FILE* m_file;
+	bool m_ownsFile;
+
+	// what's left of the current file and the padding after it
+	uint64_t m_dataLeft;
+	uint64_t m_paddingLeft;
+
+	uint32_t m_numSkipped;
+	const char* m_error;
+	std::vector<uint8_t> m_scratch;
+};
+
+#endif // TARREADER_H
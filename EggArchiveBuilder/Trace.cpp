@@ -0,0 +1,84 @@
+#include "Trace.h"
+#include <cstdio>
+#include <vector>
+#include <mutex>
+#include <chrono>
+#include <thread>
+#include <functional>
+
+namespace
+{
+	struct Event
+	{
+		const char* Name;
+		uint64_t Start;
+		uint64_t Duration;
+		uint64_t Bytes;
+		unsigned int Thread;
+		int Entry;
+	};
+
+	bool g_enabled = false;
+	std::mutex g_lock;
+	std::vector<Event> g_events;
+}
+
+void Trace::Enable()
+{
+	g_enabled = true;
+}
+
+bool Trace::IsEnabled()
+{
+	return g_enabled;
+}
+
+uint64_t Trace::Now()
+{
+	using namespace std::chrono;
+	return (uint64_t)duration_cast<nanoseconds>(steady_clock::now().time_since_epoch()).count();
+}
+
+void Trace::Record(const char* name, uint64_t start, int entry, uint64_t bytes)
+{
+	if (g_enabled == false)
+		return;
+
+	Event e;
+	e.Name = name;
+	e.Start = start;
+	e.Duration = Now() - start;
+	e.Bytes = bytes;
+	e.Thread = (unsigned int)std::hash<std::thread::id>()(std::this_thread::get_id());
+	e.Entry = entry;
+
+	std::lock_guard<std::mutex> lock(g_lock);
+	g_events.push_back(e);
+}
+
+bool Trace::Write(const char* path)
+{
+#ifdef _WIN32
+	FILE* fp;
+	fopen_s(&fp, path, "wb");
+#else
+	FILE* fp = fopen(path, "wb");
+#endif
+	if (fp == nullptr)
+		return false;
+
+	std::lock_guard<std::mutex> lock(g_lock);
+
+	// trace event timestamps are in microseconds
+	fprintf(fp, "{\"traceEvents\":[\n");
+	for (size_t i = 0; i < g_events.size(); i++)
+	{
+		const Event& e = g_events[i];
+		fprintf(fp, "%s{\"name\":\"%s\",\"cat\":\"build\",\"ph\":\"X\",\"ts\":%.3f,\"dur\":%.3f,\"pid\":1,\"tid\":%u,\"args\":{\"entry\":%d,\"bytes\":%llu}}\n",
+			i == 0 ? "" : ",", e.Name, e.Start / 1000.0, e.Duration / 1000.0, e.Thread, e.Entry, (unsigned long long)e.Bytes);
+	}
+	fprintf(fp, "]}\n");
+
+	fclose(fp);
+	return true;
+}
@@ -0,0 +1,24 @@
+#ifndef TRACE_H
+#define TRACE_H
+
+#include <cstdint>
+
+// Records what the builder spends its time on. The output is the same
+// Chrome trace event JSON that egg.h writes when it's built with EGG_PROFILE,
+// so it can be loaded into chrome://tracing or Perfetto.
+class Trace
+{
+public:
+	static void Enable();
+	static bool IsEnabled();
+
+	// nanoseconds since some arbitrary point
+	static uint64_t Now();
+
+	// Records an event that started at start and ends now. name must be a string literal.
+	static void Record(const char* name, uint64_t start, int entry = -1, uint64_t bytes = 0);
+
+	static bool Write(const char* path);
+};
+
+#endif // TRACE_H
@@ -0,0 +1,562 @@
+#include "Verify.h"
+#include "EggReader.h"
+#include "NameTable.h"
+#include "DirectoryIndex.h"
+#include "Hash.h"
+#include "Trace.h"
+#include "lz4.h"
+#include <cstdio>
+#include <cstdint>
+#include <cstdarg>
+#include <cstring>
+#include <string>
+#include <vector>
+#include <map>
+#include <algorithm>
+#include <atomic>
+#include <mutex>
+#include <thread>
+
+#ifndef _WIN32
+#include <strings.h>
+#endif
+
+namespace
+{
+	// Past this many, problems are counted but not printed, since an egg that's
+	// badly damaged would have one for every file.
+	const uint32_t MaxPrintedProblems = 100;
+
+	// LZ4 can't make anything much more than this many times smaller
+	const uint64_t MaxCompressionRatio = 255;
+
+	// A file that isn't in a solid block (along with any other TOC entries that
+	// point at the same data), or a solid block and the files in it
+	struct Piece
+	{
+		EggEntry Entry;
+		int Block;
+		std::vector<uint32_t> Files;
+	};
+
+	// Part of the egg that something takes up, for finding things that overlap
+	struct Range
+	{
+		uint64_t Start;
+		uint64_t Size;
+		std::string What;
+	};
+
+	// Everything that's wrong with the egg, which the worker threads add to as well
+	class Problems
+	{
+	public:
+		Problems()
+		{
+			m_count = 0;
+		}
+
+		void Add(const char* format, ...)
+		{
+			std::lock_guard<std::mutex> lock(m_lock);
+			m_count++;
+			if (m_count > MaxPrintedProblems)
+			{
+				if (m_count == MaxPrintedProblems + 1)
+					printf("(and more, which aren't printed)\n");
+				return;
+			}
+
+			va_list args;
+			va_start(args, format);
+			vprintf(format, args);
+			va_end(args);
+			printf("\n");
+		}
+
+		uint32_t Count()
+		{
+			std::lock_guard<std::mutex> lock(m_lock);
+			return m_count;
+		}
+
+	private:
+		std::mutex m_lock;
+		uint32_t m_count;
+	};
+
+	FILE* openFile(const char* path, const char* mode)
+	{
+#ifdef _WIN32
+		FILE* fp;
+		if (fopen_s(&fp, path, mode) != 0)
+			return nullptr;
+		return fp;
+#else
+		return fopen(path, mode);
+#endif
+	}
+
+	uint32_t readUint32(const uint8_t* p)
+	{
+		uint32_t v;
+		memcpy(&v, p, 4);
+		return v;
+	}
+
+	int compareNames(const char* a, const char* b)
+	{
+#ifdef _WIN32
+		return _stricmp(a, b);
+#else
+		return strcasecmp(a, b);
+#endif
+	}
+
+	// the same layout readGroups() in EggReader.cpp reads, except that here everything that's wrong gets reported
+	void checkGroups(const std::vector<uint8_t>& data, uint32_t numFiles, uint64_t fileSize, Problems* problems)
+	{
+		if (data.size() < 8)
+		{
+			problems->Add("The GRPS section is too small to have anything in it");
+			return;
+		}
+
+		uint32_t numGroups = readUint32(&data[0]);
+		uint32_t numMembers = readUint32(&data[4]);
+		if (8 + (uint64_t)numGroups * 24 + (uint64_t)numMembers * 4 > data.size())
+		{
+			problems->Add("The GRPS section is too small for %u groups of %u files", numGroups, numMembers);
+			return;
+		}
+
+		for (uint32_t i = 0; i < numGroups; i++)
+		{
+			const uint8_t* p = &data[8 + i * 24];
+			uint32_t nameOffset = readUint32(p);
+			uint32_t offset = readUint32(p + 4);
+			uint32_t size = readUint32(p + 8);
+			uint32_t firstMember = readUint32(p + 12);
+			uint32_t count = readUint32(p + 16);
+
+			if (nameOffset >= data.size() || memchr(&data[nameOffset], 0, data.size() - nameOffset) == nullptr)
+				problems->Add("Load group %u's name isn't inside the GRPS section", i);
+			if ((uint64_t)offset + size > fileSize)
+				problems->Add("Load group %u (%u bytes at %u) isn't inside the egg", i, size, offset);
+			if ((uint64_t)firstMember + count > numMembers)
+				problems->Add("Load group %u's files aren't inside the GRPS section", i);
+		}
+
+		const uint8_t* members = &data[8 + numGroups * 24];
+		for (uint32_t i = 0; i < numMembers; i++)
+		{
+			uint32_t file = readUint32(members + i * 4);
+			if (file >= numFiles)
+				problems->Add("A load group has file %u in it, but there are only %u files", file, numFiles);
+		}
+	}
+}
+
+int verify(const char* eggPath)
+{
+	uint64_t startTime = Trace::Now();
+
+	FILE* fp = openFile(eggPath, "rb");
+	if (fp == nullptr)
+	{
+		printf("Unable to open %s\n", eggPath);
+		return -1;
+	}
+
+	fseek(fp, 0, SEEK_END);
+	uint64_t fileSize = (uint64_t)ftell(fp);
+
+	std::vector<uint8_t> header;
+	if (fileSize < 32 || ReadAt(fp, 0, 32, &header) == false || memcmp(header.data(), "EGGA", 4) != 0)
+	{
+		printf("%s isn't an egg\n", eggPath);
+		fclose(fp);
+		return -1;
+	}
+
+	uint16_t version;
+	uint16_t flags;
+	memcpy(&version, &header[4], 2);
+	memcpy(&flags, &header[6], 2);
+	uint32_t numFiles = readUint32(&header[16]);
+	uint32_t filenameOffset = readUint32(&header[20]);
+	uint32_t tocOffset = readUint32(&header[24]);
+	uint32_t sectionTableOffset = readUint32(&header[28]);
+
+	if (version < 1 || version > 3)
+	{
+		printf("%s is version %u, which this builder doesn't know about\n", eggPath, version);
+		fclose(fp);
+		return -1;
+	}
+
+	Problems problems;
+	if ((flags & ~0x03) != 0)
+		problems.Add("The header has flags this builder doesn't know about (0x%x)", flags);
+	if ((flags & 0x01) != 0 && version < 2)
+		problems.Add("The header says there are sections, but version 1 eggs don't have them");
+	if ((flags & 0x02) != 0 && version < 3)
+		problems.Add("The header says the filenames are front coded, but only version 3 eggs can be");
+
+	// The TOC and the filenames have to fit in the file before anything gets allocated for them, since
+	// a damaged header can say there are billions of files.
+	if (tocOffset < 32 || (uint64_t)tocOffset + (uint64_t)numFiles * sizeof(EggEntry) > fileSize)
+	{
+		printf("The TOC (%u files at %u) doesn't fit in %s, which is %llu bytes\n", numFiles, tocOffset, eggPath, (unsigned long long)fileSize);
+		fclose(fp);
+		return -1;
+	}
+
+	if (tocOffset % 8 != 0)
+		problems.Add("The TOC isn't on an 8-byte boundary");
+
+	std::vector<EggEntry> toc(numFiles);
+	if (numFiles > 0 && (fseek(fp, tocOffset, SEEK_SET) != 0 || fread(toc.data(), sizeof(EggEntry), numFiles, fp) != numFiles))
+	{
+		printf("Unable to read the TOC of %s\n", eggPath);
+		fclose(fp);
+		return -1;
+	}
+
+	// every name takes at least 2 bytes, whichever kind of table it's in
+	std::vector<std::string> names;
+	uint64_t namesSize = 0;
+	if (filenameOffset < 32 || (uint64_t)filenameOffset + (uint64_t)numFiles * 2 > fileSize
+		|| ReadNameTable(fp, filenameOffset, numFiles, (flags & 0x02) != 0, &names, &namesSize) == false)
+	{
+		printf("Unable to read the filenames in %s\n", eggPath);
+		fclose(fp);
+		return -1;
+	}
+
+	std::vector<Range> ranges;
+	ranges.push_back({ 0, 32, "the header" });
+	ranges.push_back({ tocOffset, (uint64_t)numFiles * sizeof(EggEntry), "the TOC" });
+	ranges.push_back({ filenameOffset, namesSize, "the filenames" });
+
+	// egg.h binary searches the names, so they have to be in the order strcasecmp() puts them in
+	for (uint32_t i = 0; i < numFiles; i++)
+	{
+		if (names[i].empty())
+			problems.Add("File %u has no name", i);
+
+		if (i > 0)
+		{
+			int r = compareNames(names[i - 1].c_str(), names[i].c_str());
+			if (r > 0)
+				problems.Add("%s comes after %s, but the names should be sorted", names[i].c_str(), names[i - 1].c_str());
+			else if (names[i - 1] == names[i])
+				problems.Add("%s is in the egg twice", names[i].c_str());
+		}
+	}
+
+	std::vector<EggEntry> blocks;
+	std::vector<uint64_t> hashes;
+	std::vector<uint8_t> dirs;
+	bool hasDirs = false;
+	if (flags & 0x01)
+	{
+		std::vector<uint8_t> table;
+		uint32_t numSections = 0;
+		if (ReadAt(fp, sectionTableOffset, 8, &table))
+			numSections = readUint32(table.data());
+
+		if (sectionTableOffset < 32 || (uint64_t)sectionTableOffset + 8 + (uint64_t)numSections * 16 > fileSize
+			|| ReadAt(fp, sectionTableOffset + 8, numSections * 16, &table) == false)
+		{
+			problems.Add("The section table (%u sections at %u) isn't inside the egg", numSections, sectionTableOffset);
+			numSections = 0;
+		}
+		else
+			ranges.push_back({ sectionTableOffset, 8 + (uint64_t)numSections * 16, "the section table" });
+
+		for (uint32_t i = 0; i < numSections; i++)
+		{
+			const uint8_t* section = &table[i * 16];
+			std::string id((const char*)section, 4);
+			uint32_t offset = readUint32(section + 4);
+			uint32_t size = readUint32(section + 8);
+
+			std::vector<uint8_t> data;
+			if (offset < 32 || (uint64_t)offset + size > fileSize || ReadAt(fp, offset, size, &data) == false)
+			{
+				problems.Add("The %s section (%u bytes at %u) isn't inside the egg", id.c_str(), size, offset);
+				continue;
+			}
+
+			ranges.push_back({ offset, size, "the " + id + " section" });
+
+			if (id == "BLKS")
+			{
+				if (size % sizeof(EggEntry) != 0)
+					problems.Add("The BLKS section is %u bytes, which isn't a whole number of blocks", size);
+
+				blocks.resize(size / sizeof(EggEntry));
+				memcpy(blocks.data(), data.data(), blocks.size() * sizeof(EggEntry));
+			}
+			else if (id == "HASH")
+			{
+				if (size != (uint64_t)numFiles * sizeof(uint64_t))
+					problems.Add("The HASH section has %u hashes, but there are %u files", (uint32_t)(size / sizeof(uint64_t)), numFiles);
+				else
+				{
+					hashes.resize(numFiles);
+					memcpy(hashes.data(), data.data(), size);
+				}
+			}
+			else if (id == "GRPS")
+				checkGroups(data, numFiles, fileSize, &problems);
+			else if (id == "DIRS")
+			{
+				dirs.swap(data);
+				hasDirs = true;
+			}
+		}
+	}
+
+	// the directory tree only depends on the names, so the one in the egg should be exactly what they'd build now
+	if (hasDirs)
+	{
+		std::vector<const char*> namePointers(numFiles);
+		for (uint32_t i = 0; i < numFiles; i++)
+			namePointers[i] = names[i].c_str();
+
+		std::vector<uint8_t> expected;
+		BuildDirectoryIndex(namePointers.data(), numFiles, &expected);
+		if (expected != dirs)
+			problems.Add("The DIRS section doesn't match the filenames");
+	}
+
+	// work out what there is to read: every solid block, and every file that isn't in one
+	std::vector<Piece> pieces;
+	std::vector<int> pieceOfBlock(blocks.size(), -1);
+	for (uint32_t i = 0; i < (uint32_t)blocks.size(); i++)
+	{
+		const EggEntry& block = blocks[i];
+		if ((block.Flags & ~0x01u) != 0)
+			problems.Add("Solid block %u has flags this builder doesn't know about (0x%x)", i, block.Flags);
+		if ((block.Flags & 0x01) == 0 && block.CompressedSize != block.UncompressedSize)
+			problems.Add("Solid block %u isn't compressed, but its two sizes are different", i);
+
+		if (block.Offset < 32 || (uint64_t)block.Offset + block.CompressedSize > fileSize)
+			problems.Add("Solid block %u (%u bytes at %u) isn't inside the egg", i, block.CompressedSize, block.Offset);
+		else if ((block.Flags & 0x01) != 0 && (block.UncompressedSize > block.CompressedSize * MaxCompressionRatio || block.UncompressedSize > LZ4_MAX_INPUT_SIZE))
+			problems.Add("Solid block %u says it decompresses to %u bytes, which %u bytes of LZ4 can't", i, block.UncompressedSize, block.CompressedSize);
+		else
+		{
+			Piece piece;
+			piece.Entry = block;
+			piece.Block = (int)i;
+			pieceOfBlock[i] = (int)pieces.size();
+			pieces.push_back(piece);
+		}
+	}
+
+	// TOC entries that point at exactly the same data (which repack and hard links do) share a piece
+	std::map<std::pair<uint64_t, uint32_t>, size_t> pieceAt;
+	for (uint32_t i = 0; i < numFiles; i++)
+	{
+		const EggEntry& entry = toc[i];
+		const char* name = names[i].c_str();
+
+		if (entry.Flags & 0x02)
+		{
+			uint32_t block = entry.Flags >> 8;
+			if ((entry.Flags & 0xff) != 0x02)
+				problems.Add("%s has flags this builder doesn't know about (0x%x)", name, entry.Flags);
+			if (entry.CompressedSize != 0)
+				problems.Add("%s is in a solid block, but has a compressed size of its own", name);
+
+			if (block >= blocks.size())
+				problems.Add("%s is in solid block %u, but there are only %u", name, block, (uint32_t)blocks.size());
+			else if ((uint64_t)entry.Offset + entry.UncompressedSize > blocks[block].UncompressedSize)
+				problems.Add("%s (%u bytes at %u) isn't inside solid block %u", name, entry.UncompressedSize, entry.Offset, block);
+			else if (pieceOfBlock[block] >= 0)
+				pieces[pieceOfBlock[block]].Files.push_back(i);
+
+			continue;
+		}
+
+		if ((entry.Flags & ~0x01u) != 0)
+			problems.Add("%s has flags this builder doesn't know about (0x%x)", name, entry.Flags);
+		if ((entry.Flags & 0x01) == 0 && entry.CompressedSize != entry.UncompressedSize)
+			problems.Add("%s isn't compressed, but its two sizes are different", name);
+
+		if (entry.Offset < 32 || (uint64_t)entry.Offset + entry.CompressedSize > fileSize)
+		{
+			problems.Add("%s (%u bytes at %u) isn't inside the egg", name, entry.CompressedSize, entry.Offset);
+			continue;
+		}
+
+		if ((entry.Flags & 0x01) != 0 && (entry.UncompressedSize > entry.CompressedSize * MaxCompressionRatio || entry.UncompressedSize > LZ4_MAX_INPUT_SIZE))
+		{
+			problems.Add("%s says it decompresses to %u bytes, which %u bytes of LZ4 can't", name, entry.UncompressedSize, entry.CompressedSize);
+			continue;
+		}
+
+		auto key = std::make_pair(((uint64_t)entry.Offset << 32) | entry.CompressedSize, entry.Flags);
+		auto it = pieceAt.find(key);
+		if (it == pieceAt.end())
+		{
+			Piece piece;
+			piece.Entry = entry;
+			piece.Block = -1;
+			it = pieceAt.insert(std::make_pair(key, pieces.size())).first;
+			pieces.push_back(piece);
+		}
+
+		pieces[it->second].Files.push_back(i);
+	}
+
+	// nothing should share any part of the egg with anything else, except for TOC entries that share all of it
+	for (size_t i = 0; i < pieces.size(); i++)
+	{
+		const Piece& piece = pieces[i];
+		std::string what;
+		if (piece.Block >= 0)
+			what = "solid block " + std::to_string(piece.Block);
+		else
+			what = names[piece.Files[0]];
+
+		ranges.push_back({ piece.Entry.Offset, piece.Entry.CompressedSize, what });
+	}
+
+	std::sort(ranges.begin(), ranges.end(), [](const Range& a, const Range& b)
+	{
+		return a.Start != b.Start ? a.Start < b.Start : a.Size < b.Size;
+	});
+
+	uint64_t end = 0;
+	size_t furthest = 0;
+	for (size_t i = 0; i < ranges.size(); i++)
+	{
+		if (ranges[i].Size == 0)
+			continue;
+
+		if (ranges[i].Start < end)
+			problems.Add("%s overlaps %s", ranges[i].What.c_str(), ranges[furthest].What.c_str());
+
+		if (ranges[i].Start + ranges[i].Size > end)
+		{
+			end = ranges[i].Start + ranges[i].Size;
+			furthest = i;
+		}
+	}
+
+	fclose(fp);
+
+	// The pieces are read from front to back, so the disk sees one pass over the egg, and each thread
+	// takes the next one as soon as it's done with the last. Files that are stored uncompressed only
+	// need reading if there's a hash to check them against.
+	std::sort(pieces.begin(), pieces.end(), [](const Piece& a, const Piece& b) { return a.Entry.Offset < b.Entry.Offset; });
+
+	bool checkHashes = hashes.size() == numFiles;
+	std::atomic<size_t> nextPiece(0);
+	std::atomic<uint64_t> bytesRead(0);
+	std::atomic<uint64_t> bytesDecompressed(0);
+
+	auto worker = [&]()
+	{
+		FILE* file = openFile(eggPath, "rb");
+		if (file == nullptr)
+		{
+			problems.Add("Unable to open %s", eggPath);
+			return;
+		}
+
+		std::vector<uint8_t> stored, contents;
+		for (size_t i = nextPiece++; i < pieces.size(); i = nextPiece++)
+		{
+			const Piece& piece = pieces[i];
+			const char* what = piece.Block >= 0 ? "A solid block" : names[piece.Files[0]].c_str();
+			bool compressed = (piece.Entry.Flags & 0x01) != 0;
+			if (compressed == false && checkHashes == false)
+				continue;
+
+			uint64_t readStart = Trace::Now();
+			if (ReadAt(file, piece.Entry.Offset, piece.Entry.CompressedSize, &stored) == false)
+			{
+				problems.Add("Unable to read %s", what);
+				continue;
+			}
+			Trace::Record("read", readStart, piece.Block >= 0 ? -1 : (int)piece.Files[0], piece.Entry.CompressedSize);
+			bytesRead += piece.Entry.CompressedSize;
+
+			const uint8_t* data = stored.data();
+			if (compressed)
+			{
+				uint64_t decompressStart = Trace::Now();
+				contents.resize(piece.Entry.UncompressedSize);
+				int r = LZ4_decompress_safe((const char*)stored.data(), (char*)contents.data(), (int)piece.Entry.CompressedSize, (int)piece.Entry.UncompressedSize);
+				Trace::Record("decompress", decompressStart, piece.Block >= 0 ? -1 : (int)piece.Files[0], piece.Entry.UncompressedSize);
+
+				if (r < 0)
+				{
+					if (piece.Block >= 0)
+						problems.Add("Solid block %d is damaged. It doesn't decompress.", piece.Block);
+					else
+						problems.Add("%s is damaged. It doesn't decompress.", what);
+					continue;
+				}
+
+				if (r != (int)piece.Entry.UncompressedSize)
+				{
+					if (piece.Block >= 0)
+						problems.Add("Solid block %d decompresses to %d bytes instead of %u", piece.Block, r, piece.Entry.UncompressedSize);
+					else
+						problems.Add("%s decompresses to %d bytes instead of %u", what, r, piece.Entry.UncompressedSize);
+					continue;
+				}
+
+				bytesDecompressed += piece.Entry.UncompressedSize;
+				data = contents.data();
+			}
+
+			if (checkHashes == false)
+				continue;
+
+			for (size_t j = 0; j < piece.Files.size(); j++)
+			{
+				uint32_t index = piece.Files[j];
+				const EggEntry& entry = toc[index];
+				const uint8_t* start = piece.Block >= 0 ? data + entry.Offset : data;
+				if (Hasher::Hash(start, entry.UncompressedSize) != hashes[index])
+					problems.Add("%s doesn't match its hash", names[index].c_str());
+			}
+		}
+
+		fclose(file);
+	};
+
+	unsigned int numThreads = std::max(1u, std::thread::hardware_concurrency());
+	std::vector<std::thread> threads;
+	for (unsigned int i = 0; i < numThreads; i++)
+		threads.push_back(std::thread(worker));
+	for (size_t i = 0; i < threads.size(); i++)
+		threads[i].join();
+
+	double seconds = (Trace::Now() - startTime) / 1e9;
+	double megabytesRead = bytesRead / (1024.0 * 1024.0);
+	double megabytesDecompressed = bytesDecompressed / (1024.0 * 1024.0);
+	printf("Checked %s (%u files, %u solid blocks) in %.2f seconds on %u thread%s: read %.1f MB (%.1f MB/s), decompressed %.1f MB (%.1f MB/s)\n",
+		eggPath, numFiles, (uint32_t)blocks.size(), seconds, numThreads, numThreads == 1 ? "" : "s",
+		megabytesRead, seconds > 0 ? megabytesRead / seconds : 0.0, megabytesDecompressed, seconds > 0 ? megabytesDecompressed / seconds : 0.0);
+
+	if (checkHashes == false)
+		printf("%s has no HASH section, so files that aren't compressed couldn't be checked\n", eggPath);
+
+	uint32_t numProblems = problems.Count();
+	if (numProblems > 0)
+	{
+		printf("%s has %u problem%s\n", eggPath, numProblems, numProblems == 1 ? "" : "s");
+		return -1;
+	}
+
+	printf("%s is fine\n", eggPath);
+	return 0;
+}
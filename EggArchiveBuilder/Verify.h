@@ -0,0 +1,13 @@
+#ifndef VERIFY_H
+#define VERIFY_H
+
+// Checks that an egg is all there and in one piece: the header, the TOC, the
+// filenames and the sections fit in the file and agree with each other, the
+// names are sorted, nothing overlaps anything else, every compressed file and
+// solid block decompresses to the size the TOC says, and every file matches
+// its hash if the egg has a HASH section. The reading and decompressing is
+// spread over every core. Prints each problem it finds and how fast it went,
+// and returns non-zero if there were any.
+int verify(const char* eggPath);
+
+#endif // VERIFY_H
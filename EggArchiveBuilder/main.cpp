@@ -4,8 +4,28 @@
 #include <cstdint>
 #include <cstdlib>
 #include <cstring>
+#include <cctype>
+#include <algorithm>
+#include <map>
+#include <thread>
+#include <atomic>
+#include <string>
+#include <deque>
+#include <unordered_map>
 #include "lz4.h"
 #include "lz4hc.h"
+#include "InputReader.h"
+#include "Trace.h"
+#include "CompressionCache.h"
+#include "Hash.h"
+#include "Patch.h"
+#include "Verify.h"
+#include "DirectoryIndex.h"
+#include "NameTable.h"
+#include "OutputFile.h"
+#include "CompressionQueue.h"
+#include "TarReader.h"
+#include "EggReader.h"
 
 #ifdef _WIN32
 #define WIN32_LEAN_AND_MEAN
@@ -14,8 +34,7 @@
 #undef CopyFile
 #undef GetCurrentTime
 #else
-//#error Not supported yet!
-
+#include <sys/time.h>
 #endif
 
 typedef uint8_t uint8;
@@ -30,62 +49,335 @@ struct FileInfo
 	uint32 Offset;
 	uint32 UncompressedSize;
 	uint32 CompressedSize;
+	uint32 Flags;
+
+	// of the uncompressed contents, for the HASH section
+	uint64 Hash;
 };
 
-const uint32 OffsetOfFilenameOffset = 20;
-const uint32 OffsetOfTOCOffset = 24;
+// Where a solid block is and how big it is. Written out the same way as a TOC entry.
+struct BlockInfo
+{
+	uint32 Offset;
+	uint32 CompressedSize;
+	uint32 UncompressedSize;
+	uint32 Flags;
+};
 
-bool CopyFile(FILE* output, const char* input, uint32* uncompressedSize, uint32* compressedSize)
+// Small files waiting to be compressed together into a solid block
+struct PendingBlock
 {
-#ifdef _WIN32
-	FILE* fp;
-	fopen_s(&fp, input, "rb");
-#else
-	FILE* fp = fopen(input, "rb");
-#endif
-	if (fp == nullptr)
+	std::vector<uint8> Data;
+	std::vector<uint32> Files;
+};
+
+// A set of files that get loaded together (like everything a level needs), from a --groups manifest
+struct LoadGroup
+{
+	std::string Name;
+
+	// every file in the group, by input index
+	std::vector<uint32> Files;
+
+	// The inputs that get laid out with this group, which are the group's files that weren't
+	// in an earlier group. The inputs get put in order so these come one after another.
+	uint32 FirstPlaced;
+	uint32 NumPlaced;
+};
+
+// Extra data that goes after the filenames in version 2 archives, found through the section table
+struct Section
+{
+	char Id[4];
+	std::vector<uint8> Data;
+};
+
+struct BuildOptions
+{
+	// where to write a Chrome trace of the build, or null
+	const char* TracePath;
+
+	// Files smaller than a quarter of this are packed together into solid blocks
+	// of about this size, which get compressed as one. 0 turns that off.
+	uint32 SolidBlockSize;
+
+	// put files from the same directory in blocks together, instead of files with the same extension
+	bool SolidByDirectory;
+
+	// load groups, or null. See ReadGroups().
+	const std::vector<LoadGroup>* Groups;
+
+	// where compressed files are kept between builds, or null
+	const char* CacheDirectory;
+
+	// how big the cache is allowed to get
+	uint64 CacheSize;
+
+	// write the filenames front coded (see NameTable.h), which needs a version 3 reader
+	bool FrontCodedNames;
+};
+
+// What repack compresses again
+enum RecompressPolicy
+{
+	// copies everything over as it is
+	RecompressNone,
+
+	// compresses files and blocks that are stored uncompressed (files only if they're big enough to be worth it)
+	RecompressStored,
+
+	// decompresses everything and compresses it again
+	RecompressAll
+};
+
+struct RepackOptions
+{
+	// Only --trace, --cache, --cache-size and --front-coded-names mean anything here.
+	// The new egg's filenames are front coded if the old egg's were, either way.
+	BuildOptions Build;
+
+	RecompressPolicy Recompress;
+
+	// a trace from egg.h or a list of filenames that says what order to lay the files out in, or null
+	const char* OrderPath;
+
+	// Files and blocks at least this big start on a multiple of it. A power of two, 8 or more.
+	uint32 Alignment;
+
+	// leave files with the same contents as copies of their own
+	bool KeepDuplicates;
+};
+
+// what's at the start of every egg
+struct EggHeader
+{
+	char Magic[4];
+	uint16 Version;
+	uint16 Flags;
+	uint64 Time;
+	uint32 NumFiles;
+	uint32 OffsetOfFilenames;
+	uint32 OffsetOfTOC;
+	uint32 OffsetOfSections;
+};
+
+static_assert(sizeof(EggHeader) == 32, "EggHeader has unexpected size");
+
+// the most blocks there can be, since the index has to fit in the top 24 bits of the flags
+const uint32 MaxBlocks = 1 << 24;
+
+// how big the compression cache gets if --cache-size doesn't say
+const uint64 DefaultCacheSize = 1024ull * 1024 * 1024;
+
+// the biggest --align repack takes
+const uint32 MaxAlignment = 1024 * 1024;
+
+// files smaller than this aren't worth compressing on their own
+const uint32 MinCompressedFileSize = 1024 * 10;
+
+// how much of its input from-tar (or repack) holds on to while it's waiting to be compressed and written
+const uint64 MaxBytesInFlight = 256ull * 1024 * 1024;
+
+// how much from-tar lets sit in partly filled solid blocks before it writes them all out anyway
+const uint64 MaxBytesInPendingBlocks = 64ull * 1024 * 1024;
+
+// Compresses with LZ4 HC, going through the cache if there is one
+int Compress(CompressionCache* cache, const uint8* data, uint32 size, uint8* output, uint32 outputSize)
+{
+	// a block of nothing but empty files has no data at all, and LZ4 HC doesn't take a null input
+	if (size == 0)
+		return 0;
+
+	if (cache != nullptr)
+		return cache->Compress(data, size, output, outputSize, 0);
+
+	return LZ4_compress_HC((const char*)data, (char*)output, size, outputSize, 0);
+}
+
+// Whether compressing made enough of a difference to keep the compressed version
+bool WorthCompressing(uint32 size, int compressedSize)
+{
+	return compressedSize > 0 && (uint32)compressedSize <= size * 3 / 4;
+}
+
+bool CopyFile(OutputFile* output, InputFile* input, uint32 index, CompressionCache* cache, uint32* uncompressedSize, uint32* compressedSize)
+{
+	if (input->Error != 0)
 	{
-		printf("Unable to open %s", input);
+		printf("Unable to open %s: %s\n", input->Path, strerror(input->Error));
 		return false;
 	}
 
-	// get the total size
-	fseek(fp, 0, SEEK_END);
-	uint32 size = (uint32)ftell(fp);
-	fseek(fp, 0, SEEK_SET);
-
-	// allocate a buffer
-	uint8* fileBuffer = new uint8[size];
-	if (fread(fileBuffer, 1, size, fp) != size)
-		return false;
+	uint8* fileBuffer = input->Data;
+	uint32 size = input->Size;
 
 	// attempt to compress it
 	uint32 compressedBufferSize = LZ4_compressBound(size);
 	uint8* compressedBuffer = new uint8[compressedBufferSize];
-	int r = LZ4_compress_HC((char*)fileBuffer, (char*)compressedBuffer, size, compressedBufferSize, 0);
-	if (true || r <= 0 || r > size * 3 / 4 || size < 1024 * 10)
+	uint64 compressStart = Trace::Now();
+	int r = size >= MinCompressedFileSize ? Compress(cache, fileBuffer, size, compressedBuffer, compressedBufferSize) : 0;
+	Trace::Record("compress", compressStart, index, size);
+
+	uint64 writeStart = Trace::Now();
+	if (WorthCompressing(size, r) == false)
 	{
 		// compression didn't work or it wasn't worth it
-		fwrite(fileBuffer, 1, size, output);
+		output->Write(fileBuffer, size);
 		*compressedSize = size;
 	}
 	else
 	{
 		// write the compressed version
-		fwrite(compressedBuffer, 1, r, output);
+		output->Write(compressedBuffer, r);
 		*compressedSize = r;
 	}
-
-	fclose(fp);
+	Trace::Record("write", writeStart, index, *compressedSize);
 
 	*uncompressedSize = size;
 
-	delete[] fileBuffer;
 	delete[] compressedBuffer;
 
 	return true;
 }
 
+// Keeps everything in the index aligned to 8 bytes. start is where in the egg data begins.
+void AppendPadding(std::vector<uint8>* data, uint32 start)
+{
+	uint32 padding = (8 - ((start + (uint32)data->size()) % 8)) % 8;
+	data->insert(data->end(), padding, 0);
+}
+
+// Writes out a solid block that's been through the compressor (r is what that returned),
+// then points the files at the block.
+void AddBlock(OutputFile* output, const uint8* data, uint32 size, const uint8* compressed, int r, const std::vector<uint32>& members, FileInfo* files, std::vector<BlockInfo>* blocks)
+{
+	BlockInfo block;
+	block.Offset = (uint32)output->Tell();
+	block.UncompressedSize = size;
+
+	uint64 writeStart = Trace::Now();
+	if (WorthCompressing(size, r) == false)
+	{
+		output->Write(data, size);
+		block.CompressedSize = size;
+		block.Flags = 0;
+	}
+	else
+	{
+		output->Write(compressed, r);
+		block.CompressedSize = r;
+		block.Flags = 0x01;
+	}
+	Trace::Record("write block", writeStart, -1, block.CompressedSize);
+
+	output->Pad();
+
+	// 0x02 means the file's in a block, and the rest of the flags say which one
+	uint32 flags = 0x02 | ((uint32)blocks->size() << 8);
+	for (size_t i = 0; i < members.size(); i++)
+		files[members[i]].Flags = flags;
+
+	printf("Added a solid block of %u files (%u bytes compressed to %u)\n", (uint32)members.size(), block.UncompressedSize, block.CompressedSize);
+
+	blocks->push_back(block);
+}
+
+// Compresses the files in a solid block together and writes them out
+void WriteBlock(OutputFile* output, PendingBlock* pending, CompressionCache* cache, FileInfo* files, std::vector<BlockInfo>* blocks)
+{
+	uint32 size = (uint32)pending->Data.size();
+	uint32 compressedBufferSize = LZ4_compressBound(size);
+	uint8* compressedBuffer = new uint8[compressedBufferSize];
+	uint64 compressStart = Trace::Now();
+	int r = Compress(cache, pending->Data.data(), size, compressedBuffer, compressedBufferSize);
+	Trace::Record("compress block", compressStart, -1, size);
+
+	AddBlock(output, pending->Data.data(), size, compressedBuffer, r, pending->Files, files, blocks);
+
+	delete[] compressedBuffer;
+	pending->Data.clear();
+	pending->Files.clear();
+}
+
+// Writes out every block that's still waiting. Returns false if there are too many blocks.
+bool FlushBlocks(OutputFile* output, std::map<std::string, PendingBlock>* pendingBlocks, CompressionCache* cache, FileInfo* files, std::vector<BlockInfo>* blocks)
+{
+	for (auto it = pendingBlocks->begin(); it != pendingBlocks->end(); ++it)
+	{
+		if (it->second.Files.empty())
+			continue;
+
+		if (blocks->size() == MaxBlocks)
+		{
+			printf("Too many solid blocks. Try a bigger block size.\n");
+			return false;
+		}
+
+		WriteBlock(output, &it->second, cache, files, blocks);
+	}
+
+	return true;
+}
+
+void AppendUint32(std::vector<uint8>* data, uint32 value)
+{
+	uint8 bytes[4];
+	memcpy(bytes, &value, 4);
+	data->insert(data->end(), bytes, bytes + 4);
+}
+
+// Small files with the same extension (or in the same directory) share solid blocks,
+// since they're the ones that are most likely to look like each other
+std::string GetSolidGroup(const char* name, bool byDirectory)
+{
+	const char* slash = strrchr(name, '/');
+	const char* backslash = strrchr(name, '\\');
+	if (backslash != nullptr && (slash == nullptr || backslash > slash))
+		slash = backslash;
+
+	if (byDirectory)
+		return std::string(name, slash != nullptr ? slash - name : 0);
+
+	const char* dot = strrchr(slash != nullptr ? slash + 1 : name, '.');
+	std::string extension = dot != nullptr ? dot + 1 : "";
+	for (size_t i = 0; i < extension.size(); i++)
+	{
+		if (extension[i] >= 'A' && extension[i] <= 'Z')
+			extension[i] += 'a' - 'A';
+	}
+
+	return extension;
+}
+
+// Adds each section and then the table that says where they are to the index, which starts
+// at start in the egg. Returns where the table starts.
+uint32 AppendSections(std::vector<uint8>* index, uint32 start, const std::vector<Section>& sections)
+{
+	std::vector<uint32> offsets;
+	for (size_t i = 0; i < sections.size(); i++)
+	{
+		AppendPadding(index, start);
+		offsets.push_back(start + (uint32)index->size());
+		index->insert(index->end(), sections[i].Data.begin(), sections[i].Data.end());
+	}
+
+	AppendPadding(index, start);
+	uint32 offsetOfTable = start + (uint32)index->size();
+
+	AppendUint32(index, (uint32)sections.size());
+	AppendUint32(index, 0);
+
+	for (size_t i = 0; i < sections.size(); i++)
+	{
+		index->insert(index->end(), sections[i].Id, sections[i].Id + 4);
+		AppendUint32(index, offsets[i]);
+		AppendUint32(index, (uint32)sections[i].Data.size());
+		AppendUint32(index, 0);
+	}
+
+	return offsetOfTable;
+}
+
 uint64 GetCurrentTime()
 {
 #ifdef _WIN32
@@ -97,148 +389,1566 @@ uint64 GetCurrentTime()
 	uint64 result;
 	memcpy(&result, &time, sizeof(uint64));
 
-	return result;
-#else
-	assert(false && "Not supported yet");
-#endif
-}
+	return result;
+#else
+	// convert to a FILETIME (100 nanosecond intervals since January 1, 1601)
+	const uint64 secondsFrom1601To1970 = 11644473600ULL;
+
+	timeval now;
+	gettimeofday(&now, nullptr);
+
+	return ((uint64)now.tv_sec + secondsFrom1601To1970) * 10000000ULL + (uint64)now.tv_usec * 10;
+#endif
+}
+
+// One file's place in SortByName(). The first 8 bytes of its case-folded name are packed into Prefix, most
+// significant byte first, so comparing prefixes compares the first 8 characters all at once.
+struct SortKey
+{
+	uint64 Prefix;
+	uint32 Offset;
+	uint32 File;
+};
+
+// Only the first 8 bytes decide anything. Ties go to the rest of the name, and then to
+// the input order, so files whose names only differ by case come out in a fixed order.
+bool CompareSortKeys(const SortKey& a, const SortKey& b, const char* keys)
+{
+	if (a.Prefix != b.Prefix)
+		return a.Prefix < b.Prefix;
+
+	// the prefixes included the terminator, so the names are the same
+	if ((uint8)a.Prefix == 0)
+		return a.File < b.File;
+
+	int r = strcmp(keys + a.Offset + 8, keys + b.Offset + 8);
+	if (r != 0)
+		return r < 0;
+
+	return a.File < b.File;
+}
+
+// Sorts the files into the same order strcasecmp() would put them in (which is the order egg.h
+// searches them in), without folding the case again on every comparison. Every name gets folded
+// once into one buffer. The files are spread into buckets by their first two characters, and then
+// the buckets are sorted on as many threads as there are cores.
+void SortByName(FileInfo* files, uint32 numFiles)
+{
+	std::vector<char> keys;
+	std::vector<SortKey> unsorted(numFiles);
+	for (uint32 i = 0; i < numFiles; i++)
+	{
+		unsorted[i].Offset = (uint32)keys.size();
+		unsorted[i].File = i;
+
+		for (const char* c = files[i].Name; ; c++)
+		{
+			char folded = *c >= 'A' && *c <= 'Z' ? *c + ('a' - 'A') : *c;
+			keys.push_back(folded);
+			if (folded == 0)
+				break;
+		}
+	}
+
+	// room for the prefixes of short names to read past their ends
+	keys.resize(keys.size() + 8, 0);
+
+	const uint32 numBuckets = 1 << 16;
+	std::vector<uint32> bucketStarts(numBuckets + 1, 0);
+	for (uint32 i = 0; i < numFiles; i++)
+	{
+		const uint8* key = (const uint8*)&keys[unsorted[i].Offset];
+
+		// everything after the terminator is zeroed, so other names don't leak into the prefix
+		uint64 prefix = 0;
+		bool ended = false;
+		for (int j = 0; j < 8; j++)
+		{
+			ended = ended || key[j] == 0;
+			prefix = (prefix << 8) | (ended ? 0 : key[j]);
+		}
+		unsorted[i].Prefix = prefix;
+
+		bucketStarts[(prefix >> 48) + 1]++;
+	}
+
+	for (uint32 i = 0; i < numBuckets; i++)
+		bucketStarts[i + 1] += bucketStarts[i];
+
+	std::vector<SortKey> sorted(numFiles);
+	{
+		std::vector<uint32> next(bucketStarts.begin(), bucketStarts.end() - 1);
+		for (uint32 i = 0; i < numFiles; i++)
+			sorted[next[unsorted[i].Prefix >> 48]++] = unsorted[i];
+	}
+
+	const char* keyData = keys.data();
+	std::atomic<uint32> nextBucket(0);
+	auto sortBuckets = [&]()
+	{
+		for (uint32 bucket = nextBucket++; bucket < numBuckets; bucket = nextBucket++)
+		{
+			if (bucketStarts[bucket + 1] - bucketStarts[bucket] > 1)
+			{
+				std::sort(sorted.begin() + bucketStarts[bucket], sorted.begin() + bucketStarts[bucket + 1],
+					[keyData](const SortKey& a, const SortKey& b) { return CompareSortKeys(a, b, keyData); });
+			}
+		}
+	};
+
+	// not worth starting threads for a handful of files
+	std::vector<std::thread> threads;
+	unsigned int numThreads = numFiles >= 64 * 1024 ? std::thread::hardware_concurrency() : 1;
+	for (unsigned int i = 1; i < numThreads; i++)
+		threads.push_back(std::thread(sortBuckets));
+	sortBuckets();
+	for (size_t i = 0; i < threads.size(); i++)
+		threads[i].join();
+
+	std::vector<FileInfo> original(files, files + numFiles);
+	for (uint32 i = 0; i < numFiles; i++)
+		files[i] = original[sorted[i].File];
+}
+
+// Reads a list of input files, one per line. Handy when there are too many to fit on the command line.
+bool ReadInputList(const char* path, std::vector<const char*>* inputs)
+{
+#ifdef _WIN32
+	FILE* fp;
+	fopen_s(&fp, path, "rb");
+#else
+	FILE* fp = fopen(path, "rb");
+#endif
+	if (fp == nullptr)
+	{
+		printf("Unable to open %s\n", path);
+		return false;
+	}
+
+	fseek(fp, 0, SEEK_END);
+	long size = ftell(fp);
+	fseek(fp, 0, SEEK_SET);
+
+	// the filenames point into this buffer, so it has to stick around until we're done
+	char* list = new char[size + 1];
+	size_t bytesRead = fread(list, 1, size, fp);
+	list[bytesRead] = 0;
+	fclose(fp);
+
+	char* cursor = list;
+	while (*cursor != 0)
+	{
+		char* line = cursor;
+		while (*cursor != 0 && *cursor != '\n' && *cursor != '\r')
+			cursor++;
+		while (*cursor == '\n' || *cursor == '\r')
+			*cursor++ = 0;
+
+		if (*line != 0)
+			inputs->push_back(line);
+	}
+
+	return true;
+}
+
+// Reads a manifest of load groups and puts the inputs in order so each group's files are next to
+// each other. A line like [name] starts a group, and the lines after it are the files in it.
+bool ReadGroups(const char* path, std::vector<const char*>* inputs, std::vector<LoadGroup>* groups)
+{
+	std::vector<const char*> lines;
+	if (ReadInputList(path, &lines) == false)
+		return false;
+
+	// the archive doesn't care about case, so neither does the manifest
+	std::map<std::string, uint32> byName;
+	for (uint32 i = 0; i < inputs->size(); i++)
+	{
+		std::string name = (*inputs)[i];
+		for (size_t j = 0; j < name.size(); j++)
+			name[j] = (char)tolower((unsigned char)name[j]);
+		byName.insert(std::make_pair(name, i));
+	}
+
+	std::vector<uint32> order;
+	std::vector<bool> placed(inputs->size(), false);
+	for (size_t i = 0; i < lines.size(); i++)
+	{
+		const char* line = lines[i];
+		size_t length = strlen(line);
+		if (line[0] == '[' && line[length - 1] == ']')
+		{
+			LoadGroup group;
+			group.Name.assign(line + 1, length - 2);
+			group.FirstPlaced = (uint32)order.size();
+			group.NumPlaced = 0;
+			groups->push_back(group);
+			continue;
+		}
+
+		if (groups->empty())
+		{
+			printf("%s doesn't start with a [group name]\n", path);
+			return false;
+		}
+
+		std::string name = line;
+		for (size_t j = 0; j < name.size(); j++)
+			name[j] = (char)tolower((unsigned char)name[j]);
+
+		auto input = byName.find(name);
+		if (input == byName.end())
+		{
+			printf("%s is in group %s but it isn't one of the inputs\n", line, groups->back().Name.c_str());
+			continue;
+		}
+
+		groups->back().Files.push_back(input->second);
+		if (placed[input->second] == false)
+		{
+			placed[input->second] = true;
+			order.push_back(input->second);
+			groups->back().NumPlaced++;
+		}
+	}
+
+	// everything that isn't in a group goes after the groups
+	for (uint32 i = 0; i < inputs->size(); i++)
+	{
+		if (placed[i] == false)
+			order.push_back(i);
+	}
+
+	std::vector<const char*> ordered(inputs->size());
+	std::vector<uint32> newIndex(inputs->size());
+	for (uint32 i = 0; i < order.size(); i++)
+	{
+		ordered[i] = (*inputs)[order[i]];
+		newIndex[order[i]] = i;
+	}
+	inputs->swap(ordered);
+
+	for (size_t i = 0; i < groups->size(); i++)
+	{
+		std::vector<uint32>& files = (*groups)[i].Files;
+		for (size_t j = 0; j < files.size(); j++)
+			files[j] = newIndex[files[j]];
+	}
+
+	return true;
+}
+
+// Sorts the files and writes everything that goes after them: the TOC, the filenames, the sections and the
+// section table, all put together in memory and written in one go. Then it goes back to finish the header
+// and closes the egg.
+bool FinishEgg(OutputFile* out, EggHeader* header, const char* output, FileInfo* files, uint32 numFiles, const std::vector<BlockInfo>& blocks,
+	const std::vector<std::pair<uint32, uint32> >& groupSpans, const BuildOptions& options)
+{
+	// alphabetize the filenames
+	uint64 sortStart = Trace::Now();
+	SortByName(files, numFiles);
+	Trace::Record("sort", sortStart);
+
+	// the index starts right after the files
+	std::vector<uint8> index;
+	uint32 offsetOfIndex = (uint32)out->Tell();
+	assert(offsetOfIndex % 8 == 0);
+
+	std::vector<const char*> names(numFiles);
+	size_t totalNameLength = 0;
+	for (uint32 i = 0; i < numFiles; i++)
+	{
+		names[i] = files[i].Name;
+		totalNameLength += strlen(files[i].Name) + 2;
+	}
+	index.reserve(numFiles * (16 + sizeof(uint64)) + totalNameLength * 2);
+
+	// table of contents
+	uint64 tocStart = Trace::Now();
+	uint32 offsetOfTOC = offsetOfIndex;
+	for (uint32 i = 0; i < numFiles; i++)
+	{
+		AppendUint32(&index, files[i].Offset);
+		AppendUint32(&index, files[i].CompressedSize);
+		AppendUint32(&index, files[i].UncompressedSize);
+		AppendUint32(&index, files[i].Flags);
+	}
+
+	Trace::Record("toc", tocStart, -1, numFiles * 16);
+
+	// filenames
+	uint64 namesStart = Trace::Now();
+	uint32 offsetOfFilenames = offsetOfIndex + (uint32)index.size();
+	assert(offsetOfFilenames % 8 == 0);
+	if (WriteNameTable(&index, names.data(), numFiles, options.FrontCodedNames) == false)
+	{
+		printf("Unable to write the filenames. Names can't be longer than 255 characters.\n");
+		return false;
+	}
+
+	Trace::Record("names", namesStart, -1, offsetOfIndex + (uint32)index.size() - offsetOfFilenames);
+
+	std::vector<Section> sections;
+	if (blocks.empty() == false)
+	{
+		Section section = { { 'B', 'L', 'K', 'S' } };
+		section.Data.resize(blocks.size() * sizeof(BlockInfo));
+		memcpy(section.Data.data(), blocks.data(), section.Data.size());
+		sections.push_back(section);
+	}
+
+	uint32 numGroups = (uint32)groupSpans.size();
+	if (numGroups > 0)
+	{
+		// the files are sorted now, so the groups need to know where they went
+		std::vector<uint32> sortedIndex(numFiles);
+		for (uint32 i = 0; i < numFiles; i++)
+			sortedIndex[files[i].Index] = i;
+
+		uint32 numMembers = 0;
+		for (uint32 i = 0; i < numGroups; i++)
+			numMembers += (uint32)(*options.Groups)[i].Files.size();
+
+		// the count of groups and files, then the groups, then their files, then their names
+		Section section = { { 'G', 'R', 'P', 'S' } };
+		AppendUint32(&section.Data, numGroups);
+		AppendUint32(&section.Data, numMembers);
+
+		uint32 nameOffset = 8 + numGroups * 24 + numMembers * 4;
+		uint32 firstMember = 0;
+		for (uint32 i = 0; i < numGroups; i++)
+		{
+			const LoadGroup& group = (*options.Groups)[i];
+			AppendUint32(&section.Data, nameOffset);
+			AppendUint32(&section.Data, groupSpans[i].first);
+			AppendUint32(&section.Data, groupSpans[i].second);
+			AppendUint32(&section.Data, firstMember);
+			AppendUint32(&section.Data, (uint32)group.Files.size());
+			AppendUint32(&section.Data, 0);
+
+			nameOffset += (uint32)group.Name.size() + 1;
+			firstMember += (uint32)group.Files.size();
+		}
+
+		for (uint32 i = 0; i < numGroups; i++)
+		{
+			std::vector<uint32> members;
+			for (size_t j = 0; j < (*options.Groups)[i].Files.size(); j++)
+				members.push_back(sortedIndex[(*options.Groups)[i].Files[j]]);
+			std::sort(members.begin(), members.end());
+
+			for (size_t j = 0; j < members.size(); j++)
+				AppendUint32(&section.Data, members[j]);
+		}
+
+		for (uint32 i = 0; i < numGroups; i++)
+		{
+			const std::string& name = (*options.Groups)[i].Name;
+			section.Data.insert(section.Data.end(), name.c_str(), name.c_str() + name.size() + 1);
+		}
+
+		sections.push_back(section);
+	}
+
+	// a hash of every file's contents, in the same order as the TOC, so diff can tell what changed without reading anything
+	{
+		Section section = { { 'H', 'A', 'S', 'H' } };
+		section.Data.resize(numFiles * sizeof(uint64));
+		for (uint32 i = 0; i < numFiles; i++)
+			memcpy(&section.Data[i * sizeof(uint64)], &files[i].Hash, sizeof(uint64));
+		sections.push_back(section);
+	}
+
+	// the directory tree, so a directory can be listed without looking at every name
+	{
+		Section section = { { 'D', 'I', 'R', 'S' } };
+		BuildDirectoryIndex(names.data(), numFiles, &section.Data);
+		sections.push_back(section);
+	}
+
+	uint32 offsetOfSections = 0;
+	if (sections.empty() == false)
+		offsetOfSections = AppendSections(&index, offsetOfIndex, sections);
+
+	// the whole index in one write, into space that's been set aside for exactly that much
+	uint64 indexStart = Trace::Now();
+	out->Reserve(index.size());
+	out->Write(index.data(), index.size());
+
+	// then go back and finish the header->
+	// Version 2 archives have sections, and flag 0x01 says where the table is.
+	// Version 3 ones can have front coded filenames too, which flag 0x02 says.
+	header->NumFiles = numFiles;
+	header->OffsetOfFilenames = offsetOfFilenames;
+	header->OffsetOfTOC = offsetOfTOC;
+	if (sections.empty() == false)
+	{
+		header->Version = options.FrontCodedNames ? 3 : 2;
+		header->Flags = options.FrontCodedNames ? 0x03 : 0x01;
+		header->OffsetOfSections = offsetOfSections;
+	}
+	out->WriteAt(0, header, sizeof(EggHeader));
+
+	bool written = out->Close();
+	Trace::Record("write index", indexStart, -1, (uint32)index.size());
+
+	if (written == false)
+	{
+		printf("Unable to write %s\n", output);
+		return false;
+	}
+
+	return true;
+}
+
+// For build, from-tar and repack when something goes wrong after they've opened the output. Closes it
+// and deletes it, so a failed run doesn't leave a broken egg behind. Returns what the command returns.
+int AbandonEgg(OutputFile* out, const char* output)
+{
+	out->Close();
+	remove(output);
+	return -1;
+}
+
+int build(const char* output, const char* const* inputs, uint32 numInputs, const BuildOptions& options)
+{
+	if (numInputs == 0)
+	{
+		printf("At least one input is required\n");
+		return -1;
+	}
+
+	// the names go in the egg as they are, so anything that won't fit gets caught before there's an egg to clean up
+	for (uint32 i = 0; i < numInputs; i++)
+	{
+		size_t length = strlen(inputs[i]);
+		if (length == 0 || length > 255)
+		{
+			printf("Can't add \"%s\". Names can't be empty or longer than 255 characters.\n", inputs[i]);
+			return -1;
+		}
+	}
+
+	// files that haven't changed since an earlier build come out of the cache instead of being compressed again
+	CompressionCache compressionCache;
+	CompressionCache* cache = nullptr;
+	if (options.CacheDirectory != nullptr)
+	{
+		if (compressionCache.Open(options.CacheDirectory, options.CacheSize) == false)
+		{
+			printf("Unable to open the compression cache in %s\n", options.CacheDirectory);
+			return -1;
+		}
+		cache = &compressionCache;
+	}
+
+	OutputFile out;
+	if (out.Open(output) == false)
+	{
+		printf("Unable to open %s for output\n", output);
+		return -1;
+	}
+
+	// The header gets written again once the index is done and we know where everything is.
+	// Until then, this keeps its place.
+	EggHeader header;
+	memcpy(header.Magic, "EGGA", 4); // EGG Archive
+	header.Version = 1;
+	header.Flags = 0;
+	header.Time = GetCurrentTime();
+	header.NumFiles = numInputs;
+	header.OffsetOfFilenames = 0;
+	header.OffsetOfTOC = 0;
+	header.OffsetOfSections = 0;
+	out.Write(&header, sizeof(header));
+
+	// the reader keeps loading inputs in the background while we compress
+	InputReader reader;
+	reader.Start(inputs, numInputs);
+
+	// small files wait here, by group, until there are enough of them to fill a block
+	std::map<std::string, PendingBlock> pendingBlocks;
+	std::vector<BlockInfo> blocks;
+
+	// where each load group's files ended up: { offset, size }
+	uint32 numGroups = options.Groups != nullptr ? (uint32)options.Groups->size() : 0;
+	std::vector<std::pair<uint32, uint32> > groupSpans(numGroups, std::make_pair(0u, 0u));
+	uint32 nextGroup = 0;
+	int openGroup = -1;
+
+	// begin writing the files
+	std::vector<FileInfo> fileInfo(numInputs);
+	FileInfo* files = fileInfo.data();
+	for (uint32 i = 0; i <= numInputs; i++)
+	{
+		// offsets in the TOC are 32 bits
+		if (out.Tell() > 0xffffffffull)
+		{
+			printf("%s is too big. An egg can't be more than 4GB.\n", output);
+			return AbandonEgg(&out, output);
+		}
+
+		// A group's blocks are written as soon as the group's done, so they end up with the
+		// rest of its files instead of somewhere later on.
+		if (openGroup >= 0 && i == (*options.Groups)[openGroup].FirstPlaced + (*options.Groups)[openGroup].NumPlaced)
+		{
+			if (FlushBlocks(&out, &pendingBlocks, cache, files, &blocks) == false)
+				return AbandonEgg(&out, output);
+
+			groupSpans[openGroup].second = (uint32)out.Tell() - groupSpans[openGroup].first;
+			openGroup = -1;
+		}
+
+		while (nextGroup < numGroups && (*options.Groups)[nextGroup].FirstPlaced == i && openGroup < 0)
+		{
+			// groups whose files were all in earlier groups don't get any space of their own
+			if ((*options.Groups)[nextGroup].NumPlaced > 0)
+			{
+				openGroup = (int)nextGroup;
+				groupSpans[openGroup].first = (uint32)out.Tell();
+			}
+			nextGroup++;
+		}
+
+		if (i == numInputs)
+			break;
+
+		files[i].Name = inputs[i];
+		files[i].Index = i;
+		files[i].Offset = (uint32)out.Tell();
+		files[i].Flags = 0;
+
+		// only counts the time we spent waiting, since the reader runs ahead of us
+		uint64 readStart = Trace::Now();
+		InputFile* input = reader.Acquire(i);
+		Trace::Record("read", readStart, i, input->Size);
+
+		uint64 hashStart = Trace::Now();
+		files[i].Hash = input->Error == 0 ? Hasher::Hash(input->Data, input->Size) : 0;
+		Trace::Record("hash", hashStart, i, input->Size);
+
+		if (input->Error == 0 && input->Size < options.SolidBlockSize / 4)
+		{
+			PendingBlock& pending = pendingBlocks[GetSolidGroup(inputs[i], options.SolidByDirectory)];
+
+			// the offset is where the file starts inside the block once it's decompressed
+			files[i].Offset = (uint32)pending.Data.size();
+			files[i].UncompressedSize = input->Size;
+			files[i].CompressedSize = 0;
+			pending.Data.insert(pending.Data.end(), input->Data, input->Data + input->Size);
+			pending.Files.push_back(i);
+			reader.Release(input);
+
+			printf("Added %s (%u bytes, in a solid block) to %s\n", inputs[i], files[i].UncompressedSize, output);
+
+			if (pending.Data.size() >= options.SolidBlockSize)
+			{
+				if (blocks.size() == MaxBlocks)
+				{
+					printf("Too many solid blocks. Try a bigger block size.\n");
+					return AbandonEgg(&out, output);
+				}
+
+				WriteBlock(&out, &pending, cache, files, &blocks);
+			}
+
+			continue;
+		}
+
+		bool copied = CopyFile(&out, input, i, cache, &files[i].UncompressedSize, &files[i].CompressedSize);
+		reader.Release(input);
+
+		if (copied == false)
+		{
+			printf("Error copying %s into output\n", inputs[i]);
+			return AbandonEgg(&out, output);
+		}
+
+		out.Pad();
+
+		// 0x01 means LZ4 compressed
+		if (files[i].CompressedSize < files[i].UncompressedSize)
+		{
+			files[i].Flags = 0x01;
+			printf("Added %s (%u bytes compressed to %u) to %s\n", inputs[i], files[i].UncompressedSize, files[i].CompressedSize, output);
+		}
+		else
+			printf("Added %s (%u bytes) to %s\n", inputs[i], files[i].UncompressedSize, output);
+	}
+
+	// whatever's left over goes in partly filled blocks
+	if (FlushBlocks(&out, &pendingBlocks, cache, files, &blocks) == false)
+		return AbandonEgg(&out, output);
+
+	if (out.Tell() > 0xffffffffull)
+	{
+		printf("%s is too big. An egg can't be more than 4GB.\n", output);
+		return AbandonEgg(&out, output);
+	}
+
+	if (FinishEgg(&out, &header, output, files, numInputs, blocks, groupSpans, options) == false)
+		return AbandonEgg(&out, output);
+
+	if (cache != nullptr)
+	{
+		cache->Prune();
+		cache->PrintReport();
+	}
+
+	if (options.TracePath != nullptr && Trace::Write(options.TracePath) == false)
+	{
+		printf("Unable to write trace to %s\n", options.TracePath);
+		return AbandonEgg(&out, output);
+	}
+
+	return 0;
+}
+
+// Writes out a file or a solid block that the compression queue has handed back
+bool WriteCompressed(OutputFile* out, const char* output, const CompressionJob* job, FileInfo* files, std::vector<BlockInfo>* blocks)
+{
+	uint32 size = (uint32)job->Data.size();
+	int compressedSize = (int)job->Compressed.size();
+
+	if (job->SolidBlock)
+	{
+		if (blocks->size() == MaxBlocks)
+		{
+			printf("Too many solid blocks. Try a bigger block size.\n");
+			return false;
+		}
+
+		AddBlock(out, job->Data.data(), size, job->Compressed.data(), compressedSize, job->Files, files, blocks);
+	}
+	else
+	{
+		FileInfo& file = files[job->Files[0]];
+		file.Offset = (uint32)out->Tell();
+		file.UncompressedSize = size;
+		file.Hash = job->Hash;
+
+		uint64 writeStart = Trace::Now();
+		if (WorthCompressing(size, compressedSize))
+		{
+			out->Write(job->Compressed.data(), compressedSize);
+			file.CompressedSize = compressedSize;
+			file.Flags = 0x01;
+		}
+		else
+		{
+			out->Write(job->Data.data(), size);
+			file.CompressedSize = size;
+			file.Flags = 0;
+		}
+		Trace::Record("write", writeStart, job->Files[0], file.CompressedSize);
+
+		out->Pad();
+
+		if (file.Flags == 0x01)
+			printf("Added %s (%u bytes compressed to %u) to %s\n", file.Name, file.UncompressedSize, file.CompressedSize, output);
+		else
+			printf("Added %s (%u bytes) to %s\n", file.Name, file.UncompressedSize, output);
+	}
+
+	// offsets in the TOC are 32 bits
+	if (out->Tell() > 0xffffffffull)
+	{
+		printf("%s is too big. An egg can't be more than 4GB.\n", output);
+		return false;
+	}
+
+	return true;
+}
+
+// Builds an egg straight from a tar stream ("-" for stdin), without unpacking it anywhere first. While one
+// entry is being read, the ones before it are compressed on every core, and they're written in the order
+// they were in the tar. Only so much of the tar is held in memory at once, however big it is.
+int fromTar(const char* output, const char* tarPath, const BuildOptions& options)
+{
+	CompressionCache compressionCache;
+	CompressionCache* cache = nullptr;
+	if (options.CacheDirectory != nullptr)
+	{
+		if (compressionCache.Open(options.CacheDirectory, options.CacheSize) == false)
+		{
+			printf("Unable to open the compression cache in %s\n", options.CacheDirectory);
+			return -1;
+		}
+		cache = &compressionCache;
+	}
+
+	TarReader tar;
+	if (tar.Open(tarPath) == false)
+	{
+		printf("Unable to open %s\n", tarPath);
+		return -1;
+	}
+
+	OutputFile out;
+	if (out.Open(output) == false)
+	{
+		printf("Unable to open %s for output\n", output);
+		return -1;
+	}
+
+	// filled in once we know how many files there are and where everything is
+	EggHeader header;
+	memcpy(header.Magic, "EGGA", 4);
+	header.Version = 1;
+	header.Flags = 0;
+	header.Time = GetCurrentTime();
+	header.NumFiles = 0;
+	header.OffsetOfFilenames = 0;
+	header.OffsetOfTOC = 0;
+	header.OffsetOfSections = 0;
+	out.Write(&header, sizeof(header));
+
+	CompressionQueue queue;
+	queue.Start(cache, std::thread::hardware_concurrency(), MaxBytesInFlight);
+
+	// the names have to stay put, since the files point at them
+	std::vector<FileInfo> files;
+	std::deque<std::string> names;
+
+	std::map<std::string, PendingBlock> pendingBlocks;
+	uint64 pendingBytes = 0;
+	std::vector<BlockInfo> blocks;
+
+	// Hard links point at the same data as their targets, once it's been written: { link, target }.
+	// Finding the targets takes an index of the names, which only gets built if there are any.
+	std::vector<std::pair<uint32, uint32> > links;
+	std::unordered_map<std::string, uint32> filesByName;
+	bool indexingNames = false;
+
+	// hands a job to the queue, writing out what's done first if it's full
+	auto submit = [&](CompressionJob* job) -> bool
+	{
+		while (queue.IsFull())
+		{
+			CompressionJob* done = queue.Next();
+			bool written = WriteCompressed(&out, output, done, files.data(), &blocks);
+			delete done;
+
+			if (written == false)
+			{
+				delete job;
+				return false;
+			}
+		}
+
+		queue.Add(job);
+		return true;
+	};
+
+	auto submitBlock = [&](PendingBlock* pending) -> bool
+	{
+		pendingBytes -= pending->Data.size();
+
+		CompressionJob* job = new CompressionJob;
+		job->Data.swap(pending->Data);
+		job->Files.swap(pending->Files);
+		job->SolidBlock = true;
+		job->Compress = true;
+		return submit(job);
+	};
+
+	auto submitPendingBlocks = [&]() -> bool
+	{
+		for (auto it = pendingBlocks.begin(); it != pendingBlocks.end(); ++it)
+		{
+			if (it->second.Files.empty() == false && submitBlock(&it->second) == false)
+				return false;
+		}
+
+		pendingBlocks.clear();
+		return true;
+	};
+
+	TarEntry entry;
+	while (tar.Next(&entry))
+	{
+		if (entry.Size > 0xffffffffull)
+		{
+			printf("%s is too big to go in an egg\n", entry.Name.c_str());
+			return AbandonEgg(&out, output);
+		}
+
+		if (entry.Name.empty() || entry.Name.size() > 255)
+		{
+			printf("Can't add \"%s\" from %s. Names can't be empty or longer than 255 characters.\n", entry.Name.c_str(), tarPath);
+			return AbandonEgg(&out, output);
+		}
+
+		uint32 size = (uint32)entry.Size;
+		uint32 index = (uint32)files.size();
+		names.push_back(std::string());
+		names.back().swap(entry.Name);
+
+		FileInfo file = {};
+		file.Name = names.back().c_str();
+		file.Index = index;
+
+		if (entry.LinkTarget.empty() == false && indexingNames == false)
+		{
+			for (uint32 i = 0; i < index; i++)
+				filesByName[files[i].Name] = i;
+			indexingNames = true;
+		}
+
+		if (entry.LinkTarget.empty() == false)
+		{
+			auto target = filesByName.find(entry.LinkTarget);
+			if (target == filesByName.end())
+			{
+				printf("Skipping %s, which is a link to %s, which wasn't in the tar before it\n", file.Name, entry.LinkTarget.c_str());
+				names.pop_back();
+				continue;
+			}
+
+			links.push_back(std::make_pair(index, target->second));
+		}
+
+		files.push_back(file);
+		if (indexingNames)
+			filesByName[file.Name] = index;
+
+		if (entry.LinkTarget.empty() == false)
+			continue;
+
+		// small files are read straight into their block, and everything else into its own job
+		uint64 readStart = Trace::Now();
+		if (size < options.SolidBlockSize / 4)
+		{
+			PendingBlock& pending = pendingBlocks[GetSolidGroup(file.Name, options.SolidByDirectory)];
+			uint32 offset = (uint32)pending.Data.size();
+			pending.Data.resize(offset + size);
+			if (tar.Read(pending.Data.data() + offset, size) == false)
+				break;
+			Trace::Record("read", readStart, index, size);
+
+			// the offset is where the file starts inside the block once it's decompressed
+			files[index].Offset = offset;
+			files[index].UncompressedSize = size;
+			files[index].Hash = Hasher::Hash(pending.Data.data() + offset, size);
+			pending.Files.push_back(index);
+			pendingBytes += size;
+
+			printf("Added %s (%u bytes, in a solid block) to %s\n", file.Name, size, output);
+
+			if (pending.Data.size() >= options.SolidBlockSize && submitBlock(&pending) == false)
+				return AbandonEgg(&out, output);
+
+			// With --solid-by-dir, blocks for directories the tar's already finished with could
+			// hang around until the end, so they go out early rather than pile up.
+			if (pendingBytes >= MaxBytesInPendingBlocks && submitPendingBlocks() == false)
+				return AbandonEgg(&out, output);
+
+			continue;
+		}
+
+		CompressionJob* job = new CompressionJob;
+		job->Data.resize(size);
+		if (tar.Read(job->Data.data(), size) == false)
+		{
+			delete job;
+			break;
+		}
+		Trace::Record("read", readStart, index, size);
+
+		job->Files.push_back(index);
+		job->SolidBlock = false;
+		job->Compress = size >= MinCompressedFileSize;
+		if (submit(job) == false)
+			return AbandonEgg(&out, output);
+	}
+
+	if (tar.Error() != nullptr)
+	{
+		printf("Unable to read %s: %s\n", tarPath, tar.Error());
+		return AbandonEgg(&out, output);
+	}
+
+	if (files.empty())
+	{
+		printf("There are no files in %s\n", tarPath);
+		return AbandonEgg(&out, output);
+	}
+
+	// whatever's left over goes in partly filled blocks
+	if (submitPendingBlocks() == false)
+		return AbandonEgg(&out, output);
+
+	for (CompressionJob* job = queue.Next(); job != nullptr; job = queue.Next())
+	{
+		bool written = WriteCompressed(&out, output, job, files.data(), &blocks);
+		delete job;
+
+		if (written == false)
+			return AbandonEgg(&out, output);
+	}
+
+	queue.Stop();
+
+	for (size_t i = 0; i < links.size(); i++)
+	{
+		FileInfo& link = files[links[i].first];
+		const FileInfo& target = files[links[i].second];
+		link.Offset = target.Offset;
+		link.UncompressedSize = target.UncompressedSize;
+		link.CompressedSize = target.CompressedSize;
+		link.Flags = target.Flags;
+		link.Hash = target.Hash;
+
+		printf("Added %s (the same as %s) to %s\n", link.Name, target.Name, output);
+	}
+
+	if (tar.NumSkipped() > 0)
+		printf("Skipped %u entries in %s that weren't files or directories (symbolic links and so on)\n", tar.NumSkipped(), tarPath);
+
+	if (FinishEgg(&out, &header, output, files.data(), (uint32)files.size(), blocks, std::vector<std::pair<uint32, uint32> >(), options) == false)
+		return AbandonEgg(&out, output);
+
+	if (cache != nullptr)
+	{
+		cache->Prune();
+		cache->PrintReport();
+	}
+
+	if (options.TracePath != nullptr && Trace::Write(options.TracePath) == false)
+	{
+		printf("Unable to write trace to %s\n", options.TracePath);
+		return AbandonEgg(&out, output);
+	}
+
+	return 0;
+}
+
+// Something repack copies over from the old egg in one piece: a file on its own, or a solid block
+struct RepackBlob
+{
+	// where it is in the old egg, and in the new one once it's been written
+	EggEntry Old;
+	EggEntry New;
+
+	// which of the old egg's blocks it is, or -1 for a file
+	int Block;
+
+	// the TOC entries that point at it
+	std::vector<uint32> Files;
+
+	// how early the first of its files gets used, if --order says
+	uint32 FirstUse;
+
+	// If it has the same contents as another file, the blob that gets written in its place. Otherwise -1.
+	int SameAs;
+};
+
+// What the report at the end of repack compares between the old egg and the new one
+struct RepackStats
+{
+	// the file data, and where it ends (which is where the index starts)
+	uint64 DataBytes;
+	uint64 DataEnd;
+
+	// files and blocks that are compressed or not, and TOC entries that point at another's data
+	uint32 NumCompressed;
+	uint32 NumStored;
+	uint32 NumShared;
+
+	// files and blocks that are at least the alignment, and how many of them don't start on a multiple of it
+	uint32 NumBig;
+	uint32 NumMisaligned;
+
+	// reading the files in the order --order gives, how often (and how far) the reader goes back
+	uint32 NumSeeksBack;
+	uint64 BytesSeekedBack;
+};
+
+// Reads the order the files in egg get used in, as TOC indices, each one once. path is either a trace that
+// egg.h wrote with megg_writeProfileTrace() while it was reading this same egg, or a list of filenames,
+// one per line. Names that aren't in the egg are counted in numUnknown.
+bool ReadAccessOrder(const char* path, const Egg& egg, std::vector<uint32>* order, uint32* numUnknown)
+{
+#ifdef _WIN32
+	FILE* fp;
+	if (fopen_s(&fp, path, "rb") != 0)
+		fp = nullptr;
+#else
+	FILE* fp = fopen(path, "rb");
+#endif
+	if (fp == nullptr)
+	{
+		printf("Unable to open %s\n", path);
+		return false;
+	}
+
+	std::vector<char> text;
+	char buffer[64 * 1024];
+	size_t r;
+	while ((r = fread(buffer, 1, sizeof(buffer), fp)) > 0)
+		text.insert(text.end(), buffer, buffer + r);
+	fclose(fp);
+	text.push_back('\n');
+
+	uint32 numFiles = (uint32)egg.Toc.size();
+	std::vector<bool> used(numFiles, false);
+	*numUnknown = 0;
+
+	size_t first = 0;
+	while (first < text.size() && isspace((uint8)text[first]))
+		first++;
+
+	if (first < text.size() && text[first] == '{')
+	{
+		// The trace has an event on each line, with when it started ("ts") and which TOC entry it was for
+		// ("entry", which is -1 for lookups that didn't find anything). They aren't always in order.
+		std::vector<std::pair<double, uint32> > events;
+		for (size_t start = 0; start < text.size();)
+		{
+			size_t end = std::find(text.begin() + start, text.end(), '\n') - text.begin();
+			text[end] = 0;
+
+			const char* ts = strstr(&text[start], "\"ts\":");
+			const char* entry = strstr(&text[start], "\"entry\":");
+			if (ts != nullptr && entry != nullptr)
+			{
+				long index = strtol(entry + 8, nullptr, 10);
+				if (index >= 0 && (unsigned long)index < numFiles)
+					events.push_back(std::make_pair(strtod(ts + 5, nullptr), (uint32)index));
+			}
+
+			start = end + 1;
+		}
+
+		std::stable_sort(events.begin(), events.end(),
+			[](const std::pair<double, uint32>& a, const std::pair<double, uint32>& b) { return a.first < b.first; });
+
+		for (size_t i = 0; i < events.size(); i++)
+		{
+			if (used[events[i].second] == false)
+			{
+				used[events[i].second] = true;
+				order->push_back(events[i].second);
+			}
+		}
+
+		return true;
+	}
+
+	// case doesn't matter, the same as when egg.h looks a name up
+	auto lowercase = [](std::string name)
+	{
+		for (size_t i = 0; i < name.size(); i++)
+			name[i] = (char)tolower((uint8)name[i]);
+		return name;
+	};
+
+	std::unordered_map<std::string, uint32> filesByName;
+	for (uint32 i = 0; i < numFiles; i++)
+		filesByName.insert(std::make_pair(lowercase(egg.Names[i]), i));
+
+	for (size_t start = 0; start < text.size();)
+	{
+		size_t end = std::find(text.begin() + start, text.end(), '\n') - text.begin();
+
+		size_t length = end - start;
+		while (length > 0 && isspace((uint8)text[start + length - 1]))
+			length--;
+
+		if (length > 0)
+		{
+			auto it = filesByName.find(lowercase(std::string(&text[start], length)));
+			if (it == filesByName.end())
+				(*numUnknown)++;
+			else if (used[it->second] == false)
+			{
+				used[it->second] = true;
+				order->push_back(it->second);
+			}
+		}
+
+		start = end + 1;
+	}
+
+	return true;
+}
+
+// Sums up where the data is, either in the old egg (before any duplicates have been found) or in the new one
+RepackStats MeasureLayout(const std::vector<RepackBlob>& blobs, const std::vector<uint32>& blobOfFile, const std::vector<uint32>& accessOrder,
+	uint32 alignment, bool repacked)
+{
+	RepackStats stats = {};
+	stats.DataEnd = sizeof(EggHeader);
+
+	for (size_t i = 0; i < blobs.size(); i++)
+	{
+		const RepackBlob& blob = blobs[i];
+		if (repacked && blob.SameAs >= 0)
+			continue;
+
+		const EggEntry& entry = repacked ? blob.New : blob.Old;
+		stats.DataBytes += entry.CompressedSize;
+		stats.DataEnd = std::max(stats.DataEnd, (uint64)entry.Offset + entry.CompressedSize);
+
+		if (entry.Flags & 0x01)
+			stats.NumCompressed++;
+		else
+			stats.NumStored++;
+
+		if (blob.Block < 0)
+			stats.NumShared += (uint32)blob.Files.size() - 1;
+
+		if (entry.CompressedSize >= alignment)
+		{
+			stats.NumBig++;
+			if (entry.Offset % alignment != 0)
+				stats.NumMisaligned++;
+		}
+	}
+
+	uint64 end = 0;
+	int previous = -1;
+	for (size_t i = 0; i < accessOrder.size(); i++)
+	{
+		int blob = (int)blobOfFile[accessOrder[i]];
+		if (repacked && blobs[blob].SameAs >= 0)
+			blob = blobs[blob].SameAs;
+		if (blob == previous)
+			continue;
+
+		const EggEntry& entry = repacked ? blobs[blob].New : blobs[blob].Old;
+		if (previous >= 0 && entry.Offset < end)
+		{
+			stats.NumSeeksBack++;
+			stats.BytesSeekedBack += end - entry.Offset;
+		}
+
+		end = (uint64)entry.Offset + entry.CompressedSize;
+		previous = blob;
+	}
+
+	return stats;
+}
+
+// Writes a new egg with the same files as an old one, laid out again: compressed under options.Recompress,
+// with files that have the same contents sharing one copy, in the order --order gives, and aligned.
+// Whatever doesn't need to change (like files that are already compressed) is copied over as it is.
+// Compressing runs on every core while the old egg is read, and only so much of it is held in memory at once.
+int repack(const char* input, const char* output, const RepackOptions& options)
+{
+	uint64 startTime = Trace::Now();
+
+	Egg egg;
+	if (LoadEgg(input, &egg) == false || HashEntries(&egg, input) == false)
+		return -1;
+
+	uint32 numFiles = (uint32)egg.Toc.size();
+	if (numFiles == 0)
+	{
+		printf("There are no files in %s\n", input);
+		return -1;
+	}
+
+	// Work out what gets copied over in one piece. Files that already share their data keep sharing it.
+	std::vector<RepackBlob> blobs;
+	std::vector<uint32> blobOfFile(numFiles);
+	std::vector<int> blobOfBlock(egg.Blocks.size(), -1);
+	std::map<std::pair<uint64, uint32>, uint32> blobAt;
+
+	auto addBlob = [&](const EggEntry& entry, int block)
+	{
+		RepackBlob blob = {};
+		blob.Old = entry;
+		blob.Block = block;
+		blob.FirstUse = UINT32_MAX;
+		blob.SameAs = -1;
+		blobs.push_back(blob);
+		return (uint32)blobs.size() - 1;
+	};
+
+	for (uint32 i = 0; i < numFiles; i++)
+	{
+		const EggEntry& entry = egg.Toc[i];
+
+		uint32 blob;
+		if (entry.Flags & 0x02)
+		{
+			uint32 block = entry.Flags >> 8;
+			if (block >= egg.Blocks.size())
+			{
+				printf("%s is in a solid block that %s doesn't have\n", egg.Names[i].c_str(), input);
+				return -1;
+			}
+
+			if (blobOfBlock[block] < 0)
+				blobOfBlock[block] = (int)addBlob(egg.Blocks[block], (int)block);
+			blob = (uint32)blobOfBlock[block];
+		}
+		else
+		{
+			auto key = std::make_pair(((uint64)entry.Offset << 32) | entry.CompressedSize, entry.Flags);
+			auto it = blobAt.find(key);
+			if (it == blobAt.end())
+				it = blobAt.insert(std::make_pair(key, addBlob(entry, -1))).first;
+			blob = it->second;
+		}
+
+		blobs[blob].Files.push_back(i);
+		blobOfFile[i] = blob;
+	}
+
+	std::vector<uint32> accessOrder;
+	uint32 numUnknown = 0;
+	if (options.OrderPath != nullptr && ReadAccessOrder(options.OrderPath, egg, &accessOrder, &numUnknown) == false)
+		return -1;
+
+	for (uint32 i = 0; i < (uint32)accessOrder.size(); i++)
+	{
+		RepackBlob& blob = blobs[blobOfFile[accessOrder[i]]];
+		blob.FirstUse = std::min(blob.FirstUse, i);
+	}
+
+	// what gets used goes first, in the order it's used, and everything else stays in the order it was in
+	std::vector<uint32> layout(blobs.size());
+	for (uint32 i = 0; i < (uint32)blobs.size(); i++)
+		layout[i] = i;
+
+	std::stable_sort(layout.begin(), layout.end(), [&](uint32 a, uint32 b)
+	{
+		if (blobs[a].FirstUse != blobs[b].FirstUse)
+			return blobs[a].FirstUse < blobs[b].FirstUse;
+		return blobs[a].Old.Offset < blobs[b].Old.Offset;
+	});
+
+	RepackStats before = MeasureLayout(blobs, blobOfFile, accessOrder, options.Alignment, false);
+
+	// Files with the same contents as one earlier in the layout point at its copy instead. The hashes
+	// only say which ones might be the same, so they're compared to make sure.
+	uint32 numDuplicates = 0;
+	if (options.KeepDuplicates == false)
+	{
+		std::map<std::pair<uint64, uint32>, uint32> firstWithContents;
+		std::vector<uint8> contents, otherContents, scratch;
+		for (size_t i = 0; i < layout.size(); i++)
+		{
+			RepackBlob& blob = blobs[layout[i]];
+			if (blob.Block >= 0)
+				continue;
+
+			uint32 file = blob.Files[0];
+			auto key = std::make_pair(egg.Hashes[file], blob.Old.UncompressedSize);
+			auto it = firstWithContents.find(key);
+			if (it == firstWithContents.end())
+			{
+				firstWithContents.insert(std::make_pair(key, layout[i]));
+				continue;
+			}
+
+			RepackBlob& original = blobs[it->second];
+			if (ReadEntry(&egg, original.Files[0], &contents, &scratch) == false || ReadEntry(&egg, file, &otherContents, &scratch) == false)
+			{
+				printf("Unable to read %s out of %s\n", egg.Names[file].c_str(), input);
+				return -1;
+			}
 
-int compare(const void* c1, const void* c2)
-{
-	FileInfo* f1 = (FileInfo*)c1;
-	FileInfo* f2 = (FileInfo*)c2;
+			if (contents != otherContents)
+				continue;
 
-#ifdef _WIN32
-	return _stricmp(f1->Name, f2->Name);
-#else
-	return strcasecmp(f1->Name, f2->Name);
-#endif
-}
+			original.Files.insert(original.Files.end(), blob.Files.begin(), blob.Files.end());
+			numDuplicates += (uint32)blob.Files.size();
+			blob.SameAs = (int)it->second;
+		}
+	}
 
-int build(const char* output, const char* const* inputs, uint32 numInputs)
-{
-	if (numInputs == 0)
+	CompressionCache compressionCache;
+	CompressionCache* cache = nullptr;
+	if (options.Build.CacheDirectory != nullptr)
 	{
-		printf("At least one input is required\n");
-		return -1;
+		if (compressionCache.Open(options.Build.CacheDirectory, options.Build.CacheSize) == false)
+		{
+			printf("Unable to open the compression cache in %s\n", options.Build.CacheDirectory);
+			return -1;
+		}
+		cache = &compressionCache;
 	}
 
-#ifdef _WIN32
-	FILE* out;
-	fopen_s(&out, output, "wb");
-#else
-	FILE* out = fopen(output, "wb");
-#endif
-	if (out == nullptr)
+	OutputFile out;
+	if (out.Open(output) == false)
 	{
 		printf("Unable to open %s for output\n", output);
 		return -1;
 	}
 
-	// write the header
+	// filled in once everything's been written
+	EggHeader header;
+	memcpy(header.Magic, "EGGA", 4);
+	header.Version = 1;
+	header.Flags = 0;
+	header.Time = GetCurrentTime();
+	header.NumFiles = numFiles;
+	header.OffsetOfFilenames = 0;
+	header.OffsetOfTOC = 0;
+	header.OffsetOfSections = 0;
+	out.Write(&header, sizeof(header));
+
+	std::vector<FileInfo> files(numFiles);
+	for (uint32 i = 0; i < numFiles; i++)
 	{
-		char magic[4] = { 'E', 'G', 'G', 'A' }; // EGG Archive
-		fwrite(magic, 4, 1, out);
-
-		uint16 version = 1;
-		uint16 flags = 0;
-		fwrite(&version, 2, 1, out);
-		fwrite(&flags, 2, 1, out);
-
-		uint64 time = GetCurrentTime();
-		fwrite(&time, 8, 1, out);
-		fwrite(&numInputs, 4, 1, out);
+		files[i].Name = egg.Names[i].c_str();
+		files[i].Index = i;
+		files[i].Hash = egg.Hashes[i];
+	}
 
-		uint32 dummy = 0;
-		fwrite(&dummy, 4, 1, out);
-		fwrite(&dummy, 4, 1, out);
-		fwrite(&dummy, 4, 1, out);
+	CompressionQueue queue;
+	queue.Start(cache, std::thread::hardware_concurrency(), MaxBytesInFlight);
 
-		auto offset = ftell(out);
-		assert(offset % 8 == 0);
-	}
+	// the blobs the queue has, in the order it hands them back
+	std::deque<uint32> queued;
+	std::vector<BlockInfo> blocks;
 
-	// begin writing the files
-	FileInfo* files = new FileInfo[numInputs];
-	for (uint32 i = 0; i < numInputs; i++)
+	// takes the oldest job from the queue and writes it out
+	auto writeNext = [&]() -> bool
 	{
-		files[i].Name = inputs[i];
-		files[i].Index = i;
-		files[i].Offset = ftell(out);
+		CompressionJob* job = queue.Next();
+		RepackBlob& blob = blobs[queued.front()];
+		queued.pop_front();
 
-		if (CopyFile(out, inputs[i], &files[i].UncompressedSize, &files[i].CompressedSize) == false)
+		// anything that was decompressed gets checked against its hash on the way through
+		if (job->Failed || (blob.Block < 0 && job->DecompressedSize > 0 && job->Hash != egg.Hashes[blob.Files[0]]))
 		{
-			printf("Error copying %s into output\n", inputs[i]);
+			if (blob.Block >= 0)
+				printf("Solid block %d in %s is damaged\n", blob.Block, input);
+			else
+				printf("%s is damaged in %s\n", egg.Names[blob.Files[0]].c_str(), input);
+			delete job;
+			return false;
+		}
 
-			fclose(out);
-			return -1;
+		// what the queue compressed if that was worth it, otherwise it's written uncompressed,
+		// unless it was meant to be copied over as it was
+		const uint8* data = job->Data.data();
+		uint32 size = (uint32)job->Data.size();
+		uint32 flags = 0;
+		if (job->Compress && WorthCompressing(size, (int)job->Compressed.size()))
+		{
+			data = job->Compressed.data();
+			size = (uint32)job->Compressed.size();
+			flags = 0x01;
 		}
+		else if (job->Compress == false && job->DecompressedSize == 0)
+			flags = blob.Old.Flags & 0x01;
+
+		if (size >= options.Alignment)
+			out.Pad(options.Alignment);
+
+		blob.New.Offset = (uint32)out.Tell();
+		blob.New.CompressedSize = size;
+		blob.New.UncompressedSize = blob.Old.UncompressedSize;
+		blob.New.Flags = flags;
 
-		// keep everything aligned to 8 byte offset
-		auto offset = ftell(out);
-		auto padding = (8 - (offset % 8)) % 8;
-		if (padding > 0)
+		uint64 writeStart = Trace::Now();
+		out.Write(data, size);
+		Trace::Record(blob.Block >= 0 ? "write block" : "write", writeStart, blob.Block >= 0 ? -1 : (int)blob.Files[0], size);
+		out.Pad();
+		delete job;
+
+		for (size_t i = 0; i < blob.Files.size(); i++)
 		{
-			uint64 dummy = 0;
-			fwrite(&dummy, padding, 1, out);
+			FileInfo& file = files[blob.Files[i]];
+			if (blob.Block >= 0)
+			{
+				// files in a block are where they were inside it, and the block's the next one in the new egg
+				const EggEntry& entry = egg.Toc[blob.Files[i]];
+				file.Offset = entry.Offset;
+				file.CompressedSize = entry.CompressedSize;
+				file.UncompressedSize = entry.UncompressedSize;
+				file.Flags = 0x02 | ((uint32)blocks.size() << 8);
+			}
+			else
+			{
+				file.Offset = blob.New.Offset;
+				file.CompressedSize = blob.New.CompressedSize;
+				file.UncompressedSize = blob.New.UncompressedSize;
+				file.Flags = flags;
+			}
 		}
 
-		if (files[i].CompressedSize < files[i].UncompressedSize)
-			printf("Added %s (%u bytes compressed to %u) to %s\n", inputs[i], files[i].UncompressedSize, files[i].CompressedSize, output);
-		else
-			printf("Added %s (%u bytes) to %s\n", inputs[i], files[i].UncompressedSize, output);
-	}
+		if (blob.Block >= 0)
+		{
+			BlockInfo block = { blob.New.Offset, blob.New.CompressedSize, blob.New.UncompressedSize, blob.New.Flags };
+			blocks.push_back(block);
+		}
 
-	// alphabetize the filenames
-	qsort(files, numInputs, sizeof(FileInfo), compare);
+		// offsets in the TOC are 32 bits
+		if (out.Tell() > 0xffffffffull)
+		{
+			printf("%s is too big. An egg can't be more than 4GB.\n", output);
+			return false;
+		}
+
+		return true;
+	};
 
-	// write table of contents
-	uint32 offsetOfTOC = (uint32)ftell(out);
-	assert(offsetOfTOC % 8 == 0);
+	for (size_t i = 0; i < layout.size(); i++)
 	{
-		// write the file info
-		for (uint32 i = 0; i < numInputs; i++)
+		const RepackBlob& blob = blobs[layout[i]];
+		if (blob.SameAs >= 0)
+			continue;
+
+		CompressionJob* job = new CompressionJob;
+		job->Files.push_back(blob.Files[0]);
+		job->SolidBlock = blob.Block >= 0;
+
+		uint64 readStart = Trace::Now();
+		if (ReadAt(egg.File, blob.Old.Offset, blob.Old.CompressedSize, &job->Data) == false)
 		{
-			uint32 flags = 0;
+			printf("Unable to read %s out of %s\n", job->SolidBlock ? "a solid block" : egg.Names[blob.Files[0]].c_str(), input);
+			delete job;
+			return AbandonEgg(&out, output);
+		}
+		Trace::Record("read", readStart, job->SolidBlock ? -1 : (int)blob.Files[0], blob.Old.CompressedSize);
 
-			// 0x01 means LZ4 compressed
-			if (files[i].CompressedSize < files[i].UncompressedSize)
-				flags = 0x01;
+		// files on their own are only worth compressing if they're big enough, the same as in build
+		bool compressed = (blob.Old.Flags & 0x01) != 0;
+		bool worthTrying = job->SolidBlock || blob.Old.UncompressedSize >= MinCompressedFileSize;
+		if (compressed && options.Recompress == RecompressAll)
+		{
+			job->DecompressedSize = blob.Old.UncompressedSize;
+			job->Compress = worthTrying;
+		}
+		else if (compressed == false && options.Recompress != RecompressNone)
+			job->Compress = worthTrying;
 
-			fwrite(&files[i].Offset, 4, 1, out);
-			fwrite(&files[i].CompressedSize, 4, 1, out);
-			fwrite(&files[i].UncompressedSize, 4, 1, out);
-			fwrite(&flags, 4, 1, out);
+		while (queue.IsFull())
+		{
+			if (writeNext() == false)
+				return AbandonEgg(&out, output);
 		}
+
+		queue.Add(job);
+		queued.push_back(layout[i]);
 	}
 
-	// write filenames
-	uint32 offsetOfFilenames = (uint32)ftell(out);
-	assert(offsetOfFilenames % 8 == 0);
+	while (queued.empty() == false)
 	{
-		for (uint32 i = 0; i < numInputs; i++)
+		if (writeNext() == false)
+			return AbandonEgg(&out, output);
+	}
+
+	queue.Stop();
+
+	// the load groups cover wherever the data that was in their old spans went
+	std::vector<LoadGroup> groups;
+	std::vector<std::pair<uint32, uint32> > groupSpans;
+	for (size_t i = 0; i < egg.Groups.size(); i++)
+	{
+		const EggGroup& oldGroup = egg.Groups[i];
+
+		LoadGroup group;
+		group.Name = oldGroup.Name;
+		group.Files = oldGroup.Files;
+		group.FirstPlaced = 0;
+		group.NumPlaced = 0;
+		groups.push_back(group);
+
+		uint64 begin = UINT64_MAX;
+		uint64 end = 0;
+		for (size_t j = 0; j < blobs.size(); j++)
 		{
-			uint32 len = strlen(files[i].Name);
-			assert(len <= 255);
+			if (blobs[j].Old.Offset < oldGroup.Offset || blobs[j].Old.Offset >= (uint64)oldGroup.Offset + oldGroup.Size)
+				continue;
 
-			uint8 blen = (uint8)len;
-			fwrite(&blen, 1, 1, out);
-			fwrite(files[i].Name, len + 1, 1, out);
+			const RepackBlob& blob = blobs[j].SameAs >= 0 ? blobs[blobs[j].SameAs] : blobs[j];
+			begin = std::min(begin, (uint64)blob.New.Offset);
+			end = std::max(end, (uint64)blob.New.Offset + blob.New.CompressedSize);
 		}
+
+		groupSpans.push_back(begin < end ? std::make_pair((uint32)begin, (uint32)(end - begin)) : std::make_pair(0u, 0u));
+	}
+
+	BuildOptions buildOptions = options.Build;
+	buildOptions.Groups = &groups;
+	if (egg.Header[6] & 0x02)
+		buildOptions.FrontCodedNames = true;
+
+	if (FinishEgg(&out, &header, output, files.data(), numFiles, blocks, groupSpans, buildOptions) == false)
+		return AbandonEgg(&out, output);
+
+	RepackStats after = MeasureLayout(blobs, blobOfFile, accessOrder, options.Alignment, true);
+	uint64 newSize = out.Tell();
+	double seconds = (Trace::Now() - startTime) / 1e9;
+
+	printf("Repacked %s (%u files) into %s in %.2f seconds (%.1f MB/s)\n", input, numFiles, output, seconds,
+		seconds > 0 ? egg.Size / (1024.0 * 1024.0) / seconds : 0.0);
+	printf("                        before      after\n");
+	printf("  size          %14llu %10llu bytes\n", (unsigned long long)egg.Size, (unsigned long long)newSize);
+	printf("  file data     %14llu %10llu bytes\n", (unsigned long long)before.DataBytes, (unsigned long long)after.DataBytes);
+	printf("  padding, gaps %14llu %10llu bytes\n", (unsigned long long)(before.DataEnd - sizeof(EggHeader) - std::min(before.DataBytes, before.DataEnd - sizeof(EggHeader))),
+		(unsigned long long)(after.DataEnd - sizeof(EggHeader) - after.DataBytes));
+	printf("  index         %14llu %10llu bytes\n", (unsigned long long)(egg.Size - std::min(egg.Size, before.DataEnd)), (unsigned long long)(newSize - after.DataEnd));
+	printf("  compressed    %14u %10u files and blocks\n", before.NumCompressed, after.NumCompressed);
+	printf("  uncompressed  %14u %10u files and blocks\n", before.NumStored, after.NumStored);
+	printf("  shared        %14u %10u files with another file's data (%u duplicates found)\n", before.NumShared, after.NumShared, numDuplicates);
+	if (options.Alignment > 8)
+		printf("  misaligned    %14u %10u of the files and blocks of %u bytes or more\n", before.NumMisaligned, after.NumMisaligned, options.Alignment);
+
+	if (options.OrderPath != nullptr)
+	{
+		printf("  seeks back    %14u %10u reading the %u files in %s in order\n", before.NumSeeksBack, after.NumSeeksBack, (uint32)accessOrder.size(), options.OrderPath);
+		printf("  bytes back    %14llu %10llu\n", (unsigned long long)before.BytesSeekedBack, (unsigned long long)after.BytesSeekedBack);
+		if (numUnknown > 0)
+			printf("%u names in %s aren't in %s\n", numUnknown, options.OrderPath, input);
 	}
 
-	// go back and write the offsets
-	fseek(out, OffsetOfTOCOffset, SEEK_SET);
-	fwrite(&offsetOfTOC, 4, 1, out);
-	fseek(out, OffsetOfFilenameOffset, SEEK_SET);
-	fwrite(&offsetOfFilenames, 4, 1, out);
+	CloseEgg(&egg);
 
-	fclose(out);
+	if (cache != nullptr)
+	{
+		cache->Prune();
+		cache->PrintReport();
+	}
+
+	if (options.Build.TracePath != nullptr && Trace::Write(options.Build.TracePath) == false)
+	{
+		printf("Unable to write trace to %s\n", options.Build.TracePath);
+		return AbandonEgg(&out, output);
+	}
 
 	return 0;
 }
 
-int list(const char* egg)
+// Finds a section in a version 2 archive. tableOffset is the header's last field.
+bool FindSection(FILE* fp, uint32 tableOffset, const char* id, uint32* offset, uint32* size)
+{
+	uint32 numSections;
+	if (fseek(fp, tableOffset, SEEK_SET) != 0 || fread(&numSections, 4, 1, fp) != 1)
+		return false;
+
+	for (uint32 i = 0; i < numSections; i++)
+	{
+		struct
+		{
+			char Id[4];
+			uint32 Offset;
+			uint32 Size;
+			uint32 Unused;
+		} section;
+
+		if (fseek(fp, tableOffset + 8 + i * sizeof(section), SEEK_SET) != 0 || fread(&section, sizeof(section), 1, fp) != 1)
+			return false;
+
+		if (memcmp(section.Id, id, 4) == 0)
+		{
+			*offset = section.Offset;
+			*size = section.Size;
+			return true;
+		}
+	}
+
+	return false;
+}
+
+// Lists every file in the egg, or just the ones in directory (and its subdirectories) if it isn't null
+int list(const char* egg, const char* directory)
 {
 #ifdef _WIN32
 	FILE* fp;
@@ -264,14 +1974,6 @@ int list(const char* egg)
 		unsigned int OffsetToTableOfContents;
 		unsigned int Reserved;
 	} header;
-
-	struct
-	{
-		unsigned int OffsetToFile;
-		unsigned int CompressedSizeOfFile;
-		unsigned int UncompressedSizeOfFile;
-		unsigned int Flags;
-	} toc;
 #pragma pack()
 
 	fread(&header, sizeof(header), 1, fp);
@@ -286,24 +1988,98 @@ int list(const char* egg)
 		return -1;
 	}
 
-	// jump to the filenames
-	fseek(fp, header.OffsetToFilenames, SEEK_SET);
+	std::vector<std::string> names;
+	if (ReadNameTable(fp, header.OffsetToFilenames, header.NumFiles, (header.Flags & 0x02) != 0, &names) == false)
+	{
+		printf("Unable to read the filenames in %s\n", egg);
+		fclose(fp);
+		return -1;
+	}
 
-	char buffer[256];
-	for (uint32 i = 0; i < header.NumFiles; i++)
+	uint32 first = 0, count = header.NumFiles;
+	if (directory != nullptr)
 	{
-		uint8 len;
-		fread(&len, 1, 1, fp);
+		// the DIRS section says which run of files is in there
+		uint32 offset, size;
+		std::vector<uint8> section;
+		if ((header.Flags & 0x01) != 0 && FindSection(fp, header.Reserved, "DIRS", &offset, &size))
+		{
+			section.resize(size);
+			if (fseek(fp, offset, SEEK_SET) != 0 || fread(section.data(), 1, size, fp) != size)
+				section.clear();
+		}
+
+		if (section.empty())
+		{
+			// eggs from before there was a DIRS section get searched the long way
+			size_t length = strlen(directory);
+			while (length > 0 && directory[length - 1] == '/')
+				length--;
+
+			for (uint32 i = 0; i < header.NumFiles; i++)
+			{
+				const char* name = names[i].c_str();
+#ifdef _WIN32
+				if (_strnicmp(name, directory, length) == 0 && name[length] == '/')
+#else
+				if (strncasecmp(name, directory, length) == 0 && name[length] == '/')
+#endif
+					puts(name);
+			}
 
-		fread(buffer, len + 1, 1, fp);
+			fclose(fp);
+			return 0;
+		}
 
-		puts(buffer);
+		if (FindDirectory(section, directory, &first, &count) == false || first > header.NumFiles || count > header.NumFiles - first)
+		{
+			printf("There's no directory called %s in %s\n", directory, egg);
+			fclose(fp);
+			return -1;
+		}
 	}
 
+	for (uint32 i = first; i < first + count; i++)
+		puts(names[i].c_str());
+
 	fclose(fp);
 	return 0;
 }
 
+// Writes size bytes that start offset bytes into a (decompressed) solid block
+bool ExtractFromBlock(FILE* fp, uint16 headerFlags, uint32 sectionTableOffset, uint32 blockIndex, uint32 offset, uint32 size, FILE* out)
+{
+	uint32 blocksOffset, blocksSize;
+	if ((headerFlags & 0x01) == 0 || FindSection(fp, sectionTableOffset, "BLKS", &blocksOffset, &blocksSize) == false)
+		return false;
+
+	BlockInfo block;
+	if (blockIndex >= blocksSize / sizeof(BlockInfo)
+		|| fseek(fp, blocksOffset + blockIndex * sizeof(BlockInfo), SEEK_SET) != 0
+		|| fread(&block, sizeof(block), 1, fp) != 1
+		|| offset > block.UncompressedSize || size > block.UncompressedSize - offset)
+		return false;
+
+	char* compressed = new char[block.CompressedSize + 1];
+	bool ok = fseek(fp, block.Offset, SEEK_SET) == 0 && fread(compressed, 1, block.CompressedSize, fp) == block.CompressedSize;
+	if (ok && (block.Flags & 0x01))
+	{
+		// only as much as it takes to get to the end of the file, although LZ4 can go past that
+		char* uncompressed = new char[block.UncompressedSize + 1];
+		int r = LZ4_decompress_safe_partial(compressed, uncompressed, block.CompressedSize, offset + size, block.UncompressedSize);
+		ok = r >= 0 && (uint32)r >= offset + size;
+		if (ok)
+			fwrite(uncompressed + offset, 1, size, out);
+
+		delete[] uncompressed;
+	}
+	else if (ok)
+		fwrite(compressed + offset, 1, size, out);
+
+	delete[] compressed;
+	return ok;
+}
+
 int extract(const char* egg, const char* file)
 {
 #ifdef _WIN32
@@ -352,16 +2128,17 @@ int extract(const char* egg, const char* file)
 		return -1;
 	}
 
-	// jump to the filenames
-	fseek(fp, header.OffsetToFilenames, SEEK_SET);
+	std::vector<std::string> names;
+	if (ReadNameTable(fp, header.OffsetToFilenames, header.NumFiles, (header.Flags & 0x02) != 0, &names) == false)
+	{
+		printf("Unable to read the filenames in %s\n", egg);
+		fclose(fp);
+		return -1;
+	}
 
-	char buffer[256];
 	for (uint32 i = 0; i < header.NumFiles; i++)
 	{
-		uint8 len;
-		fread(&len, 1, 1, fp);
-
-		fread(buffer, len + 1, 1, fp);
+		const char* buffer = names[i].c_str();
 
 #ifdef _WIN32
 		if (_stricmp(buffer, file) == 0)
@@ -390,7 +2167,40 @@ int extract(const char* egg, const char* file)
 			fseek(fp, header.OffsetToTableOfContents + sizeof(toc) * i, SEEK_SET);
 			fread(&toc, sizeof(toc), 1, fp);
 
+			if (toc.Flags & 0x02)
+			{
+				bool ok = ExtractFromBlock(fp, header.Flags, header.Reserved, toc.Flags >> 8, toc.OffsetToFile, toc.UncompressedSizeOfFile, out);
+				if (ok == false)
+					printf("Unable to read %s out of its solid block\n", buffer);
+
+				fclose(out);
+				fclose(fp);
+				return ok ? 0 : -1;
+			}
+
 			fseek(fp, toc.OffsetToFile, SEEK_SET);
+
+			if (toc.Flags & 0x01)
+			{
+				// LZ4 blocks have to be decompressed all at once
+				char* compressed = new char[toc.CompressedSizeOfFile];
+				char* uncompressed = new char[toc.UncompressedSizeOfFile];
+
+				bool ok = fread(compressed, 1, toc.CompressedSizeOfFile, fp) == toc.CompressedSizeOfFile &&
+					LZ4_decompress_safe(compressed, uncompressed, toc.CompressedSizeOfFile, toc.UncompressedSizeOfFile) == (int)toc.UncompressedSizeOfFile;
+				if (ok)
+					fwrite(uncompressed, 1, toc.UncompressedSizeOfFile, out);
+				else
+					printf("Unable to decompress %s\n", buffer);
+
+				delete[] compressed;
+				delete[] uncompressed;
+
+				fclose(out);
+				fclose(fp);
+				return ok ? 0 : -1;
+			}
+
 			const uint32 extractBufferSize = 1024 * 4;
 			char extractBuffer[extractBufferSize];
 
@@ -421,6 +2231,140 @@ int extract(const char* egg, const char* file)
 	return -1;
 }
 
+// Reads the option at argv[arg], if it's one that build, from-tar and repack share. Returns how many
+// arguments it took up, or 0 if it isn't one of them.
+int ParseBuildOption(int argc, char* argv[], int arg, BuildOptions* options, const char** groupsPath)
+{
+	if (strcmp(argv[arg], "--trace") == 0 && arg + 1 < argc)
+	{
+		options->TracePath = argv[arg + 1];
+		Trace::Enable();
+		return 2;
+	}
+	else if (strcmp(argv[arg], "--solid") == 0 && arg + 1 < argc)
+	{
+		options->SolidBlockSize = (uint32)strtoul(argv[arg + 1], nullptr, 10);
+		return 2;
+	}
+	else if (strcmp(argv[arg], "--solid-by-dir") == 0)
+	{
+		options->SolidByDirectory = true;
+		return 1;
+	}
+	else if (strcmp(argv[arg], "--groups") == 0 && arg + 1 < argc)
+	{
+		*groupsPath = argv[arg + 1];
+		return 2;
+	}
+	else if (strcmp(argv[arg], "--cache") == 0 && arg + 1 < argc)
+	{
+		options->CacheDirectory = argv[arg + 1];
+		return 2;
+	}
+	else if (strcmp(argv[arg], "--front-coded-names") == 0)
+	{
+		options->FrontCodedNames = true;
+		return 1;
+	}
+	else if (strcmp(argv[arg], "--cache-size") == 0 && arg + 1 < argc)
+	{
+		options->CacheSize = strtoull(argv[arg + 1], nullptr, 10) * 1024 * 1024;
+		return 2;
+	}
+
+	return 0;
+}
+
+// Reads the options that build and from-tar take, leaving firstArg at the first argument that isn't one.
+// Returns false if there's one it doesn't know.
+bool ParseBuildOptions(int argc, char* argv[], int* firstArg, BuildOptions* options, const char** groupsPath)
+{
+	options->CacheSize = DefaultCacheSize;
+
+	int arg = *firstArg;
+	while (arg < argc && strncmp(argv[arg], "--", 2) == 0)
+	{
+		int used = ParseBuildOption(argc, argv, arg, options, groupsPath);
+		if (used == 0)
+		{
+			printf("Unknown option %s\n", argv[arg]);
+			return false;
+		}
+		arg += used;
+	}
+
+	*firstArg = arg;
+	return true;
+}
+
+// The same for repack, which takes some options of its own as well
+bool ParseRepackOptions(int argc, char* argv[], int* firstArg, RepackOptions* options)
+{
+	options->Build.CacheSize = DefaultCacheSize;
+	options->Recompress = RecompressStored;
+	options->Alignment = 8;
+
+	const char* groupsPath = nullptr;
+	int arg = *firstArg;
+	while (arg < argc && strncmp(argv[arg], "--", 2) == 0)
+	{
+		if (strcmp(argv[arg], "--recompress") == 0 && arg + 1 < argc)
+		{
+			if (strcmp(argv[arg + 1], "none") == 0)
+				options->Recompress = RecompressNone;
+			else if (strcmp(argv[arg + 1], "stored") == 0)
+				options->Recompress = RecompressStored;
+			else if (strcmp(argv[arg + 1], "all") == 0)
+				options->Recompress = RecompressAll;
+			else
+			{
+				printf("--recompress takes none, stored or all\n");
+				return false;
+			}
+			arg += 2;
+		}
+		else if (strcmp(argv[arg], "--order") == 0 && arg + 1 < argc)
+		{
+			options->OrderPath = argv[arg + 1];
+			arg += 2;
+		}
+		else if (strcmp(argv[arg], "--align") == 0 && arg + 1 < argc)
+		{
+			options->Alignment = (uint32)strtoul(argv[arg + 1], nullptr, 10);
+			if (options->Alignment < 8 || options->Alignment > MaxAlignment || (options->Alignment & (options->Alignment - 1)) != 0)
+			{
+				printf("--align takes a power of two from 8 to %u\n", MaxAlignment);
+				return false;
+			}
+			arg += 2;
+		}
+		else if (strcmp(argv[arg], "--keep-duplicates") == 0)
+		{
+			options->KeepDuplicates = true;
+			arg++;
+		}
+		else
+		{
+			int used = ParseBuildOption(argc, argv, arg, &options->Build, &groupsPath);
+			if (used == 0)
+			{
+				printf("Unknown option %s\n", argv[arg]);
+				return false;
+			}
+
+			if (options->Build.SolidBlockSize > 0 || options->Build.SolidByDirectory || groupsPath != nullptr)
+			{
+				printf("repack keeps the solid blocks and load groups the old egg has, so it doesn't take %s\n", argv[arg]);
+				return false;
+			}
+			arg += used;
+		}
+	}
+
+	*firstArg = arg;
+	return true;
+}
+
 int main(int argc, char* argv[])
 {	
 	const char* command = argv[1];
@@ -433,13 +2377,84 @@ int main(int argc, char* argv[])
 	
 	if (strcmp(command, "build") == 0)
 	{
-		if (argc <= 3)
+		BuildOptions options = {};
+		const char* groupsPath = nullptr;
+		std::vector<LoadGroup> groups;
+
+		int firstArg = 2;
+		if (ParseBuildOptions(argc, argv, &firstArg, &options, &groupsPath) == false)
+			goto printUsage;
+
+		eggFile = argv[firstArg];
+		if (argc <= firstArg + 1)
 		{
 			printf("The egg needs at least one file.\n");
 			goto printUsage;
 		}
 
-		return build(eggFile, &argv[3], argc - 3);
+		std::vector<const char*> inputs;
+		for (int i = firstArg + 1; i < argc; i++)
+		{
+			if (argv[i][0] == '@')
+			{
+				if (ReadInputList(argv[i] + 1, &inputs) == false)
+					return -1;
+			}
+			else
+				inputs.push_back(argv[i]);
+		}
+
+		if (groupsPath != nullptr)
+		{
+			if (ReadGroups(groupsPath, &inputs, &groups) == false)
+				return -1;
+			options.Groups = &groups;
+		}
+
+		return build(eggFile, inputs.data(), (uint32)inputs.size(), options);
+	}
+	else if (strcmp(command, "from-tar") == 0)
+	{
+		BuildOptions options = {};
+		const char* groupsPath = nullptr;
+
+		int firstArg = 2;
+		if (ParseBuildOptions(argc, argv, &firstArg, &options, &groupsPath) == false)
+			goto printUsage;
+
+		if (groupsPath != nullptr)
+		{
+			printf("--groups has to know about every file before it starts, so it doesn't work with from-tar.\n");
+			return -1;
+		}
+
+		if (firstArg >= argc)
+		{
+			printf("Where should the egg go?\n");
+			goto printUsage;
+		}
+
+		return fromTar(argv[firstArg], firstArg + 1 < argc ? argv[firstArg + 1] : "-", options);
+	}
+	else if (strcmp(command, "repack") == 0)
+	{
+		RepackOptions options = {};
+
+		int firstArg = 2;
+		if (ParseRepackOptions(argc, argv, &firstArg, &options) == false)
+			goto printUsage;
+
+		if (argc < firstArg + 2)
+		{
+			printf("repack needs the old egg and where to write the new one.\n");
+			goto printUsage;
+		}
+
+		return repack(argv[firstArg], argv[firstArg + 1], options);
+	}
+	else if (strcmp(command, "verify") == 0)
+	{
+		return verify(eggFile);
 	}
 	else if (strcmp(command, "extract") == 0)
 	{
@@ -453,7 +2468,27 @@ int main(int argc, char* argv[])
 	}
 	else if (strcmp(command, "list") == 0)
 	{
-		return list(eggFile);
+		return list(eggFile, argc > 3 ? argv[3] : nullptr);
+	}
+	else if (strcmp(command, "diff") == 0)
+	{
+		if (argc < 5)
+		{
+			printf("diff needs the old egg, the new egg and where to write the patch.\n");
+			goto printUsage;
+		}
+
+		return diff(argv[2], argv[3], argv[4]);
+	}
+	else if (strcmp(command, "patch") == 0)
+	{
+		if (argc < 5)
+		{
+			printf("patch needs the old egg, the patch and where to write the new egg.\n");
+			goto printUsage;
+		}
+
+		return patch(argv[2], argv[3], argv[4]);
 	}
 	else
 	{
@@ -463,9 +2498,37 @@ int main(int argc, char* argv[])
 
 printUsage:
 	printf("Usage:\n");
-	printf("EggArchiveBuilder build [OUTPUT] [input files]\n");
+	printf("EggArchiveBuilder build [options] [OUTPUT] [input files or @file containing a list of input files]\n");
+	printf("EggArchiveBuilder from-tar [options] [OUTPUT] [tar file, or - for stdin (the default)]\n");
+	printf("EggArchiveBuilder repack [options] [old egg] [new egg]\n");
 	printf("EggArchiveBuilder extract [egg file] [file to extract]\n");
-	printf("EggArchiveBuilder list [egg file]\n");
+	printf("EggArchiveBuilder list [egg file] [directory (optional)]\n");
+	printf("EggArchiveBuilder verify [egg file]\n");
+	printf("EggArchiveBuilder diff [old egg] [new egg] [patch file]\n");
+	printf("EggArchiveBuilder patch [old egg] [patch file] [new egg]\n");
+	printf("\n");
+	printf("Build options (from-tar takes all of them except --groups):\n");
+	printf("  --trace [file]  write a Chrome trace of where the build spent its time\n");
+	printf("  --solid [size]  pack files smaller than a quarter of size into solid blocks of about size bytes\n");
+	printf("                  that get compressed together (64K or so works well), grouped by extension\n");
+	printf("  --solid-by-dir  group the files in solid blocks by directory instead of by extension\n");
+	printf("  --groups [file] lay out load groups from a manifest so each one can be read in one go.\n");
+	printf("                  [name] starts a group, and the lines after it are the files in it\n");
+	printf("  --front-coded-names\n");
+	printf("                  store the filenames front coded, which makes the table much smaller,\n");
+	printf("                  but it takes an egg.h that knows about version 3 to read them\n");
+	printf("  --cache [dir]   keep compressed files in dir, so files that haven't changed don't get compressed again\n");
+	printf("  --cache-size [MB] prune the least recently used files from the cache once it's bigger than this (default 1024)\n");
+	printf("\n");
+	printf("Repack options (and --trace, --cache, --cache-size and --front-coded-names):\n");
+	printf("  --recompress [none|stored|all]\n");
+	printf("                  what to compress again: nothing, files and blocks that are stored uncompressed\n");
+	printf("                  (the default), or everything, decompressing what's already compressed first\n");
+	printf("  --order [file]  lay the files out in the order they're used, from a trace egg.h wrote with\n");
+	printf("                  megg_writeProfileTrace() while reading this egg, or a list of names, one per line\n");
+	printf("  --align [bytes] start every file or block at least this big on a multiple of it (default 8)\n");
+	printf("  --keep-duplicates\n");
+	printf("                  keep a copy of each file, instead of pointing files with the same contents at one\n");
 	printf("\n");
 
 	return 0;
@@ -0,0 +1,978 @@
+// EggBench generates synthetic asset corpora, packs them with EggArchiveBuilder
+// and measures how fast the results can be built, opened, searched and read.
+// Everything ends up in a JSON file so results from different releases can be compared.
+//
+// This one is POSIX only, since cold cache runs rely on posix_fadvise(). Comparing
+// EggPreload against the loose files needs Linux as well.
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <cstdint>
+#include <cerrno>
+#include <ctime>
+#include <vector>
+#include <string>
+#include <algorithm>
+#include <chrono>
+#include <thread>
+
+#include <strings.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#define MONDEGREENGAMES_EGG_IMPLEMENTATION
+#include "egg.h"
+
+typedef uint8_t uint8;
+typedef unsigned short uint16;
+typedef unsigned int uint32;
+typedef uint64_t uint64;
+
+enum Compressibility
+{
+	Compressibility_Random,  // incompressible, like already compressed audio/textures
+	Compressibility_Text,    // scripts, json, shaders
+	Compressibility_Sparse,  // mostly zeros, like uncompressed meshes/level data
+};
+
+struct CorpusDescription
+{
+	const char* Name;
+	uint32 NumFiles;
+	uint32 MinSize;
+	uint32 MaxSize;
+
+	// percent of files of each kind. Whatever is left over is Sparse.
+	uint32 PercentRandom;
+	uint32 PercentText;
+};
+
+struct Corpus
+{
+	std::string Directory;
+	std::vector<std::string> Files;
+	uint64 TotalBytes;
+};
+
+struct Percentiles
+{
+	double P50, P90, P99, P999, Max;
+};
+
+// xorshift64*, so the corpora are the same on every machine
+struct Random
+{
+	uint64 State;
+
+	uint64 Next()
+	{
+		State ^= State >> 12;
+		State ^= State << 25;
+		State ^= State >> 27;
+		return State * 2685821657736338717ULL;
+	}
+
+	uint32 Range(uint32 min, uint32 max)
+	{
+		return min + (uint32)(Next() % (uint64)(max - min + 1));
+	}
+};
+
+double now()
+{
+	using namespace std::chrono;
+	return duration_cast<duration<double>>(steady_clock::now().time_since_epoch()).count();
+}
+
+Percentiles calculatePercentiles(std::vector<double>& samples)
+{
+	Percentiles result = {};
+	if (samples.empty())
+		return result;
+
+	std::sort(samples.begin(), samples.end());
+	auto at = [&](double p) { return samples[(size_t)(p * (samples.size() - 1))]; };
+
+	result.P50 = at(0.50);
+	result.P90 = at(0.90);
+	result.P99 = at(0.99);
+	result.P999 = at(0.999);
+	result.Max = samples.back();
+	return result;
+}
+
+bool makeDirectories(const std::string& path)
+{
+	for (size_t i = 1; i <= path.size(); i++)
+	{
+		if (i == path.size() || path[i] == '/')
+		{
+			std::string partial = path.substr(0, i);
+			if (mkdir(partial.c_str(), 0755) != 0 && errno != EEXIST)
+				return false;
+		}
+	}
+
+	return true;
+}
+
+void fillBuffer(Random* rng, Compressibility kind, uint8* buffer, uint32 size)
+{
+	static const char* words[] = {
+		"texture", "mesh", "chicken", "kitten", "level", "sound", "float4", "return",
+		"{", "}", "\"position\":", "0.5f", "material", "shader", "egg", "true", "false", "null",
+		"uniform", "sampler2D", "vec3", "if", "else", "for", "while", "\n", "\t", "=", ";"
+	};
+	const uint32 numWords = sizeof(words) / sizeof(words[0]);
+
+	switch (kind)
+	{
+	case Compressibility_Random:
+		for (uint32 i = 0; i < size; i++)
+			buffer[i] = (uint8)rng->Next();
+		break;
+	case Compressibility_Text:
+	{
+		uint32 cursor = 0;
+		while (cursor < size)
+		{
+			const char* word = words[rng->Next() % numWords];
+			uint32 len = (uint32)strlen(word);
+			for (uint32 i = 0; i < len && cursor < size; i++)
+				buffer[cursor++] = (uint8)word[i];
+			if (cursor < size)
+				buffer[cursor++] = ' ';
+		}
+		break;
+	}
+	case Compressibility_Sparse:
+		memset(buffer, 0, size);
+		for (uint32 i = 0; i < size / 64; i++)
+			buffer[rng->Next() % size] = (uint8)rng->Next();
+		break;
+	}
+}
+
+bool generateCorpus(const std::string& workDirectory, const CorpusDescription& desc, Corpus* corpus)
+{
+	Random rng = { 0x9E3779B97F4A7C15ULL ^ desc.NumFiles ^ ((uint64)desc.MaxSize << 20) };
+
+	static const char* extensions[] = { "png", "ogg", "lua", "json", "mesh", "glsl", "lvl" };
+
+	corpus->Directory = workDirectory + "/" + desc.Name;
+	corpus->Files.clear();
+	corpus->TotalBytes = 0;
+
+	std::vector<uint8> buffer(desc.MaxSize);
+	for (uint32 i = 0; i < desc.NumFiles; i++)
+	{
+		char relative[256];
+		snprintf(relative, sizeof(relative), "%s/dir%02u/sub%02u/asset_%06u.%s",
+			desc.Name, i % 17, (i / 17) % 23, i, extensions[i % 7]);
+
+		std::string path = workDirectory + "/" + relative;
+		if (makeDirectories(path.substr(0, path.rfind('/'))) == false)
+		{
+			fprintf(stderr, "Unable to create directories for %s\n", path.c_str());
+			return false;
+		}
+
+		// skew towards the small end, like real asset folders
+		uint32 span = desc.MaxSize - desc.MinSize;
+		uint32 size = desc.MinSize + (uint32)((uint64)span * rng.Range(0, 1000) * rng.Range(0, 1000) / 1000000);
+
+		uint32 roll = rng.Range(0, 99);
+		Compressibility kind = roll < desc.PercentRandom ? Compressibility_Random :
+			roll < desc.PercentRandom + desc.PercentText ? Compressibility_Text : Compressibility_Sparse;
+		fillBuffer(&rng, kind, buffer.data(), size);
+
+		FILE* fp = fopen(path.c_str(), "wb");
+		if (fp == nullptr)
+		{
+			fprintf(stderr, "Unable to write %s\n", path.c_str());
+			return false;
+		}
+		fwrite(buffer.data(), 1, size, fp);
+		fclose(fp);
+
+		corpus->Files.push_back(path);
+		corpus->TotalBytes += size;
+	}
+
+	return true;
+}
+
+// Writes an egg with lots of empty entries. Building one of these from real files
+// would take forever, and we only want to see how opening scales with the entry count.
+bool writeSyntheticEgg(const char* path, uint32 numEntries)
+{
+	FILE* fp = fopen(path, "wb");
+	if (fp == nullptr)
+		return false;
+
+	const uint32 headerSize = 32;
+	uint32 offsetOfTOC = headerSize;
+	uint32 offsetOfFilenames = offsetOfTOC + numEntries * 16;
+
+	char magic[4] = { 'E', 'G', 'G', 'A' };
+	uint16 version = 1, flags = 0;
+	uint64 time = 0;
+	uint32 reserved = 0;
+	fwrite(magic, 4, 1, fp);
+	fwrite(&version, 2, 1, fp);
+	fwrite(&flags, 2, 1, fp);
+	fwrite(&time, 8, 1, fp);
+	fwrite(&numEntries, 4, 1, fp);
+	fwrite(&offsetOfFilenames, 4, 1, fp);
+	fwrite(&offsetOfTOC, 4, 1, fp);
+	fwrite(&reserved, 4, 1, fp);
+
+	uint32 toc[4] = { headerSize, 0, 0, 0 };
+	for (uint32 i = 0; i < numEntries; i++)
+		fwrite(toc, sizeof(toc), 1, fp);
+
+	// zero padded numbers sort the same way the builder would sort them
+	char name[64];
+	for (uint32 i = 0; i < numEntries; i++)
+	{
+		uint8 len = (uint8)snprintf(name, sizeof(name), "data/dir%03u/file_%08u.bin", i / 1000, i);
+		fwrite(&len, 1, 1, fp);
+		fwrite(name, len + 1, 1, fp);
+	}
+
+	fclose(fp);
+	return true;
+}
+
+struct MappedEgg
+{
+	int Fd;
+	unsigned char* Bytes;
+	uint32 Length;
+	megg_info Info;
+	std::vector<unsigned int> FilenameOffsets;
+};
+
+bool openEgg(const char* path, MappedEgg* egg)
+{
+	egg->Fd = open(path, O_RDONLY);
+	if (egg->Fd == -1)
+		return false;
+
+	struct stat sb;
+	fstat(egg->Fd, &sb);
+	egg->Length = (uint32)sb.st_size;
+
+	egg->Bytes = (unsigned char*)mmap(nullptr, egg->Length, PROT_READ, MAP_PRIVATE, egg->Fd, 0);
+	if (egg->Bytes == MAP_FAILED)
+	{
+		close(egg->Fd);
+		return false;
+	}
+
+	if (megg_getEggInfo(egg->Bytes, egg->Length, &egg->Info) != 0)
+	{
+		munmap(egg->Bytes, egg->Length);
+		close(egg->Fd);
+		return false;
+	}
+
+	egg->FilenameOffsets.resize(egg->Info.NumFiles);
+	megg_indexFilenames(&egg->Info, egg->FilenameOffsets.data());
+	return true;
+}
+
+void closeEgg(MappedEgg* egg)
+{
+	munmap(egg->Bytes, egg->Length);
+	close(egg->Fd);
+}
+
+void dropFromCache(const char* path)
+{
+	int fd = open(path, O_RDONLY);
+	if (fd == -1)
+		return;
+
+	posix_fadvise(fd, 0, 0, POSIX_FADV_DONTNEED);
+	close(fd);
+}
+
+// returns the number of bytes loaded
+uint64 loadLooseFiles(const Corpus& corpus, std::vector<uint8>& buffer)
+{
+	uint64 total = 0;
+	for (size_t i = 0; i < corpus.Files.size(); i++)
+	{
+		int fd = open(corpus.Files[i].c_str(), O_RDONLY);
+		if (fd == -1)
+			continue;
+
+		struct stat sb;
+		fstat(fd, &sb);
+		if ((size_t)sb.st_size > buffer.size())
+			buffer.resize(sb.st_size);
+
+		ssize_t r = read(fd, buffer.data(), sb.st_size);
+		if (r > 0)
+			total += r;
+		close(fd);
+	}
+
+	return total;
+}
+
+uint64 loadFromEgg(const char* eggPath, const std::vector<std::string>& names, std::vector<uint8>& buffer)
+{
+	MappedEgg egg;
+	if (openEgg(eggPath, &egg) == false)
+		return 0;
+
+	uint64 total = 0;
+	for (size_t i = 0; i < names.size(); i++)
+	{
+		int index = megg_findFile(&egg.Info, names[i].c_str());
+		if (index < 0)
+			continue;
+
+		uint32 size = egg.Info.TableOfContents[index].UncompressedSize;
+		if (size > buffer.size())
+			buffer.resize(size);
+
+		int r = megg_readFile(egg.Bytes, &egg.Info, index, buffer.data(), (uint32)buffer.size());
+		if (r > 0)
+			total += r;
+	}
+
+	closeEgg(&egg);
+	return total;
+}
+
+uint64 checksumBytes(const uint8* bytes, size_t size, uint64 checksum)
+{
+	size_t i = 0;
+	for (; i + 8 <= size; i += 8)
+	{
+		uint64 word;
+		memcpy(&word, bytes + i, 8);
+		checksum = (checksum ^ word) * 0x100000001b3ULL;
+	}
+	for (; i < size; i++)
+		checksum = (checksum ^ bytes[i]) * 0x100000001b3ULL;
+	return checksum;
+}
+
+// Loads every file in a list the way programs that don't know about eggs do, with open(), fstat(),
+// read() and close(), and prints how many bytes it got, a checksum of them, how many files it
+// couldn't open and how long it took. benchPreload() runs this in a child process, with and
+// without EggPreload.
+int loadListedFiles(const char* listPath, const char* root)
+{
+	std::vector<std::string> paths;
+	FILE* list = fopen(listPath, "rb");
+	if (list == nullptr)
+		return -1;
+
+	char line[1024];
+	while (fgets(line, sizeof(line), list) != nullptr)
+	{
+		line[strcspn(line, "\r\n")] = 0;
+		if (line[0] != 0)
+			paths.push_back(std::string(root) + "/" + line);
+	}
+	fclose(list);
+
+	std::vector<uint8> buffer;
+	uint64 total = 0, checksum = 0xcbf29ce484222325ULL;
+	uint32 failures = 0;
+	double elapsed = 0;
+	for (size_t i = 0; i < paths.size(); i++)
+	{
+		double start = now();
+		int fd = open(paths[i].c_str(), O_RDONLY);
+		if (fd == -1)
+		{
+			failures++;
+			continue;
+		}
+
+		struct stat sb;
+		fstat(fd, &sb);
+		if ((size_t)sb.st_size > buffer.size())
+			buffer.resize(sb.st_size);
+
+		ssize_t r = read(fd, buffer.data(), sb.st_size);
+		close(fd);
+		elapsed += now() - start;
+
+		if (r > 0)
+		{
+			total += r;
+			checksum = checksumBytes(buffer.data(), r, checksum);
+		}
+	}
+
+	printf("%llu %llu %u %.9f\n", (unsigned long long)total, (unsigned long long)checksum, failures, elapsed);
+	return 0;
+}
+
+struct LoadResult
+{
+	uint64 Bytes;
+	uint64 Checksum;
+	uint32 Failures;
+
+	// just the loading, and the whole child process (so EggPreload mapping the egg counts)
+	double Seconds;
+	double ProcessSeconds;
+};
+
+bool runLoader(const std::string& command, LoadResult* result)
+{
+	double start = now();
+	FILE* child = popen(command.c_str(), "r");
+	if (child == nullptr)
+		return false;
+
+	unsigned long long bytes = 0, checksum = 0;
+	int numRead = fscanf(child, "%llu %llu %u %lf", &bytes, &checksum, &result->Failures, &result->Seconds);
+	int status = pclose(child);
+	result->ProcessSeconds = now() - start;
+	result->Bytes = bytes;
+	result->Checksum = checksum;
+
+	if (numRead != 4 || status != 0)
+	{
+		fprintf(stderr, "Loading failed: %s\n", command.c_str());
+		return false;
+	}
+
+	return true;
+}
+
+// A tiny JSON writer. Just enough to keep the commas in the right places.
+struct Json
+{
+	FILE* Out;
+	int Depth;
+	bool NeedComma;
+
+	void Indent()
+	{
+		fputc('\n', Out);
+		for (int i = 0; i < Depth; i++)
+			fputs("  ", Out);
+	}
+
+	void Prefix(const char* key)
+	{
+		if (NeedComma)
+			fputc(',', Out);
+		if (Depth > 0)
+			Indent();
+		if (key != nullptr)
+			fprintf(Out, "\"%s\": ", key);
+		NeedComma = true;
+	}
+
+	void BeginObject(const char* key = nullptr) { Prefix(key); fputc('{', Out); Depth++; NeedComma = false; }
+	void EndObject() { Depth--; Indent(); fputc('}', Out); NeedComma = true; }
+	void BeginArray(const char* key = nullptr) { Prefix(key); fputc('[', Out); Depth++; NeedComma = false; }
+	void EndArray() { Depth--; Indent(); fputc(']', Out); NeedComma = true; }
+
+	void Value(const char* key, const char* value) { Prefix(key); fprintf(Out, "\"%s\"", value); }
+	void Value(const char* key, double value) { Prefix(key); fprintf(Out, "%.6g", value); }
+	void Value(const char* key, uint64 value) { Prefix(key); fprintf(Out, "%llu", (unsigned long long)value); }
+	void Value(const char* key, bool value) { Prefix(key); fputs(value ? "true" : "false", Out); }
+
+	void Value(const char* key, const Percentiles& p)
+	{
+		BeginObject(key);
+		Value("p50", p.P50);
+		Value("p90", p.P90);
+		Value("p99", p.P99);
+		Value("p999", p.P999);
+		Value("max", p.Max);
+		EndObject();
+	}
+};
+
+bool countFile(void* userData, unsigned int index)
+{
+	(*(uint32*)userData)++;
+	return true;
+}
+
+// The same loose-file loading code, run against the loose files and then with EggPreload
+// serving the same paths out of the egg
+void benchPreload(Json* json, const std::string& workDirectory, const Corpus& corpus, const std::string& eggPath,
+	const std::string& listPath, const char* preload, const char* self)
+{
+	fprintf(stderr, "Loading through EggPreload...\n");
+
+	std::string loose = std::string("\"") + self + "\" --load-files \"" + listPath + "\" \"" + workDirectory + "\"";
+	std::string preloaded = std::string("EGG_PRELOAD_EGGS=\"") + eggPath + "\" EGG_PRELOAD_PREFIX=\"" + workDirectory +
+		"\" LD_PRELOAD=\"" + preload + "\" " + loose;
+
+	json->BeginObject("preload");
+	for (int cold = 0; cold < 2; cold++)
+	{
+		LoadResult looseResult, preloadResult;
+		if (cold)
+		{
+			sync();
+			for (size_t i = 0; i < corpus.Files.size(); i++)
+				dropFromCache(corpus.Files[i].c_str());
+			dropFromCache(eggPath.c_str());
+		}
+		else
+			runLoader(loose, &looseResult);
+
+		if (runLoader(loose, &looseResult) == false)
+			break;
+
+		if (cold)
+		{
+			for (size_t i = 0; i < corpus.Files.size(); i++)
+				dropFromCache(corpus.Files[i].c_str());
+			dropFromCache(eggPath.c_str());
+		}
+		else
+			runLoader(preloaded, &preloadResult);
+
+		if (runLoader(preloaded, &preloadResult) == false)
+			break;
+
+		json->BeginObject(cold ? "cold" : "warm");
+		json->Value("loose_seconds", looseResult.Seconds);
+		json->Value("preload_seconds", preloadResult.Seconds);
+		json->Value("loose_process_seconds", looseResult.ProcessSeconds);
+		json->Value("preload_process_seconds", preloadResult.ProcessSeconds);
+		json->Value("loose_bytes", looseResult.Bytes);
+		json->Value("preload_bytes", preloadResult.Bytes);
+		json->Value("failures", (uint64)(looseResult.Failures + preloadResult.Failures));
+		json->Value("contents_match", looseResult.Checksum == preloadResult.Checksum && looseResult.Bytes == preloadResult.Bytes);
+		json->Value("speedup", preloadResult.Seconds > 0 ? looseResult.Seconds / preloadResult.Seconds : 0.0);
+		json->EndObject();
+	}
+	json->EndObject();
+}
+
+void benchCorpus(Json* json, const std::string& workDirectory, const char* builder, const char* preload, const char* self,
+	const CorpusDescription& desc)
+{
+	fprintf(stderr, "Generating %s (%u files)...\n", desc.Name, desc.NumFiles);
+
+	Corpus corpus;
+	if (generateCorpus(workDirectory, desc, &corpus) == false)
+		return;
+
+	// the builder stores names exactly as it gets them, so hand it paths relative to the work directory
+	std::vector<std::string> names;
+	std::string listPath = workDirectory + "/" + desc.Name + ".txt";
+	FILE* list = fopen(listPath.c_str(), "wb");
+	for (size_t i = 0; i < corpus.Files.size(); i++)
+	{
+		names.push_back(corpus.Files[i].substr(workDirectory.size() + 1));
+		fprintf(list, "%s\n", names.back().c_str());
+	}
+	fclose(list);
+
+	std::string eggName = std::string(desc.Name) + ".egg";
+	std::string eggPath = workDirectory + "/" + eggName;
+
+	json->BeginObject();
+	json->Value("name", desc.Name);
+	json->Value("files", (uint64)desc.NumFiles);
+	json->Value("bytes", corpus.TotalBytes);
+
+	// build
+	{
+		fprintf(stderr, "Building %s...\n", eggName.c_str());
+
+		std::string command = std::string("cd \"") + workDirectory + "\" && \"" + builder + "\" build \"" +
+			eggName + "\" @" + desc.Name + ".txt > /dev/null";
+
+		double start = now();
+		int r = system(command.c_str());
+		double elapsed = now() - start;
+
+		struct stat sb;
+		if (r != 0 || stat(eggPath.c_str(), &sb) != 0)
+		{
+			fprintf(stderr, "Build failed: %s\n", command.c_str());
+			json->EndObject();
+			return;
+		}
+
+		json->BeginObject("build");
+		json->Value("seconds", elapsed);
+		json->Value("input_mb_per_second", corpus.TotalBytes / elapsed / (1024.0 * 1024.0));
+		json->Value("files_per_second", desc.NumFiles / elapsed);
+		json->Value("output_bytes", (uint64)sb.st_size);
+		json->Value("ratio", (double)sb.st_size / (double)corpus.TotalBytes);
+		json->EndObject();
+	}
+
+	MappedEgg egg;
+	if (openEgg(eggPath.c_str(), &egg) == false)
+	{
+		fprintf(stderr, "Unable to open %s\n", eggPath.c_str());
+		json->EndObject();
+		return;
+	}
+
+	// name lookups, in a random order so we don't just measure the branch predictor
+	{
+		std::vector<uint32> order(names.size());
+		for (uint32 i = 0; i < order.size(); i++)
+			order[i] = i;
+		Random rng = { 12345 };
+		for (size_t i = order.size(); i > 1; i--)
+			std::swap(order[i - 1], order[rng.Next() % i]);
+
+		std::vector<double> samples;
+		samples.reserve(order.size());
+		uint32 misses = 0;
+		for (size_t i = 0; i < order.size(); i++)
+		{
+			double start = now();
+			int index = megg_findFile(&egg.Info, names[order[i]].c_str());
+			samples.push_back((now() - start) * 1e9);
+
+			if (index < 0)
+				misses++;
+		}
+
+		json->BeginObject("lookup");
+		json->Value("count", (uint64)samples.size());
+		json->Value("misses", (uint64)misses);
+		json->Value("nanoseconds", calculatePercentiles(samples));
+		json->EndObject();
+	}
+
+	// listing each directory through the DIRS section, against checking every name for the directory
+	{
+		std::vector<double> indexedSamples, scanSamples;
+		uint32 numListed = 0, numScanned = 0;
+		char buffer[MEGG_MAX_FILENAME];
+		for (uint32 d = 0; d < 17; d++)
+		{
+			for (uint32 s = 0; s < 23; s++)
+			{
+				char path[128];
+				snprintf(path, sizeof(path), "%s/dir%02u/sub%02u/", desc.Name, d, s);
+
+				double start = now();
+				int count = megg_enumerateDirectory(egg.Bytes, &egg.Info, path, false, countFile, &numListed);
+				indexedSamples.push_back((now() - start) * 1e6);
+				if (count < 0)
+				{
+					indexedSamples.pop_back();
+					continue;
+				}
+
+				size_t length = strlen(path);
+				start = now();
+				for (uint32 i = 0; i < egg.Info.NumFiles; i++)
+				{
+					const char* name = megg_getFilename(&egg.Info, i, buffer);
+					if (strncasecmp(name, path, length) == 0 && strchr(name + length, '/') == nullptr)
+						numScanned++;
+				}
+				scanSamples.push_back((now() - start) * 1e6);
+			}
+		}
+
+		json->BeginObject("list_directory");
+		json->Value("directories", (uint64)indexedSamples.size());
+		json->Value("files", (uint64)numListed);
+		json->Value("mismatches", (uint64)(numListed > numScanned ? numListed - numScanned : numScanned - numListed));
+		json->Value("indexed_microseconds", calculatePercentiles(indexedSamples));
+		json->Value("scan_microseconds", calculatePercentiles(scanSamples));
+		json->EndObject();
+	}
+
+	// read every entry, keeping stored and compressed entries apart
+	{
+		std::vector<uint8> buffer;
+		double storedTime = 0, compressedTime = 0;
+		uint64 storedBytes = 0, compressedBytes = 0, compressedInputBytes = 0;
+		uint32 numCompressed = 0, failures = 0;
+		std::vector<double> samples;
+
+		for (uint32 i = 0; i < egg.Info.NumFiles; i++)
+		{
+			const megg_info::TOC& toc = egg.Info.TableOfContents[i];
+			if (toc.UncompressedSize > buffer.size())
+				buffer.resize(toc.UncompressedSize);
+
+			double start = now();
+			int r = megg_readFile(egg.Bytes, &egg.Info, i, buffer.data(), (uint32)buffer.size());
+			double elapsed = now() - start;
+			samples.push_back(elapsed * 1e6);
+
+			if (r < 0)
+				failures++;
+			else if (toc.Flags & 0x03)
+			{
+				compressedTime += elapsed;
+				compressedBytes += r;
+				compressedInputBytes += toc.CompressedSize;
+				numCompressed++;
+			}
+			else
+			{
+				storedTime += elapsed;
+				storedBytes += r;
+			}
+		}
+
+		const double mb = 1024.0 * 1024.0;
+		json->BeginObject("read");
+		json->Value("entries", (uint64)egg.Info.NumFiles);
+		json->Value("compressed_entries", (uint64)numCompressed);
+		json->Value("failures", (uint64)failures);
+		json->Value("stored_mb_per_second", storedTime > 0 ? storedBytes / storedTime / mb : 0.0);
+		json->Value("decompress_mb_per_second", compressedTime > 0 ? compressedBytes / compressedTime / mb : 0.0);
+		json->Value("decompress_input_mb_per_second", compressedTime > 0 ? compressedInputBytes / compressedTime / mb : 0.0);
+		json->Value("overall_mb_per_second", (storedBytes + compressedBytes) / (storedTime + compressedTime) / mb);
+		json->Value("microseconds_per_entry", calculatePercentiles(samples));
+		json->EndObject();
+	}
+
+	closeEgg(&egg);
+
+	// loading everything: loose files versus the egg
+	{
+		std::vector<uint8> buffer;
+		json->BeginObject("load");
+
+		for (int cold = 0; cold < 2; cold++)
+		{
+			if (cold)
+			{
+				// make sure nothing is dirty, otherwise DONTNEED leaves it in the cache
+				sync();
+				for (size_t i = 0; i < corpus.Files.size(); i++)
+					dropFromCache(corpus.Files[i].c_str());
+			}
+			else
+				loadLooseFiles(corpus, buffer);
+
+			double start = now();
+			uint64 looseBytes = loadLooseFiles(corpus, buffer);
+			double looseTime = now() - start;
+
+			if (cold)
+				dropFromCache(eggPath.c_str());
+			else
+				loadFromEgg(eggPath.c_str(), names, buffer);
+
+			start = now();
+			uint64 eggBytes = loadFromEgg(eggPath.c_str(), names, buffer);
+			double eggTime = now() - start;
+
+			json->BeginObject(cold ? "cold" : "warm");
+			json->Value("loose_seconds", looseTime);
+			json->Value("egg_seconds", eggTime);
+			json->Value("loose_bytes", looseBytes);
+			json->Value("egg_bytes", eggBytes);
+			json->Value("speedup", eggTime > 0 ? looseTime / eggTime : 0.0);
+			json->EndObject();
+		}
+
+		json->EndObject();
+	}
+
+	if (preload[0] != 0)
+		benchPreload(json, workDirectory, corpus, eggPath, listPath, preload, self);
+
+	json->EndObject();
+}
+
+void benchOpenScaling(Json* json, const std::string& workDirectory, bool quick)
+{
+	const uint32 counts[] = { 1000, 10000, 100000, 1000000 };
+	const int numCounts = quick ? 3 : 4;
+
+	json->BeginArray("open_scaling");
+	for (int i = 0; i < numCounts; i++)
+	{
+		char path[512];
+		snprintf(path, sizeof(path), "%s/synthetic_%u.egg", workDirectory.c_str(), counts[i]);
+		fprintf(stderr, "Opening an egg with %u entries...\n", counts[i]);
+
+		if (writeSyntheticEgg(path, counts[i]) == false)
+			continue;
+
+		const int repeats = 9;
+		std::vector<double> openTimes, indexTimes;
+		for (int r = 0; r < repeats; r++)
+		{
+			double start = now();
+			int fd = open(path, O_RDONLY);
+			struct stat sb;
+			fstat(fd, &sb);
+			unsigned char* bytes = (unsigned char*)mmap(nullptr, sb.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+			megg_info info;
+			int result = megg_getEggInfo(bytes, (unsigned int)sb.st_size, &info);
+			double opened = now();
+
+			std::vector<unsigned int> offsets(info.NumFiles);
+			if (result == 0)
+				megg_indexFilenames(&info, offsets.data());
+			double indexed = now();
+
+			munmap(bytes, sb.st_size);
+			close(fd);
+
+			if (result == 0)
+			{
+				openTimes.push_back((opened - start) * 1e6);
+				indexTimes.push_back((indexed - opened) * 1e6);
+			}
+		}
+
+		json->BeginObject();
+		json->Value("entries", (uint64)counts[i]);
+		json->Value("open_microseconds", calculatePercentiles(openTimes).P50);
+		json->Value("index_microseconds", calculatePercentiles(indexTimes).P50);
+		json->EndObject();
+	}
+	json->EndArray();
+}
+
+void printUsage()
+{
+	printf("Usage:\n");
+	printf("EggBench [options]\n");
+	printf("  --out [file]      write the JSON results here instead of stdout\n");
+	printf("  --work [dir]      where to put the generated corpora (default: bench_work)\n");
+	printf("  --builder [path]  the EggArchiveBuilder to measure (default: ../EggArchiveBuilder/EggArchiveBuilder)\n");
+	printf("  --scale [n]       multiplies the number of files in each corpus (default: 1)\n");
+	printf("  --preload [path]  the EggPreload library to compare against the loose files (default: ../EggPreload/libeggpreload.so)\n");
+	printf("  --quick           smaller corpora, for a quick sanity check\n");
+	printf("\n");
+}
+
+int main(int argc, char* argv[])
+{
+	const char* outputPath = nullptr;
+	std::string workDirectory = "bench_work";
+	std::string builder = "../EggArchiveBuilder/EggArchiveBuilder";
+	std::string preload = "../EggPreload/libeggpreload.so";
+	double scale = 1.0;
+	bool quick = false;
+
+	// what benchPreload() runs in the child processes
+	if (argc == 4 && strcmp(argv[1], "--load-files") == 0)
+		return loadListedFiles(argv[2], argv[3]);
+
+	for (int i = 1; i < argc; i++)
+	{
+		if (strcmp(argv[i], "--out") == 0 && i + 1 < argc)
+			outputPath = argv[++i];
+		else if (strcmp(argv[i], "--work") == 0 && i + 1 < argc)
+			workDirectory = argv[++i];
+		else if (strcmp(argv[i], "--builder") == 0 && i + 1 < argc)
+			builder = argv[++i];
+		else if (strcmp(argv[i], "--preload") == 0 && i + 1 < argc)
+			preload = argv[++i];
+		else if (strcmp(argv[i], "--scale") == 0 && i + 1 < argc)
+			scale = atof(argv[++i]);
+		else if (strcmp(argv[i], "--quick") == 0)
+			quick = true;
+		else
+		{
+			printUsage();
+			return -1;
+		}
+	}
+
+	if (quick)
+		scale *= 0.1;
+
+	// the builder gets run from inside the work directory
+	char resolved[4096];
+	if (realpath(builder.c_str(), resolved) == nullptr)
+	{
+		printf("Unable to find the builder at %s\n", builder.c_str());
+		return -1;
+	}
+	builder = resolved;
+
+	if (makeDirectories(workDirectory) == false)
+	{
+		printf("Unable to create %s\n", workDirectory.c_str());
+		return -1;
+	}
+
+	// EggPreload gets pointed at the work directory, and the children load from it with absolute paths
+	if (realpath(workDirectory.c_str(), resolved) != nullptr)
+		workDirectory = resolved;
+
+	// the preload comparison is skipped if there's no library, or no way to run ourselves again
+	char self[4096];
+	ssize_t selfLength = readlink("/proc/self/exe", self, sizeof(self) - 1);
+	self[selfLength > 0 ? selfLength : 0] = 0;
+	if (selfLength > 0 && realpath(preload.c_str(), resolved) != nullptr)
+		preload = resolved;
+	else
+	{
+		fprintf(stderr, "Not comparing EggPreload against the loose files, since %s isn't there\n", preload.c_str());
+		preload.clear();
+	}
+
+	CorpusDescription corpora[] = {
+		// name            files    min      max              random text
+		{ "tiny_text",     20000,   64,      2 * 1024,        10,    80 },
+		{ "small_mixed",   10000,   1024,    64 * 1024,       40,    40 },
+		{ "large_mixed",   500,     64 * 1024, 4 * 1024 * 1024, 50,  25 },
+		{ "incompressible", 2000,   1024,    256 * 1024,      100,   0 },
+	};
+	const int numCorpora = sizeof(corpora) / sizeof(corpora[0]);
+	for (int i = 0; i < numCorpora; i++)
+	{
+		corpora[i].NumFiles = (uint32)(corpora[i].NumFiles * scale);
+		if (corpora[i].NumFiles < 1)
+			corpora[i].NumFiles = 1;
+	}
+
+	FILE* out = stdout;
+	if (outputPath != nullptr)
+	{
+		out = fopen(outputPath, "wb");
+		if (out == nullptr)
+		{
+			printf("Unable to open %s for writing\n", outputPath);
+			return -1;
+		}
+	}
+
+	Json json = { out, 0, false };
+	json.BeginObject();
+	json.Value("format_version", (uint64)1);
+	json.Value("timestamp", (uint64)time(nullptr));
+	json.Value("hardware_threads", (uint64)std::thread::hardware_concurrency());
+	json.Value("scale", scale);
+
+	json.BeginArray("corpora");
+	for (int i = 0; i < numCorpora; i++)
+		benchCorpus(&json, workDirectory, builder.c_str(), preload.c_str(), self, corpora[i]);
+	json.EndArray();
+
+	benchOpenScaling(&json, workDirectory, quick);
+
+	json.EndObject();
+	fputc('\n', out);
+
+	if (out != stdout)
+		fclose(out);
+
+	return 0;
+}
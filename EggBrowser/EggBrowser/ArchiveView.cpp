@@ -0,0 +1,476 @@
+#include "ArchiveView.h"
+#include "egg.h"
+#include <algorithm>
+#include <thread>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define ARCHIVEVIEW_SSE2
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+#endif
+
+namespace
+{
+	// below this much work per thread it's not worth starting threads
+	const unsigned int MinFilesPerThread = 32 * 1024;
+	const unsigned int MaxThreads = 16;
+
+	unsigned int getNumThreads(size_t count)
+	{
+		unsigned int numThreads = std::thread::hardware_concurrency();
+		if (numThreads > MaxThreads)
+			numThreads = MaxThreads;
+		if (numThreads > count / MinFilesPerThread)
+			numThreads = (unsigned int)(count / MinFilesPerThread);
+
+		return numThreads > 0 ? numThreads : 1;
+	}
+
+	// Calls func(0) through func(count - 1), each on its own thread (except the
+	// last one, which runs on this thread), and waits for them all.
+	template<typename F>
+	void runThreads(unsigned int count, const F& func)
+	{
+		std::vector<std::thread> threads;
+		for (unsigned int i = 0; i + 1 < count; i++)
+			threads.push_back(std::thread(func, i));
+
+		if (count > 0)
+			func(count - 1);
+
+		for (size_t i = 0; i < threads.size(); i++)
+			threads[i].join();
+	}
+
+	struct SortEntry
+	{
+		uint32_t Key;
+		unsigned int File;
+	};
+
+	// A stable LSD radix sort, a byte at a time. Each thread counts and then scatters its
+	// own share of the entries, so the result is the same however many threads there are.
+	// Passes where every key has the same byte are skipped, so small keys are cheap.
+	void radixSort(std::vector<SortEntry>& entries)
+	{
+		size_t count = entries.size();
+		unsigned int numThreads = getNumThreads(count);
+
+		std::vector<size_t> bounds(numThreads + 1);
+		for (unsigned int i = 0; i <= numThreads; i++)
+			bounds[i] = count * i / numThreads;
+
+		// a pass is pointless if every key has the same byte there
+		uint32_t differences = 0;
+		for (size_t i = 1; i < count; i++)
+			differences |= entries[i].Key ^ entries[0].Key;
+
+		std::vector<SortEntry> sorted(count);
+		std::vector<size_t> offsets(numThreads * 256);
+		for (int shift = 0; shift < 32; shift += 8)
+		{
+			if (((differences >> shift) & 0xff) == 0)
+				continue;
+
+			runThreads(numThreads, [&](unsigned int i) {
+				size_t* threadCounts = &offsets[i * 256];
+				for (int digit = 0; digit < 256; digit++)
+					threadCounts[digit] = 0;
+				for (size_t j = bounds[i]; j < bounds[i + 1]; j++)
+					threadCounts[(entries[j].Key >> shift) & 0xff]++;
+			});
+
+			// turn the counts into where each thread's entries with each digit go
+			size_t total = 0;
+			for (int digit = 0; digit < 256; digit++)
+			{
+				for (unsigned int i = 0; i < numThreads; i++)
+				{
+					size_t threadCount = offsets[i * 256 + digit];
+					offsets[i * 256 + digit] = total;
+					total += threadCount;
+				}
+			}
+
+			runThreads(numThreads, [&](unsigned int i) {
+				size_t* threadOffsets = &offsets[i * 256];
+				for (size_t j = bounds[i]; j < bounds[i + 1]; j++)
+					sorted[threadOffsets[(entries[j].Key >> shift) & 0xff]++] = entries[j];
+			});
+
+			entries.swap(sorted);
+		}
+	}
+
+	uint32_t getSortKey(const megg_info::TOC& toc, ArchiveColumn column)
+	{
+		switch (column)
+		{
+		case ArchiveColumn_Size:
+			return toc.UncompressedSize;
+		case ArchiveColumn_CompressedSize:
+			return toc.CompressedSize;
+		case ArchiveColumn_Ratio:
+		{
+			// empty files and files in solid blocks don't have a ratio, so they go at the end
+			if (toc.UncompressedSize == 0 || (toc.Flags & 0x02))
+				return UINT32_MAX;
+
+			uint64_t ratio = ((uint64_t)toc.CompressedSize << 16) / toc.UncompressedSize;
+			return ratio < UINT32_MAX ? (uint32_t)ratio : UINT32_MAX - 1;
+		}
+		case ArchiveColumn_Compression:
+			return toc.Flags & 0x03;
+		default:
+			return 0;
+		}
+	}
+
+	// The order sortFiles() puts files in, for merging more of them in later
+	struct RowOrder
+	{
+		const megg_info* Info;
+		ArchiveColumn Column;
+		bool Descending;
+
+		bool operator()(unsigned int a, unsigned int b) const
+		{
+			if (Column == ArchiveColumn_Name)
+				return Descending ? a > b : a < b;
+
+			uint32_t keyA = getSortKey(Info->TableOfContents[a], Column);
+			uint32_t keyB = getSortKey(Info->TableOfContents[b], Column);
+			if (Descending)
+			{
+				keyA = ~keyA;
+				keyB = ~keyB;
+			}
+
+			return keyA != keyB ? keyA < keyB : a < b;
+		}
+	};
+
+	// Same case folding as the name comparison in egg.h
+	inline char toLower(char c)
+	{
+		return (c >= 'A' && c <= 'Z') ? c + ('a' - 'A') : c;
+	}
+
+	inline bool equalsNoCase(const char* text, const char* lowerNeedle, size_t length)
+	{
+		for (size_t i = 0; i < length; i++)
+		{
+			if (toLower(text[i]) != lowerNeedle[i])
+				return false;
+		}
+
+		return true;
+	}
+
+	inline int countTrailingZeros(unsigned int mask)
+	{
+#ifdef _MSC_VER
+		unsigned long index;
+		_BitScanForward(&index, mask);
+		return (int)index;
+#else
+		return __builtin_ctz(mask);
+#endif
+	}
+
+	// Finds the first place in [text, end) that contains the needle, ignoring case.
+	// The needle must already be lower case and can't be empty.
+	const char* findNoCase(const char* text, const char* end, const char* lowerNeedle, size_t length)
+	{
+		if ((size_t)(end - text) < length)
+			return nullptr;
+
+		// the last place a match could start
+		const char* last = end - length;
+
+		char first = lowerNeedle[0];
+		char firstUpper = (first >= 'a' && first <= 'z') ? first - ('a' - 'A') : first;
+
+#ifdef ARCHIVEVIEW_SSE2
+		// Look for places where the first and last characters of the needle both match,
+		// 16 at a time, and only compare the whole thing there.
+		char lastChar = lowerNeedle[length - 1];
+		char lastCharUpper = (lastChar >= 'a' && lastChar <= 'z') ? lastChar - ('a' - 'A') : lastChar;
+
+		const __m128i firstLower16 = _mm_set1_epi8(first);
+		const __m128i firstUpper16 = _mm_set1_epi8(firstUpper);
+		const __m128i lastLower16 = _mm_set1_epi8(lastChar);
+		const __m128i lastUpper16 = _mm_set1_epi8(lastCharUpper);
+
+		while (last - text >= 15)
+		{
+			__m128i starts = _mm_loadu_si128((const __m128i*)text);
+			__m128i ends = _mm_loadu_si128((const __m128i*)(text + length - 1));
+
+			__m128i startMatches = _mm_or_si128(_mm_cmpeq_epi8(starts, firstLower16), _mm_cmpeq_epi8(starts, firstUpper16));
+			__m128i endMatches = _mm_or_si128(_mm_cmpeq_epi8(ends, lastLower16), _mm_cmpeq_epi8(ends, lastUpper16));
+
+			unsigned int mask = (unsigned int)_mm_movemask_epi8(_mm_and_si128(startMatches, endMatches));
+			while (mask != 0)
+			{
+				int i = countTrailingZeros(mask);
+				if (equalsNoCase(text + i, lowerNeedle, length))
+					return text + i;
+
+				mask &= mask - 1;
+			}
+
+			text += 16;
+		}
+#endif
+
+		for (; text <= last; text++)
+		{
+			if ((*text == first || *text == firstUpper) && equalsNoCase(text, lowerNeedle, length))
+				return text;
+		}
+
+		return nullptr;
+	}
+
+	// Marks the files in [firstFile, lastFile) whose names contain the needle. The names are
+	// next to each other in the archive, so this searches straight through all of them at once
+	// and then works out which file each match landed in.
+	void scanNames(const megg_info* info, const unsigned int* filenameOffsets, unsigned int firstFile, unsigned int lastFile,
+		const char* lowerNeedle, size_t length, uint8_t* matches)
+	{
+		if (firstFile >= lastFile)
+			return;
+
+		const char* names = (const char*)info->Filenames;
+		const megg_info::Filename* lastName = &info->Filenames[filenameOffsets[lastFile - 1]];
+		const char* end = lastName->Name + lastName->Length;
+
+		// A match can't run from one name into the next, since the needle never contains
+		// the null terminator. It can start on a length byte though, so those get skipped.
+		unsigned int file = firstFile;
+		const char* cursor = names + filenameOffsets[file];
+		while ((cursor = findNoCase(cursor, end, lowerNeedle, length)) != nullptr)
+		{
+			while (file + 1 < lastFile && names + filenameOffsets[file + 1] <= cursor)
+				file++;
+
+			const char* name = info->Filenames[filenameOffsets[file]].Name;
+			if (cursor < name)
+			{
+				cursor = name;
+				continue;
+			}
+
+			matches[file] = 1;
+
+			// no need to look at the rest of this name
+			if (++file >= lastFile)
+				break;
+			cursor = names + filenameOffsets[file];
+		}
+	}
+}
+
+ArchiveView::ArchiveView()
+{
+	m_info = nullptr;
+	m_filenameOffsets = nullptr;
+	m_numFiles = 0;
+	m_sortColumn = ArchiveColumn_Name;
+	m_descending = false;
+}
+
+void ArchiveView::Reset()
+{
+	m_info = nullptr;
+	m_filenameOffsets = nullptr;
+	m_numFiles = 0;
+
+	m_order.clear();
+	m_matches.clear();
+	m_rows.clear();
+}
+
+void ArchiveView::Update(const megg_info* info, const unsigned int* filenameOffsets, unsigned int numFiles)
+{
+	if (info == m_info && filenameOffsets == m_filenameOffsets && numFiles == m_numFiles)
+		return;
+
+	// while the archive loads it only gets more files, so only those need sorting and filtering
+	if (info == m_info && filenameOffsets == m_filenameOffsets && numFiles > m_numFiles)
+	{
+		unsigned int first = m_numFiles;
+		m_numFiles = numFiles;
+		addFiles(first);
+		return;
+	}
+
+	m_info = info;
+	m_filenameOffsets = filenameOffsets;
+	m_numFiles = numFiles;
+
+	sort();
+	filter(false);
+	buildRows();
+}
+
+void ArchiveView::SetSort(ArchiveColumn column, bool descending)
+{
+	if (column == m_sortColumn && descending == m_descending)
+		return;
+
+	m_sortColumn = column;
+	m_descending = descending;
+
+	sort();
+	buildRows();
+}
+
+void ArchiveView::SetFilter(const char* text)
+{
+	std::string lower(text);
+	for (size_t i = 0; i < lower.size(); i++)
+		lower[i] = toLower(lower[i]);
+
+	if (lower == m_filter)
+		return;
+
+	// anything that matches the new filter matched the old one too
+	bool refine = m_filter.empty() == false && lower.find(m_filter) != std::string::npos;
+
+	m_filter = lower;
+	filter(refine);
+	buildRows();
+}
+
+int ArchiveView::FindRow(unsigned int file)
+{
+	std::vector<unsigned int>::iterator row = std::find(m_rows.begin(), m_rows.end(), file);
+	if (row == m_rows.end())
+		return -1;
+
+	return (int)(row - m_rows.begin());
+}
+
+void ArchiveView::sort()
+{
+	m_order.resize(m_numFiles);
+	sortFiles(0, m_numFiles, m_order.data());
+}
+
+void ArchiveView::sortFiles(unsigned int first, unsigned int last, unsigned int* order)
+{
+	unsigned int count = last - first;
+
+	// the archive is already in name order
+	if (m_sortColumn == ArchiveColumn_Name)
+	{
+		for (unsigned int i = 0; i < count; i++)
+			order[i] = m_descending ? last - 1 - i : first + i;
+
+		return;
+	}
+
+	// the sort is stable, so files with the same key stay in name order
+	std::vector<SortEntry> entries(count);
+	for (unsigned int i = 0; i < count; i++)
+	{
+		uint32_t key = getSortKey(m_info->TableOfContents[first + i], m_sortColumn);
+		entries[i].Key = m_descending ? ~key : key;
+		entries[i].File = first + i;
+	}
+
+	radixSort(entries);
+
+	for (unsigned int i = 0; i < count; i++)
+		order[i] = entries[i].File;
+}
+
+void ArchiveView::addFiles(unsigned int first)
+{
+	size_t numSorted = m_order.size();
+	m_order.resize(m_numFiles);
+	sortFiles(first, m_numFiles, &m_order[numSorted]);
+
+	if (m_filter.empty())
+		m_matches.resize(m_numFiles, 1);
+	else
+	{
+		m_matches.resize(m_numFiles, 0);
+		matchFiles(first, m_numFiles);
+	}
+
+	// the new rows are sorted the same way as the old ones, so both get merged in
+	size_t numRows = m_rows.size();
+	for (size_t i = numSorted; i < m_order.size(); i++)
+	{
+		if (m_matches[m_order[i]] != 0)
+			m_rows.push_back(m_order[i]);
+	}
+
+	RowOrder rowOrder = { m_info, m_sortColumn, m_descending };
+	std::inplace_merge(m_order.begin(), m_order.begin() + numSorted, m_order.end(), rowOrder);
+	std::inplace_merge(m_rows.begin(), m_rows.begin() + numRows, m_rows.end(), rowOrder);
+}
+
+void ArchiveView::filter(bool refine)
+{
+	if (m_filter.empty() || m_numFiles == 0)
+	{
+		m_matches.assign(m_numFiles, 1);
+		return;
+	}
+
+	const char* needle = m_filter.c_str();
+	size_t length = m_filter.size();
+
+	if (refine)
+	{
+		// only what's showing now can still match
+		unsigned int numThreads = getNumThreads(m_rows.size());
+		runThreads(numThreads, [&](unsigned int i) {
+			size_t first = m_rows.size() * i / numThreads;
+			size_t last = m_rows.size() * (i + 1) / numThreads;
+
+			for (size_t j = first; j < last; j++)
+			{
+				const megg_info::Filename* name = &m_info->Filenames[m_filenameOffsets[m_rows[j]]];
+				if (findNoCase(name->Name, name->Name + name->Length, needle, length) == nullptr)
+					m_matches[m_rows[j]] = 0;
+			}
+		});
+
+		return;
+	}
+
+	m_matches.assign(m_numFiles, 0);
+	matchFiles(0, m_numFiles);
+}
+
+void ArchiveView::matchFiles(unsigned int first, unsigned int last)
+{
+	const char* needle = m_filter.c_str();
+	size_t length = m_filter.size();
+
+	unsigned int count = last - first;
+	unsigned int numThreads = getNumThreads(count);
+	runThreads(numThreads, [&](unsigned int i) {
+		unsigned int threadFirst = first + (unsigned int)((uint64_t)count * i / numThreads);
+		unsigned int threadLast = first + (unsigned int)((uint64_t)count * (i + 1) / numThreads);
+
+		scanNames(m_info, m_filenameOffsets, threadFirst, threadLast, needle, length, &m_matches[0]);
+	});
+}
+
+void ArchiveView::buildRows()
+{
+	m_rows.clear();
+	for (unsigned int i = 0; i < m_numFiles; i++)
+	{
+		if (m_matches[m_order[i]] != 0)
+			m_rows.push_back(m_order[i]);
+	}
+}
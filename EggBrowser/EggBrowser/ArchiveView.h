@@ -0,0 +1,86 @@
+#ifndef ARCHIVEVIEW_H
+#define ARCHIVEVIEW_H
+
+#include <vector>
+#include <string>
+#include <stdint.h>
+
+struct megg_info;
+
+enum ArchiveColumn
+{
+	ArchiveColumn_Name,
+	ArchiveColumn_Size,
+	ArchiveColumn_CompressedSize,
+	ArchiveColumn_Ratio,
+	ArchiveColumn_Compression,
+
+	ArchiveColumn_Count
+};
+
+// The order the files of an archive are shown in. It's a permutation of the file
+// indices, sorted by one of the columns and then cut down to the files whose names
+// contain the filter text (case-insensitive).
+//
+// Files are stored sorted by name, so that order costs nothing. Everything else is
+// radix sorted in parallel. Filtering scans the name table directly, and if the new filter
+// contains the old one only the rows that already matched get looked at again.
+// While an archive loads, only the files that are new get sorted and filtered, and
+// then they're merged into the rows that are already there.
+class ArchiveView
+{
+public:
+	ArchiveView();
+
+	void Reset();
+
+	// Rebuilds the view over the first numFiles files. filenameOffsets is where each
+	// name starts, like megg_info::FilenameOffsets. Does nothing if nothing changed,
+	// and only adds the new files if it's the same archive with more of them.
+	void Update(const megg_info* info, const unsigned int* filenameOffsets, unsigned int numFiles);
+
+	void SetSort(ArchiveColumn column, bool descending);
+	void SetFilter(const char* text);
+
+	ArchiveColumn GetSortColumn() { return m_sortColumn; }
+	bool IsSortDescending() { return m_descending; }
+
+	unsigned int GetNumFiles() { return m_numFiles; }
+	unsigned int GetNumRows() { return (unsigned int)m_rows.size(); }
+	unsigned int GetFile(unsigned int row) { return m_rows[row]; }
+
+	// Returns the row the file is shown on, or -1 if it's been filtered out
+	int FindRow(unsigned int file);
+
+private:
+	void sort();
+	// sorts files [first, last) into order
+	void sortFiles(unsigned int first, unsigned int last, unsigned int* order);
+	// sorts, filters and merges in the files from first on
+	void addFiles(unsigned int first);
+	void filter(bool refine);
+	// marks which of files [first, last) match the filter
+	void matchFiles(unsigned int first, unsigned int last);
+	void buildRows();
+
+	const megg_info* m_info;
+	const unsigned int* m_filenameOffsets;
+	unsigned int m_numFiles;
+
+	ArchiveColumn m_sortColumn;
+	bool m_descending;
+
+	// lower case
+	std::string m_filter;
+
+	// every file, sorted
+	std::vector<unsigned int> m_order;
+
+	// one per file, non-zero if it matches the filter
+	std::vector<uint8_t> m_matches;
+
+	// what's actually shown
+	std::vector<unsigned int> m_rows;
+};
+
+#endif // ARCHIVEVIEW_H
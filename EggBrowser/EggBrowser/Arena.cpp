@@ -0,0 +1,93 @@
+#include "Arena.h"
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdint.h>
+
+Arena::Arena(size_t blockSize)
+{
+	m_first = nullptr;
+	m_current = nullptr;
+	m_blockSize = blockSize;
+}
+
+Arena::~Arena()
+{
+	Release();
+}
+
+void* Arena::Allocate(size_t size, size_t alignment)
+{
+	while (true)
+	{
+		if (m_current != nullptr)
+		{
+			uintptr_t base = (uintptr_t)(m_current + 1);
+			uintptr_t start = (base + m_current->Used + alignment - 1) & ~(uintptr_t)(alignment - 1);
+			if (start + size <= base + m_current->Size)
+			{
+				m_current->Used = start + size - base;
+				return (void*)start;
+			}
+
+			// try the next block, if there's one left over from before a reset
+			if (m_current->Next != nullptr)
+			{
+				m_current = m_current->Next;
+				m_current->Used = 0;
+				continue;
+			}
+		}
+
+		size_t blockSize = size + alignment > m_blockSize ? size + alignment : m_blockSize;
+		Block* block = (Block*)new unsigned char[sizeof(Block) + blockSize];
+		block->Next = nullptr;
+		block->Size = blockSize;
+		block->Used = 0;
+
+		if (m_current == nullptr)
+			m_first = block;
+		else
+			m_current->Next = block;
+		m_current = block;
+	}
+}
+
+const char* Arena::Format(const char* format, ...)
+{
+	va_list args;
+	va_start(args, format);
+	int length = vsnprintf(nullptr, 0, format, args);
+	va_end(args);
+
+	if (length < 0)
+		return "";
+
+	char* result = (char*)Allocate(length + 1, 1);
+
+	va_start(args, format);
+	vsnprintf(result, length + 1, format, args);
+	va_end(args);
+
+	return result;
+}
+
+void Arena::Reset()
+{
+	m_current = m_first;
+	if (m_current != nullptr)
+		m_current->Used = 0;
+}
+
+void Arena::Release()
+{
+	Block* block = m_first;
+	while (block != nullptr)
+	{
+		Block* next = block->Next;
+		delete[] (unsigned char*)block;
+		block = next;
+	}
+
+	m_first = nullptr;
+	m_current = nullptr;
+}
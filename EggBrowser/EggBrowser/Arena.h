@@ -0,0 +1,43 @@
+#ifndef ARENA_H
+#define ARENA_H
+
+#include <stddef.h>
+
+// A simple bump allocator. Everything allocated from it goes away at once when it's reset.
+class Arena
+{
+public:
+	Arena(size_t blockSize = 64 * 1024);
+	~Arena();
+
+	void* Allocate(size_t size, size_t alignment = 8);
+
+	template<typename T>
+	T* Allocate(size_t count)
+	{
+		return (T*)Allocate(sizeof(T) * count, alignof(T));
+	}
+
+	// printf() into the arena
+	const char* Format(const char* format, ...);
+
+	// Forgets about everything that's been allocated. The memory is kept around for next time.
+	void Reset();
+
+	// Like Reset(), but gives the memory back too
+	void Release();
+
+private:
+	struct Block
+	{
+		Block* Next;
+		size_t Size;
+		size_t Used;
+	};
+
+	Block* m_first;
+	Block* m_current;
+	size_t m_blockSize;
+};
+
+#endif // ARENA_H
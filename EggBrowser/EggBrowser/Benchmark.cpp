@@ -0,0 +1,273 @@
+#include "Benchmark.h"
+#include "egg.h"
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <utility>
+
+// how far apart the bytes that get touched to page in a file are
+const unsigned int PageInStride = 4096;
+
+// how often the worker wakes up the UI, at most
+const unsigned long long WakeIntervalNanoseconds = 16 * 1000 * 1000;
+
+static unsigned long long nanosecondsNow()
+{
+	using namespace std::chrono;
+	return (unsigned long long)duration_cast<nanoseconds>(steady_clock::now().time_since_epoch()).count();
+}
+
+static void addTime(BenchmarkTimes* times, unsigned long long nanoseconds, unsigned long long bytes)
+{
+	times->TotalNanoseconds += nanoseconds;
+	times->Bytes += bytes;
+	if (nanoseconds > times->MaxNanoseconds)
+		times->MaxNanoseconds = nanoseconds;
+
+	int bucket = 0;
+	while (bucket < 31 && (nanoseconds >> (bucket + 1)) != 0)
+		bucket++;
+	times->Histogram[bucket]++;
+}
+
+Benchmark::Benchmark()
+{
+	m_fileBytes = nullptr;
+	m_info = nullptr;
+	m_wake = nullptr;
+	m_hasResults = false;
+	m_running = false;
+	m_cancelRequested = false;
+	m_numDone = 0;
+}
+
+Benchmark::~Benchmark()
+{
+	Cancel();
+	Wait();
+}
+
+void Benchmark::Start(const unsigned char* fileBytes, const megg_info* info, const std::vector<unsigned int>& files, void (*wake)())
+{
+	Cancel();
+	Wait();
+
+	m_fileBytes = fileBytes;
+	m_info = info;
+	m_wake = wake;
+	m_files = files;
+	m_hasResults = false;
+	m_cancelRequested = false;
+	m_numDone = 0;
+
+	m_running = true;
+	m_thread = std::thread(&Benchmark::work, this);
+}
+
+void Benchmark::Cancel()
+{
+	m_cancelRequested = true;
+}
+
+void Benchmark::Wait()
+{
+	if (m_thread.joinable())
+		m_thread.join();
+}
+
+void Benchmark::Reset()
+{
+	Cancel();
+	Wait();
+
+	m_hasResults = false;
+	m_results = BenchmarkResults();
+	m_files.clear();
+	m_numDone = 0;
+}
+
+bool Benchmark::IsRunning()
+{
+	if (m_thread.joinable() == false)
+		return false;
+
+	if (m_running.load(std::memory_order_acquire))
+		return true;
+
+	Wait();
+	return false;
+}
+
+void Benchmark::work()
+{
+	BenchmarkResults results = {};
+	results.NumFiles = (unsigned int)m_files.size();
+	results.Entries.reserve(m_files.size());
+
+	const megg_info::TOC* toc = m_info->TableOfContents;
+
+	// one buffer that's big enough for anything, so allocating doesn't get timed
+	unsigned int largest = 1;
+	for (size_t i = 0; i < m_files.size(); i++)
+	{
+		if (toc[m_files[i]].UncompressedSize > largest)
+			largest = toc[m_files[i]].UncompressedSize;
+	}
+	std::vector<unsigned char> buffer(largest);
+
+	// what's read while paging things in goes here so it can't be optimized away
+	volatile unsigned char sink = 0;
+
+	megg_block_cache cache;
+	megg_initBlockCache(&cache);
+
+	unsigned long long start = nanosecondsNow();
+	unsigned long long lastWake = start;
+
+	for (size_t i = 0; i < m_files.size(); i++)
+	{
+		if (m_cancelRequested.load(std::memory_order_relaxed))
+			break;
+
+		unsigned int file = m_files[i];
+		const char* name = m_info->Filenames[m_info->FilenameOffsets[file]].Name;
+
+		// the file's compressed bytes, or the whole solid block it's in
+		unsigned int spanOffset = 0, compressedSize = 0;
+		megg_getFileSpan(m_info, file, &spanOffset, &compressedSize);
+		const unsigned char* contents = m_fileBytes + spanOffset;
+
+		BenchmarkEntry entry;
+		entry.File = file;
+
+		unsigned long long before = nanosecondsNow();
+		int found = megg_findFile(m_info, name);
+		unsigned long long afterLookup = nanosecondsNow();
+
+		unsigned char touched = 0;
+		for (unsigned int offset = 0; offset < compressedSize; offset += PageInStride)
+			touched ^= contents[offset];
+		if (compressedSize > 0)
+			touched ^= contents[compressedSize - 1];
+		sink = sink ^ touched;
+		unsigned long long afterPageIn = nanosecondsNow();
+
+		int bytesRead = megg_readFileCached(m_fileBytes, m_info, &cache, file, &buffer[0], (unsigned int)buffer.size());
+		unsigned long long afterRead = nanosecondsNow();
+
+		if (found != (int)file || bytesRead != (int)toc[file].UncompressedSize)
+			results.NumFailed++;
+
+		entry.Nanoseconds[BenchmarkPhase_Lookup] = afterLookup - before;
+		entry.Nanoseconds[BenchmarkPhase_PageIn] = afterPageIn - afterLookup;
+		entry.Nanoseconds[BenchmarkPhase_Decompress] = afterRead - afterPageIn;
+		results.Entries.push_back(entry);
+
+		addTime(&results.Phases[BenchmarkPhase_Lookup], entry.Nanoseconds[BenchmarkPhase_Lookup], 0);
+		addTime(&results.Phases[BenchmarkPhase_PageIn], entry.Nanoseconds[BenchmarkPhase_PageIn], compressedSize);
+		addTime(&results.Phases[BenchmarkPhase_Decompress], entry.Nanoseconds[BenchmarkPhase_Decompress], toc[file].UncompressedSize);
+
+		m_numDone.store((unsigned int)i + 1, std::memory_order_relaxed);
+		if (m_wake != nullptr && afterRead - lastWake >= WakeIntervalNanoseconds)
+		{
+			m_wake();
+			lastWake = afterRead;
+		}
+	}
+
+	results.Seconds = (nanosecondsNow() - start) / 1000000000.0;
+
+	megg_freeBlockCache(&cache);
+
+	if (m_cancelRequested == false)
+	{
+		size_t numSlowest = results.Entries.size() < NumSlowest ? results.Entries.size() : NumSlowest;
+		results.Slowest.resize(numSlowest);
+		std::partial_sort_copy(results.Entries.begin(), results.Entries.end(), results.Slowest.begin(), results.Slowest.end(),
+			[](const BenchmarkEntry& a, const BenchmarkEntry& b) { return a.Nanoseconds[BenchmarkPhase_Decompress] > b.Nanoseconds[BenchmarkPhase_Decompress]; });
+
+		m_results = std::move(results);
+		m_hasResults = true;
+	}
+
+	m_running.store(false, std::memory_order_release);
+	if (m_wake != nullptr)
+		m_wake();
+}
+
+static void writeJsonString(FILE* fp, const char* text)
+{
+	fputc('"', fp);
+	for (const unsigned char* c = (const unsigned char*)text; *c != 0; c++)
+	{
+		if (*c == '"' || *c == '\\')
+			fprintf(fp, "\\%c", *c);
+		else if (*c < 0x20)
+			fprintf(fp, "\\u%04x", *c);
+		else
+			fputc(*c, fp);
+	}
+	fputc('"', fp);
+}
+
+static void writeJsonEntry(FILE* fp, const megg_info* info, const BenchmarkEntry& entry)
+{
+	const megg_info::TOC& toc = info->TableOfContents[entry.File];
+
+	fprintf(fp, "{\"entry\":%u,\"name\":", entry.File);
+	writeJsonString(fp, info->Filenames[info->FilenameOffsets[entry.File]].Name);
+	fprintf(fp, ",\"compressedSize\":%u,\"uncompressedSize\":%u,\"lookupNanoseconds\":%llu,\"pageInNanoseconds\":%llu,\"decompressNanoseconds\":%llu}",
+		toc.CompressedSize, toc.UncompressedSize,
+		entry.Nanoseconds[BenchmarkPhase_Lookup], entry.Nanoseconds[BenchmarkPhase_PageIn], entry.Nanoseconds[BenchmarkPhase_Decompress]);
+}
+
+bool Benchmark::WriteJson(const char* path, const char* archivePath)
+{
+	if (m_hasResults == false)
+		return false;
+
+#ifdef _MSC_VER
+	FILE* fp;
+	fopen_s(&fp, path, "wb");
+#else
+	FILE* fp = fopen(path, "wb");
+#endif
+	if (fp == nullptr)
+		return false;
+
+	static const char* phaseNames[] = { "lookup", "pageIn", "decompress" };
+
+	fprintf(fp, "{\n\"archive\":");
+	writeJsonString(fp, archivePath != nullptr ? archivePath : "");
+	fprintf(fp, ",\n\"files\":%u,\n\"failed\":%u,\n\"seconds\":%.6f,\n\"phases\":{\n", m_results.NumFiles, m_results.NumFailed, m_results.Seconds);
+
+	for (int i = 0; i < BenchmarkPhase_Count; i++)
+	{
+		const BenchmarkTimes& times = m_results.Phases[i];
+		double megabytesPerSecond = times.TotalNanoseconds > 0 ? times.Bytes / (times.TotalNanoseconds / 1000000000.0) / (1024.0 * 1024.0) : 0;
+
+		fprintf(fp, "%s\"%s\":{\"totalNanoseconds\":%llu,\"maxNanoseconds\":%llu,\"bytes\":%llu,\"megabytesPerSecond\":%.3f,\"histogram\":[",
+			i == 0 ? "" : ",\n", phaseNames[i], times.TotalNanoseconds, times.MaxNanoseconds, times.Bytes, megabytesPerSecond);
+		for (int j = 0; j < 32; j++)
+			fprintf(fp, "%s%u", j == 0 ? "" : ",", times.Histogram[j]);
+		fprintf(fp, "]}");
+	}
+
+	fprintf(fp, "\n},\n\"slowest\":[\n");
+	for (size_t i = 0; i < m_results.Slowest.size(); i++)
+	{
+		fprintf(fp, "%s", i == 0 ? "" : ",\n");
+		writeJsonEntry(fp, m_info, m_results.Slowest[i]);
+	}
+
+	fprintf(fp, "\n],\n\"entries\":[\n");
+	for (size_t i = 0; i < m_results.Entries.size(); i++)
+	{
+		fprintf(fp, "%s", i == 0 ? "" : ",\n");
+		writeJsonEntry(fp, m_info, m_results.Entries[i]);
+	}
+	fprintf(fp, "\n]\n}\n");
+
+	return fclose(fp) == 0;
+}
@@ -0,0 +1,111 @@
+#ifndef BENCHMARK_H
+#define BENCHMARK_H
+
+#include <vector>
+#include <thread>
+#include <atomic>
+#include <stdint.h>
+
+struct megg_info;
+
+enum BenchmarkPhase
+{
+	// megg_findFile() on the file's name
+	BenchmarkPhase_Lookup,
+
+	// touching every page of the compressed data (or the solid block it's in), so the OS has to bring it in
+	BenchmarkPhase_PageIn,
+
+	// megg_readFileCached()
+	BenchmarkPhase_Decompress,
+
+	BenchmarkPhase_Count
+};
+
+struct BenchmarkTimes
+{
+	unsigned long long TotalNanoseconds;
+	unsigned long long MaxNanoseconds;
+	unsigned long long Bytes;
+
+	// Histogram[i] counts the files that took at least 2^i (but less than 2^(i+1)) nanoseconds
+	unsigned int Histogram[32];
+};
+
+struct BenchmarkEntry
+{
+	unsigned int File;
+	unsigned long long Nanoseconds[BenchmarkPhase_Count];
+};
+
+struct BenchmarkResults
+{
+	unsigned int NumFiles;
+	unsigned int NumFailed;
+	double Seconds;
+	BenchmarkTimes Phases[BenchmarkPhase_Count];
+
+	// every file, in the order they were read
+	std::vector<BenchmarkEntry> Entries;
+
+	// the files that took longest to decompress, slowest first
+	std::vector<BenchmarkEntry> Slowest;
+};
+
+// Times how long it takes to get files out of an archive, going through egg.h the same way the game does.
+//
+// Each file is looked up by name, its compressed bytes are paged in, and then it's read with
+// megg_readFileCached(), keeping a block cache the way the game would. Everything happens on one worker thread, one file at a time, so the
+// timings aren't muddied by anything else the benchmark is doing.
+class Benchmark
+{
+public:
+	Benchmark();
+	~Benchmark();
+
+	// fileBytes and info have to stay valid until IsRunning() returns false. info needs
+	// FilenameOffsets. wake gets called every so often while it runs, and once at the end.
+	void Start(const unsigned char* fileBytes, const megg_info* info, const std::vector<unsigned int>& files, void (*wake)());
+
+	// Stops after the file that's being timed now. Doesn't wait for that.
+	void Cancel();
+	void Wait();
+
+	// stops and throws away the results
+	void Reset();
+
+	// Returns true while it's still going. Once it's finished it waits for the thread.
+	bool IsRunning();
+
+	bool HasResults() { return m_hasResults; }
+	bool WasCancelled() { return m_cancelRequested; }
+	unsigned int GetNumDone() { return m_numDone; }
+	unsigned int GetNumFiles() { return (unsigned int)m_files.size(); }
+
+	// Only valid once IsRunning() returns false and HasResults() returns true
+	const BenchmarkResults& GetResults() { return m_results; }
+
+	// Writes the results as JSON. Returns false if the file couldn't be written.
+	bool WriteJson(const char* path, const char* archivePath);
+
+	// how many of the slowest files get kept
+	static const unsigned int NumSlowest = 20;
+
+private:
+	void work();
+
+	const unsigned char* m_fileBytes;
+	const megg_info* m_info;
+	void (*m_wake)();
+
+	std::vector<unsigned int> m_files;
+	BenchmarkResults m_results;
+	bool m_hasResults;
+
+	std::thread m_thread;
+	std::atomic<bool> m_running;
+	std::atomic<bool> m_cancelRequested;
+	std::atomic<unsigned int> m_numDone;
+};
+
+#endif // BENCHMARK_H
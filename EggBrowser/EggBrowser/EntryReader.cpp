@@ -0,0 +1,329 @@
+#include "EntryReader.h"
+#include <string.h>
+
+EntryReader::EntryReader()
+{
+	m_fileBytes = nullptr;
+	m_toc = nullptr;
+	m_blockFileRead = false;
+	m_useCounter = 0;
+	m_window = nullptr;
+	m_windowPage = -1;
+	m_budget = 0;
+	m_targetPage = 0;
+}
+
+EntryReader::~EntryReader()
+{
+	Close();
+
+	for (size_t i = 0; i < m_pages.size(); i++)
+		delete[] m_pages[i].Data;
+	delete[] m_window;
+}
+
+void EntryReader::Open(const unsigned char* fileBytes, const megg_info* info, unsigned int index)
+{
+	Close();
+
+	const megg_info::TOC* toc = &info->TableOfContents[index];
+	m_fileBytes = fileBytes;
+	m_toc = toc;
+
+	if (toc->Flags & 0x02)
+	{
+		m_blockFile.resize(toc->UncompressedSize);
+		m_blockFileRead = megg_readFile(fileBytes, info, index, m_blockFile.data(), toc->UncompressedSize) == (int)toc->UncompressedSize;
+	}
+	else if (toc->Flags & 0x01)
+	{
+		Cursor start = {};
+		m_pageStarts.push_back(start);
+
+		if (m_window == nullptr)
+			m_window = new unsigned char[PageSize * 2];
+	}
+}
+
+void EntryReader::Close()
+{
+	m_fileBytes = nullptr;
+	m_toc = nullptr;
+	m_blockFile.clear();
+	m_blockFileRead = false;
+	m_pageStarts.clear();
+	m_windowPage = -1;
+	m_targetPage = 0;
+
+	// hang on to the memory for the next file
+	for (size_t i = 0; i < m_pages.size(); i++)
+		m_pages[i].LastUsed = 0;
+}
+
+EntryReader::Result EntryReader::Read(unsigned int offset, unsigned int size, void* destination, unsigned int* bytesRead)
+{
+	*bytesRead = 0;
+	if (m_toc == nullptr || offset >= m_toc->UncompressedSize)
+		return Result_OK;
+
+	if (size > m_toc->UncompressedSize - offset)
+		size = m_toc->UncompressedSize - offset;
+
+	if (m_toc->Flags & 0x02)
+	{
+		if (m_blockFileRead == false)
+			return Result_Error;
+
+		memcpy(destination, m_blockFile.data() + offset, size);
+		*bytesRead = size;
+		return Result_OK;
+	}
+
+	if ((m_toc->Flags & 0x01) == 0)
+	{
+		memcpy(destination, m_fileBytes + m_toc->FileContentOffset + offset, size);
+		*bytesRead = size;
+		return Result_OK;
+	}
+
+	m_budget = MaxBytesPerRead;
+
+	unsigned int end = offset + size;
+	unsigned char* cursor = (unsigned char*)destination;
+	while (offset < end)
+	{
+		unsigned int pageOffset = offset % PageSize;
+		unsigned int count = PageSize - pageOffset;
+		if (count > end - offset)
+			count = end - offset;
+
+		const unsigned char* page;
+		Result r = getPage(offset / PageSize, &page);
+		if (r != Result_OK)
+			return r;
+
+		memcpy(cursor, page + pageOffset, count);
+		cursor += count;
+		offset += count;
+		*bytesRead += count;
+	}
+
+	return Result_OK;
+}
+
+float EntryReader::GetProgress()
+{
+	return (float)(m_windowPage + 1) / (m_targetPage + 1);
+}
+
+EntryReader::Result EntryReader::getPage(unsigned int index, const unsigned char** data)
+{
+	Page* page = findPage(index);
+	if (page != nullptr)
+	{
+		page->LastUsed = ++m_useCounter;
+		*data = page->Data;
+		return Result_OK;
+	}
+
+	if (m_windowPage == (int)index)
+	{
+		*data = m_window + PageSize;
+		return Result_OK;
+	}
+
+	m_targetPage = index;
+
+	// Start from the closest page before this one that we know how to get to,
+	// and that we still have the page before it for
+	unsigned int start = index < m_pageStarts.size() - 1 ? index : (unsigned int)m_pageStarts.size() - 1;
+	for (; start > 0; start--)
+	{
+		if (m_windowPage == (int)start - 1)
+			break;
+
+		Page* previous = findPage(start - 1);
+		if (previous != nullptr)
+		{
+			memcpy(m_window + PageSize, previous->Data, PageSize);
+			m_windowPage = (int)start - 1;
+			break;
+		}
+	}
+
+	for (unsigned int i = start; i <= index; i++)
+	{
+		if (m_budget < PageSize)
+			return Result_Pending;
+		m_budget -= PageSize;
+
+		if (decodePage(i) == false)
+			return Result_Error;
+
+		if (i == index || i % CacheEveryNthPage == 0)
+			cachePage(i, m_window + PageSize);
+	}
+
+	*data = m_window + PageSize;
+	return Result_OK;
+}
+
+bool EntryReader::decodePage(unsigned int index)
+{
+	// the page before this one becomes the history
+	if (index > 0)
+		memcpy(m_window, m_window + PageSize, PageSize);
+
+	const unsigned char* in = m_fileBytes + m_toc->FileContentOffset;
+	unsigned int inSize = m_toc->CompressedSize;
+
+	unsigned int pageStart = index * PageSize;
+	unsigned int limit = m_toc->UncompressedSize - pageStart < PageSize ? m_toc->UncompressedSize - pageStart : PageSize;
+	unsigned char* out = m_window + PageSize;
+	unsigned int produced = 0;
+
+	Cursor c = m_pageStarts[index];
+	while (produced < limit)
+	{
+		switch (c.Phase)
+		{
+		case Phase_Token:
+		{
+			if (c.In >= inSize)
+				return false;
+
+			unsigned char token = in[c.In++];
+			unsigned int length = token >> 4;
+			if (length == 15)
+			{
+				unsigned char b;
+				do
+				{
+					if (c.In >= inSize || length > inSize)
+						return false;
+					b = in[c.In++];
+					length += b;
+				} while (b == 255);
+			}
+
+			c.Literals = length;
+			c.MatchToken = token & 15;
+			c.Phase = Phase_Literals;
+			break;
+		}
+		case Phase_Literals:
+		{
+			unsigned int count = c.Literals < limit - produced ? c.Literals : limit - produced;
+			if (count > inSize - c.In)
+				return false;
+
+			memcpy(out + produced, in + c.In, count);
+			c.In += count;
+			c.Out += count;
+			c.Literals -= count;
+			produced += count;
+
+			if (c.Literals == 0)
+				c.Phase = Phase_MatchHeader;
+			break;
+		}
+		case Phase_MatchHeader:
+		{
+			// the last sequence doesn't have a match, so running out here means the file is too short
+			if (inSize - c.In < 2)
+				return false;
+
+			c.MatchOffset = in[c.In] | (in[c.In + 1] << 8);
+			c.In += 2;
+			if (c.MatchOffset == 0 || c.MatchOffset > c.Out)
+				return false;
+
+			unsigned int length = c.MatchToken;
+			if (length == 15)
+			{
+				unsigned char b;
+				do
+				{
+					if (c.In >= inSize || length > m_toc->UncompressedSize)
+						return false;
+					b = in[c.In++];
+					length += b;
+				} while (b == 255);
+			}
+
+			c.Match = length + 4;
+			c.Phase = Phase_Match;
+			break;
+		}
+		case Phase_Match:
+		{
+			unsigned int count = c.Match < limit - produced ? c.Match : limit - produced;
+
+			// matches can reach back into the previous page, which is right before this one in the window
+			unsigned char* dest = out + produced;
+			const unsigned char* source = dest - c.MatchOffset;
+			if (c.MatchOffset >= count)
+				memcpy(dest, source, count);
+			else
+			{
+				for (unsigned int i = 0; i < count; i++)
+					dest[i] = source[i];
+			}
+
+			c.Out += count;
+			c.Match -= count;
+			produced += count;
+
+			if (c.Match == 0)
+				c.Phase = Phase_Token;
+			break;
+		}
+		}
+	}
+
+	if (index + 1 == m_pageStarts.size())
+		m_pageStarts.push_back(c);
+	m_windowPage = (int)index;
+
+	return true;
+}
+
+EntryReader::Page* EntryReader::findPage(unsigned int index)
+{
+	for (size_t i = 0; i < m_pages.size(); i++)
+	{
+		if (m_pages[i].LastUsed != 0 && m_pages[i].Index == index)
+			return &m_pages[i];
+	}
+
+	return nullptr;
+}
+
+void EntryReader::cachePage(unsigned int index, const unsigned char* data)
+{
+	Page* page = findPage(index);
+	if (page == nullptr)
+	{
+		if (m_pages.size() < MaxCachedPages)
+		{
+			Page newPage;
+			newPage.Data = new unsigned char[PageSize];
+			m_pages.push_back(newPage);
+			page = &m_pages.back();
+		}
+		else
+		{
+			// throw out whatever was used longest ago (unused pages have LastUsed == 0)
+			page = &m_pages[0];
+			for (size_t i = 1; i < m_pages.size(); i++)
+			{
+				if (m_pages[i].LastUsed < page->LastUsed)
+					page = &m_pages[i];
+			}
+		}
+	}
+
+	page->Index = index;
+	page->LastUsed = ++m_useCounter;
+	memcpy(page->Data, data, PageSize);
+}
@@ -0,0 +1,110 @@
+#ifndef ENTRYREADER_H
+#define ENTRYREADER_H
+
+#include <vector>
+#include <stdint.h>
+#include "egg.h"
+
+// Reads pieces of one file in an archive without decompressing (or copying) the whole thing.
+//
+// Stored files are read straight out of the mapping. LZ4 files are a single block, so there's
+// no jumping into the middle of one: everything before a byte has to be decompressed to get
+// to it. The decoder here can stop anywhere and carry on later though. It remembers its state
+// at the start of every page it passes, so it can restart from any page that's still cached
+// instead of from the beginning, and it only does a bounded amount of work per call so
+// scrolling through a huge file never stalls. Decompressed pages go in a small LRU cache.
+// Files in solid blocks are small, so they're just read whole when they're opened.
+class EntryReader
+{
+public:
+	enum Result
+	{
+		Result_OK,
+
+		// ran out of time before getting there. Call again next frame.
+		Result_Pending,
+
+		// the compressed data is bad
+		Result_Error
+	};
+
+	EntryReader();
+	~EntryReader();
+
+	// fileBytes and info have to stay valid until Close() or the next Open()
+	void Open(const unsigned char* fileBytes, const megg_info* info, unsigned int index);
+	void Close();
+
+	bool IsOpen() { return m_toc != nullptr; }
+	unsigned int GetSize() { return m_toc != nullptr ? m_toc->UncompressedSize : 0; }
+
+	// Copies up to size bytes starting at offset into destination, stopping at the end of the file
+	Result Read(unsigned int offset, unsigned int size, void* destination, unsigned int* bytesRead);
+
+	// How far the last pending Read() got, from 0 to 1
+	float GetProgress();
+
+	static const unsigned int PageSize = 64 * 1024;
+	static const unsigned int MaxCachedPages = 256;
+
+	// Pages skipped over on the way to somewhere else are only cached this often.
+	// That's still enough to restart from without going back too far.
+	static const unsigned int CacheEveryNthPage = 16;
+
+	// how much gets decompressed in one call to Read()
+	static const unsigned int MaxBytesPerRead = 64 * 1024 * 1024;
+
+private:
+	enum Phase
+	{
+		Phase_Token,
+		Phase_Literals,
+		Phase_MatchHeader,
+		Phase_Match
+	};
+
+	// everything needed to pick up decoding in the middle of the block
+	struct Cursor
+	{
+		unsigned int In;
+		unsigned int Out;
+		unsigned int Literals;
+		unsigned int Match;
+		unsigned int MatchOffset;
+		unsigned char MatchToken;
+		unsigned char Phase;
+	};
+
+	struct Page
+	{
+		unsigned int Index;
+		uint64_t LastUsed;
+		unsigned char* Data;
+	};
+
+	Result getPage(unsigned int index, const unsigned char** data);
+	bool decodePage(unsigned int index);
+	Page* findPage(unsigned int index);
+	void cachePage(unsigned int index, const unsigned char* data);
+
+	const unsigned char* m_fileBytes;
+	const megg_info::TOC* m_toc;
+
+	// the whole file, if it's in a solid block, or empty if it couldn't be read
+	std::vector<unsigned char> m_blockFile;
+	bool m_blockFileRead;
+
+	// m_pageStarts[i] is where the decoder was when it reached page i
+	std::vector<Cursor> m_pageStarts;
+	std::vector<Page> m_pages;
+	uint64_t m_useCounter;
+
+	// the page that's just been decoded follows the one before it, since matches can reach back into it
+	unsigned char* m_window;
+	int m_windowPage;
+
+	unsigned int m_budget;
+	unsigned int m_targetPage;
+};
+
+#endif // ENTRYREADER_H
@@ -0,0 +1,221 @@
+#include "Extractor.h"
+#include "FileSystem.h"
+#include "egg.h"
+#include <cstdio>
+#include <cstring>
+
+// how often the threads wake up the UI, at most
+const long long WakeIntervalMilliseconds = 16;
+
+static long long millisecondsNow()
+{
+	using namespace std::chrono;
+	return (long long)duration_cast<milliseconds>(steady_clock::now().time_since_epoch()).count();
+}
+
+// Names come out of the archive, so make sure they can't end up outside the directory
+static bool isSafePath(const char* name)
+{
+	if (name[0] == 0 || name[0] == '/' || name[0] == '\\' || strchr(name, ':') != nullptr)
+		return false;
+
+	const char* component = name;
+	for (const char* c = name; ; c++)
+	{
+		if (*c == '/' || *c == '\\' || *c == 0)
+		{
+			if (c - component == 2 && component[0] == '.' && component[1] == '.')
+				return false;
+			if (*c == 0)
+				return true;
+
+			component = c + 1;
+		}
+	}
+}
+
+Extractor::Extractor()
+{
+	m_fileBytes = nullptr;
+	m_info = nullptr;
+	m_filenameOffsets = nullptr;
+	m_wake = nullptr;
+	m_seconds = 0;
+	m_next = 0;
+	m_numDone = 0;
+	m_numFailed = 0;
+	m_numRunning = 0;
+	m_bytesWritten = 0;
+	m_cancelRequested = false;
+	m_lastWake = 0;
+}
+
+Extractor::~Extractor()
+{
+	Cancel();
+	Wait();
+}
+
+void Extractor::Start(const unsigned char* fileBytes, const megg_info* info, const unsigned int* filenameOffsets,
+	const std::vector<unsigned int>& files, const char* directory, void (*wake)())
+{
+	Cancel();
+	Wait();
+
+	m_fileBytes = fileBytes;
+	m_info = info;
+	m_filenameOffsets = filenameOffsets;
+	m_wake = wake;
+	m_files = files;
+	m_directory = directory;
+
+	m_next = 0;
+	m_numDone = 0;
+	m_numFailed = 0;
+	m_bytesWritten = 0;
+	m_cancelRequested = false;
+	m_lastWake = 0;
+	m_startTime = std::chrono::steady_clock::now();
+	m_seconds = 0;
+
+	// leave a core for the UI
+	unsigned int numThreads = std::thread::hardware_concurrency();
+	numThreads = numThreads > 1 ? numThreads - 1 : 1;
+	if (numThreads > m_files.size())
+		numThreads = (unsigned int)m_files.size();
+	if (numThreads == 0)
+		numThreads = 1;
+
+	m_numRunning = numThreads;
+	for (unsigned int i = 0; i < numThreads; i++)
+		m_threads.push_back(std::thread(&Extractor::work, this));
+}
+
+void Extractor::Cancel()
+{
+	m_cancelRequested = true;
+}
+
+void Extractor::Wait()
+{
+	if (m_threads.empty())
+		return;
+
+	for (size_t i = 0; i < m_threads.size(); i++)
+		m_threads[i].join();
+	m_threads.clear();
+
+	m_seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - m_startTime).count();
+}
+
+bool Extractor::IsRunning()
+{
+	if (m_threads.empty())
+		return false;
+
+	if (m_numRunning.load(std::memory_order_acquire) > 0)
+		return true;
+
+	Wait();
+	return false;
+}
+
+Extractor::Progress Extractor::GetProgress()
+{
+	Progress progress;
+	progress.NumFiles = (unsigned int)m_files.size();
+	progress.NumDone = m_numDone;
+	progress.NumFailed = m_numFailed;
+	progress.BytesWritten = m_bytesWritten;
+	progress.Cancelled = m_cancelRequested;
+
+	if (m_threads.empty())
+		progress.Seconds = m_seconds;
+	else
+		progress.Seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - m_startTime).count();
+
+	return progress;
+}
+
+void Extractor::work()
+{
+	std::string path;
+	std::vector<unsigned char> buffer;
+
+	megg_block_cache cache;
+	megg_initBlockCache(&cache);
+
+	while (m_cancelRequested.load(std::memory_order_relaxed) == false)
+	{
+		unsigned int i = m_next.fetch_add(1, std::memory_order_relaxed);
+		if (i >= m_files.size())
+			break;
+
+		if (extractFile(m_files[i], &path, &buffer, &cache) == false)
+			m_numFailed++;
+		m_numDone++;
+
+		maybeWake();
+	}
+
+	megg_freeBlockCache(&cache);
+
+	// the last one out lets the UI know it's over
+	if (m_numRunning.fetch_sub(1, std::memory_order_acq_rel) == 1 && m_wake != nullptr)
+		m_wake();
+}
+
+bool Extractor::extractFile(unsigned int file, std::string* path, std::vector<unsigned char>* buffer, megg_block_cache* cache)
+{
+	const megg_info::TOC& toc = m_info->TableOfContents[file];
+	const char* name = m_info->Filenames[m_filenameOffsets[file]].Name;
+	if (isSafePath(name) == false)
+		return false;
+
+	*path = m_directory;
+	path->push_back('/');
+	path->append(name);
+	if (FileSystem::CreateDirectories(path->c_str()) == false)
+		return false;
+
+	// stored files don't need to go anywhere first. Compressed ones and ones in solid blocks do.
+	const unsigned char* contents = m_fileBytes + toc.FileContentOffset;
+	if (toc.Flags & 0x03)
+	{
+		if (buffer->size() < toc.UncompressedSize + 1)
+			buffer->resize(toc.UncompressedSize + 1);
+		if (megg_readFileCached(m_fileBytes, m_info, cache, file, &(*buffer)[0], toc.UncompressedSize) != (int)toc.UncompressedSize)
+			return false;
+
+		contents = &(*buffer)[0];
+	}
+
+#ifdef _MSC_VER
+	FILE* fp;
+	fopen_s(&fp, path->c_str(), "wb");
+#else
+	FILE* fp = fopen(path->c_str(), "wb");
+#endif
+	bool ok = false;
+	if (fp != nullptr)
+	{
+		ok = fwrite(contents, 1, toc.UncompressedSize, fp) == toc.UncompressedSize;
+		ok = fclose(fp) == 0 && ok;
+	}
+
+	if (ok)
+		m_bytesWritten += toc.UncompressedSize;
+
+	return ok;
+}
+
+void Extractor::maybeWake()
+{
+	if (m_wake == nullptr)
+		return;
+
+	long long now = millisecondsNow();
+	long long last = m_lastWake.load(std::memory_order_relaxed);
+	if (now - last >= WakeIntervalMilliseconds && m_lastWake.compare_exchange_strong(last, now))
+		m_wake();
+}
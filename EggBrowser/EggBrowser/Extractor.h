@@ -0,0 +1,79 @@
+#ifndef EXTRACTOR_H
+#define EXTRACTOR_H
+
+#include <vector>
+#include <string>
+#include <thread>
+#include <atomic>
+#include <chrono>
+
+struct megg_info;
+struct megg_block_cache;
+
+// Extracts a bunch of files out of an archive, on a pool of threads so the UI doesn't have to wait.
+//
+// Stored files are written straight out of the mapped archive, and compressed ones are
+// decompressed from it into a buffer per thread and written from there. Each thread keeps its
+// own cache of solid blocks, so the files in a block don't each decompress it. The threads take one
+// file at a time from a shared counter, so a few huge files don't leave the others idle.
+class Extractor
+{
+public:
+	struct Progress
+	{
+		unsigned int NumFiles;
+		unsigned int NumDone;
+		unsigned int NumFailed;
+		unsigned long long BytesWritten;
+		double Seconds;
+		bool Cancelled;
+	};
+
+	Extractor();
+	~Extractor();
+
+	// Starts extracting files into directory, keeping the paths they have in the archive.
+	// fileBytes, info and filenameOffsets have to stay valid until IsRunning() returns false.
+	// The threads call wake every so often while they work, and once when they're done.
+	void Start(const unsigned char* fileBytes, const megg_info* info, const unsigned int* filenameOffsets,
+		const std::vector<unsigned int>& files, const char* directory, void (*wake)());
+
+	// Stops as soon as the files that are being written right now are finished. Doesn't wait for that.
+	void Cancel();
+
+	// waits for the threads to finish
+	void Wait();
+
+	// Returns true while the threads are still going. Once they're finished it waits for them.
+	bool IsRunning();
+
+	Progress GetProgress();
+
+private:
+	void work();
+	bool extractFile(unsigned int file, std::string* path, std::vector<unsigned char>* buffer, megg_block_cache* cache);
+	void maybeWake();
+
+	const unsigned char* m_fileBytes;
+	const megg_info* m_info;
+	const unsigned int* m_filenameOffsets;
+	void (*m_wake)();
+
+	std::vector<unsigned int> m_files;
+	std::string m_directory;
+	std::chrono::steady_clock::time_point m_startTime;
+	double m_seconds;
+
+	std::vector<std::thread> m_threads;
+	std::atomic<unsigned int> m_next;
+	std::atomic<unsigned int> m_numDone;
+	std::atomic<unsigned int> m_numFailed;
+	std::atomic<unsigned int> m_numRunning;
+	std::atomic<unsigned long long> m_bytesWritten;
+	std::atomic<bool> m_cancelRequested;
+
+	// when wake was last called, so the UI isn't woken up for every file
+	std::atomic<long long> m_lastWake;
+};
+
+#endif // EXTRACTOR_H
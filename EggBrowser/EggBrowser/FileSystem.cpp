@@ -1,4 +1,5 @@
 #include "FileSystem.h"
+#include <string.h>
 
 #ifdef _WIN32
 #define WIN32_LEAN_AND_MEAN
@@ -10,6 +11,7 @@
 #include <sys/stat.h>
 #include <fcntl.h>
 #include <sys/mman.h>
+#include <errno.h>
 
 // some stupid garbage is #defining "Success", which conflicts with NxnaResult::Success
 #undef Success
@@ -143,4 +145,37 @@ void FileSystem::UnmapFile(File* file)
 	file->Memory = nullptr;
 
 #endif
-}
\ No newline at end of file
+}
+
+bool FileSystem::CreateDirectories(const char* path)
+{
+	char directory[1024];
+	size_t length = strlen(path);
+	if (length >= sizeof(directory))
+		return false;
+
+	memcpy(directory, path, length + 1);
+
+	// make each directory in turn by cutting the path off at each separator
+	for (size_t i = 1; i < length; i++)
+	{
+		if (directory[i] != '/' && directory[i] != '\\')
+			continue;
+
+		// there's no making a drive
+		if (directory[i - 1] == ':')
+			continue;
+
+		directory[i] = 0;
+#ifdef _WIN32
+		if (CreateDirectory(directory, nullptr) == FALSE && GetLastError() != ERROR_ALREADY_EXISTS)
+			return false;
+#else
+		if (mkdir(directory, 0755) == -1 && errno != EEXIST)
+			return false;
+#endif
+		directory[i] = path[i];
+	}
+
+	return true;
+}
@@ -23,6 +23,9 @@ public:
 
 	static void* MapFile(File* file);
 	static void UnmapFile(File* file);
+
+	// Makes every directory leading up to the file at path, if they aren't there already
+	static bool CreateDirectories(const char* path);
 };
 
 #endif // FILESYSTEM_H
@@ -0,0 +1,429 @@
+#include "LayoutMap.h"
+#include "egg.h"
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+
+// every archive starts with this much header
+const unsigned int HeaderSize = 32;
+
+// nothing gets aligned to more than this, so bigger gaps are always dead space
+const unsigned long long MaxAlignment = 64 * 1024;
+
+// something that takes up part of the archive that isn't a file
+struct LayoutRange
+{
+	unsigned long long Start;
+	unsigned long long End;
+	LayoutCategory Category;
+	float Ratio;
+};
+
+LayoutMap::LayoutMap()
+{
+	m_fileBytes = nullptr;
+	m_fileSize = 0;
+	m_info = nullptr;
+	m_filenameOffsets = nullptr;
+	m_onDone = nullptr;
+	m_state = State_Empty;
+	m_cancelRequested = false;
+	m_bucketSize = 1;
+	memset(&m_stats, 0, sizeof(m_stats));
+	memset(&m_traceStats, 0, sizeof(m_traceStats));
+}
+
+LayoutMap::~LayoutMap()
+{
+	Reset();
+}
+
+void LayoutMap::Start(const unsigned char* fileBytes, unsigned int fileSize, const megg_info* info, const unsigned int* filenameOffsets, void (*onDone)())
+{
+	Reset();
+
+	m_fileBytes = fileBytes;
+	m_fileSize = fileSize;
+	m_info = info;
+	m_filenameOffsets = filenameOffsets;
+	m_onDone = onDone;
+
+	m_state = State_Working;
+	m_thread = std::thread(&LayoutMap::work, this);
+}
+
+void LayoutMap::Reset()
+{
+	if (m_thread.joinable())
+	{
+		m_cancelRequested = true;
+		m_thread.join();
+	}
+
+	m_fileBytes = nullptr;
+	m_fileSize = 0;
+	m_info = nullptr;
+	m_filenameOffsets = nullptr;
+	m_cancelRequested = false;
+	m_state = State_Empty;
+
+	m_byOffset.clear();
+	m_buckets.clear();
+	memset(&m_stats, 0, sizeof(m_stats));
+
+	ClearTrace();
+}
+
+void LayoutMap::work()
+{
+	const megg_info::TOC* toc = m_info->TableOfContents;
+	unsigned int numFiles = m_info->NumFiles;
+
+	// Archives are normally written in name order, which means they're already sorted
+	// by offset. Only sort if they aren't.
+	bool sorted = true;
+	for (unsigned int i = 0; i < numFiles; i++)
+	{
+		// files in solid blocks don't have any bytes of their own. Their blocks stand in for them.
+		if (toc[i].CompressedSize == 0 || (toc[i].Flags & 0x02))
+			continue;
+
+		if (m_byOffset.empty() == false && toc[i].FileContentOffset < toc[m_byOffset.back()].FileContentOffset)
+		{
+			m_stats.NumOutOfOrder++;
+			sorted = false;
+		}
+		m_byOffset.push_back(i);
+	}
+
+	if (sorted == false)
+	{
+		// the offset goes in the top half and the file in the bottom, so there are no ties
+		std::vector<uint64_t> keys(m_byOffset.size());
+		for (size_t i = 0; i < keys.size(); i++)
+			keys[i] = ((uint64_t)toc[m_byOffset[i]].FileContentOffset << 32) | m_byOffset[i];
+		std::sort(keys.begin(), keys.end());
+		for (size_t i = 0; i < keys.size(); i++)
+			m_byOffset[i] = (unsigned int)keys[i];
+	}
+
+	if (m_cancelRequested)
+		return;
+
+	m_bucketSize = (m_fileSize + MaxBuckets - 1) / MaxBuckets;
+	if (m_bucketSize == 0)
+		m_bucketSize = 1;
+
+	Bucket empty = {};
+	m_buckets.assign((m_fileSize + m_bucketSize - 1) / m_bucketSize, empty);
+
+	// the header, TOC, filenames, sections and solid blocks, sorted by where they start
+	std::vector<LayoutRange> others;
+	unsigned long long tocStart = (const unsigned char*)toc - m_fileBytes;
+	unsigned long long namesStart, namesEnd;
+	if (m_info->FrontCodedNames != nullptr)
+	{
+		// Filenames points at the decoded copy, not the bytes in the egg
+		namesStart = m_info->FrontCodedNames - m_fileBytes;
+		namesEnd = namesStart + m_info->FrontCodedNamesSize;
+	}
+	else
+	{
+		namesStart = (const unsigned char*)m_info->Filenames - m_fileBytes;
+		namesEnd = namesStart;
+		if (numFiles > 0)
+			namesEnd += m_filenameOffsets[numFiles - 1] + m_info->Filenames[m_filenameOffsets[numFiles - 1]].Length + 2;
+	}
+
+	LayoutRange header = { 0, HeaderSize < m_fileSize ? HeaderSize : m_fileSize, LayoutCategory_Metadata, 0 };
+	LayoutRange tocRange = { tocStart, tocStart + (unsigned long long)numFiles * sizeof(megg_info::TOC), LayoutCategory_Metadata, 0 };
+	LayoutRange names = { namesStart, namesEnd, LayoutCategory_Metadata, 0 };
+	others.push_back(header);
+	others.push_back(tocRange);
+	others.push_back(names);
+
+	if (m_info->Sections != nullptr)
+	{
+		// the table starts with the number of sections and a spare field
+		unsigned long long tableStart = (const unsigned char*)m_info->Sections - m_fileBytes - 8;
+		LayoutRange table = { tableStart, tableStart + 8 + (unsigned long long)m_info->NumSections * sizeof(megg_info::Section), LayoutCategory_Metadata, 0 };
+		others.push_back(table);
+
+		for (unsigned int i = 0; i < m_info->NumSections; i++)
+		{
+			const megg_info::Section& section = m_info->Sections[i];
+			LayoutRange range = { section.Offset, (unsigned long long)section.Offset + section.Size, LayoutCategory_Metadata, 0 };
+			others.push_back(range);
+		}
+	}
+
+	for (unsigned int i = 0; i < m_info->NumBlocks; i++)
+	{
+		const megg_info::TOC& block = m_info->Blocks[i];
+		LayoutRange range = { block.FileContentOffset, (unsigned long long)block.FileContentOffset + block.CompressedSize, LayoutCategory_Stored, 0 };
+		if (block.Flags & 0x01)
+		{
+			range.Category = LayoutCategory_Compressed;
+			range.Ratio = block.UncompressedSize > 0 ? (float)block.CompressedSize / block.UncompressedSize : 1.0f;
+		}
+		others.push_back(range);
+	}
+
+	std::stable_sort(others.begin(), others.end(), [](const LayoutRange& a, const LayoutRange& b) { return a.Start < b.Start; });
+
+	// Walk through everything in order of where it starts. Whatever isn't covered
+	// by anything is a gap, and whatever's covered twice is an overlap.
+	unsigned long long covered = 0;
+	size_t nextOther = 0, nextFile = 0;
+	while (nextOther < others.size() || nextFile < m_byOffset.size())
+	{
+		if ((nextFile & 0xffff) == 0 && m_cancelRequested)
+			return;
+
+		unsigned long long start, end;
+		LayoutCategory category;
+		float ratio = 0;
+
+		if (nextFile == m_byOffset.size() || (nextOther < others.size() && others[nextOther].Start <= toc[m_byOffset[nextFile]].FileContentOffset))
+		{
+			start = others[nextOther].Start;
+			end = others[nextOther].End;
+			category = others[nextOther].Category;
+			ratio = others[nextOther].Ratio;
+			nextOther++;
+		}
+		else
+		{
+			const megg_info::TOC& entry = toc[m_byOffset[nextFile]];
+			start = entry.FileContentOffset;
+			end = start + entry.CompressedSize;
+			if (entry.Flags & 0x01)
+			{
+				category = LayoutCategory_Compressed;
+				ratio = entry.UncompressedSize > 0 ? (float)entry.CompressedSize / entry.UncompressedSize : 1.0f;
+			}
+			else
+				category = LayoutCategory_Stored;
+			nextFile++;
+		}
+
+		if (start >= end)
+			continue;
+
+		if (start > covered)
+			addGap(covered, start);
+		else if (start < covered)
+		{
+			unsigned long long overlapEnd = end < covered ? end : covered;
+			addRange(start, overlapEnd, LayoutCategory_Overlap, 0);
+			m_stats.NumOverlaps++;
+			start = overlapEnd;
+		}
+
+		if (start < end)
+			addRange(start, end, category, ratio);
+		if (end > covered)
+			covered = end;
+	}
+
+	if (covered < m_fileSize)
+		addGap(covered, m_fileSize);
+
+	m_state.store(State_Done, std::memory_order_release);
+	if (m_onDone != nullptr)
+		m_onDone();
+}
+
+void LayoutMap::addRange(unsigned long long start, unsigned long long end, LayoutCategory category, float ratio)
+{
+	m_stats.Bytes[category] += end - start;
+
+	while (start < end)
+	{
+		unsigned int bucket = (unsigned int)(start / m_bucketSize);
+		unsigned long long bucketEnd = (unsigned long long)(bucket + 1) * m_bucketSize;
+		unsigned int count = (unsigned int)((end < bucketEnd ? end : bucketEnd) - start);
+
+		m_buckets[bucket].Bytes[category] += count;
+		if (category == LayoutCategory_Compressed)
+			m_buckets[bucket].RatioSum += count * ratio;
+
+		start += count;
+	}
+}
+
+void LayoutMap::addGap(unsigned long long start, unsigned long long end)
+{
+	// padding is whatever it takes to get from one file to the next alignment boundary
+	unsigned long long alignment = end & (~end + 1);
+	bool padding = alignment >= 16 && alignment <= MaxAlignment && end - start < alignment;
+
+	addRange(start, end, padding ? LayoutCategory_Padding : LayoutCategory_Dead, 0);
+	m_stats.NumGaps++;
+}
+
+void LayoutMap::Draw(unsigned char* pixels, int width, int height, const LayoutPalette& palette)
+{
+	unsigned long long numPixels = (unsigned long long)width * height;
+	unsigned int numBuckets = (unsigned int)m_buckets.size();
+
+	for (unsigned long long p = 0; p < numPixels; p++)
+	{
+		unsigned char* out = pixels + p * 4;
+		out[3] = 255;
+
+		unsigned long long byteStart = p * m_fileSize / numPixels;
+		unsigned long long byteEnd = (p + 1) * m_fileSize / numPixels;
+		unsigned int first = (unsigned int)(byteStart / m_bucketSize);
+		unsigned int last = (unsigned int)((byteEnd + m_bucketSize - 1) / m_bucketSize);
+		if (last <= first)
+			last = first + 1;
+		if (last > numBuckets)
+			last = numBuckets;
+
+		// a pixel can cover many buckets, or a bucket can cover many pixels
+		unsigned long long bytes[LayoutCategory_Count] = {};
+		float ratioSum = 0;
+		for (unsigned int b = first; b < last; b++)
+		{
+			for (int i = 0; i < LayoutCategory_Count; i++)
+				bytes[i] += m_buckets[b].Bytes[i];
+			ratioSum += m_buckets[b].RatioSum;
+		}
+
+		unsigned long long total = 0;
+		for (int i = 0; i < LayoutCategory_Count; i++)
+			total += bytes[i];
+		if (total == 0)
+		{
+			out[0] = out[1] = out[2] = 0;
+			continue;
+		}
+
+		float ratio = bytes[LayoutCategory_Compressed] > 0 ? ratioSum / bytes[LayoutCategory_Compressed] : 0.0f;
+		if (ratio > 1.0f)
+			ratio = 1.0f;
+
+		float color[3] = {};
+		for (int i = 0; i < LayoutCategory_Count; i++)
+		{
+			float weight = (float)bytes[i] / total;
+			for (int j = 0; j < 3; j++)
+			{
+				float c = palette.Colors[i][j];
+				if (i == LayoutCategory_Compressed)
+					c += (palette.PoorlyCompressed[j] - c) * ratio;
+
+				color[j] += c * weight;
+			}
+		}
+
+		for (int j = 0; j < 3; j++)
+			out[j] = (unsigned char)(color[j] * 255.0f + 0.5f);
+	}
+}
+
+int LayoutMap::FindFileAt(unsigned long long offset)
+{
+	const megg_info::TOC* toc = m_info->TableOfContents;
+
+	// find the last file that starts at or before offset
+	size_t low = 0, high = m_byOffset.size();
+	while (low < high)
+	{
+		size_t middle = low + (high - low) / 2;
+		if (toc[m_byOffset[middle]].FileContentOffset <= offset)
+			low = middle + 1;
+		else
+			high = middle;
+	}
+
+	if (low == 0)
+		return -1;
+
+	unsigned int file = m_byOffset[low - 1];
+	if (offset >= (unsigned long long)toc[file].FileContentOffset + toc[file].CompressedSize)
+		return -1;
+
+	return (int)file;
+}
+
+bool LayoutMap::LoadTrace(const char* path)
+{
+	ClearTrace();
+
+#ifdef _MSC_VER
+	FILE* fp;
+	fopen_s(&fp, path, "rb");
+#else
+	FILE* fp = fopen(path, "rb");
+#endif
+	if (fp == nullptr)
+		return false;
+
+	// megg_writeProfileTrace() puts one event on each line. Threads can finish
+	// out of order, so everything gets sorted by when it started.
+	std::vector<std::pair<double, unsigned int> > reads;
+
+	char line[512];
+	while (fgets(line, sizeof(line), fp))
+	{
+		if (strstr(line, "\"name\":\"read\"") == nullptr)
+			continue;
+
+		const char* ts = strstr(line, "\"ts\":");
+		const char* entry = strstr(line, "\"entry\":");
+		double start;
+		int file;
+		if (ts == nullptr || entry == nullptr || sscanf(ts + 5, "%lf", &start) != 1 || sscanf(entry + 8, "%d", &file) != 1)
+			continue;
+
+		// the trace could be from a different archive
+		if (file < 0 || (unsigned int)file >= m_info->NumFiles)
+			continue;
+
+		reads.push_back(std::make_pair(start, (unsigned int)file));
+	}
+
+	fclose(fp);
+
+	std::stable_sort(reads.begin(), reads.end(), [](const std::pair<double, unsigned int>& a, const std::pair<double, unsigned int>& b) { return a.first < b.first; });
+
+	for (size_t i = 0; i < reads.size(); i++)
+	{
+		unsigned int file = reads[i].second;
+		m_trace.push_back(file);
+
+		if (i > 0)
+		{
+			// files in solid blocks are read from wherever their block is
+			unsigned int previousOffset, previousSize, offset, size;
+			megg_getFileSpan(m_info, reads[i - 1].second, &previousOffset, &previousSize);
+			megg_getFileSpan(m_info, file, &offset, &size);
+
+			unsigned long long previousEnd = (unsigned long long)previousOffset + previousSize;
+			unsigned long long start = offset;
+
+			// the next file in the same block doesn't need to go anywhere
+			if (start == previousOffset)
+				continue;
+
+			if (start < previousEnd)
+			{
+				m_traceStats.SeekBytes += previousEnd - start;
+				m_traceStats.NumBackwardSeeks++;
+			}
+			else
+				m_traceStats.SeekBytes += start - previousEnd;
+		}
+	}
+	m_traceStats.NumReads = (unsigned int)m_trace.size();
+
+	return true;
+}
+
+void LayoutMap::ClearTrace()
+{
+	m_trace.clear();
+	memset(&m_traceStats, 0, sizeof(m_traceStats));
+}
@@ -0,0 +1,146 @@
+#ifndef LAYOUTMAP_H
+#define LAYOUTMAP_H
+
+#include <vector>
+#include <thread>
+#include <atomic>
+#include <stdint.h>
+
+struct megg_info;
+
+// what each byte of an archive is being used for
+enum LayoutCategory
+{
+	// the header, TOC, filenames and sections
+	LayoutCategory_Metadata,
+	LayoutCategory_Stored,
+	LayoutCategory_Compressed,
+
+	// gaps that end on an alignment boundary and are smaller than that alignment
+	LayoutCategory_Padding,
+
+	// every other gap. Nothing points at these bytes.
+	LayoutCategory_Dead,
+
+	// bytes that belong to more than one file
+	LayoutCategory_Overlap,
+
+	LayoutCategory_Count
+};
+
+// linear RGB, 0 to 1
+struct LayoutPalette
+{
+	float Colors[LayoutCategory_Count][3];
+
+	// Compressed files are blended from LayoutCategory_Compressed toward this
+	// as they get closer to not being compressed at all
+	float PoorlyCompressed[3];
+};
+
+struct LayoutStats
+{
+	unsigned long long Bytes[LayoutCategory_Count];
+	unsigned int NumGaps;
+	unsigned int NumOverlaps;
+
+	// files whose data comes before the data of the file before them (by name)
+	unsigned int NumOutOfOrder;
+};
+
+struct TraceStats
+{
+	unsigned int NumReads;
+
+	// the distance from the end of each read to the start of the next one, added up
+	unsigned long long SeekBytes;
+	unsigned int NumBackwardSeeks;
+};
+
+// Where everything in an archive is, by byte offset, for seeing how an archive is laid out.
+//
+// The archive is split into a fixed number of buckets, and a background thread works out how
+// many bytes of each bucket go to each LayoutCategory. Drawing the map at any size then only
+// needs a pass over the buckets, no matter how many files there are.
+//
+// It can also hold an access trace: the order files were read in during a run of the game,
+// taken from a trace written by megg_writeProfileTrace().
+class LayoutMap
+{
+public:
+	enum State
+	{
+		State_Empty,
+		State_Working,
+		State_Done
+	};
+
+	LayoutMap();
+	~LayoutMap();
+
+	// Starts working out the layout on another thread. fileBytes and info have to stay valid until
+	// Reset(). onDone gets called from that thread when it's finished.
+	void Start(const unsigned char* fileBytes, unsigned int fileSize, const megg_info* info, const unsigned int* filenameOffsets, void (*onDone)());
+
+	// Stops the thread and forgets the archive and the trace
+	void Reset();
+
+	State GetState() { return (State)m_state.load(std::memory_order_acquire); }
+
+	// Everything below needs GetState() == State_Done
+
+	const LayoutStats& GetStats() { return m_stats; }
+	unsigned int GetFileSize() { return m_fileSize; }
+
+	// Draws the map into pixels (width * height, RGBA). Bytes run left to right, then top to bottom.
+	void Draw(unsigned char* pixels, int width, int height, const LayoutPalette& palette);
+
+	// Returns the file that contains the given byte, or -1
+	int FindFileAt(unsigned long long offset);
+
+	// Reads an access trace. Only "read" events count, since those are the ones that touch
+	// the archive. Returns false if the file couldn't be opened.
+	bool LoadTrace(const char* path);
+	void ClearTrace();
+
+	// the files that were read, in order
+	const std::vector<unsigned int>& GetTrace() { return m_trace; }
+	const TraceStats& GetTraceStats() { return m_traceStats; }
+
+	static const unsigned int MaxBuckets = 256 * 1024;
+
+private:
+	struct Bucket
+	{
+		uint32_t Bytes[LayoutCategory_Count];
+
+		// compressed / uncompressed size of each compressed byte, added up
+		float RatioSum;
+	};
+
+	void work();
+	void addRange(unsigned long long start, unsigned long long end, LayoutCategory category, float ratio);
+	void addGap(unsigned long long start, unsigned long long end);
+
+	const unsigned char* m_fileBytes;
+	unsigned int m_fileSize;
+	const megg_info* m_info;
+	const unsigned int* m_filenameOffsets;
+	void (*m_onDone)();
+
+	std::thread m_thread;
+	std::atomic<int> m_state;
+	std::atomic<bool> m_cancelRequested;
+
+	// every file with any data, sorted by where it starts
+	std::vector<unsigned int> m_byOffset;
+
+	std::vector<Bucket> m_buckets;
+	unsigned int m_bucketSize;
+	LayoutStats m_stats;
+
+	std::vector<unsigned int> m_trace;
+	TraceStats m_traceStats;
+};
+
+#endif // LAYOUTMAP_H
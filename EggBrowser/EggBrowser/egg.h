@@ -29,18 +29,411 @@ struct megg_info
 		unsigned int Flags;
 	};
 	TOC *TableOfContents;
+
+	// Optional. Filled in by megg_indexFilenames() so that megg_findFile()
+	// can do a binary search instead of walking every filename.
+	unsigned int* FilenameOffsets;
+
+	// Version 2 archives can have extra sections after the filenames, each
+	// one named with four characters. See megg_findSection().
+	struct Section
+	{
+		char Id[4];
+		unsigned int Offset;
+		unsigned int Size;
+		unsigned int Unused;
+	};
+	unsigned int NumSections;
+	Section* Sections;
+
+	// Small files can be packed together into solid blocks (the "BLKS" section) that get
+	// compressed as one. A file in a block has flag 0x2 with the block's index in the top
+	// 24 bits of its flags, and its FileContentOffset is where it starts inside the
+	// decompressed block. Blocks are described the same way files are.
+	unsigned int NumBlocks;
+	TOC* Blocks;
+
+	// Version 3 archives can have front coded filenames (header flag 0x2). Then FrontCodedNames
+	// points at the table and Filenames is null, unless it's been given somewhere to decode the
+	// names to (see megg_getDecodedFilenamesSize()). The names are in buckets of NameBucketSize,
+	// and the first one in each bucket is stored whole, so megg_findFile() binary searches those
+	// and then only decodes the one bucket the name could be in.
+	const unsigned char* FrontCodedNames;
+	unsigned int FrontCodedNamesSize;
+	unsigned int NameBucketSize;
+	unsigned int NumNameBuckets;
+	const unsigned int* NameBucketOffsets;
 };
 
+// the most room a filename can need, terminator included
+#define MEGG_MAX_FILENAME 256
+
 int megg_getEggInfo(unsigned char* fileBytes, unsigned int length, megg_info* result);
 
+// megg_getEggInfo() checks every filename and TOC entry before it returns, which can take a while
+// for a big archive. These split that up: megg_getEggHeader() only checks the header, and
+// megg_validateAndIndex() checks files [first, first + count) and records where their names
+// start in offsets (which needs room for NumFiles entries). The chunks have to be done in order,
+// starting at 0. Once the last one is done FilenameOffsets points at offsets.
+// Both return 0 on success or -1 if the archive isn't valid.
+int megg_getEggHeader(unsigned char* fileBytes, unsigned int length, megg_info* result);
+int megg_validateAndIndex(const unsigned char* fileBytes, unsigned int length, megg_info* info, unsigned int* offsets, unsigned int first, unsigned int count);
+
+// Records where each filename starts. offsets must have room for NumFiles entries
+// and must stay alive as long as the megg_info does.
+void megg_indexFilenames(megg_info* info, unsigned int* offsets);
+
+// Front coded filenames have to be decoded before Filenames can be used, which tools that show
+// every name want. This works out how many bytes that takes (checking the whole table on the way),
+// and returns 0 or -1 if the table's broken. Point Filenames at that much memory (which has to stay
+// alive as long as the megg_info does) and megg_validateAndIndex() or megg_indexFilenames() will
+// decode the names into it as they go. Lookups don't need any of this.
+int megg_getDecodedFilenamesSize(const megg_info* info, unsigned int* size);
+
+// Gets a file's name, from either kind of filename table. Front coded names get decoded into buffer,
+// which needs room for MEGG_MAX_FILENAME characters. Returns null if there's no such file.
+const char* megg_getFilename(const megg_info* info, unsigned int index, char* buffer);
+
+// Finds a file by name (case-insensitive). Returns the index of the file or -1 if it isn't there.
+int megg_findFile(const megg_info* info, const char* name);
+
+// Copies (and decompresses, if needed) the contents of a file into destination.
+// Returns the number of bytes written or -1 if something went wrong.
+// Compressed files need LZ4: define MONDEGREENGAMES_EGG_LZ4 and build lz4.c in, or reading them returns -1.
+int megg_readFile(const unsigned char* fileBytes, const megg_info* info, unsigned int index, void* destination, unsigned int destinationSize);
+
+// Finds a section by its id (like "BLKS"). Returns null if the archive doesn't have it.
+const megg_info::Section* megg_findSection(const megg_info* info, const char* id);
+
+// Where the bytes that have to be read to get at a file are. That's the file itself,
+// or the whole block if it's in one. Returns 0, or -1 if there's no such file.
+int megg_getFileSpan(const megg_info* info, unsigned int index, unsigned int* offset, unsigned int* size);
+
+// Load groups (the "GRPS" section) are sets of files that get loaded together, like everything
+// a level needs. The builder puts each group's files next to each other, so reading the group's
+// span in one go gets all of them.
+struct megg_group
+{
+	const char* Name;
+
+	// the part of the archive the group's files are in
+	unsigned int Offset;
+	unsigned int Size;
+
+	// Every file in the group, by index, in order. A file that's in more than one group
+	// is only inside the span of the first one.
+	const unsigned int* Files;
+	unsigned int NumFiles;
+};
+
+unsigned int megg_getNumGroups(const unsigned char* fileBytes, const megg_info* info);
+
+// Returns 0, or -1 if there's no such group or the section is broken
+int megg_getGroup(const unsigned char* fileBytes, const megg_info* info, unsigned int index, megg_group* result);
+
+// Finds a group by name (case-insensitive). Returns its index or -1.
+int megg_findGroup(const unsigned char* fileBytes, const megg_info* info, const char* name);
+
+// Gets a group and asks for all of it to be paged in: one MADV_WILLNEED for the group's span
+// (or touching every page of it, where there's no madvise()), plus whatever of its files are
+// outside the span. Returns 0, or -1 if there's no such group. If the archive isn't mapped,
+// use megg_getGroup() and read [Offset, Offset + Size) with a single read instead.
+int megg_loadGroup(const unsigned char* fileBytes, const megg_info* info, unsigned int index, megg_group* result);
+
+// The "DIRS" section is a tree of the directories in the archive (split on '/'). Since the names are
+// sorted, every file in a directory or one of its subdirectories is in one run of the TOC, so listing
+// a directory takes time in proportion to what's in it instead of the size of the archive.
+struct megg_directory
+{
+	// the whole path, with no '/' at the end. The top directory's is "".
+	const char* Name;
+
+	// -1 for the top directory
+	int Parent;
+
+	// its subdirectories are [FirstChild, FirstChild + NumChildren), in the same order as the files
+	unsigned int FirstChild;
+	unsigned int NumChildren;
+
+	// the files in it and all its subdirectories are [FirstFile, FirstFile + NumFiles)
+	unsigned int FirstFile;
+	unsigned int NumFiles;
+};
+
+unsigned int megg_getNumDirectories(const unsigned char* fileBytes, const megg_info* info);
+
+// Returns 0, or -1 if there's no such directory or the section is broken. The top directory is 0.
+int megg_getDirectory(const unsigned char* fileBytes, const megg_info* info, unsigned int index, megg_directory* result);
+
+// Finds a directory by path (case-insensitive, "" for the top one). Returns its index or -1.
+int megg_findDirectory(const unsigned char* fileBytes, const megg_info* info, const char* path);
+
+// Gets called with the index of each file that's found, in name order. Return false to stop.
+typedef bool (*megg_file_callback)(void* userData, unsigned int index);
+
+// Calls callback for every file in a directory, and in its subdirectories too if recursive is set.
+// Returns how many files it was called for, or -1 if there's no such directory.
+int megg_enumerateDirectory(const unsigned char* fileBytes, const megg_info* info, const char* path, bool recursive, megg_file_callback callback, void* userData);
+
+// Calls callback for every file whose name matches pattern (case-insensitive). '*' matches any number of
+// characters and '?' matches one, but neither matches a '/'. "**" between slashes matches any number of
+// directories, so "levels/**/*.lvl" is every .lvl anywhere under levels. Only the directories the pattern
+// can match get looked at. More than one "**" can find the same file more than once. Returns how many
+// matches there were, or -1 if the archive doesn't have a DIRS section. Without megg_indexFilenames(),
+// plain filename tables get walked from the start for each run of files it looks at.
+int megg_glob(const unsigned char* fileBytes, const megg_info* info, const char* pattern, megg_file_callback callback, void* userData);
+
+#ifndef MEGG_BLOCK_CACHE_SLOTS
+#define MEGG_BLOCK_CACHE_SLOTS 4
+#endif
+
+// Getting a file out of a solid block means decompressing the block up to that file.
+// A cache keeps the last few blocks around whole, so the files next to it come out
+// with a memcpy. Caches aren't thread safe, so give each thread that reads its own.
+// Blocks are remembered by where the archive is mapped, so free the cache when the
+// archive is closed.
+struct megg_block_cache
+{
+	const unsigned char* FileBytes[MEGG_BLOCK_CACHE_SLOTS];
+	unsigned int Block[MEGG_BLOCK_CACHE_SLOTS];
+	unsigned char* Data[MEGG_BLOCK_CACHE_SLOTS];
+	unsigned int Capacity[MEGG_BLOCK_CACHE_SLOTS];
+	unsigned long long LastUsed[MEGG_BLOCK_CACHE_SLOTS];
+	unsigned long long UseCounter;
+};
+
+void megg_initBlockCache(megg_block_cache* cache);
+void megg_freeBlockCache(megg_block_cache* cache);
+
+// The same as megg_readFile(), but files in solid blocks are read through cache
+int megg_readFileCached(const unsigned char* fileBytes, const megg_info* info, megg_block_cache* cache, unsigned int index, void* destination, unsigned int destinationSize);
+
+// For archives that aren't memory mapped. Queue up the files you want with megg_queueRead(), then
+// megg_flushReads() sorts them by where they are in the archive and merges the ones that are close
+// together into a single call to read, so a batch of neighbouring files costs one read instead of
+// one each. The bytes in the gaps get read and thrown away, so MergeGap shouldn't be too big.
+//
+// info is only used for its TOC and blocks, so it can come from a copy of just the start of the
+// archive and the index. read should read size bytes starting at offset into destination (with
+// pread() or ReadFile() or whatever) and return how many it read.
+typedef int (*megg_read_callback)(void* userData, unsigned int offset, void* destination, unsigned int size);
+
+struct megg_read_span;
+
+struct megg_read_request
+{
+	unsigned int Index;
+	void* Destination;
+	unsigned int DestinationSize;
+
+	// filled in by megg_flushReads(): the number of bytes written to Destination, or -1
+	int Result;
+};
+
+struct megg_read_queue
+{
+	megg_read_request* Requests;
+	unsigned int NumRequests;
+	unsigned int Capacity;
+
+	// files this close together (or closer) get read together
+	unsigned int MergeGap;
+
+	// but reads never get bigger than this, unless a single file's bigger
+	unsigned int MaxReadSize;
+
+	// Counters since megg_initReadQueue(). Every merged request is one less call to read.
+	unsigned long long NumRequested;
+	unsigned long long NumReads;
+	unsigned long long NumMerged;
+	unsigned long long BytesSkipped;
+
+	// where the reads go
+	unsigned char* Buffer;
+	unsigned int BufferSize;
+	megg_read_span* Spans;
+	unsigned int SpansCapacity;
+
+	// so files in the same solid block only decompress it once
+	megg_block_cache Blocks;
+};
+
+void megg_initReadQueue(megg_read_queue* queue, unsigned int mergeGap, unsigned int maxReadSize);
+void megg_freeReadQueue(megg_read_queue* queue);
+
+// Returns which request this is in queue->Requests (until the next flush), or -1 if it couldn't be added
+int megg_queueRead(megg_read_queue* queue, unsigned int index, void* destination, unsigned int destinationSize);
+
+// Reads (and decompresses) everything that's queued, then empties the queue.
+// The results stay in queue->Requests until the next megg_queueRead().
+// Returns the number of requests that failed.
+int megg_flushReads(megg_read_queue* queue, const megg_info* info, megg_read_callback read, void* userData);
+
+// Define EGG_PROFILE (everywhere egg.h is included) to time every lookup, read and decompression.
+// Without it none of this exists and the hot paths are exactly the same as before.
+#ifdef EGG_PROFILE
+
+#ifndef EGG_PROFILE_MAX_EVENTS
+#define EGG_PROFILE_MAX_EVENTS 65536
+#endif
+
+struct megg_profile_counter
+{
+	unsigned long long Calls;
+	unsigned long long Bytes;
+	unsigned long long TotalNanoseconds;
+	unsigned long long MaxNanoseconds;
+
+	// Histogram[i] counts the calls that took at least 2^i (but less than 2^(i+1)) nanoseconds
+	unsigned long long Histogram[32];
+};
+
+struct megg_profile_stats
+{
+	megg_profile_counter Lookup;
+
+	// Reading means getting the bytes out of the file. With a memory mapped egg that's where
+	// the page faults happen, so compressed data gets touched before it's decompressed.
+	megg_profile_counter Read;
+	megg_profile_counter Decompress;
+
+	unsigned long long LookupMisses;
+	unsigned long long CacheHits;
+	unsigned long long CacheMisses;
+};
+
+void megg_getProfileStats(megg_profile_stats* result);
+void megg_resetProfileStats();
+
+// Writes the most recent EGG_PROFILE_MAX_EVENTS calls as Chrome trace events
+// (open it with chrome://tracing or Perfetto). Returns 0 on success.
+int megg_writeProfileTrace(const char* path);
+
+#endif // EGG_PROFILE
+
 
 #endif // MONDEGREENGAMES_EGG_H
 
 #ifdef MONDEGREENGAMES_EGG_IMPLEMENTATION
 
 #include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
 
-int megg_getEggInfo(unsigned char* fileBytes, unsigned int length, megg_info* result)
+#if defined(__unix__) || defined(__APPLE__)
+#include <sys/mman.h>
+#include <unistd.h>
+#endif
+
+#ifndef MEGG_MALLOC
+#define MEGG_MALLOC(size) malloc(size)
+#define MEGG_FREE(p) free(p)
+#endif
+
+#ifdef MONDEGREENGAMES_EGG_LZ4
+#include "lz4.h"
+#endif
+
+#ifdef EGG_PROFILE
+#include <stdio.h>
+#include <atomic>
+#include <chrono>
+#include <functional>
+#include <thread>
+
+enum megg_profile_event_type
+{
+	megg_profile_lookup,
+	megg_profile_read,
+	megg_profile_decompress
+};
+
+struct megg_profile_event
+{
+	unsigned long long Start;
+	unsigned long long Duration;
+	unsigned long long Bytes;
+	unsigned int Thread;
+	int Index;
+	megg_profile_event_type Type;
+};
+
+struct megg_profile_atomic_counter
+{
+	std::atomic<unsigned long long> Calls;
+	std::atomic<unsigned long long> Bytes;
+	std::atomic<unsigned long long> TotalNanoseconds;
+	std::atomic<unsigned long long> MaxNanoseconds;
+	std::atomic<unsigned long long> Histogram[32];
+};
+
+static megg_profile_atomic_counter megg_profileCounters[3];
+static std::atomic<unsigned long long> megg_profileLookupMisses;
+static std::atomic<unsigned long long> megg_profileCacheHits;
+static std::atomic<unsigned long long> megg_profileCacheMisses;
+
+static megg_profile_event megg_profileEvents[EGG_PROFILE_MAX_EVENTS];
+static std::atomic<unsigned long long> megg_profileNextEvent;
+
+static unsigned long long megg_profileNow()
+{
+	using namespace std::chrono;
+	return (unsigned long long)duration_cast<nanoseconds>(steady_clock::now().time_since_epoch()).count();
+}
+
+static void megg_profileRecord(megg_profile_event_type type, unsigned long long start, int index, unsigned long long bytes)
+{
+	unsigned long long duration = megg_profileNow() - start;
+
+	megg_profile_atomic_counter& counter = megg_profileCounters[type];
+	counter.Calls.fetch_add(1, std::memory_order_relaxed);
+	counter.Bytes.fetch_add(bytes, std::memory_order_relaxed);
+	counter.TotalNanoseconds.fetch_add(duration, std::memory_order_relaxed);
+
+	unsigned long long max = counter.MaxNanoseconds.load(std::memory_order_relaxed);
+	while (duration > max && counter.MaxNanoseconds.compare_exchange_weak(max, duration, std::memory_order_relaxed) == false)
+	{
+	}
+
+	int bucket = 0;
+	while (bucket < 31 && (duration >> (bucket + 1)) != 0)
+		bucket++;
+	counter.Histogram[bucket].fetch_add(1, std::memory_order_relaxed);
+
+	megg_profile_event& e = megg_profileEvents[megg_profileNextEvent.fetch_add(1, std::memory_order_relaxed) % EGG_PROFILE_MAX_EVENTS];
+	e.Start = start;
+	e.Duration = duration;
+	e.Bytes = bytes;
+	e.Thread = (unsigned int)std::hash<std::thread::id>()(std::this_thread::get_id());
+	e.Index = index;
+	e.Type = type;
+}
+
+#ifdef MONDEGREENGAMES_EGG_LZ4
+// touch every page first so any page faults get blamed on reading instead of LZ4
+static void megg_profileTouch(const unsigned char* bytes, unsigned int size, int index)
+{
+	unsigned long long start = megg_profileNow();
+	volatile unsigned char sink = 0;
+	for (unsigned int i = 0; i < size; i += 4096)
+		sink += bytes[i];
+	megg_profileRecord(megg_profile_read, start, index, size);
+	(void)sink;
+}
+#endif
+
+#define MEGG_PROFILE_BEGIN(name) unsigned long long name = megg_profileNow()
+#define MEGG_PROFILE_END(name, type, index, bytes) megg_profileRecord(type, name, index, bytes)
+#define MEGG_PROFILE_COUNT(counter) counter.fetch_add(1, std::memory_order_relaxed)
+#define MEGG_PROFILE_TOUCH(bytes, size, index) megg_profileTouch(bytes, size, index)
+#else
+#define MEGG_PROFILE_BEGIN(name)
+#define MEGG_PROFILE_END(name, type, index, bytes)
+#define MEGG_PROFILE_COUNT(counter)
+#define MEGG_PROFILE_TOUCH(bytes, size, index)
+#endif
+
+int megg_getEggHeader(unsigned char* fileBytes, unsigned int length, megg_info* result)
 {
 	static_assert(sizeof(megg_info::Filename) == 1, "megg_info::Filename is unexpected size");
 
@@ -63,6 +456,10 @@ int megg_getEggInfo(unsigned char* fileBytes, unsigned int length, megg_info* re
 	if (h->Magic[0] != 'E' || h->Magic[1] != 'G' || h->Magic[2] != 'G' || h->Magic[3] != 'A')
 		return -1;
 
+	// anything newer might lay out the names or the TOC in a way this doesn't understand
+	if (h->Version > 3)
+		return -1;
+
 	if (h->FilenameOffset > length
 		|| h->TOCOffset > length
 		|| h->TOCOffset + sizeof(megg_info::TOC) * h->NumFiles > length
@@ -74,10 +471,308 @@ int megg_getEggInfo(unsigned char* fileBytes, unsigned int length, megg_info* re
 	result->NumFiles = h->NumFiles;
 	result->TableOfContents = toc;
 	result->Filenames = (megg_info::Filename*)(fileBytes + h->FilenameOffset);
+	result->FilenameOffsets = nullptr;
+	result->NumSections = 0;
+	result->Sections = nullptr;
+	result->NumBlocks = 0;
+	result->Blocks = nullptr;
+	result->FrontCodedNames = nullptr;
+	result->FrontCodedNamesSize = 0;
+	result->NameBucketSize = 0;
+	result->NumNameBuckets = 0;
+	result->NameBucketOffsets = nullptr;
+
+	// flag 0x2 means the filenames are front coded: the number of buckets, the bucket size,
+	// the size of the table and an unused field, then where each bucket starts, then the buckets
+	if (h->Flags & 0x02)
+	{
+		if (length - h->FilenameOffset < 16)
+			return -1;
+
+		const unsigned int* table = (const unsigned int*)(fileBytes + h->FilenameOffset);
+		unsigned int numBuckets = table[0];
+		unsigned int bucketSize = table[1];
+		unsigned int size = table[2];
+		if (bucketSize == 0
+			|| numBuckets != h->NumFiles / bucketSize + (h->NumFiles % bucketSize != 0 ? 1 : 0)
+			|| size > length - h->FilenameOffset
+			|| size < 16
+			|| numBuckets > (size - 16) / 4)
+			return -1;
+
+		result->Filenames = nullptr;
+		result->FrontCodedNames = fileBytes + h->FilenameOffset;
+		result->FrontCodedNamesSize = size;
+		result->NameBucketSize = bucketSize;
+		result->NumNameBuckets = numBuckets;
+		result->NameBucketOffsets = table + 4;
+	}
+
+	// flag 0x1 means the unused field is where the section table is
+	if (h->Flags & 0x01)
+	{
+		unsigned int tableOffset = h->Unused;
+		if (tableOffset > length || length - tableOffset < 8)
+			return -1;
+
+		unsigned int numSections = *(unsigned int*)(fileBytes + tableOffset);
+		if (numSections > (length - tableOffset - 8) / sizeof(megg_info::Section))
+			return -1;
+
+		result->NumSections = numSections;
+		result->Sections = (megg_info::Section*)(fileBytes + tableOffset + 8);
+		for (unsigned int i = 0; i < numSections; i++)
+		{
+			if (result->Sections[i].Offset > length || result->Sections[i].Size > length - result->Sections[i].Offset)
+				return -1;
+		}
+
+		const megg_info::Section* blocks = megg_findSection(result, "BLKS");
+		if (blocks != nullptr)
+		{
+			result->NumBlocks = blocks->Size / sizeof(megg_info::TOC);
+			result->Blocks = (megg_info::TOC*)(fileBytes + blocks->Offset);
+			for (unsigned int i = 0; i < result->NumBlocks; i++)
+			{
+				const megg_info::TOC& block = result->Blocks[i];
+				if (block.FileContentOffset > length || block.CompressedSize > length - block.FileContentOffset)
+					return -1;
+
+				// a block that isn't compressed is exactly as big as what's in it
+				if ((block.Flags & 0x01) == 0 && block.CompressedSize != block.UncompressedSize)
+					return -1;
+			}
+		}
+	}
+
+	return 0;
+}
+
+const megg_info::Section* megg_findSection(const megg_info* info, const char* id)
+{
+	for (unsigned int i = 0; i < info->NumSections; i++)
+	{
+		if (memcmp(info->Sections[i].Id, id, 4) == 0)
+			return &info->Sections[i];
+	}
+
+	return nullptr;
+}
+
+// makes sure a file's data is inside the archive, or inside its block
+static bool megg_isEntryValid(const megg_info* info, unsigned int index, unsigned int length)
+{
+	const megg_info::TOC& toc = info->TableOfContents[index];
+	if (toc.Flags & 0x02)
+	{
+		unsigned int block = toc.Flags >> 8;
+		return block < info->NumBlocks
+			&& toc.FileContentOffset <= info->Blocks[block].UncompressedSize
+			&& toc.UncompressedSize <= info->Blocks[block].UncompressedSize - toc.FileContentOffset;
+	}
+
+	// a file that's stored as is takes up exactly its own size
+	if ((toc.Flags & 0x01) == 0 && toc.CompressedSize != toc.UncompressedSize)
+		return false;
+
+	return toc.FileContentOffset <= length && toc.CompressedSize <= length - toc.FileContentOffset;
+}
+
+int megg_getFileSpan(const megg_info* info, unsigned int index, unsigned int* offset, unsigned int* size)
+{
+	if (index >= info->NumFiles)
+		return -1;
+
+	const megg_info::TOC* toc = &info->TableOfContents[index];
+	if (toc->Flags & 0x02)
+	{
+		if ((toc->Flags >> 8) >= info->NumBlocks)
+			return -1;
+		toc = &info->Blocks[toc->Flags >> 8];
+	}
+
+	*offset = toc->FileContentOffset;
+	*size = toc->CompressedSize;
+	return 0;
+}
+
+// Walks through a bucket of front coded names, decoding each one into Name. Everything's
+// checked against the end of the table, so a broken archive can't send it anywhere else.
+struct megg_name_cursor
+{
+	const unsigned char* Position;
+	const unsigned char* End;
+
+	// how many names in the bucket come after this one
+	unsigned int Remaining;
+
+	unsigned int Length;
+	char Name[MEGG_MAX_FILENAME];
+};
+
+static bool megg_startBucket(const megg_info* info, unsigned int bucket, megg_name_cursor* cursor)
+{
+	if (bucket >= info->NumNameBuckets || info->NameBucketOffsets[bucket] >= info->FrontCodedNamesSize)
+		return false;
+
+	// the first name is stored whole
+	const unsigned char* p = info->FrontCodedNames + info->NameBucketOffsets[bucket];
+	const unsigned char* end = info->FrontCodedNames + info->FrontCodedNamesSize;
+	unsigned int length = p[0];
+	if ((unsigned int)(end - p) < length + 2 || p[length + 1] != 0)
+		return false;
+
+	memcpy(cursor->Name, p + 1, length + 1);
+	cursor->Length = length;
+	cursor->Position = p + length + 2;
+	cursor->End = end;
+
+	unsigned int first = bucket * info->NameBucketSize;
+	cursor->Remaining = (info->NumFiles - first < info->NameBucketSize ? info->NumFiles - first : info->NameBucketSize) - 1;
+	return true;
+}
+
+static bool megg_nextName(megg_name_cursor* cursor)
+{
+	if (cursor->Remaining == 0 || cursor->End - cursor->Position < 2)
+		return false;
+
+	// how much of the last name this one starts with, then the rest of it
+	unsigned int shared = cursor->Position[0];
+	unsigned int suffix = cursor->Position[1];
+	if (shared > cursor->Length || shared + suffix >= MEGG_MAX_FILENAME || (unsigned int)(cursor->End - cursor->Position - 2) < suffix)
+		return false;
+
+	memcpy(cursor->Name + shared, cursor->Position + 2, suffix);
+	cursor->Length = shared + suffix;
+	cursor->Name[cursor->Length] = 0;
+	cursor->Position += suffix + 2;
+	cursor->Remaining--;
+	return true;
+}
+
+// moves on to the next file's name, which might be the start of the next bucket
+static bool megg_advanceName(const megg_info* info, unsigned int index, megg_name_cursor* cursor)
+{
+	if (index % info->NameBucketSize == 0)
+		return megg_startBucket(info, index / info->NameBucketSize, cursor);
+
+	return megg_nextName(cursor);
+}
+
+static bool megg_seekName(const megg_info* info, unsigned int index, megg_name_cursor* cursor)
+{
+	if (index >= info->NumFiles || megg_startBucket(info, index / info->NameBucketSize, cursor) == false)
+		return false;
+
+	for (unsigned int i = index % info->NameBucketSize; i > 0; i--)
+	{
+		if (megg_nextName(cursor) == false)
+			return false;
+	}
+
+	return true;
+}
+
+// Checks front coded names [first, first + count), and writes them out whole if Filenames
+// has been pointed somewhere, recording where each one starts in offsets.
+static bool megg_decodeFilenames(megg_info* info, unsigned int* offsets, unsigned int first, unsigned int count)
+{
+	// pick up where the last chunk left off
+	unsigned int cursor = 0;
+	if (info->Filenames != nullptr && first > 0)
+		cursor = offsets[first - 1] + info->Filenames[offsets[first - 1]].Length + 2;
+
+	megg_name_cursor name;
+	if (count > 0 && megg_seekName(info, first, &name) == false)
+		return false;
+
+	for (unsigned int i = first; i < first + count; i++)
+	{
+		if (i > first && megg_advanceName(info, i, &name) == false)
+			return false;
+
+		if (info->Filenames != nullptr)
+		{
+			unsigned char* destination = (unsigned char*)info->Filenames + cursor;
+			destination[0] = (unsigned char)name.Length;
+			memcpy(destination + 1, name.Name, name.Length + 1);
+
+			offsets[i] = cursor;
+			cursor += name.Length + 2;
+		}
+	}
+
+	if (first + count == info->NumFiles && info->Filenames != nullptr)
+		info->FilenameOffsets = offsets;
+
+	return true;
+}
+
+int megg_getDecodedFilenamesSize(const megg_info* info, unsigned int* size)
+{
+	*size = 0;
+	if (info->FrontCodedNames == nullptr)
+		return -1;
+
+	megg_name_cursor name;
+	unsigned int total = 0;
+	for (unsigned int i = 0; i < info->NumFiles; i++)
+	{
+		if (megg_advanceName(info, i, &name) == false)
+			return -1;
+		total += name.Length + 2;
+	}
+
+	*size = total;
+	return 0;
+}
+
+const char* megg_getFilename(const megg_info* info, unsigned int index, char* buffer)
+{
+	if (index >= info->NumFiles)
+		return nullptr;
+
+	if (info->Filenames != nullptr && info->FilenameOffsets != nullptr)
+		return info->Filenames[info->FilenameOffsets[index]].Name;
+
+	if (info->FrontCodedNames != nullptr)
+	{
+		megg_name_cursor name;
+		if (megg_seekName(info, index, &name) == false)
+			return nullptr;
+
+		memcpy(buffer, name.Name, name.Length + 1);
+		return buffer;
+	}
+
+	auto filenameCursor = info->Filenames;
+	for (unsigned int i = 0; i < index; i++)
+		filenameCursor += filenameCursor->Length + 2;
+
+	return filenameCursor->Name;
+}
+
+int megg_getEggInfo(unsigned char* fileBytes, unsigned int length, megg_info* result)
+{
+	if (megg_getEggHeader(fileBytes, length, result) != 0)
+		return -1;
+
+	if (result->FrontCodedNames != nullptr)
+	{
+		megg_name_cursor name;
+		for (unsigned int i = 0; i < result->NumFiles; i++)
+		{
+			if (megg_advanceName(result, i, &name) == false || megg_isEntryValid(result, i, length) == false)
+				return -1;
+		}
+
+		return 0;
+	}
 
 	// do a quick validation of the filenames and TOC
 	auto filenameCursor = result->Filenames;
-	for (unsigned int i = 0; i < h->NumFiles; i++)
+	for (unsigned int i = 0; i < result->NumFiles; i++)
 	{
 		if (filenameCursor->Name + filenameCursor->Length + 1 > (char*)fileBytes + length)
 			return -1;
@@ -85,11 +780,1090 @@ int megg_getEggInfo(unsigned char* fileBytes, unsigned int length, megg_info* re
 			return -1;
 		filenameCursor += filenameCursor->Length + 2;
 
-		if (result->TableOfContents[i].FileContentOffset + result->TableOfContents[i].CompressedSize > length)
+		if (megg_isEntryValid(result, i, length) == false)
+			return -1;
+	}
+
+	return 0;
+}
+
+int megg_validateAndIndex(const unsigned char* fileBytes, unsigned int length, megg_info* info, unsigned int* offsets, unsigned int first, unsigned int count)
+{
+	if (first > info->NumFiles || count > info->NumFiles - first)
+		return -1;
+
+	if (info->FrontCodedNames != nullptr)
+	{
+		for (unsigned int i = first; i < first + count; i++)
+		{
+			if (megg_isEntryValid(info, i, length) == false)
+				return -1;
+		}
+
+		return megg_decodeFilenames(info, offsets, first, count) ? 0 : -1;
+	}
+
+	// pick up where the last chunk left off
+	unsigned int cursor = 0;
+	if (first > 0)
+		cursor = offsets[first - 1] + info->Filenames[offsets[first - 1]].Length + 2;
+
+	const char* end = (const char*)fileBytes + length;
+	for (unsigned int i = first; i < first + count; i++)
+	{
+		const megg_info::Filename* filename = (const megg_info::Filename*)((const char*)info->Filenames + cursor);
+		if ((const char*)filename + 1 > end || filename->Name + filename->Length + 1 > end)
+			return -1;
+		if (filename->Name[filename->Length] != 0)
+			return -1;
+
+		if (megg_isEntryValid(info, i, length) == false)
 			return -1;
+
+		offsets[i] = cursor;
+		cursor += filename->Length + 2;
 	}
 
+	if (first + count == info->NumFiles)
+		info->FilenameOffsets = offsets;
+
 	return 0;
 }
 
+void megg_indexFilenames(megg_info* info, unsigned int* offsets)
+{
+	if (info->FrontCodedNames != nullptr)
+	{
+		megg_decodeFilenames(info, offsets, 0, info->NumFiles);
+		return;
+	}
+
+	unsigned int cursor = 0;
+	for (unsigned int i = 0; i < info->NumFiles; i++)
+	{
+		offsets[i] = cursor;
+		cursor += info->Filenames[cursor].Length + 2;
+	}
+
+	info->FilenameOffsets = offsets;
+}
+
+static int megg_compareFilenames(const char* a, const char* b)
+{
+	// same order as the builder's strcasecmp()
+	while (true)
+	{
+		int ca = (unsigned char)*a++;
+		int cb = (unsigned char)*b++;
+		if (ca >= 'A' && ca <= 'Z') ca += 'a' - 'A';
+		if (cb >= 'A' && cb <= 'Z') cb += 'a' - 'A';
+
+		if (ca != cb || ca == 0)
+			return ca - cb;
+	}
+}
+
+// Binary searches the first name in each bucket, then decodes the one bucket the name could be in
+static int megg_findFrontCodedFile(const megg_info* info, const char* name)
+{
+	unsigned int first = 0;
+	unsigned int last = info->NumNameBuckets;
+	while (first < last)
+	{
+		unsigned int middle = first + (last - first) / 2;
+
+		// the first name in the bucket is stored whole (length, name, 0), so check it all fits before comparing
+		unsigned int offset = info->NameBucketOffsets[middle];
+		if (offset >= info->FrontCodedNamesSize)
+			return -1;
+		unsigned int length = info->FrontCodedNames[offset];
+		if (info->FrontCodedNamesSize - offset < length + 2 || info->FrontCodedNames[offset + length + 1] != 0)
+			return -1;
+
+		const char* bucketName = (const char*)info->FrontCodedNames + offset + 1;
+		int r = megg_compareFilenames(bucketName, name);
+		if (r == 0)
+			return (int)(middle * info->NameBucketSize);
+		if (r < 0)
+			first = middle + 1;
+		else
+			last = middle;
+	}
+
+	// name comes before every bucket
+	if (first == 0)
+		return -1;
+
+	unsigned int bucket = first - 1;
+	megg_name_cursor cursor;
+	if (megg_startBucket(info, bucket, &cursor) == false)
+		return -1;
+
+	for (unsigned int i = bucket * info->NameBucketSize + 1; megg_nextName(&cursor); i++)
+	{
+		int r = megg_compareFilenames(cursor.Name, name);
+		if (r == 0)
+			return (int)i;
+		if (r > 0)
+			break;
+	}
+
+	return -1;
+}
+
+static int megg_findFileUnprofiled(const megg_info* info, const char* name)
+{
+	if (info->FilenameOffsets == nullptr && info->FrontCodedNames != nullptr)
+		return megg_findFrontCodedFile(info, name);
+
+	if (info->FilenameOffsets == nullptr)
+	{
+		auto filenameCursor = info->Filenames;
+		for (unsigned int i = 0; i < info->NumFiles; i++)
+		{
+			if (megg_compareFilenames(filenameCursor->Name, name) == 0)
+				return (int)i;
+			filenameCursor += filenameCursor->Length + 2;
+		}
+
+		return -1;
+	}
+
+	unsigned int first = 0;
+	unsigned int last = info->NumFiles;
+	while (first < last)
+	{
+		unsigned int middle = first + (last - first) / 2;
+		int r = megg_compareFilenames(info->Filenames[info->FilenameOffsets[middle]].Name, name);
+		if (r == 0)
+			return (int)middle;
+		if (r < 0)
+			first = middle + 1;
+		else
+			last = middle;
+	}
+
+	return -1;
+}
+
+int megg_findFile(const megg_info* info, const char* name)
+{
+	MEGG_PROFILE_BEGIN(start);
+
+	int result = megg_findFileUnprofiled(info, name);
+
+	MEGG_PROFILE_END(start, megg_profile_lookup, result, 0);
+	if (result < 0)
+		MEGG_PROFILE_COUNT(megg_profileLookupMisses);
+
+	return result;
+}
+
+void megg_initBlockCache(megg_block_cache* cache)
+{
+	memset(cache, 0, sizeof(megg_block_cache));
+}
+
+void megg_freeBlockCache(megg_block_cache* cache)
+{
+	for (int i = 0; i < MEGG_BLOCK_CACHE_SLOTS; i++)
+		MEGG_FREE(cache->Data[i]);
+
+	megg_initBlockCache(cache);
+}
+
+#ifdef MONDEGREENGAMES_EGG_LZ4
+// Decompresses at least the first size bytes of a block into destination, which has to have
+// room for the whole block (LZ4 might not stop right away). index is the file that wanted them.
+static bool megg_decompressBlock(const unsigned char* fileBytes, const megg_info::TOC* block, unsigned char* destination, unsigned int size, int index)
+{
+	MEGG_PROFILE_TOUCH(fileBytes + block->FileContentOffset, block->CompressedSize, index);
+
+	MEGG_PROFILE_BEGIN(start);
+	int r = LZ4_decompress_safe_partial((const char*)fileBytes + block->FileContentOffset, (char*)destination,
+		(int)block->CompressedSize, (int)size, (int)block->UncompressedSize);
+	MEGG_PROFILE_END(start, megg_profile_decompress, index, size);
+
+	return r >= 0 && (unsigned int)r >= size;
+}
+
+static const unsigned char* megg_getCachedBlock(const unsigned char* fileBytes, const megg_info* info, megg_block_cache* cache, unsigned int blockIndex, int index)
+{
+	int slot = 0;
+	for (int i = 0; i < MEGG_BLOCK_CACHE_SLOTS; i++)
+	{
+		if (cache->FileBytes[i] == fileBytes && cache->Block[i] == blockIndex)
+		{
+			cache->LastUsed[i] = ++cache->UseCounter;
+			MEGG_PROFILE_COUNT(megg_profileCacheHits);
+			return cache->Data[i];
+		}
+
+		if (cache->LastUsed[i] < cache->LastUsed[slot])
+			slot = i;
+	}
+
+	MEGG_PROFILE_COUNT(megg_profileCacheMisses);
+
+	// throw out whatever was used longest ago
+	const megg_info::TOC* block = &info->Blocks[blockIndex];
+	if (cache->Data[slot] == nullptr || cache->Capacity[slot] < block->UncompressedSize)
+	{
+		MEGG_FREE(cache->Data[slot]);
+		cache->Capacity[slot] = block->UncompressedSize > 0 ? block->UncompressedSize : 1;
+		cache->Data[slot] = (unsigned char*)MEGG_MALLOC(cache->Capacity[slot]);
+	}
+
+	cache->FileBytes[slot] = nullptr;
+	cache->LastUsed[slot] = 0;
+	if (cache->Data[slot] == nullptr || megg_decompressBlock(fileBytes, block, cache->Data[slot], block->UncompressedSize, index) == false)
+		return nullptr;
+
+	cache->FileBytes[slot] = fileBytes;
+	cache->Block[slot] = blockIndex;
+	cache->LastUsed[slot] = ++cache->UseCounter;
+	return cache->Data[slot];
+}
+#endif
+
+static int megg_readBlockFile(const unsigned char* fileBytes, const megg_info* info, megg_block_cache* cache, unsigned int index, void* destination)
+{
+	const megg_info::TOC* toc = &info->TableOfContents[index];
+	unsigned int blockIndex = toc->Flags >> 8;
+	if (blockIndex >= info->NumBlocks)
+		return -1;
+
+	// the file has to be inside the block, even if nobody checked the archive
+	const megg_info::TOC* block = &info->Blocks[blockIndex];
+	if (toc->FileContentOffset > block->UncompressedSize || toc->UncompressedSize > block->UncompressedSize - toc->FileContentOffset)
+		return -1;
+
+	if ((block->Flags & 0x01) == 0)
+	{
+		if (block->CompressedSize != block->UncompressedSize)
+			return -1;
+
+		MEGG_PROFILE_BEGIN(start);
+		memcpy(destination, fileBytes + block->FileContentOffset + toc->FileContentOffset, toc->UncompressedSize);
+		MEGG_PROFILE_END(start, megg_profile_read, (int)index, toc->UncompressedSize);
+		return (int)toc->UncompressedSize;
+	}
+
+#ifndef MONDEGREENGAMES_EGG_LZ4
+	return -1;
+#else
+	if (toc->UncompressedSize == 0)
+		return 0;
+
+	if (cache != nullptr)
+	{
+		const unsigned char* data = megg_getCachedBlock(fileBytes, info, cache, blockIndex, (int)index);
+		if (data == nullptr)
+			return -1;
+
+		memcpy(destination, data + toc->FileContentOffset, toc->UncompressedSize);
+		return (int)toc->UncompressedSize;
+	}
+
+	// without a cache only as much of the block as it takes to get to the end of the file gets decompressed
+	unsigned int end = toc->FileContentOffset + toc->UncompressedSize;
+	unsigned char* scratch = (unsigned char*)MEGG_MALLOC(block->UncompressedSize);
+	if (scratch == nullptr)
+		return -1;
+
+	bool ok = megg_decompressBlock(fileBytes, block, scratch, end, (int)index);
+	if (ok)
+		memcpy(destination, scratch + toc->FileContentOffset, toc->UncompressedSize);
+
+	MEGG_FREE(scratch);
+	return ok ? (int)toc->UncompressedSize : -1;
+#endif
+}
+
+int megg_readFileCached(const unsigned char* fileBytes, const megg_info* info, megg_block_cache* cache, unsigned int index, void* destination, unsigned int destinationSize)
+{
+	if (index >= info->NumFiles)
+		return -1;
+
+	const megg_info::TOC* toc = &info->TableOfContents[index];
+	if (toc->UncompressedSize > destinationSize)
+		return -1;
+
+	if (toc->Flags & 0x02)
+		return megg_readBlockFile(fileBytes, info, cache, index, destination);
+
+	if (toc->Flags & 0x01)
+	{
+#ifndef MONDEGREENGAMES_EGG_LZ4
+		return -1;
+#else
+		MEGG_PROFILE_TOUCH(fileBytes + toc->FileContentOffset, toc->CompressedSize, (int)index);
+
+		MEGG_PROFILE_BEGIN(start);
+		int r = LZ4_decompress_safe((const char*)fileBytes + toc->FileContentOffset, (char*)destination, (int)toc->CompressedSize, (int)destinationSize);
+		MEGG_PROFILE_END(start, megg_profile_decompress, (int)index, toc->UncompressedSize);
+		if (r != (int)toc->UncompressedSize)
+			return -1;
+#endif
+	}
+	else
+	{
+		if (toc->CompressedSize != toc->UncompressedSize)
+			return -1;
+
+		MEGG_PROFILE_BEGIN(start);
+		memcpy(destination, fileBytes + toc->FileContentOffset, toc->UncompressedSize);
+		MEGG_PROFILE_END(start, megg_profile_read, (int)index, toc->UncompressedSize);
+	}
+
+	return (int)toc->UncompressedSize;
+}
+
+int megg_readFile(const unsigned char* fileBytes, const megg_info* info, unsigned int index, void* destination, unsigned int destinationSize)
+{
+	return megg_readFileCached(fileBytes, info, nullptr, index, destination, destinationSize);
+}
+
+// the counts of groups and files, then the groups, then their files, then their names
+struct megg_group_entry
+{
+	unsigned int NameOffset;
+	unsigned int Offset;
+	unsigned int Size;
+	unsigned int FirstFile;
+	unsigned int NumFiles;
+	unsigned int Unused;
+};
+
+unsigned int megg_getNumGroups(const unsigned char* fileBytes, const megg_info* info)
+{
+	const megg_info::Section* section = megg_findSection(info, "GRPS");
+	if (section == nullptr || section->Size < 8)
+		return 0;
+
+	return *(const unsigned int*)(fileBytes + section->Offset);
+}
+
+int megg_getGroup(const unsigned char* fileBytes, const megg_info* info, unsigned int index, megg_group* result)
+{
+	const megg_info::Section* section = megg_findSection(info, "GRPS");
+	if (section == nullptr || section->Size < 8)
+		return -1;
+
+	const unsigned char* data = fileBytes + section->Offset;
+	unsigned int numGroups = ((const unsigned int*)data)[0];
+	unsigned int numFiles = ((const unsigned int*)data)[1];
+	if (index >= numGroups
+		|| numGroups > (section->Size - 8) / sizeof(megg_group_entry)
+		|| numFiles > (section->Size - 8 - numGroups * sizeof(megg_group_entry)) / 4)
+		return -1;
+
+	const megg_group_entry* group = (const megg_group_entry*)(data + 8) + index;
+	const unsigned int* files = (const unsigned int*)(data + 8 + numGroups * sizeof(megg_group_entry));
+	if (group->FirstFile > numFiles || group->NumFiles > numFiles - group->FirstFile
+		|| group->NameOffset >= section->Size
+		|| memchr(data + group->NameOffset, 0, section->Size - group->NameOffset) == nullptr)
+		return -1;
+
+	for (unsigned int i = 0; i < group->NumFiles; i++)
+	{
+		if (files[group->FirstFile + i] >= info->NumFiles)
+			return -1;
+	}
+
+	result->Name = (const char*)data + group->NameOffset;
+	result->Offset = group->Offset;
+	result->Size = group->Size;
+	result->Files = files + group->FirstFile;
+	result->NumFiles = group->NumFiles;
+	return 0;
+}
+
+int megg_findGroup(const unsigned char* fileBytes, const megg_info* info, const char* name)
+{
+	unsigned int numGroups = megg_getNumGroups(fileBytes, info);
+	for (unsigned int i = 0; i < numGroups; i++)
+	{
+		megg_group group;
+		if (megg_getGroup(fileBytes, info, i, &group) == 0 && megg_compareFilenames(group.Name, name) == 0)
+			return (int)i;
+	}
+
+	return -1;
+}
+
+struct megg_directory_entry
+{
+	unsigned int NameOffset;
+	unsigned int Parent;
+	unsigned int FirstChild;
+	unsigned int NumChildren;
+	unsigned int FirstFile;
+	unsigned int NumFiles;
+};
+
+unsigned int megg_getNumDirectories(const unsigned char* fileBytes, const megg_info* info)
+{
+	const megg_info::Section* section = megg_findSection(info, "DIRS");
+	if (section == nullptr || section->Size < 8)
+		return 0;
+
+	return *(const unsigned int*)(fileBytes + section->Offset);
+}
+
+int megg_getDirectory(const unsigned char* fileBytes, const megg_info* info, unsigned int index, megg_directory* result)
+{
+	const megg_info::Section* section = megg_findSection(info, "DIRS");
+	if (section == nullptr || section->Size < 8)
+		return -1;
+
+	const unsigned char* data = fileBytes + section->Offset;
+	unsigned int numDirectories = *(const unsigned int*)data;
+	if (index >= numDirectories || numDirectories > (section->Size - 8) / sizeof(megg_directory_entry))
+		return -1;
+
+	// subdirectories always come after their parent, so a broken section can't go round in circles
+	const megg_directory_entry* directory = (const megg_directory_entry*)(data + 8) + index;
+	if (directory->FirstFile > info->NumFiles || directory->NumFiles > info->NumFiles - directory->FirstFile
+		|| directory->FirstChild > numDirectories || directory->NumChildren > numDirectories - directory->FirstChild
+		|| (directory->NumChildren > 0 && directory->FirstChild <= index)
+		|| (directory->Parent >= numDirectories && directory->Parent != 0xffffffff)
+		|| directory->NameOffset >= section->Size
+		|| memchr(data + directory->NameOffset, 0, section->Size - directory->NameOffset) == nullptr)
+		return -1;
+
+	result->Name = (const char*)data + directory->NameOffset;
+	result->Parent = (int)directory->Parent;
+	result->FirstChild = directory->FirstChild;
+	result->NumChildren = directory->NumChildren;
+	result->FirstFile = directory->FirstFile;
+	result->NumFiles = directory->NumFiles;
+	return 0;
+}
+
+// Compares a directory's path with the first length characters of path, as if both ended in a '/',
+// since that's how they sort amongst the files
+static int megg_compareDirectories(const char* name, const char* path, unsigned int length)
+{
+	while (true)
+	{
+		bool nameEnded = *name == 0;
+		bool pathEnded = length == 0;
+		if (nameEnded && pathEnded)
+			return 0;
+
+		int a = nameEnded ? '/' : (unsigned char)*name;
+		int b = pathEnded ? '/' : (unsigned char)*path;
+		if (a >= 'A' && a <= 'Z') a += 'a' - 'A';
+		if (b >= 'A' && b <= 'Z') b += 'a' - 'A';
+
+		if (a != b)
+			return a - b;
+		if (nameEnded)
+			return -1;
+		if (pathEnded)
+			return 1;
+
+		name++;
+		path++;
+		length--;
+	}
+}
+
+// Finds the directory that's the first length characters of path, one binary search of the children at each level
+static int megg_findDirectoryPrefix(const unsigned char* fileBytes, const megg_info* info, const char* path, unsigned int length)
+{
+	megg_directory directory;
+	if (megg_getDirectory(fileBytes, info, 0, &directory) != 0)
+		return -1;
+
+	// "/sounds/ui/" is the same as "sounds/ui"
+	while (length > 0 && *path == '/')
+	{
+		path++;
+		length--;
+	}
+	while (length > 0 && path[length - 1] == '/')
+		length--;
+
+	unsigned int index = 0;
+	unsigned int end = 0;
+	while (end < length)
+	{
+		end++;
+		while (end < length && path[end] != '/')
+			end++;
+
+		unsigned int first = 0;
+		unsigned int last = directory.NumChildren;
+		bool found = false;
+		while (first < last)
+		{
+			unsigned int middle = first + (last - first) / 2;
+			megg_directory child;
+			if (megg_getDirectory(fileBytes, info, directory.FirstChild + middle, &child) != 0)
+				return -1;
+
+			int r = megg_compareDirectories(child.Name, path, end);
+			if (r == 0)
+			{
+				index = directory.FirstChild + middle;
+				directory = child;
+				found = true;
+				break;
+			}
+			if (r < 0)
+				first = middle + 1;
+			else
+				last = middle;
+		}
+
+		if (found == false)
+			return -1;
+	}
+
+	return (int)index;
+}
+
+int megg_findDirectory(const unsigned char* fileBytes, const megg_info* info, const char* path)
+{
+	return megg_findDirectoryPrefix(fileBytes, info, path, (unsigned int)strlen(path));
+}
+
+// The files that are right in a directory are its run of the TOC without its subdirectories' runs (which
+// are in the same order as the subdirectories). This gets the next piece of what's left. *position starts
+// at FirstFile and *child at 0. Returns 1, 0 once there's nothing left, or -1 if the section's broken.
+static int megg_nextDirectFiles(const unsigned char* fileBytes, const megg_info* info, const megg_directory* directory, unsigned int* child, unsigned int* position, unsigned int* first, unsigned int* count)
+{
+	unsigned int end = directory->FirstFile + directory->NumFiles;
+	while (*position < end)
+	{
+		unsigned int next = end;
+		unsigned int skipTo = end;
+		if (*child < directory->NumChildren)
+		{
+			megg_directory subdirectory;
+			if (megg_getDirectory(fileBytes, info, directory->FirstChild + *child, &subdirectory) != 0
+				|| subdirectory.FirstFile < *position || subdirectory.NumFiles > end - subdirectory.FirstFile)
+				return -1;
+
+			next = subdirectory.FirstFile;
+			skipTo = subdirectory.FirstFile + subdirectory.NumFiles;
+			(*child)++;
+		}
+
+		*first = *position;
+		*count = next - *position;
+		*position = skipTo;
+		if (*count > 0)
+			return 1;
+	}
+
+	return 0;
+}
+
+int megg_enumerateDirectory(const unsigned char* fileBytes, const megg_info* info, const char* path, bool recursive, megg_file_callback callback, void* userData)
+{
+	megg_directory directory;
+	int index = megg_findDirectory(fileBytes, info, path);
+	if (index < 0 || megg_getDirectory(fileBytes, info, (unsigned int)index, &directory) != 0)
+		return -1;
+
+	int numFound = 0;
+	if (recursive)
+	{
+		for (unsigned int i = directory.FirstFile; i < directory.FirstFile + directory.NumFiles; i++)
+		{
+			numFound++;
+			if (callback(userData, i) == false)
+				break;
+		}
+
+		return numFound;
+	}
+
+	unsigned int child = 0, position = directory.FirstFile, first, count;
+	while (megg_nextDirectFiles(fileBytes, info, &directory, &child, &position, &first, &count) > 0)
+	{
+		for (unsigned int i = first; i < first + count; i++)
+		{
+			numFound++;
+			if (callback(userData, i) == false)
+				return numFound;
+		}
+	}
+
+	return numFound;
+}
+
+// Matches one part of a path, so '*' and '?' never have to worry about slashes
+static bool megg_matchWildcard(const char* pattern, unsigned int patternLength, const char* name)
+{
+	const char* patternEnd = pattern + patternLength;
+	const char* star = nullptr;
+	const char* afterStar = nullptr;
+	while (*name != 0)
+	{
+		int a = pattern < patternEnd ? (unsigned char)*pattern : 0;
+		int b = (unsigned char)*name;
+		if (a >= 'A' && a <= 'Z') a += 'a' - 'A';
+		if (b >= 'A' && b <= 'Z') b += 'a' - 'A';
+
+		if (a == '*')
+		{
+			star = ++pattern;
+			afterStar = name;
+		}
+		else if (a != 0 && (a == '?' || a == b))
+		{
+			pattern++;
+			name++;
+		}
+		else if (star != nullptr)
+		{
+			// let the last '*' have one more character and try again
+			pattern = star;
+			name = ++afterStar;
+		}
+		else
+			return false;
+	}
+
+	while (pattern < patternEnd && *pattern == '*')
+		pattern++;
+
+	return pattern == patternEnd;
+}
+
+struct megg_glob_state
+{
+	const unsigned char* FileBytes;
+	const megg_info* Info;
+	megg_file_callback Callback;
+	void* UserData;
+	int NumFound;
+	bool Stopped;
+};
+
+// Matches the names of files [first, first + count) (skipping their first skip characters) against one part of a pattern
+static bool megg_globFiles(megg_glob_state* state, unsigned int first, unsigned int count, unsigned int skip, const char* pattern, unsigned int patternLength)
+{
+	const megg_info* info = state->Info;
+	megg_name_cursor frontCoded;
+	const megg_info::Filename* plain = nullptr;
+
+	for (unsigned int i = first; i < first + count && state->Stopped == false; i++)
+	{
+		const char* name;
+		if (info->FilenameOffsets != nullptr)
+			name = info->Filenames[info->FilenameOffsets[i]].Name;
+		else if (info->FrontCodedNames != nullptr)
+		{
+			if ((i == first ? megg_seekName(info, i, &frontCoded) : megg_advanceName(info, i, &frontCoded)) == false)
+				return false;
+			name = frontCoded.Name;
+		}
+		else
+		{
+			if (i == first)
+			{
+				plain = info->Filenames;
+				for (unsigned int j = 0; j < first; j++)
+					plain += plain->Length + 2;
+			}
+			else
+				plain += plain->Length + 2;
+			name = plain->Name;
+		}
+
+		if (memchr(name, 0, skip) != nullptr)
+			return false;
+
+		if (megg_matchWildcard(pattern, patternLength, name + skip))
+		{
+			state->NumFound++;
+			if (state->Callback(state->UserData, i) == false)
+				state->Stopped = true;
+		}
+	}
+
+	return true;
+}
+
+// Matches what's left of the pattern against what's in a directory
+static bool megg_globDirectory(megg_glob_state* state, unsigned int index, const char* pattern)
+{
+	megg_directory directory;
+	if (state->Stopped)
+		return true;
+	if (megg_getDirectory(state->FileBytes, state->Info, index, &directory) != 0)
+		return false;
+
+	const char* slash = strchr(pattern, '/');
+	unsigned int length = slash != nullptr ? (unsigned int)(slash - pattern) : (unsigned int)strlen(pattern);
+	unsigned int skip = directory.Name[0] != 0 ? (unsigned int)strlen(directory.Name) + 1 : 0;
+
+	if (length == 2 && pattern[0] == '*' && pattern[1] == '*')
+	{
+		// at the end it's everything under here
+		if (slash == nullptr)
+		{
+			for (unsigned int i = directory.FirstFile; i < directory.FirstFile + directory.NumFiles && state->Stopped == false; i++)
+			{
+				state->NumFound++;
+				if (state->Callback(state->UserData, i) == false)
+					state->Stopped = true;
+			}
+
+			return true;
+		}
+
+		// otherwise it's no directories at all, or one more and then still "**"
+		if (megg_globDirectory(state, index, slash + 1) == false)
+			return false;
+
+		for (unsigned int i = 0; i < directory.NumChildren; i++)
+		{
+			if (megg_globDirectory(state, directory.FirstChild + i, pattern) == false)
+				return false;
+		}
+
+		return true;
+	}
+
+	// the last part of the pattern is for the files right in here
+	if (slash == nullptr)
+	{
+		unsigned int child = 0, position = directory.FirstFile, first, count;
+		int r;
+		while ((r = megg_nextDirectFiles(state->FileBytes, state->Info, &directory, &child, &position, &first, &count)) > 0)
+		{
+			if (megg_globFiles(state, first, count, skip, pattern, length) == false)
+				return false;
+		}
+
+		return r == 0;
+	}
+
+	for (unsigned int i = 0; i < directory.NumChildren; i++)
+	{
+		megg_directory child;
+		if (megg_getDirectory(state->FileBytes, state->Info, directory.FirstChild + i, &child) != 0 || strlen(child.Name) < skip)
+			return false;
+
+		if (megg_matchWildcard(pattern, length, child.Name + skip) && megg_globDirectory(state, directory.FirstChild + i, slash + 1) == false)
+			return false;
+	}
+
+	return true;
+}
+
+int megg_glob(const unsigned char* fileBytes, const megg_info* info, const char* pattern, megg_file_callback callback, void* userData)
+{
+	if (megg_getNumDirectories(fileBytes, info) == 0)
+		return -1;
+
+	while (*pattern == '/')
+		pattern++;
+
+	// go straight to the deepest directory the pattern spells out without any wildcards
+	unsigned int prefixLength = 0;
+	for (const char* p = pattern; *p != 0 && *p != '*' && *p != '?'; p++)
+	{
+		if (*p == '/')
+			prefixLength = (unsigned int)(p - pattern);
+	}
+
+	int index = megg_findDirectoryPrefix(fileBytes, info, pattern, prefixLength);
+	if (index < 0)
+		return 0;
+
+	megg_glob_state state = { fileBytes, info, callback, userData, 0, false };
+	megg_globDirectory(&state, (unsigned int)index, prefixLength > 0 ? pattern + prefixLength + 1 : pattern);
+	return state.NumFound;
+}
+
+// asks for part of the archive to be paged in ahead of time
+static void megg_prefetch(const unsigned char* bytes, unsigned int size)
+{
+	if (size == 0)
+		return;
+
+#if defined(__unix__) || defined(__APPLE__)
+	// madvise() wants the start of a page
+	uintptr_t pageSize = (uintptr_t)sysconf(_SC_PAGESIZE);
+	uintptr_t start = (uintptr_t)bytes & ~(pageSize - 1);
+	madvise((void*)start, (uintptr_t)bytes + size - start, MADV_WILLNEED);
+#else
+	volatile unsigned char sink = 0;
+	for (unsigned int i = 0; i < size; i += 4096)
+		sink += bytes[i];
+	sink += bytes[size - 1];
+	(void)sink;
+#endif
+}
+
+int megg_loadGroup(const unsigned char* fileBytes, const megg_info* info, unsigned int index, megg_group* result)
+{
+	if (megg_getGroup(fileBytes, info, index, result) != 0)
+		return -1;
+
+	MEGG_PROFILE_BEGIN(start);
+
+	megg_prefetch(fileBytes + result->Offset, result->Size);
+
+	// files that were already laid out with an earlier group
+	unsigned long long bytes = result->Size;
+	for (unsigned int i = 0; i < result->NumFiles; i++)
+	{
+		unsigned int offset, size;
+		if (megg_getFileSpan(info, result->Files[i], &offset, &size) != 0)
+			continue;
+
+		if (offset < result->Offset || offset - result->Offset >= result->Size)
+		{
+			megg_prefetch(fileBytes + offset, size);
+			bytes += size;
+		}
+	}
+
+	MEGG_PROFILE_END(start, megg_profile_read, -1, bytes);
+
+	return 0;
+}
+
+// a request along with where it has to be read from
+struct megg_read_span
+{
+	unsigned int Offset;
+	unsigned int Size;
+	unsigned int Request;
+};
+
+void megg_initReadQueue(megg_read_queue* queue, unsigned int mergeGap, unsigned int maxReadSize)
+{
+	memset(queue, 0, sizeof(megg_read_queue));
+	megg_initBlockCache(&queue->Blocks);
+	queue->MergeGap = mergeGap;
+	queue->MaxReadSize = maxReadSize;
+}
+
+void megg_freeReadQueue(megg_read_queue* queue)
+{
+	MEGG_FREE(queue->Requests);
+	MEGG_FREE(queue->Buffer);
+	MEGG_FREE(queue->Spans);
+	megg_freeBlockCache(&queue->Blocks);
+	memset(queue, 0, sizeof(megg_read_queue));
+}
+
+int megg_queueRead(megg_read_queue* queue, unsigned int index, void* destination, unsigned int destinationSize)
+{
+	// the results of the last flush stay around until something new gets queued
+	if (queue->NumRequests > 0 && queue->Requests[queue->NumRequests - 1].Result != -2)
+		queue->NumRequests = 0;
+
+	if (queue->NumRequests == queue->Capacity)
+	{
+		unsigned int capacity = queue->Capacity > 0 ? queue->Capacity * 2 : 64;
+		megg_read_request* requests = (megg_read_request*)MEGG_MALLOC(capacity * sizeof(megg_read_request));
+		if (requests == nullptr)
+			return -1;
+
+		if (queue->NumRequests > 0)
+			memcpy(requests, queue->Requests, queue->NumRequests * sizeof(megg_read_request));
+		MEGG_FREE(queue->Requests);
+		queue->Requests = requests;
+		queue->Capacity = capacity;
+	}
+
+	// -2 means it hasn't been read yet
+	megg_read_request* request = &queue->Requests[queue->NumRequests];
+	request->Index = index;
+	request->Destination = destination;
+	request->DestinationSize = destinationSize;
+	request->Result = -2;
+
+	return (int)queue->NumRequests++;
+}
+
+static int megg_compareSpans(const void* a, const void* b)
+{
+	const megg_read_span* spanA = (const megg_read_span*)a;
+	const megg_read_span* spanB = (const megg_read_span*)b;
+	if (spanA->Offset != spanB->Offset)
+		return spanA->Offset < spanB->Offset ? -1 : 1;
+
+	// keeps it stable, so requests for the same block stay in the order they were made
+	return spanA->Request < spanB->Request ? -1 : (spanA->Request > spanB->Request ? 1 : 0);
+}
+
+int megg_flushReads(megg_read_queue* queue, const megg_info* info, megg_read_callback read, void* userData)
+{
+	unsigned int numRequests = queue->NumRequests;
+	if (numRequests == 0 || queue->Requests[numRequests - 1].Result != -2)
+		return 0;
+
+	if (queue->SpansCapacity < numRequests)
+	{
+		MEGG_FREE(queue->Spans);
+		queue->Spans = (megg_read_span*)MEGG_MALLOC(queue->Capacity * sizeof(megg_read_span));
+		queue->SpansCapacity = queue->Spans != nullptr ? queue->Capacity : 0;
+		if (queue->Spans == nullptr)
+			return (int)numRequests;
+	}
+
+	int numFailed = 0;
+	unsigned int numSpans = 0;
+	for (unsigned int i = 0; i < numRequests; i++)
+	{
+		megg_read_request* request = &queue->Requests[i];
+		megg_read_span* span = &queue->Spans[numSpans];
+		if (megg_getFileSpan(info, request->Index, &span->Offset, &span->Size) != 0
+			|| info->TableOfContents[request->Index].UncompressedSize > request->DestinationSize)
+		{
+			request->Result = -1;
+			numFailed++;
+			continue;
+		}
+
+		span->Request = i;
+		numSpans++;
+	}
+	queue->NumRequested += numRequests;
+
+	qsort(queue->Spans, numSpans, sizeof(megg_read_span), megg_compareSpans);
+
+	unsigned int first = 0;
+	while (first < numSpans)
+	{
+		// keep adding spans while they're close enough to the end of the read
+		unsigned int start = queue->Spans[first].Offset;
+		unsigned long long end = (unsigned long long)start + queue->Spans[first].Size;
+		unsigned int last = first + 1;
+		while (last < numSpans)
+		{
+			const megg_read_span* next = &queue->Spans[last];
+			unsigned long long nextEnd = (unsigned long long)next->Offset + next->Size;
+			if (next->Offset > end + queue->MergeGap || (nextEnd > end && nextEnd - start > queue->MaxReadSize))
+				break;
+
+			if (next->Offset > end)
+				queue->BytesSkipped += next->Offset - end;
+			if (nextEnd > end)
+				end = nextEnd;
+			last++;
+		}
+
+		unsigned int size = (unsigned int)(end - start);
+		if (queue->BufferSize < size)
+		{
+			MEGG_FREE(queue->Buffer);
+			queue->Buffer = (unsigned char*)MEGG_MALLOC(size);
+			queue->BufferSize = queue->Buffer != nullptr ? size : 0;
+		}
+
+		MEGG_PROFILE_BEGIN(readStart);
+		bool ok = queue->Buffer != nullptr && (size == 0 || read(userData, start, queue->Buffer, size) == (int)size);
+		MEGG_PROFILE_END(readStart, megg_profile_read, (int)queue->Requests[queue->Spans[first].Request].Index, size);
+
+		queue->NumReads++;
+		queue->NumMerged += last - first - 1;
+
+		// Everything in this read is where it would be in the archive, just moved back by start.
+		// Pretending the buffer's the whole archive means the normal read code can be used.
+		const unsigned char* fileBytes = queue->Buffer - start;
+		for (unsigned int i = first; i < last; i++)
+		{
+			megg_read_request* request = &queue->Requests[queue->Spans[i].Request];
+			request->Result = ok ? megg_readFileCached(fileBytes, info, &queue->Blocks, request->Index, request->Destination, request->DestinationSize) : -1;
+			if (request->Result < 0)
+			{
+				request->Result = -1;
+				numFailed++;
+			}
+		}
+
+		first = last;
+	}
+
+	// The cache knows blocks by where the archive is, which the buffer pretends to be. A later
+	// flush could end up pretending the same thing, so the blocks aren't kept (just the memory).
+	for (int i = 0; i < MEGG_BLOCK_CACHE_SLOTS; i++)
+		queue->Blocks.FileBytes[i] = nullptr;
+
+	return numFailed;
+}
+
+#ifdef EGG_PROFILE
+
+void megg_getProfileStats(megg_profile_stats* result)
+{
+	megg_profile_counter* counters[3] = { &result->Lookup, &result->Read, &result->Decompress };
+	for (int i = 0; i < 3; i++)
+	{
+		counters[i]->Calls = megg_profileCounters[i].Calls.load();
+		counters[i]->Bytes = megg_profileCounters[i].Bytes.load();
+		counters[i]->TotalNanoseconds = megg_profileCounters[i].TotalNanoseconds.load();
+		counters[i]->MaxNanoseconds = megg_profileCounters[i].MaxNanoseconds.load();
+		for (int j = 0; j < 32; j++)
+			counters[i]->Histogram[j] = megg_profileCounters[i].Histogram[j].load();
+	}
+
+	result->LookupMisses = megg_profileLookupMisses.load();
+	result->CacheHits = megg_profileCacheHits.load();
+	result->CacheMisses = megg_profileCacheMisses.load();
+}
+
+void megg_resetProfileStats()
+{
+	for (int i = 0; i < 3; i++)
+	{
+		megg_profileCounters[i].Calls = 0;
+		megg_profileCounters[i].Bytes = 0;
+		megg_profileCounters[i].TotalNanoseconds = 0;
+		megg_profileCounters[i].MaxNanoseconds = 0;
+		for (int j = 0; j < 32; j++)
+			megg_profileCounters[i].Histogram[j] = 0;
+	}
+
+	megg_profileLookupMisses = 0;
+	megg_profileCacheHits = 0;
+	megg_profileCacheMisses = 0;
+	megg_profileNextEvent = 0;
+}
+
+int megg_writeProfileTrace(const char* path)
+{
+#ifdef _MSC_VER
+	FILE* fp;
+	fopen_s(&fp, path, "wb");
+#else
+	FILE* fp = fopen(path, "wb");
+#endif
+	if (fp == nullptr)
+		return -1;
+
+	static const char* names[] = { "lookup", "read", "decompress" };
+
+	unsigned long long end = megg_profileNextEvent.load();
+	unsigned long long begin = end > EGG_PROFILE_MAX_EVENTS ? end - EGG_PROFILE_MAX_EVENTS : 0;
+
+	fprintf(fp, "{\"traceEvents\":[\n");
+	for (unsigned long long i = begin; i < end; i++)
+	{
+		const megg_profile_event& e = megg_profileEvents[i % EGG_PROFILE_MAX_EVENTS];
+
+		// trace event timestamps are in microseconds
+		fprintf(fp, "%s{\"name\":\"%s\",\"cat\":\"egg\",\"ph\":\"X\",\"ts\":%.3f,\"dur\":%.3f,\"pid\":1,\"tid\":%u,\"args\":{\"entry\":%d,\"bytes\":%llu}}\n",
+			i == begin ? "" : ",", names[e.Type], e.Start / 1000.0, e.Duration / 1000.0, e.Thread, e.Index, e.Bytes);
+	}
+	fprintf(fp, "]}\n");
+
+	fclose(fp);
+	return 0;
+}
+
+#endif // EGG_PROFILE
+
 #endif // MONDEGREENGAMES_EGG_IMPLEMENTATION
\ No newline at end of file
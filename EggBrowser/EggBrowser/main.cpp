@@ -1,4 +1,6 @@
 #include <cstdio>
+#include <thread>
+#include <atomic>
 #include "SDL.h"
 #include "GL/glew.h"
 
@@ -6,6 +8,12 @@
 #include "egg.h"
 
 #include "FileSystem.h"
+#include "Arena.h"
+#include "ArchiveView.h"
+#include "EntryReader.h"
+#include "LayoutMap.h"
+#include "Extractor.h"
+#include "Benchmark.h"
 
 #define ENABLE_SRGB
 
@@ -17,6 +25,9 @@ bool g_quitRequested = false;
 int g_screenWidth = 640;
 int g_screenHeight = 480;
 
+// background threads push this to get the main loop to redraw
+Uint32 g_wakeEvent;
+
 struct MenuItem
 {
 	const char* Text;
@@ -25,6 +36,11 @@ struct MenuItem
 	MenuItem* Children;
 };
 
+struct Rect
+{
+	float X0, Y0, X1, Y1;
+};
+
 struct Context
 {
 	NVGcontext* NVG;
@@ -41,20 +57,77 @@ struct Context
 	const char* MsgBoxMessage;
 
 	bool Invalidated;
+
+	// cleared at the start of every frame
+	Arena* FrameArena;
+
+	// what was typed since the last frame
+	char TextInput[32];
+	SDL_Keycode KeyDown;
+	SDL_Keymod KeyMods;
+
+	// The part of the window that needs to be redrawn. Events and widgets add to it
+	// whenever they change something, and the next frame only redraws what's in here.
+	// Everything else stays as it was in the framebuffer.
+	Rect Damage;
+
+	// the menu bar item under the mouse, or -1
+	int HoveredMenu;
+
+	// how tall the list box was last frame. If that changes, everything moves.
+	float ListHeight;
 };
 
+bool isEmpty(const Rect& r)
+{
+	return r.X0 >= r.X1 || r.Y0 >= r.Y1;
+}
+
+void damage(Context* c, float x, float y, float w, float h)
+{
+	if (w <= 0 || h <= 0)
+		return;
+
+	if (isEmpty(c->Damage))
+	{
+		c->Damage.X0 = x;
+		c->Damage.Y0 = y;
+		c->Damage.X1 = x + w;
+		c->Damage.Y1 = y + h;
+		return;
+	}
+
+	if (x < c->Damage.X0) c->Damage.X0 = x;
+	if (y < c->Damage.Y0) c->Damage.Y0 = y;
+	if (x + w > c->Damage.X1) c->Damage.X1 = x + w;
+	if (y + h > c->Damage.Y1) c->Damage.Y1 = y + h;
+}
+
+void damageAll(Context* c)
+{
+	damage(c, 0, 0, (float)g_screenWidth, (float)g_screenHeight);
+}
+
 MenuItem file[] = {
 	{ "Open", 0, nullptr },
+	{ "Extract", 0, nullptr },
 	{ "Exit", 0, nullptr }
 };
 
+MenuItem tools[] = {
+	{ "Files", 0, nullptr },
+	{ "Layout map", 0, nullptr },
+	{ "Load trace", 0, nullptr },
+	{ "Benchmark", 0, nullptr }
+};
+
 MenuItem help[] = {
 	{ "About", 0, nullptr }
 };
 
 MenuItem menu[] = {
-	{ "File", 2, file },
-	{ "Tools", 0, nullptr },
+	{ "File", 3, file },
+	{ "Tools", 4, tools },
 	{ "Help", 1, help }
 };
 
@@ -80,9 +153,34 @@ struct ScrollData
 	float MaxValue;
 };
 
-struct ListBoxRow
+// Returns the text for a cell, or null if it's empty. Anything that has to be formatted
+// should go in scratch, which is only good until the end of the frame.
+typedef const char* (*ListBoxGetCell)(void* userData, int row, int column, Arena* scratch);
+
+enum ListBoxSelection
+{
+	// just the row that was clicked
+	ListBoxSelection_Set,
+
+	// flip the row that was clicked (ctrl+click)
+	ListBoxSelection_Toggle,
+
+	// everything from the anchor to the row that was clicked (shift+click)
+	ListBoxSelection_Range
+};
+
+// For list boxes that can have more than one row selected
+typedef void (*ListBoxSelect)(void* userData, int row, int anchor, ListBoxSelection how);
+typedef bool (*ListBoxIsSelected)(void* userData, int row);
+
+const int MaxListBoxColumns = 8;
+
+// Remembers how much of each cell's text fits inside its column, so we only
+// have to measure glyphs when a row scrolls into view.
+struct ListBoxCachedRow
 {
-	const char** Items;
+	int Row;
+	int TextLength[MaxListBoxColumns];
 };
 
 struct ListBoxData
@@ -92,70 +190,555 @@ struct ListBoxData
 	int* ColumnWidths;
 
 	int NumRows;
-	ListBoxRow* Rows;
+	ListBoxGetCell GetCell;
+	void* UserData;
 
 	int FirstVisibleRow;
 	int SelectedRowIndex;
 
+	// Optional. Without these only SelectedRowIndex is selected.
+	ListBoxSelect Select;
+	ListBoxIsSelected IsSelected;
+
+	// where shift+click selects from
+	int AnchorRow;
+
+	// which header gets an arrow, or -1
+	int SortColumn;
+	bool SortDescending;
+
 	ScrollData Scrolling;
+
+	// rows live at Cache[row % CacheSize]
+	ListBoxCachedRow* Cache;
+	int CacheSize;
+
+	bool MetricsValid;
+	float Ascender;
+
+	// bumped whenever the rows change, so the list box knows to redraw
+	int Version;
 };
 
+// Call whenever the rows or columns change
+void invalidateListbox(ListBoxData* data)
+{
+	for (int i = 0; i < data->CacheSize; i++)
+		data->Cache[i].Row = -1;
+
+	data->Version++;
+}
+
 ListBoxData data;
 
-void menuClicked(Context* c, MenuItem* item)
+enum ArchiveState
 {
-	if (item == &file[0])
+	ArchiveState_Closed,
+	ArchiveState_Loading,
+	ArchiveState_Loaded,
+	ArchiveState_Failed,
+	ArchiveState_Cancelled
+};
+
+// The archive stays mapped for as long as it's open, and the list box reads
+// straight out of it instead of keeping its own copy of every row.
+//
+// Opening happens on the loader thread, which validates and indexes the files a
+// chunk at a time. After each chunk it bumps NumLoaded, and the UI can use every
+// row below NumLoaded without taking a lock. Everything else (EggFile, Info,
+// FilenameOffsets, Error) belongs to the loader until it's been joined, except
+// that Info and FilenameOffsets are safe to read once NumLoaded is non-zero.
+// The loader indexes into its own megg_info and fills in Info once, before the
+// first chunk is published, so the UI never sees it change.
+struct Archive
+{
+	const char* Path;
+	File EggFile;
+	megg_info Info;
+	unsigned int* FilenameOffsets;
+	const char* Error;
+
+	// the order the rows are shown in. Only the UI touches this.
+	ArchiveView View;
+
+	// one per file, non-zero if it's selected. Only the UI touches this either.
+	std::vector<uint8_t> Selected;
+	unsigned int NumSelected;
+
+	std::thread Loader;
+	std::atomic<int> State;
+	std::atomic<unsigned int> NumFiles;
+	std::atomic<unsigned int> NumLoaded;
+	std::atomic<bool> CancelRequested;
+};
+
+Archive g_archive;
+
+// anything that lives exactly as long as the open archive
+Arena g_archiveArena;
+
+// how many files the loader checks before handing them to the UI
+const unsigned int ArchiveLoadChunkSize = 16 * 1024;
+
+// what's typed into the filter box
+char g_filterText[256];
+
+enum PreviewMode
+{
+	PreviewMode_Hex,
+	PreviewMode_Text
+};
+
+// Shows the contents of the selected file. Only what's on screen gets read.
+struct Preview
+{
+	// -1 when nothing is selected
+	int File;
+	PreviewMode Mode;
+
+	// the first byte on screen
+	unsigned int Offset;
+	ScrollData Scrolling;
+
+	EntryReader Reader;
+};
+
+Preview g_preview;
+
+enum MainView
+{
+	MainView_Files,
+	MainView_Layout,
+	MainView_Benchmark
+};
+
+MainView g_mainView = MainView_Files;
+
+// Tools > Layout map
+struct LayoutView
+{
+	LayoutMap Map;
+
+	// the map, drawn at the size it's shown at. 0 until it's been drawn.
+	int Image;
+	int ImageWidth, ImageHeight;
+	bool ImageValid;
+	std::vector<unsigned char> Pixels;
+
+	// what was shown last frame, so it only gets redrawn when that changes
+	int ShownState;
+	int HoveredFile;
+	unsigned int ShownTraceReads;
+};
+
+LayoutView g_layout;
+
+// File > Extract
+Extractor g_extractor;
+
+// true from when extracting starts until the result's been shown
+bool g_extracting;
+
+// Tools > Benchmark
+Benchmark g_benchmark;
+bool g_benchmarking;
+
+// what the benchmark panel showed last frame, so it only gets redrawn when that changes
+int g_benchmarkShown = -1;
+
+const char* getArchiveCell(void* userData, int row, int column, Arena* scratch)
+{
+	Archive* archive = (Archive*)userData;
+	unsigned int file = archive->View.GetFile(row);
+	const megg_info::TOC& toc = archive->Info.TableOfContents[file];
+
+	switch (column)
 	{
-		const char* result = noc_file_dialog_open(NOC_FILE_DIALOG_OPEN, nullptr, nullptr, nullptr);
-		if (result)
+	case ArchiveColumn_Name:
+		return archive->Info.Filenames[archive->FilenameOffsets[file]].Name;
+	case ArchiveColumn_Size:
+		return scratch->Format("%u", toc.UncompressedSize);
+	case ArchiveColumn_CompressedSize:
+		// files in solid blocks don't have a compressed size of their own
+		if (toc.Flags & 0x02)
+			return nullptr;
+		return scratch->Format("%u", toc.CompressedSize);
+	case ArchiveColumn_Ratio:
+		if (toc.UncompressedSize == 0 || (toc.Flags & 0x02))
+			return nullptr;
+		return scratch->Format("%u%%", (unsigned int)((unsigned long long)toc.CompressedSize * 100 / toc.UncompressedSize));
+	case ArchiveColumn_Compression:
+		if (toc.Flags & 0x02)
+			return "Solid block";
+		return (toc.Flags & 0x01) ? "LZ4" : "None";
+	}
+
+	return nullptr;
+}
+
+bool isArchiveRowSelected(void* userData, int row)
+{
+	Archive* archive = (Archive*)userData;
+	return archive->Selected[archive->View.GetFile(row)] != 0;
+}
+
+void selectArchiveFile(Archive* archive, unsigned int file, bool selected)
+{
+	if ((archive->Selected[file] != 0) == selected)
+		return;
+
+	archive->Selected[file] = selected ? 1 : 0;
+	if (selected)
+		archive->NumSelected++;
+	else
+		archive->NumSelected--;
+}
+
+void selectArchiveRows(void* userData, int row, int anchor, ListBoxSelection how)
+{
+	Archive* archive = (Archive*)userData;
+
+	if (how == ListBoxSelection_Toggle)
+	{
+		unsigned int file = archive->View.GetFile(row);
+		selectArchiveFile(archive, file, archive->Selected[file] == 0);
+		return;
+	}
+
+	memset(&archive->Selected[0], 0, archive->Selected.size());
+	archive->NumSelected = 0;
+
+	int first = how == ListBoxSelection_Range && anchor < row ? anchor : row;
+	int last = how == ListBoxSelection_Range && anchor > row ? anchor : row;
+	for (int i = first; i <= last; i++)
+		selectArchiveFile(archive, archive->View.GetFile(i), true);
+}
+
+void wakeMainLoop()
+{
+	SDL_Event e = {};
+	e.type = g_wakeEvent;
+	SDL_PushEvent(&e);
+}
+
+void finishLoading(Archive* archive, ArchiveState state, const char* error)
+{
+	if (state != ArchiveState_Loaded)
+		FileSystem::Close(&archive->EggFile);
+
+	archive->Error = error;
+	archive->State.store(state, std::memory_order_release);
+	wakeMainLoop();
+}
+
+void loadArchive(Archive* archive, const char* path)
+{
+	File* f = &archive->EggFile;
+	if (FileSystem::Open(path, f) == false)
+	{
+		finishLoading(archive, ArchiveState_Failed, "Unable to open file :(");
+		return;
+	}
+
+	f->Memory = nullptr;
+	if (FileSystem::MapFile(f) == nullptr)
+	{
+		finishLoading(archive, ArchiveState_Failed, "Unable to map file");
+		return;
+	}
+
+	unsigned char* bytes = (unsigned char*)f->Memory;
+	megg_info info;
+	if (megg_getEggHeader(bytes, f->FileSize, &info) != 0)
+	{
+		finishLoading(archive, ArchiveState_Failed, "Unable to read egg archive");
+		return;
+	}
+
+	// front-coded names get decoded into a classic table while the archive is indexed
+	if (info.FrontCodedNames != nullptr)
+	{
+		unsigned int size;
+		if (megg_getDecodedFilenamesSize(&info, &size) != 0)
 		{
-			File f;
-			if (FileSystem::Open(result, &f) == false)
-				c->MsgBoxMessage = "Unable to open file :(";
-			else
-			{
-				auto bytes = FileSystem::MapFile(&f);
-				if (bytes == nullptr)
-				{
-					c->MsgBoxMessage = "Unable to map file";
-					FileSystem::Close(&f);
-					return;
-				}
-				megg_info egg;
-				if (megg_getEggInfo((unsigned char*)f.Memory, f.FileSize, &egg) != 0)
-				{
-					c->MsgBoxMessage = "Unable to read egg archive";
-					FileSystem::Close(&f);
-					return;
-				}
+			finishLoading(archive, ArchiveState_Failed, "Unable to read egg archive");
+			return;
+		}
 
-				data.NumRows = egg.NumFiles;
-				data.Rows = new ListBoxRow[egg.NumFiles];
-				auto fileCursor = egg.Filenames;
-				for (unsigned int i = 0; i < egg.NumFiles; i++)
-				{
-					data.Rows[i].Items = new const char*[4];
-					data.Rows[i].Items[0] = new char[fileCursor->Length + 1];
-					strcpy((char*)data.Rows[i].Items[0], fileCursor->Name);
+		info.Filenames = (megg_info::Filename*)g_archiveArena.Allocate<unsigned char>(size);
+	}
 
-					data.Rows[i].Items[1] = new char[10];
-					_itoa(egg.TableOfContents[i].CompressedSize, (char*)data.Rows[i].Items[1], 10);
+	// the UI won't touch the archive arena until this thread has been joined
+	unsigned int numFiles = info.NumFiles;
+	archive->FilenameOffsets = g_archiveArena.Allocate<unsigned int>(numFiles);
 
-					data.Rows[i].Items[2] = nullptr;
+	// megg_validateAndIndex() only sets FilenameOffsets after the last chunk, so the UI's
+	// copy gets it now and nothing in it changes after that
+	archive->Info = info;
+	archive->Info.FilenameOffsets = archive->FilenameOffsets;
+	archive->NumFiles.store(numFiles, std::memory_order_release);
 
-					if (egg.TableOfContents[i].Flags == 1)
-						data.Rows[i].Items[3] = "LZ4";
-					else
-						data.Rows[i].Items[3] = "None";
+	for (unsigned int first = 0; first < numFiles; first += ArchiveLoadChunkSize)
+	{
+		if (archive->CancelRequested.load(std::memory_order_relaxed))
+		{
+			finishLoading(archive, ArchiveState_Cancelled, nullptr);
+			return;
+		}
 
-					fileCursor += fileCursor->Length + 2;
-				}
-				FileSystem::Close(&f);
-			}
+		unsigned int count = numFiles - first < ArchiveLoadChunkSize ? numFiles - first : ArchiveLoadChunkSize;
+		if (megg_validateAndIndex(bytes, f->FileSize, &info, archive->FilenameOffsets, first, count) != 0)
+		{
+			finishLoading(archive, ArchiveState_Failed, "Unable to read egg archive");
+			return;
 		}
+
+		archive->NumLoaded.store(first + count, std::memory_order_release);
+		wakeMainLoop();
+	}
+
+	finishLoading(archive, ArchiveState_Loaded, nullptr);
+}
+
+void closeArchive()
+{
+	if (g_archive.Loader.joinable())
+	{
+		g_archive.CancelRequested = true;
+		g_archive.Loader.join();
+	}
+
+	if (g_archive.State == ArchiveState_Closed)
+		return;
+
+	data.NumRows = 0;
+	data.FirstVisibleRow = 0;
+	data.SelectedRowIndex = -1;
+	data.AnchorRow = -1;
+	invalidateListbox(&data);
+
+	// everything that reads the archive on another thread has to stop before it goes away
+	g_extractor.Cancel();
+	g_extractor.Wait();
+	g_extracting = false;
+
+	g_benchmark.Reset();
+	g_benchmarking = false;
+
+	g_layout.Map.Reset();
+	g_layout.ImageValid = false;
+	g_layout.HoveredFile = -1;
+
+	// the loader closes the file itself if it didn't finish
+	if (g_archive.State == ArchiveState_Loaded)
+		FileSystem::Close(&g_archive.EggFile);
+
+	g_preview.File = -1;
+	g_preview.Reader.Close();
+
+	g_archive.Selected.clear();
+	g_archive.NumSelected = 0;
+
+	g_archive.View.Reset();
+	g_archiveArena.Reset();
+	g_archive.Path = nullptr;
+	g_archive.FilenameOffsets = nullptr;
+	g_archive.Error = nullptr;
+	g_archive.NumFiles = 0;
+	g_archive.NumLoaded = 0;
+	g_archive.CancelRequested = false;
+	g_archive.State = ArchiveState_Closed;
+}
+
+void openArchive(const char* path)
+{
+	closeArchive();
+
+	data.FirstVisibleRow = 0;
+	data.SelectedRowIndex = -1;
+
+	// the dialog's buffer won't last as long as the loader might
+	const char* pathCopy = g_archiveArena.Format("%s", path);
+
+	g_archive.State = ArchiveState_Loading;
+	g_archive.Path = pathCopy;
+	g_archive.Loader = std::thread(loadArchive, &g_archive, pathCopy);
+}
+
+int getSelectedFile()
+{
+	if (data.SelectedRowIndex < 0 || data.SelectedRowIndex >= data.NumRows)
+		return -1;
+
+	return (int)g_archive.View.GetFile(data.SelectedRowIndex);
+}
+
+// Call after the view has been sorted or filtered. Keeps the same file selected if it's still there.
+void viewChanged(Context* c, int selectedFile)
+{
+	// the filter box shows how many rows there are
+	damage(c, 0, 0, (float)g_screenWidth, 30);
+
+	data.NumRows = (int)g_archive.View.GetNumRows();
+	data.SelectedRowIndex = selectedFile >= 0 ? g_archive.View.FindRow((unsigned int)selectedFile) : -1;
+	data.AnchorRow = data.SelectedRowIndex;
+	data.SortColumn = g_archive.View.GetSortColumn();
+	data.SortDescending = g_archive.View.IsSortDescending();
+	invalidateListbox(&data);
+}
+
+// Picks up whatever the loader has finished since the last frame
+void updateArchive(Context* c)
+{
+	int state = g_archive.State.load(std::memory_order_acquire);
+	if (state == ArchiveState_Closed)
+		return;
+
+	if (state == ArchiveState_Failed || state == ArchiveState_Cancelled)
+	{
+		if (state == ArchiveState_Failed)
+			c->MsgBoxMessage = g_archive.Error;
+		closeArchive();
+		return;
+	}
+
+	if (state == ArchiveState_Loaded && g_archive.Loader.joinable())
+		g_archive.Loader.join();
+
+	unsigned int numLoaded = g_archive.NumLoaded.load(std::memory_order_acquire);
+	if (numLoaded != g_archive.View.GetNumFiles())
+	{
+		int selectedFile = getSelectedFile();
+		g_archive.Selected.resize(numLoaded, 0);
+		g_archive.View.Update(&g_archive.Info, g_archive.FilenameOffsets, numLoaded);
+		viewChanged(c, selectedFile);
+	}
+}
+
+// The layout map needs every file, so it waits until the archive has finished loading
+void startLayoutMap()
+{
+	if (g_layout.Map.GetState() == LayoutMap::State_Empty && g_archive.State == ArchiveState_Loaded)
+		g_layout.Map.Start((const unsigned char*)g_archive.EggFile.Memory, g_archive.EggFile.FileSize, &g_archive.Info, g_archive.FilenameOffsets, wakeMainLoop);
+}
+
+// Ctrl+A
+void selectAllRows(Context* c)
+{
+	memset(&g_archive.Selected[0], 0, g_archive.Selected.size());
+	g_archive.NumSelected = 0;
+
+	for (unsigned int i = 0; i < g_archive.View.GetNumRows(); i++)
+		selectArchiveFile(&g_archive, g_archive.View.GetFile(i), true);
+
+	damageAll(c);
+}
+
+// File > Extract. Extracts every selected file into a directory, keeping their paths.
+void startExtracting(Context* c)
+{
+	if (g_archive.State != ArchiveState_Loaded)
+	{
+		c->MsgBoxMessage = "Open an archive first";
+		return;
+	}
+
+	if (g_extracting || g_benchmarking)
+	{
+		c->MsgBoxMessage = g_extracting ? "Already extracting" : "Wait for the benchmark to finish first";
+		return;
+	}
+
+	if (g_archive.NumSelected == 0)
+	{
+		c->MsgBoxMessage = "Select the files to extract first. Ctrl+click and shift+click select more than one, and Ctrl+A selects everything.";
+		return;
+	}
+
+	const char* directory = noc_file_dialog_open(NOC_FILE_DIALOG_OPEN | NOC_FILE_DIALOG_DIR, nullptr, nullptr, nullptr);
+	if (directory == nullptr)
+		return;
+
+	// in archive order rather than the order they're shown in, so the archive gets read from front to back
+	std::vector<unsigned int> files;
+	files.reserve(g_archive.NumSelected);
+	for (unsigned int i = 0; i < g_archive.Selected.size(); i++)
+	{
+		if (g_archive.Selected[i] != 0)
+			files.push_back(i);
+	}
+
+	g_extractor.Start((const unsigned char*)g_archive.EggFile.Memory, &g_archive.Info, g_archive.FilenameOffsets, files, directory, wakeMainLoop);
+	g_extracting = true;
+}
+
+// Tools > Benchmark. Times the selected files, or every file if none are selected.
+void startBenchmark(Context* c)
+{
+	if (g_archive.State != ArchiveState_Loaded)
+	{
+		c->MsgBoxMessage = "Open an archive first";
+		return;
+	}
+
+	// extracting at the same time would throw the timings off
+	if (g_extracting || g_benchmarking)
+	{
+		c->MsgBoxMessage = g_extracting ? "Wait for extracting to finish first" : "Already benchmarking";
+		return;
+	}
+
+	std::vector<unsigned int> files;
+	for (unsigned int i = 0; i < g_archive.Selected.size(); i++)
+	{
+		if (g_archive.NumSelected == 0 || g_archive.Selected[i] != 0)
+			files.push_back(i);
+	}
+
+	g_benchmark.Start((const unsigned char*)g_archive.EggFile.Memory, &g_archive.Info, files, wakeMainLoop);
+	g_benchmarking = true;
+
+	g_mainView = MainView_Benchmark;
+	damageAll(c);
+}
+
+void menuClicked(Context* c, MenuItem* item)
+{
+	if (item == &file[0])
+	{
+		const char* result = noc_file_dialog_open(NOC_FILE_DIALOG_OPEN, nullptr, nullptr, nullptr);
+		if (result)
+			openArchive(result);
 	}
 	else if (item == &file[1])
+		startExtracting(c);
+	else if (item == &file[2])
 		g_quitRequested = true;
+	else if (item == &tools[0] || item == &tools[1])
+	{
+		g_mainView = item == &tools[0] ? MainView_Files : MainView_Layout;
+		damageAll(c);
+	}
+	else if (item == &tools[3])
+		startBenchmark(c);
+	else if (item == &tools[2])
+	{
+		if (g_archive.State != ArchiveState_Loaded)
+			c->MsgBoxMessage = "Open an archive first";
+		else
+		{
+			const char* result = noc_file_dialog_open(NOC_FILE_DIALOG_OPEN, nullptr, nullptr, nullptr);
+			if (result)
+			{
+				startLayoutMap();
+				if (g_layout.Map.LoadTrace(result) == false)
+					c->MsgBoxMessage = "Unable to read the trace";
+
+				g_mainView = MainView_Layout;
+				damageAll(c);
+			}
+		}
+	}
 	else if (item == &help[0])
 		c->MsgBoxMessage = "EGG archive browser v0.0.1";
 }
@@ -212,262 +795,1449 @@ void drawVScroll(Context* c, float x, float y, float h, ScrollData* scroll)
 	}
 }
 
-void doListbox(Context* c, ListBoxData* data, float x, float y, float w, float h)
+// Figures out how many bytes of text fit in the given width
+int fitText(NVGcontext* ctx, const char* text, float width)
+{
+	const int maxGlyphs = 256;
+	NVGglyphPosition glyphs[maxGlyphs];
+
+	int numGlyphs = nvgTextGlyphPositions(ctx, 0, 0, text, nullptr, glyphs, maxGlyphs);
+
+	int length = (int)strlen(text);
+	for (int i = 0; i < numGlyphs; i++)
+	{
+		if (glyphs[i].maxx > width)
+			return (int)(glyphs[i].str - text);
+	}
+
+	return length;
+}
+
+ListBoxCachedRow* getCachedRow(Context* c, ListBoxData* data, int row)
+{
+	ListBoxCachedRow* cached = &data->Cache[row % data->CacheSize];
+	if (cached->Row == row)
+		return cached;
+
+	cached->Row = row;
+	for (int j = 0; j < data->NumColumns && j < MaxListBoxColumns; j++)
+	{
+		const char* text = data->GetCell(data->UserData, row, j, c->FrameArena);
+		cached->TextLength[j] = text != nullptr ? fitText(c->NVG, text, data->ColumnWidths[j] - textOffsetX) : 0;
+	}
+
+	return cached;
+}
+
+// Returns the column whose header was clicked, or -1
+int doListbox(Context* c, ListBoxData* data, float x, float y, float w, float h)
 {	
+	int clickedColumn = -1;
+
+	int oldFirstVisibleRow = data->FirstVisibleRow;
+	int oldSelectedRowIndex = data->SelectedRowIndex;
+	int oldVersion = data->Version;
+	bool selectionChanged = false;
+
 	int maxVisibleRows = (int)((h - 30) / 30);
 
-	data->FirstVisibleRow -= c->MouseWheel;
+	if (c->MouseX >= x && c->MouseX < x + w && c->MouseY >= y && c->MouseY < y + h)
+		data->FirstVisibleRow -= c->MouseWheel;
 	if (data->FirstVisibleRow > data->NumRows - maxVisibleRows)
 		data->FirstVisibleRow = data->NumRows - maxVisibleRows;
 	if (data->FirstVisibleRow < 0)
 		data->FirstVisibleRow = 0;
 
-	float ascender, descender, height;
-	nvgTextMetrics(c->NVG, &ascender, &descender, &height);
+	// the font never changes, so neither do the metrics
+	if (data->MetricsValid == false)
+	{
+		float descender, height;
+		nvgTextMetrics(c->NVG, &data->Ascender, &descender, &height);
+		data->MetricsValid = true;
+	}
+	float ascender = data->Ascender;
+
+	// make sure every visible row (plus the partial one at the bottom) fits in the cache
+	if (data->CacheSize < maxVisibleRows + 1)
+	{
+		delete[] data->Cache;
+		data->CacheSize = maxVisibleRows + 1;
+		data->Cache = new ListBoxCachedRow[data->CacheSize];
+		invalidateListbox(data);
+	}
+
+	if (c->Modal == nullptr && c->LButtonDown == false && c->LButtonTransitionCount > 0)
+	{
+		if (c->MouseX >= x && c->MouseX <= x + w &&
+			c->MouseY >= y && c->MouseY <= y + h)
+		{
+			// the box was clicked. Determine which row.
+			c->Hot = data;
+
+			int row = (int)((c->MouseY - y) / 30);
+			if (row > 0 && data->FirstVisibleRow + row - 1 < data->NumRows)
+			{
+				data->SelectedRowIndex = data->FirstVisibleRow + row - 1;
+
+				if (data->Select != nullptr)
+				{
+					ListBoxSelection how = ListBoxSelection_Set;
+					if ((c->KeyMods & KMOD_SHIFT) && data->AnchorRow >= 0)
+						how = ListBoxSelection_Range;
+					else if (c->KeyMods & (KMOD_CTRL | KMOD_GUI))
+						how = ListBoxSelection_Toggle;
+
+					data->Select(data->UserData, data->SelectedRowIndex, data->AnchorRow, how);
+					if (how != ListBoxSelection_Range)
+						data->AnchorRow = data->SelectedRowIndex;
+
+					// any number of rows could have changed
+					selectionChanged = true;
+				}
+			}
+			else if (row == 0)
+			{
+				float columnX = x;
+				for (int i = 0; i < data->NumColumns && clickedColumn < 0; i++)
+				{
+					columnX += data->ColumnWidths[i];
+					if (c->MouseX < columnX)
+						clickedColumn = i;
+				}
+			}
+		}
+	}
+
+	float textOffsetY = 30 * 0.5f + ascender * 0.5f;
+
+	// draw the background
+	drawBox(c->NVG, x, y, w, h, srgb(80, 80, 80), 0, 0);
+
+	// draw the header
+	drawBox(c->NVG, x, y, w, 30, srgb(100, 100, 100), 0, 0);
+
+	// draw the header text
+	float cx = 0;
+	nvgBeginPath(c->NVG);
+	nvgFillColor(c->NVG, srgb(255, 255, 255));
+	for (int i = 0; i < data->NumColumns; i++)
+	{
+		nvgText(c->NVG, cx, y + textOffsetY, data->HeaderNames[i], nullptr);
+
+		cx += (float)data->ColumnWidths[i];
+	}
+
+	// point the arrow the way the column is sorted
+	if (data->SortColumn >= 0 && data->SortColumn < data->NumColumns)
+	{
+		float arrowX = x;
+		for (int i = 0; i <= data->SortColumn; i++)
+			arrowX += (float)data->ColumnWidths[i];
+		arrowX -= 12.0f;
+
+		float arrowY = y + 15.0f;
+		float direction = data->SortDescending ? 1.0f : -1.0f;
+
+		nvgBeginPath(c->NVG);
+		nvgMoveTo(c->NVG, arrowX - 4.0f, arrowY - 2.0f * direction);
+		nvgLineTo(c->NVG, arrowX + 4.0f, arrowY - 2.0f * direction);
+		nvgLineTo(c->NVG, arrowX, arrowY + 3.0f * direction);
+		nvgClosePath(c->NVG);
+		nvgFill(c->NVG);
+	}
+
+	// only the rows that are actually on screen get drawn
+	int lastVisibleRow = data->FirstVisibleRow + maxVisibleRows + 1;
+	if (lastVisibleRow > data->NumRows)
+		lastVisibleRow = data->NumRows;
+
+	// draw the selection. The row that was clicked last is a bit brighter than the others.
+	if (data->IsSelected != nullptr)
+	{
+		for (int i = data->FirstVisibleRow; i < lastVisibleRow; i++)
+		{
+			if (data->IsSelected(data->UserData, i))
+				drawBox(c->NVG, x, y + 30.0f * (i - data->FirstVisibleRow + 1), w, 30, i == data->SelectedRowIndex ? srgb(0, 70, 125) : srgb(0, 50, 90), 0, 0);
+		}
+	}
+	else if (data->SelectedRowIndex >= data->FirstVisibleRow && data->SelectedRowIndex < lastVisibleRow)
+		drawBox(c->NVG, x, y + 30.0f * (data->SelectedRowIndex - data->FirstVisibleRow + 1), w, 30, srgb(0, 50, 90), 0, 0);
+
+	// draw the text of every row in one go
+	nvgSave(c->NVG);
+	nvgIntersectScissor(c->NVG, x, y + 30.0f, w, h - 30.0f);
+	nvgBeginPath(c->NVG);
+	nvgFillColor(c->NVG, srgb(255, 255, 255));
+
+	float cy = y + 30.0f;
+	for (int i = data->FirstVisibleRow; i < lastVisibleRow; i++)
+	{
+		ListBoxCachedRow* cached = getCachedRow(c, data, i);
+
+		cx = x;
+		for (int j = 0; j < data->NumColumns; j++)
+		{
+			const char* text = data->GetCell(data->UserData, i, j, c->FrameArena);
+			if (text != nullptr && cached->TextLength[j] > 0)
+				nvgText(c->NVG, cx, cy + textOffsetY, text, text + cached->TextLength[j]);
+
+			cx += data->ColumnWidths[j];
+		}
+
+		cy += 30;
+	}
+	nvgRestore(c->NVG);
+
+
+
+	// draw the scrollbar
+	data->Scrolling.Value = (float)data->FirstVisibleRow;
+	data->Scrolling.MaxValue = (float)(data->NumRows - maxVisibleRows);
+	drawVScroll(c, x + w - 10, y, h, &data->Scrolling);
+
+	data->FirstVisibleRow = (int)data->Scrolling.Value;
+
+	// redraw what changed next frame
+	if (data->FirstVisibleRow != oldFirstVisibleRow || data->Version != oldVersion || selectionChanged)
+		damage(c, x, y, w, h);
+	else if (data->SelectedRowIndex != oldSelectedRowIndex)
+	{
+		int rows[2] = { oldSelectedRowIndex, data->SelectedRowIndex };
+		for (int i = 0; i < 2; i++)
+		{
+			if (rows[i] >= data->FirstVisibleRow && rows[i] <= data->FirstVisibleRow + maxVisibleRows)
+				damage(c, x, y + 30.0f * (rows[i] - data->FirstVisibleRow + 1), w, 30);
+		}
+	}
+
+	return clickedColumn;
+}
+
+// how wide the menus that drop down from the menu bar are
+const int MenuWidth = 100;
+
+MenuItem* doMenu(Context* c, int font, MenuItem* items, int numItems, float x, float y)
+{
+	float ascender, descender, height;
+	nvgTextMetrics(c->NVG, &ascender, &descender, &height);
+
+	float textOffsetY = 30 * 0.5f + ascender * 0.5f;
+
+	drawBox(c->NVG, x, y, (float)MenuWidth, numItems * 30.0f, srgb(40, 40, 40), 0, 0);
+
+	MenuItem* clickedItem = nullptr;
+
+	nvgBeginPath(c->NVG);
+	nvgFillColor(c->NVG, srgb(255, 255, 255));
+	for (int j = 0; j < numItems; j++)
+	{
+		nvgText(c->NVG, textOffsetX + x, y + j * 30 + textOffsetY, items[j].Text, nullptr);
+
+		if (c->Modal == nullptr &&
+			c->MouseX >= x && c->MouseX < x + MenuWidth &&
+			c->MouseY >= y + j * 30 && c->MouseY <= y + (j + 1) * 30 &&
+			c->LButtonDown && c->LButtonTransitionCount > 0)
+		{
+			c->Hot = nullptr;
+			clickedItem = &items[j];
+		}
+	}
+
+	return clickedItem;
+}
+
+const int MenuBarItemWidth = 50;
+const int MenuBarHeight = 30;
+const int NumMenuBarItems = 3;
+
+// Returns which menu bar item is at the given point, or -1
+int menuBarItemAt(int x, int y)
+{
+	if (x < 0 || x >= NumMenuBarItems * MenuBarItemWidth || y < 0 || y > MenuBarHeight)
+		return -1;
+
+	return x / MenuBarItemWidth;
+}
+
+// Returns the menu that's open, if there is one
+MenuItem* getOpenMenu(Context* c)
+{
+	for (int i = 0; i < NumMenuBarItems; i++)
+	{
+		if (c->Hot == &menu[i])
+			return &menu[i];
+	}
+
+	return nullptr;
+}
+
+// the part of the window a menu covers while it's open
+void damageMenu(Context* c, MenuItem* item)
+{
+	if (item == nullptr)
+		return;
+
+	float x = (float)((item - menu) * MenuBarItemWidth);
+	damage(c, x, 0, (float)MenuWidth, (float)(MenuBarHeight + item->NumChildren * 30));
+}
+
+MenuItem* doMenuBar(Context* c, int font, MenuItem* items, int numItems)
+{
+	nvgFontFaceId(c->NVG, font);
+
+	int hovered = menuBarItemAt(c->MouseX, c->MouseY);
+	if (hovered != c->HoveredMenu)
+	{
+		if (c->HoveredMenu >= 0)
+			damage(c, (float)(c->HoveredMenu * MenuBarItemWidth), 0, (float)MenuBarItemWidth, (float)MenuBarHeight);
+		if (hovered >= 0)
+			damage(c, (float)(hovered * MenuBarItemWidth), 0, (float)MenuBarItemWidth, (float)MenuBarHeight);
+
+		c->HoveredMenu = hovered;
+	}
+
+	// draw menu background
+	drawBox(c->NVG, 0, 0, (float)g_screenWidth, 30, srgb(50, 50, 50), 0, 0);
+	
+	float ascender, descender, height;
+	nvgTextMetrics(c->NVG, &ascender, &descender, &height);
+
+	float textOffsetY = 30 * 0.5f + ascender * 0.5f;
+
+	MenuItem* clickedItem = nullptr;
+	for (int i = 0; i < 3; i++)
+	{
+		if (hovered == i)
+		{
+			drawBox(c->NVG, (float)(i * 50), 0, 50, 30, srgb(60, 60, 60), 0, 0);
+
+			if (c->Modal == nullptr && c->LButtonDown == false && c->LButtonTransitionCount > 0)
+			{
+				if (c->Hot == &menu[i])
+				{
+					c->Hot = nullptr;
+				}
+				else
+				{
+					c->Hot = &menu[i];
+				}
+
+				c->Invalidated = true;
+			}
+		}
+
+		nvgBeginPath(c->NVG);
+		if (c->Hot == &menu[i])
+			nvgFillColor(c->NVG, srgb(255, 0, 0));
+		else
+			nvgFillColor(c->NVG, srgb(255, 255, 255));
+		nvgText(c->NVG, textOffsetX + i * 50, textOffsetY, menu[i].Text, nullptr);
+
+		if (c->Hot == &menu[i])
+		{
+			auto item = doMenu(c, font, menu[i].Children, menu[i].NumChildren, i * 50.0f, 30);
+			if (item != nullptr)
+				clickedItem = item;
+		}
+	}
+
+	return clickedItem;
+}
+
+bool doButton(Context* c, float x, float y, float w, float h, const char* label, float originX = 0.5f, float originY = 0.5f)
+{
+	drawBox(c->NVG, x, y, w, h, srgb(100, 0, 0), originX, originY);
+
+	float ascender, descender, height;
+	nvgTextMetrics(c->NVG, &ascender, &descender, &height);
+
+	float bounds[4];
+	nvgTextBounds(c->NVG, 0, 0, label, nullptr, bounds);
+
+	float textWidth = bounds[2] - bounds[0];
+	float textHeight = bounds[3] - bounds[1];
+
+	nvgFillColor(c->NVG, srgb(255, 255, 255));
+	nvgText(c->NVG, x - textWidth * 0.5f, y - textHeight * originY + ascender * 0.5f, label, nullptr);
+
+	if (c->MouseX >= x - w * originX && c->MouseX <= x + w * (1.0f - originX) &&
+		c->MouseY >= y - h * originY && c->MouseY <= y + h * (1.0f - originY))
+	{
+		if (c->LButtonDown == false && c->LButtonTransitionCount > 0)
+		{
+			return true;
+		}
+	}
+
+	return false;
+}
+
+bool doMessageBox(Context* c, const char* message)
+{
+	c->Modal = (void*)message;
+
+	const float buttonHeight = 30.0f;
+	const float buttonPadding = 15.0f;
+
+	float ascender, descender, height;
+	nvgTextMetrics(c->NVG, &ascender, &descender, &height);
+
+	float maxTextboxWidth = g_screenWidth * 0.8f;
+	float minWidth = 200.0f;
+
+	float bounds[4];
+	nvgTextBoxBounds(c->NVG, 0, 0, maxTextboxWidth, message, nullptr, bounds);
+
+	float screenCenterX = (float)(g_screenWidth / 2);
+	float screenCenterY = (float)(g_screenHeight / 2);
+
+	float textWidth = bounds[2] - bounds[0];
+	float textHeight = bounds[3] - bounds[1];
+
+	const float padding = 5.0f;
+	float boxWidth = textWidth + padding * 2.0f;
+	float boxHeight = textHeight + padding * 2.0f + buttonHeight + buttonPadding;
+	if (boxWidth < minWidth) boxWidth = minWidth;
+	
+	drawBox(c->NVG, screenCenterX, screenCenterY, boxWidth, boxHeight, srgb(100, 100, 100));
+
+	nvgFillColor(c->NVG, nvgRGB(255, 255, 255));
+	nvgTextBox(c->NVG, screenCenterX - textWidth / 2, screenCenterY - boxHeight * 0.5f + padding + height, maxTextboxWidth, message, nullptr);
+
+	if (doButton(c, screenCenterX, screenCenterY + boxHeight * 0.5f - padding, 100.0f, 30.0f, "Got it!", 0.5f, 1.0f))
+	{
+		c->Modal = nullptr;
+		return true;
+	}
+
+	return false;
+}
+
+void selectPreview(int file)
+{
+	if (file == g_preview.File)
+		return;
+
+	g_preview.File = file;
+	g_preview.Offset = 0;
+
+	if (file < 0)
+		g_preview.Reader.Close();
+	else
+		g_preview.Reader.Open((const unsigned char*)g_archive.EggFile.Memory, &g_archive.Info, (unsigned int)file);
+}
+
+const float PreviewLineHeight = 20.0f;
+const unsigned int PreviewMaxLineLength = 256;
+const int PreviewScrollLines = 3;
+
+// Finds where the line before the one starting at offset starts. Long lines are wrapped
+// at PreviewMaxLineLength, so it never has to look back further than that.
+bool findPreviousLine(Context* c, unsigned int offset, unsigned int* result)
+{
+	if (offset == 0)
+	{
+		*result = 0;
+		return true;
+	}
+
+	unsigned int start = offset > PreviewMaxLineLength ? offset - PreviewMaxLineLength : 0;
+	unsigned char* bytes = c->FrameArena->Allocate<unsigned char>(PreviewMaxLineLength);
+	unsigned int bytesRead;
+	if (g_preview.Reader.Read(start, offset - start, bytes, &bytesRead) != EntryReader::Result_OK)
+		return false;
+
+	// skip the newline that ends the previous line
+	unsigned int i = offset - start - 1;
+	while (i > 0 && bytes[i - 1] != '\n')
+		i--;
+
+	*result = start + i;
+	return true;
+}
+
+void drawHexPreview(Context* c, const unsigned char* bytes, unsigned int count, float x, float y, float ascender)
+{
+	const char* hexDigits = "0123456789abcdef";
+
+	nvgBeginPath(c->NVG);
+	nvgFillColor(c->NVG, srgb(255, 255, 255));
+
+	for (unsigned int row = 0; row * 16 < count; row++)
+	{
+		float textY = y + row * PreviewLineHeight + PreviewLineHeight * 0.5f + ascender * 0.5f;
+		nvgText(c->NVG, x + textOffsetX, textY, c->FrameArena->Format("%08x", g_preview.Offset + row * 16), nullptr);
+
+		char ascii[17];
+		unsigned int i;
+		for (i = 0; i < 16 && row * 16 + i < count; i++)
+		{
+			unsigned char b = bytes[row * 16 + i];
+
+			char hex[3] = { hexDigits[b >> 4], hexDigits[b & 15], 0 };
+			nvgText(c->NVG, x + 90.0f + i * 22.0f + (i >= 8 ? 8.0f : 0), textY, hex, nullptr);
+
+			ascii[i] = (b >= 32 && b < 127) ? (char)b : '.';
+		}
+		ascii[i] = 0;
+
+		nvgText(c->NVG, x + 90.0f + 16 * 22.0f + 24.0f, textY, ascii, nullptr);
+	}
+}
+
+// Returns where the line after the first few starts, so scrolling down knows where to go
+unsigned int drawTextPreview(Context* c, const unsigned char* bytes, unsigned int count, unsigned int maxLines, float x, float y, float ascender)
+{
+	nvgBeginPath(c->NVG);
+	nvgFillColor(c->NVG, srgb(255, 255, 255));
+
+	unsigned int nextLine = count;
+	unsigned int cursor = 0;
+	char* line = c->FrameArena->Allocate<char>(PreviewMaxLineLength + 1);
+	for (unsigned int i = 0; i < maxLines && cursor < count; i++)
+	{
+		unsigned int length = 0;
+		while (cursor < count && length < PreviewMaxLineLength && bytes[cursor] != '\n')
+		{
+			unsigned char b = bytes[cursor++];
+			if (b == '\r')
+				continue;
+
+			if (b == '\t')
+				line[length++] = ' ';
+			else if (b < 32)
+				line[length++] = '.';
+			else
+				line[length++] = (char)b;
+		}
+		line[length] = 0;
+
+		if (cursor < count && bytes[cursor] == '\n')
+			cursor++;
+		if (i + 1 == PreviewScrollLines)
+			nextLine = cursor;
+
+		nvgText(c->NVG, x + textOffsetX, y + i * PreviewLineHeight + PreviewLineHeight * 0.5f + ascender * 0.5f, line, nullptr);
+	}
+
+	return nextLine;
+}
+
+void doPreview(Context* c, float x, float y, float w, float h)
+{
+	PreviewMode oldMode = g_preview.Mode;
+	unsigned int oldOffset = g_preview.Offset;
+
+	const megg_info::TOC& toc = g_archive.Info.TableOfContents[g_preview.File];
+	const char* name = g_archive.Info.Filenames[g_archive.FilenameOffsets[g_preview.File]].Name;
+
+	float ascender, descender, height;
+	nvgTextMetrics(c->NVG, &ascender, &descender, &height);
+
+	// the header
+	drawBox(c->NVG, x, y, w, 30, srgb(100, 100, 100), 0, 0);
+	nvgBeginPath(c->NVG);
+	nvgFillColor(c->NVG, srgb(255, 255, 255));
+	nvgText(c->NVG, x + textOffsetX, y + 15.0f + ascender * 0.5f, c->FrameArena->Format("%s (%u bytes)", name, toc.UncompressedSize), nullptr);
+
+	if (doButton(c, x + w - 105.0f, y + 15.0f, 60.0f, 24.0f, "Hex") && c->Modal == nullptr)
+	{
+		g_preview.Mode = PreviewMode_Hex;
+		g_preview.Offset &= ~15u;
+		c->Invalidated = true;
+	}
+	if (doButton(c, x + w - 40.0f, y + 15.0f, 60.0f, 24.0f, "Text") && c->Modal == nullptr)
+	{
+		g_preview.Mode = PreviewMode_Text;
+		c->Invalidated = true;
+	}
+
+	float bodyY = y + 30.0f;
+	float bodyHeight = h - 30.0f;
+	drawBox(c->NVG, x, bodyY, w, bodyHeight, srgb(60, 60, 60), 0, 0);
+
+	unsigned int maxLines = (unsigned int)(bodyHeight / PreviewLineHeight);
+	unsigned int size = g_preview.Reader.GetSize();
+	bool hovered = c->MouseX >= x && c->MouseX < x + w && c->MouseY >= bodyY && c->MouseY < bodyY + bodyHeight;
+
+	unsigned int wanted = g_preview.Mode == PreviewMode_Hex ? maxLines * 16 : maxLines * (PreviewMaxLineLength + 1);
+	unsigned char* bytes = c->FrameArena->Allocate<unsigned char>(wanted);
+	unsigned int bytesRead;
+	EntryReader::Result result = g_preview.Reader.Read(g_preview.Offset, wanted, bytes, &bytesRead);
+
+	nvgSave(c->NVG);
+	nvgIntersectScissor(c->NVG, x, bodyY, w - 10.0f, bodyHeight);
+
+	unsigned int nextLine = 0;
+	if (result == EntryReader::Result_Pending)
+	{
+		// keep going next frame
+		nvgBeginPath(c->NVG);
+		nvgFillColor(c->NVG, srgb(200, 200, 200));
+		nvgText(c->NVG, x + textOffsetX, bodyY + 15.0f + ascender * 0.5f,
+			c->FrameArena->Format("Decompressing... %d%%", (int)(g_preview.Reader.GetProgress() * 100)), nullptr);
+		c->Invalidated = true;
+	}
+	else if (result == EntryReader::Result_Error)
+	{
+		nvgBeginPath(c->NVG);
+		nvgFillColor(c->NVG, srgb(255, 100, 100));
+		nvgText(c->NVG, x + textOffsetX, bodyY + 15.0f + ascender * 0.5f, "Unable to decompress this file", nullptr);
+	}
+	else if (g_preview.Mode == PreviewMode_Hex)
+		drawHexPreview(c, bytes, bytesRead, x, bodyY, ascender);
+	else
+		nextLine = drawTextPreview(c, bytes, bytesRead, maxLines, x, bodyY, ascender);
+
+	nvgRestore(c->NVG);
+
+	// scrolling
+	if (hovered && c->MouseWheel != 0 && c->Modal == nullptr && result == EntryReader::Result_OK)
+	{
+		if (g_preview.Mode == PreviewMode_Hex)
+		{
+			long long offset = (long long)g_preview.Offset - c->MouseWheel * PreviewScrollLines * 16;
+			long long last = size > 0 ? (long long)((size - 1) & ~15u) : 0;
+			g_preview.Offset = (unsigned int)(offset < 0 ? 0 : offset > last ? last : offset);
+		}
+		else
+		{
+			for (int i = 0; i < c->MouseWheel * PreviewScrollLines; i++)
+			{
+				if (findPreviousLine(c, g_preview.Offset, &g_preview.Offset) == false)
+					break;
+			}
+			if (c->MouseWheel < 0 && nextLine < bytesRead)
+				g_preview.Offset += nextLine;
+		}
+
+		c->Invalidated = true;
+	}
+
+	g_preview.Scrolling.Value = (float)g_preview.Offset;
+	g_preview.Scrolling.MaxValue = size > 0 ? (float)size : 1.0f;
+	drawVScroll(c, x + w - 10.0f, bodyY, bodyHeight, &g_preview.Scrolling);
+
+	// only take the scrollbar's word for it while it's being dragged, since a float can't hold every offset
+	if (c->Hot == &g_preview.Scrolling && c->LButtonDown)
+	{
+		float value = g_preview.Scrolling.Value;
+		unsigned int offset = value <= 0 ? 0 : value >= size ? (size > 0 ? size - 1 : 0) : (unsigned int)value;
+		if (g_preview.Mode == PreviewMode_Hex)
+			offset &= ~15u;
+		g_preview.Offset = offset;
+	}
+
+	if (g_preview.Mode != oldMode || g_preview.Offset != oldOffset || result == EntryReader::Result_Pending)
+		damage(c, x, y, w, h);
+}
+
+// Applies whatever was typed this frame to the buffer. Returns true if it changed.
+bool doTextInput(Context* c, char* buffer, int bufferSize)
+{
+	bool changed = false;
+	int length = (int)strlen(buffer);
+
+	if (c->KeyDown == SDLK_BACKSPACE && length > 0)
+	{
+		// take off a whole UTF-8 character
+		do
+			length--;
+		while (length > 0 && (buffer[length] & 0xc0) == 0x80);
+
+		changed = true;
+	}
+	else if (c->KeyDown == SDLK_ESCAPE && length > 0)
+	{
+		length = 0;
+		changed = true;
+	}
+
+	for (const char* cursor = c->TextInput; *cursor != 0 && length + 1 < bufferSize; cursor++)
+	{
+		buffer[length++] = *cursor;
+		changed = true;
+	}
+
+	buffer[length] = 0;
+	return changed;
+}
+
+void drawTextBox(Context* c, float x, float y, float w, float h, const char* text, const char* placeholder)
+{
+	drawBox(c->NVG, x, y, w, h, srgb(30, 30, 30), 0, 0);
+
+	float ascender, descender, height;
+	nvgTextMetrics(c->NVG, &ascender, &descender, &height);
+	float textY = y + h * 0.5f + ascender * 0.5f;
+
+	nvgSave(c->NVG);
+	nvgIntersectScissor(c->NVG, x, y, w, h);
+
+	nvgBeginPath(c->NVG);
+	if (text[0] == 0)
+	{
+		nvgFillColor(c->NVG, srgb(120, 120, 120));
+		nvgText(c->NVG, x + textOffsetX, textY, placeholder, nullptr);
+	}
+	else
+	{
+		nvgFillColor(c->NVG, srgb(255, 255, 255));
+		nvgText(c->NVG, x + textOffsetX, textY, text, nullptr);
+	}
+
+	// the box always has focus, so the cursor is always at the end
+	float cursorX = x + textOffsetX;
+	if (text[0] != 0)
+		cursorX += nvgTextBounds(c->NVG, 0, 0, text, nullptr, nullptr);
+	drawBox(c->NVG, cursorX, y + 4.0f, 1.0f, h - 8.0f, srgb(255, 255, 255), 0, 0);
+
+	nvgRestore(c->NVG);
+}
+
+void drawFilterBox(Context* c)
+{
+	const float width = 250.0f;
+	float x = g_screenWidth - width - 5.0f;
+
+	drawTextBox(c, x, 3.0f, width, 24.0f, g_filterText, "Filter");
+
+	if (g_filterText[0] != 0 && g_archive.State != ArchiveState_Closed)
+	{
+		const char* count = c->FrameArena->Format("%u of %u", g_archive.View.GetNumRows(), g_archive.View.GetNumFiles());
+		float countWidth = nvgTextBounds(c->NVG, 0, 0, count, nullptr, nullptr);
+
+		float ascender, descender, height;
+		nvgTextMetrics(c->NVG, &ascender, &descender, &height);
+
+		nvgBeginPath(c->NVG);
+		nvgFillColor(c->NVG, srgb(200, 200, 200));
+		nvgText(c->NVG, x - countWidth - 10.0f, 15.0f + ascender * 0.5f, count, nullptr);
+	}
+}
+
+// what a progress bar showed last time, so it only gets redrawn when that changes
+struct ProgressBar
+{
+	int Filled;
+	char Text[128];
+};
+
+ProgressBar g_loadingBar;
+ProgressBar g_extractingBar;
+
+// Returns true if the user wants to cancel
+bool doProgressBar(Context* c, ProgressBar* bar, float x, float y, float w, float h, float fraction, const char* text)
+{
+	const float buttonWidth = 80.0f;
+	float barWidth = w - buttonWidth;
+
+	int filled = (int)(barWidth * fraction);
+	if (filled != bar->Filled || strncmp(text, bar->Text, sizeof(bar->Text) - 1) != 0)
+	{
+		damage(c, x, y, barWidth, h);
+		bar->Filled = filled;
+		strncpy(bar->Text, text, sizeof(bar->Text) - 1);
+	}
+
+	drawBox(c->NVG, x, y, barWidth, h, srgb(50, 50, 50), 0, 0);
+	drawBox(c->NVG, x, y, barWidth * fraction, h, srgb(0, 50, 90), 0, 0);
+
+	float ascender, descender, height;
+	nvgTextMetrics(c->NVG, &ascender, &descender, &height);
+
+	nvgBeginPath(c->NVG);
+	nvgFillColor(c->NVG, srgb(255, 255, 255));
+	nvgText(c->NVG, x + textOffsetX, y + h * 0.5f + ascender * 0.5f, text, nullptr);
+
+	return doButton(c, x + w - buttonWidth * 0.5f, y + h * 0.5f, buttonWidth, h, "Cancel") && c->Modal == nullptr;
+}
+
+// Shows how far along the loader is. Returns true if the user wants to cancel.
+bool doLoadingBar(Context* c, float x, float y, float w, float h, unsigned int numLoaded, unsigned int numFiles)
+{
+	float fraction = numFiles > 0 ? (float)numLoaded / numFiles : 0;
+
+	const char* text = "Opening...";
+	if (numFiles > 0)
+		text = c->FrameArena->Format("Loading... %u of %u files", numLoaded, numFiles);
+
+	return doProgressBar(c, &g_loadingBar, x, y, w, h, fraction, text);
+}
+
+// 1234567 -> "1.2 MB"
+const char* formatBytes(Arena* scratch, unsigned long long bytes)
+{
+	if (bytes < 1024)
+		return scratch->Format("%llu bytes", bytes);
+	if (bytes < 1024 * 1024)
+		return scratch->Format("%.1f KB", bytes / 1024.0);
+	if (bytes < 1024 * 1024 * 1024)
+		return scratch->Format("%.1f MB", bytes / (1024.0 * 1024.0));
+
+	return scratch->Format("%.1f GB", bytes / (1024.0 * 1024.0 * 1024.0));
+}
+
+struct LayoutLegend
+{
+	const char* Name;
+	unsigned char R, G, B;
+};
+
+// what each LayoutCategory is called and what color it is on the map
+const LayoutLegend layoutLegend[LayoutCategory_Count] = {
+	{ "Header", 150, 150, 170 },
+	{ "Stored", 40, 110, 200 },
+	{ "LZ4", 40, 180, 80 },
+	{ "Padding", 70, 70, 70 },
+	{ "Dead", 200, 40, 40 },
+	{ "Overlap", 220, 50, 220 }
+};
+
+// LZ4 files that barely got any smaller end up this color
+const LayoutLegend layoutPoorlyCompressed = { "LZ4 (poor)", 230, 190, 40 };
+
+NVGcolor layoutColor(const LayoutLegend& legend)
+{
+	return srgb(legend.R, legend.G, legend.B);
+}
+
+// Switches to the file list with the given file selected and scrolled to
+void showFile(Context* c, int file)
+{
+	if (g_archive.View.FindRow((unsigned int)file) < 0)
+	{
+		g_filterText[0] = 0;
+		g_archive.View.SetFilter(g_filterText);
+	}
+
+	viewChanged(c, file);
+	data.FirstVisibleRow = data.SelectedRowIndex;
+
+	g_mainView = MainView_Files;
+	damageAll(c);
+}
+
+void drawLayoutLegend(Context* c, float x, float y, float h, float ascender)
+{
+	const float swatchSize = 12.0f;
+
+	for (int i = 0; i <= LayoutCategory_Count; i++)
+	{
+		const LayoutLegend& legend = i < LayoutCategory_Count ? layoutLegend[i] : layoutPoorlyCompressed;
+
+		drawBox(c->NVG, x, y + (h - swatchSize) * 0.5f, swatchSize, swatchSize, layoutColor(legend), 0, 0);
+		x += swatchSize + 5.0f;
+
+		nvgBeginPath(c->NVG);
+		nvgFillColor(c->NVG, srgb(200, 200, 200));
+		nvgText(c->NVG, x, y + h * 0.5f + ascender * 0.5f, legend.Name, nullptr);
+		x += nvgTextBounds(c->NVG, 0, 0, legend.Name, nullptr, nullptr) + 15.0f;
+	}
+}
+
+// Draws the order the trace read files in, as a line from each one to the next.
+// It starts out blue and turns white, so it's possible to tell which way it went.
+void drawTrace(Context* c, float x, float y, int width, int height)
+{
+	const std::vector<unsigned int>& trace = g_layout.Map.GetTrace();
+	unsigned long long fileSize = g_layout.Map.GetFileSize();
+	if (trace.size() < 2 || fileSize == 0)
+		return;
+
+	unsigned long long numPixels = (unsigned long long)width * height;
+
+	// one path per color
+	const size_t numBands = 32;
+	size_t readsPerBand = (trace.size() - 1 + numBands - 1) / numBands;
+
+	nvgStrokeWidth(c->NVG, 1.0f);
+	for (size_t first = 0; first + 1 < trace.size(); first += readsPerBand)
+	{
+		size_t last = first + readsPerBand < trace.size() - 1 ? first + readsPerBand : trace.size() - 1;
+
+		nvgBeginPath(c->NVG);
+		for (size_t i = first; i <= last; i++)
+		{
+			unsigned int offset, size;
+			megg_getFileSpan(&g_archive.Info, trace[i], &offset, &size);
+
+			unsigned long long pixel = (unsigned long long)offset * numPixels / fileSize;
+			float px = x + (float)(pixel % width) + 0.5f;
+			float py = y + (float)(pixel / width) + 0.5f;
+
+			if (i == first)
+				nvgMoveTo(c->NVG, px, py);
+			else
+				nvgLineTo(c->NVG, px, py);
+		}
+
+		float t = (float)first / (trace.size() - 1);
+		nvgStrokeColor(c->NVG, nvgLerpRGBA(srgb(60, 120, 255), srgb(255, 255, 255), t));
+		nvgStroke(c->NVG);
+	}
+}
+
+// Shows where everything is in the archive, as a map with the first byte at the top left
+// and the last one at the bottom right. Clicking a file shows it in the file list.
+void doLayoutMap(Context* c, float x, float y, float w, float h)
+{
+	startLayoutMap();
+
+	LayoutMap* map = &g_layout.Map;
+	int state = map->GetState();
+	if (state != g_layout.ShownState)
+	{
+		damage(c, x, y, w, h);
+		g_layout.ShownState = state;
+	}
+
+	float ascender, descender, lineHeight;
+	nvgTextMetrics(c->NVG, &ascender, &descender, &lineHeight);
+
+	// a line of stats, the map, then a line about whatever's under the mouse
+	const float lineSpacing = 30.0f;
+	float textY = lineSpacing * 0.5f + ascender * 0.5f;
+
+	drawBox(c->NVG, x, y, w, h, srgb(30, 30, 30), 0, 0);
+
+	if (state != LayoutMap::State_Done)
+	{
+		nvgBeginPath(c->NVG);
+		nvgFillColor(c->NVG, srgb(200, 200, 200));
+		nvgText(c->NVG, x + textOffsetX, y + textY, g_archive.State == ArchiveState_Closed ? "No archive is open" : "Working out the layout...", nullptr);
+		return;
+	}
+
+	float mapY = y + lineSpacing;
+	int width = (int)w;
+	int height = (int)(h - lineSpacing * 2);
+	if (width <= 0 || height <= 0)
+		return;
+
+	// the map only has to be drawn again if it changes size
+	if (g_layout.ImageValid == false || width != g_layout.ImageWidth || height != g_layout.ImageHeight)
+	{
+		LayoutPalette palette;
+		for (int i = 0; i <= LayoutCategory_Count; i++)
+		{
+			NVGcolor color = layoutColor(i < LayoutCategory_Count ? layoutLegend[i] : layoutPoorlyCompressed);
+			float* out = i < LayoutCategory_Count ? palette.Colors[i] : palette.PoorlyCompressed;
+			out[0] = color.r;
+			out[1] = color.g;
+			out[2] = color.b;
+		}
+
+		g_layout.Pixels.resize((size_t)width * height * 4);
+		map->Draw(&g_layout.Pixels[0], width, height, palette);
+
+		if (g_layout.Image != 0 && (width != g_layout.ImageWidth || height != g_layout.ImageHeight))
+		{
+			nvgDeleteImage(c->NVG, g_layout.Image);
+			g_layout.Image = 0;
+		}
+
+		if (g_layout.Image == 0)
+			g_layout.Image = nvgCreateImageRGBA(c->NVG, width, height, NVG_IMAGE_NEAREST, &g_layout.Pixels[0]);
+		else
+			nvgUpdateImage(c->NVG, g_layout.Image, &g_layout.Pixels[0]);
+
+		g_layout.ImageWidth = width;
+		g_layout.ImageHeight = height;
+		g_layout.ImageValid = true;
+		damage(c, x, y, w, h);
+	}
+
+	const LayoutStats& stats = map->GetStats();
+	Arena* scratch = c->FrameArena;
+	const char* summary = scratch->Format("%s. %s dead in %u gaps, %s of padding, %s overlapping. %u files out of order.",
+		formatBytes(scratch, map->GetFileSize()),
+		formatBytes(scratch, stats.Bytes[LayoutCategory_Dead]), stats.NumGaps,
+		formatBytes(scratch, stats.Bytes[LayoutCategory_Padding]),
+		formatBytes(scratch, stats.Bytes[LayoutCategory_Overlap]),
+		stats.NumOutOfOrder);
+
+	const TraceStats& traceStats = map->GetTraceStats();
+	if (traceStats.NumReads > 0)
+	{
+		summary = scratch->Format("%s Trace: %u reads, %s of seeking, %u backwards.",
+			summary, traceStats.NumReads, formatBytes(scratch, traceStats.SeekBytes), traceStats.NumBackwardSeeks);
+	}
+
+	nvgBeginPath(c->NVG);
+	nvgFillColor(c->NVG, srgb(200, 200, 200));
+	nvgText(c->NVG, x + textOffsetX, y + textY, summary, nullptr);
 
-	if (c->Modal == nullptr && c->LButtonDown == false && c->LButtonTransitionCount > 0)
+	NVGpaint paint = nvgImagePattern(c->NVG, x, mapY, (float)width, (float)height, 0, g_layout.Image, 1.0f);
+	nvgBeginPath(c->NVG);
+	nvgRect(c->NVG, x, mapY, (float)width, (float)height);
+	nvgFillPaint(c->NVG, paint);
+	nvgFill(c->NVG);
+
+	drawTrace(c, x, mapY, width, height);
+
+	int hovered = -1;
+	if (c->Modal == nullptr && c->MouseX >= x && c->MouseX < x + width && c->MouseY >= mapY && c->MouseY < mapY + height)
 	{
-		if (c->MouseX >= x && c->MouseX <= x + w &&
-			c->MouseY >= y && c->MouseY <= y + h)
-		{
-			// the box was clicked. Determine which row.
-			c->Hot = data;
+		unsigned long long pixel = (unsigned long long)(c->MouseY - (int)mapY) * width + (c->MouseX - (int)x);
+		hovered = map->FindFileAt(pixel * map->GetFileSize() / ((unsigned long long)width * height));
 
-			int row = (int)((c->MouseY - y) / 30);
-			if (row > 0)
+		// only a click that started on the map counts, not the release from picking a menu item over it
+		if (c->LButtonDown && c->LButtonTransitionCount > 0)
+			c->Hot = &g_layout;
+		else if (c->LButtonDown == false && c->LButtonTransitionCount > 0 && c->Hot == &g_layout)
+		{
+			c->Hot = nullptr;
+			if (hovered >= 0)
 			{
-				data->SelectedRowIndex = data->FirstVisibleRow + row - 1;
+				showFile(c, hovered);
+				return;
 			}
 		}
 	}
 
-	float textOffsetY = 30 * 0.5f + ascender * 0.5f;
+	float infoY = mapY + height;
+	if (hovered != g_layout.HoveredFile)
+	{
+		damage(c, x, infoY, w, lineSpacing);
+		g_layout.HoveredFile = hovered;
+	}
 
-	// draw the background
-	drawBox(c->NVG, x, y, w, h, srgb(80, 80, 80), 0, 0);
+	if (hovered < 0)
+	{
+		drawLayoutLegend(c, x + textOffsetX, infoY, lineSpacing, ascender);
+		return;
+	}
 
-	// draw the header
-	drawBox(c->NVG, x, y, w, 30, srgb(100, 100, 100), 0, 0);
+	const megg_info::TOC& toc = g_archive.Info.TableOfContents[hovered];
+	const char* name = g_archive.Info.Filenames[g_archive.FilenameOffsets[hovered]].Name;
+	const char* info;
+	if (toc.Flags & 0x01)
+	{
+		info = scratch->Format("%s: %s at %u, LZ4 from %s", name, formatBytes(scratch, toc.CompressedSize),
+			toc.FileContentOffset, formatBytes(scratch, toc.UncompressedSize));
+	}
+	else
+		info = scratch->Format("%s: %s at %u", name, formatBytes(scratch, toc.CompressedSize), toc.FileContentOffset);
 
-	// draw the header text
-	float cx = 0;
 	nvgBeginPath(c->NVG);
 	nvgFillColor(c->NVG, srgb(255, 255, 255));
-	for (int i = 0; i < data->NumColumns; i++)
-	{
-		nvgText(c->NVG, cx, y + textOffsetY, data->HeaderNames[i], nullptr);
+	nvgText(c->NVG, x + textOffsetX, infoY + textY, info, nullptr);
+}
 
-		cx += (float)data->ColumnWidths[i];
-	}
+// where the message about how extracting went is kept while it's shown
+char g_extractingMessage[256];
 
-	// draw each row
-	float cy = y + 30.0f;
-	for (int i = data->FirstVisibleRow; i < data->NumRows; i++)
+// Shows how far along extracting is, and how it went once it's done
+void doExtractingBar(Context* c, float x, float y, float w, float h)
+{
+	Extractor::Progress progress = g_extractor.GetProgress();
+
+	if (g_extractor.IsRunning() == false)
 	{
-		cx = x;
-		
-		if (i == data->SelectedRowIndex)
-		{
-			drawBox(c->NVG, x, cy, w, 30, srgb(0, 50, 90), 0, 0);
-			//nvgBeginPath(c->NVG);
-			//nvgFillColor(c->NVG, srgb(0, 50, 90));
-			//nvgRect(ctx, x, cy, w, 30);
-			//nvgFill(ctx);
-			nvgBeginPath(c->NVG);
-		}
-		
-		nvgFillColor(c->NVG, srgb(255, 255, 255));
+		g_extracting = false;
+		damageAll(c);
 
-		for (int j = 0; j < data->NumColumns; j++)
-		{
-			if (data->Rows[i].Items[j] != nullptr)
-				nvgText(c->NVG, cx, cy + textOffsetY, data->Rows[i].Items[j], nullptr);
+		if (progress.Cancelled)
+			return;
 
-			cx += data->ColumnWidths[j];
-		}
+		Arena* scratch = c->FrameArena;
+		const char* message = scratch->Format("Extracted %u files (%s) in %.1f seconds.",
+			progress.NumDone - progress.NumFailed, formatBytes(scratch, progress.BytesWritten), progress.Seconds);
+		if (progress.NumFailed > 0)
+			message = scratch->Format("%s %u couldn't be extracted.", message, progress.NumFailed);
 
-		cy += 30;
+		strncpy(g_extractingMessage, message, sizeof(g_extractingMessage) - 1);
+		c->MsgBoxMessage = g_extractingMessage;
+		return;
 	}
 
+	double bytesPerSecond = progress.Seconds > 0 ? progress.BytesWritten / progress.Seconds : 0;
+	const char* text = c->FrameArena->Format("Extracting... %u of %u files, %s, %s/s",
+		progress.NumDone, progress.NumFiles, formatBytes(c->FrameArena, progress.BytesWritten), formatBytes(c->FrameArena, (unsigned long long)bytesPerSecond));
 
+	float fraction = progress.NumFiles > 0 ? (float)progress.NumDone / progress.NumFiles : 0;
+	if (doProgressBar(c, &g_extractingBar, x, y, w, h, fraction, text))
+		g_extractor.Cancel();
+}
 
-	// draw the scrollbar
-	data->Scrolling.Value = (float)data->FirstVisibleRow;
-	data->Scrolling.MaxValue = (float)(data->NumRows - maxVisibleRows);
-	drawVScroll(c, (float)(g_screenWidth - 10), 30, (float)(g_screenHeight - 30), &data->Scrolling);
+// 1234 -> "1.2 us"
+const char* formatNanoseconds(Arena* scratch, unsigned long long nanoseconds)
+{
+	if (nanoseconds < 1000)
+		return scratch->Format("%llu ns", nanoseconds);
+	if (nanoseconds < 1000 * 1000)
+		return scratch->Format("%.1f us", nanoseconds / 1000.0);
+	if (nanoseconds < 1000 * 1000 * 1000)
+		return scratch->Format("%.1f ms", nanoseconds / (1000.0 * 1000.0));
+
+	return scratch->Format("%.2f s", nanoseconds / (1000.0 * 1000.0 * 1000.0));
+}
 
-	data->FirstVisibleRow = (int)data->Scrolling.Value;
+// "123.4 MB/s"
+const char* formatThroughput(Arena* scratch, const BenchmarkTimes& times)
+{
+	double bytesPerSecond = times.TotalNanoseconds > 0 ? times.Bytes / (times.TotalNanoseconds / 1000000000.0) : 0;
+	return scratch->Format("%s/s", formatBytes(scratch, (unsigned long long)bytesPerSecond));
 }
 
-MenuItem* doMenu(Context* c, int font, MenuItem* items, int numItems, float x, float y)
+ProgressBar g_benchmarkingBar;
+
+void doBenchmarkingBar(Context* c, float x, float y, float w, float h)
 {
-	float ascender, descender, height;
-	nvgTextMetrics(c->NVG, &ascender, &descender, &height);
+	if (g_benchmark.IsRunning() == false)
+	{
+		g_benchmarking = false;
+		damageAll(c);
+		return;
+	}
 
-	float textOffsetY = 30 * 0.5f + ascender * 0.5f;
+	unsigned int numDone = g_benchmark.GetNumDone();
+	unsigned int numFiles = g_benchmark.GetNumFiles();
+	const char* text = c->FrameArena->Format("Benchmarking... %u of %u files", numDone, numFiles);
+
+	if (doProgressBar(c, &g_benchmarkingBar, x, y, w, h, numFiles > 0 ? (float)numDone / numFiles : 0, text))
+		g_benchmark.Cancel();
+}
 
-	drawBox(c->NVG, x, y, 50, numItems * 30.0f, srgb(40, 40, 40), 0, 0);
+// Draws how many files took how long to decompress, one bar per power of two nanoseconds
+void drawBenchmarkHistogram(Context* c, const unsigned int* histogram, float x, float y, float w, float h, float ascender)
+{
+	const float labelHeight = 20.0f;
+	const float minLabelSpacing = 70.0f;
 
-	MenuItem* clickedItem = nullptr;
+	int first = 0, last = 31;
+	while (first < last && histogram[first] == 0)
+		first++;
+	while (last > first && histogram[last] == 0)
+		last--;
 
-	nvgBeginPath(c->NVG);
-	nvgFillColor(c->NVG, srgb(255, 255, 255));
-	for (int j = 0; j < numItems; j++)
+	unsigned int most = 1;
+	for (int i = first; i <= last; i++)
 	{
-		nvgText(c->NVG, textOffsetX + x, y + j * 30 + textOffsetY, items[j].Text, nullptr);
+		if (histogram[i] > most)
+			most = histogram[i];
+	}
 
-		if (c->Modal == nullptr &&
-			c->MouseX >= x && c->MouseX < x + 50 &&
-			c->MouseY >= y + j * 30 && c->MouseY <= y + (j + 1) * 30 &&
-			c->LButtonDown && c->LButtonTransitionCount > 0)
+	float barWidth = w / (last - first + 1);
+	if (barWidth > 60.0f)
+		barWidth = 60.0f;
+	int labelEvery = (int)ceilf(minLabelSpacing / barWidth);
+
+	float barsHeight = h - labelHeight;
+	for (int i = first; i <= last; i++)
+	{
+		float barX = x + (i - first) * barWidth;
+		float barHeight = barsHeight * histogram[i] / most;
+		drawBox(c->NVG, barX, y + barsHeight - barHeight, barWidth - 2.0f, barHeight, srgb(0, 90, 160), 0, 0);
+
+		if ((i - first) % labelEvery == 0)
 		{
-			c->Hot = nullptr;
-			clickedItem = &items[j];
+			nvgBeginPath(c->NVG);
+			nvgFillColor(c->NVG, srgb(200, 200, 200));
+			nvgText(c->NVG, barX, y + barsHeight + labelHeight * 0.5f + ascender * 0.5f, formatNanoseconds(c->FrameArena, 1ull << i), nullptr);
 		}
 	}
-
-	return clickedItem;
 }
 
-MenuItem* doMenuBar(Context* c, int font, MenuItem* items, int numItems)
+// Tools > Benchmark
+void doBenchmarkPanel(Context* c, float x, float y, float w, float h)
 {
-	nvgFontFaceId(c->NVG, font);
+	int shown = g_benchmarking ? 1 : (g_benchmark.HasResults() ? 2 : 0);
+	if (shown != g_benchmarkShown)
+	{
+		damage(c, x, y, w, h);
+		g_benchmarkShown = shown;
+	}
 
-	// draw menu background
-	drawBox(c->NVG, 0, 0, (float)g_screenWidth, 30, srgb(50, 50, 50), 0, 0);
-	
-	float ascender, descender, height;
-	nvgTextMetrics(c->NVG, &ascender, &descender, &height);
+	drawBox(c->NVG, x, y, w, h, srgb(30, 30, 30), 0, 0);
 
-	float textOffsetY = 30 * 0.5f + ascender * 0.5f;
+	float ascender, descender, lineHeight;
+	nvgTextMetrics(c->NVG, &ascender, &descender, &lineHeight);
 
-	MenuItem* clickedItem = nullptr;
-	for (int i = 0; i < 3; i++)
+	const float lineSpacing = 30.0f;
+	const float rowSpacing = 22.0f;
+	float textX = x + textOffsetX;
+	float textY = lineSpacing * 0.5f + ascender * 0.5f;
+
+	nvgBeginPath(c->NVG);
+	nvgFillColor(c->NVG, srgb(200, 200, 200));
+
+	if (g_benchmarking)
 	{
-		if (c->MouseX >= i * 50 && c->MouseX < (i + 1) * 50 &&
-			c->MouseY >= 0 && c->MouseY <= 30)
-		{
-			drawBox(c->NVG, (float)(i * 50), 0, 50, 30, srgb(60, 60, 60), 0, 0);
+		nvgText(c->NVG, textX, y + textY, "Benchmarking...", nullptr);
+		return;
+	}
 
-			if (c->Modal == nullptr && c->LButtonDown == false && c->LButtonTransitionCount > 0)
-			{
-				if (c->Hot == &menu[i])
-				{
-					c->Hot = nullptr;
-				}
-				else
-				{
-					c->Hot = &menu[i];
-				}
+	if (g_benchmark.HasResults() == false)
+	{
+		nvgText(c->NVG, textX, y + textY, "Tools > Benchmark times the selected files, or the whole archive if nothing is selected.", nullptr);
+		return;
+	}
 
-				c->Invalidated = true;
-			}
-		}
+	const BenchmarkResults& results = g_benchmark.GetResults();
+	const BenchmarkTimes* phases = results.Phases;
+	Arena* scratch = c->FrameArena;
+
+	const char* lines[4];
+	lines[0] = scratch->Format("%u files in %.2f seconds.", results.NumFiles, results.Seconds);
+	if (results.NumFailed > 0)
+		lines[0] = scratch->Format("%s %u couldn't be read.", lines[0], results.NumFailed);
+	lines[1] = scratch->Format("Lookup: %s average, %s worst",
+		formatNanoseconds(scratch, results.NumFiles > 0 ? phases[BenchmarkPhase_Lookup].TotalNanoseconds / results.NumFiles : 0),
+		formatNanoseconds(scratch, phases[BenchmarkPhase_Lookup].MaxNanoseconds));
+	lines[2] = scratch->Format("Page-in: %s of compressed data, %s worst",
+		formatThroughput(scratch, phases[BenchmarkPhase_PageIn]), formatNanoseconds(scratch, phases[BenchmarkPhase_PageIn].MaxNanoseconds));
+	lines[3] = scratch->Format("Decompress: %s of output, %s worst",
+		formatThroughput(scratch, phases[BenchmarkPhase_Decompress]), formatNanoseconds(scratch, phases[BenchmarkPhase_Decompress].MaxNanoseconds));
+
+	float lineY = y;
+	for (int i = 0; i < 4; i++)
+	{
+		nvgText(c->NVG, textX, lineY + textY, lines[i], nullptr);
+		lineY += lineSpacing;
+	}
 
-		nvgBeginPath(c->NVG);
-		if (c->Hot == &menu[i])
-			nvgFillColor(c->NVG, srgb(255, 0, 0));
-		else
-			nvgFillColor(c->NVG, srgb(255, 255, 255));
-		nvgText(c->NVG, textOffsetX + i * 50, textOffsetY, menu[i].Text, nullptr);
+	if (doButton(c, x + w - 80.0f, y + lineSpacing * 0.5f, 140.0f, 24.0f, "Export JSON") && c->Modal == nullptr)
+	{
+		const char* path = noc_file_dialog_open(NOC_FILE_DIALOG_SAVE | NOC_FILE_DIALOG_OVERWRITE_CONFIRMATION, "JSON\0*.json\0", nullptr, "benchmark.json");
+		if (path != nullptr && g_benchmark.WriteJson(path, g_archive.Path) == false)
+			c->MsgBoxMessage = "Unable to write the results";
+	}
 
-		if (c->Hot == &menu[i])
-		{
-			auto item = doMenu(c, font, menu[i].Children, menu[i].NumChildren, i * 50.0f, 30);
-			if (item != nullptr)
-				clickedItem = item;
-		}
+	const float histogramHeight = 140.0f;
+	nvgBeginPath(c->NVG);
+	nvgFillColor(c->NVG, srgb(255, 255, 255));
+	nvgText(c->NVG, textX, lineY + textY, "Decompress times", nullptr);
+	lineY += lineSpacing;
+
+	drawBenchmarkHistogram(c, phases[BenchmarkPhase_Decompress].Histogram, textX, lineY, w - textOffsetX * 2, histogramHeight, ascender);
+	lineY += histogramHeight + 10.0f;
+
+	nvgBeginPath(c->NVG);
+	nvgFillColor(c->NVG, srgb(255, 255, 255));
+	nvgText(c->NVG, textX, lineY + textY, "Slowest to decompress", nullptr);
+	lineY += lineSpacing;
+
+	nvgBeginPath(c->NVG);
+	nvgFillColor(c->NVG, srgb(200, 200, 200));
+	for (size_t i = 0; i < results.Slowest.size() && lineY + rowSpacing <= y + h; i++)
+	{
+		const BenchmarkEntry& entry = results.Slowest[i];
+		const megg_info::TOC& toc = g_archive.Info.TableOfContents[entry.File];
+		float rowY = lineY + rowSpacing * 0.5f + ascender * 0.5f;
+
+		nvgText(c->NVG, textX, rowY, formatNanoseconds(scratch, entry.Nanoseconds[BenchmarkPhase_Decompress]), nullptr);
+		nvgText(c->NVG, textX + 100.0f, rowY, formatBytes(scratch, toc.UncompressedSize), nullptr);
+		nvgText(c->NVG, textX + 200.0f, rowY, g_archive.Info.Filenames[g_archive.FilenameOffsets[entry.File]].Name, nullptr);
+		lineY += rowSpacing;
 	}
+}
 
-	return clickedItem;
+void drawFileMenu(Context* c, int font)
+{
+	auto clickedItem = doMenuBar(c, font, menu, 3);
+
+	if (clickedItem != nullptr)
+		menuClicked(c, clickedItem);
 }
 
-bool doButton(Context* c, float x, float y, float w, float h, const char* label, float originX = 0.5f, float originY = 0.5f)
+// Everything gets drawn into this instead of straight to the window, so the parts
+// that haven't changed can be left alone from one frame to the next.
+struct Framebuffer
 {
-	drawBox(c->NVG, x, y, w, h, srgb(100, 0, 0), originX, originY);
+	GLuint FBO;
+	GLuint Texture;
+	GLuint Stencil;
+	int Width, Height;
+};
 
-	float ascender, descender, height;
-	nvgTextMetrics(c->NVG, &ascender, &descender, &height);
+Framebuffer g_framebuffer;
 
-	float bounds[4];
-	nvgTextBounds(c->NVG, 0, 0, label, nullptr, bounds);
+void destroyFramebuffer(Framebuffer* fb)
+{
+	if (fb->FBO != 0)
+	{
+		glDeleteFramebuffers(1, &fb->FBO);
+		glDeleteTextures(1, &fb->Texture);
+		glDeleteRenderbuffers(1, &fb->Stencil);
+	}
 
-	float textWidth = bounds[2] - bounds[0];
-	float textHeight = bounds[3] - bounds[1];
+	fb->FBO = 0;
+	fb->Texture = 0;
+	fb->Stencil = 0;
+	fb->Width = 0;
+	fb->Height = 0;
+}
 
-	nvgFillColor(c->NVG, srgb(255, 255, 255));
-	nvgText(c->NVG, x - textWidth * 0.5f, y - textHeight * originY + ascender * 0.5f, label, nullptr);
+bool createFramebuffer(Framebuffer* fb, int width, int height)
+{
+	destroyFramebuffer(fb);
 
-	if (c->MouseX >= x - w * originX && c->MouseX <= x + w * (1.0f - originX) &&
-		c->MouseY >= y - h * originY && c->MouseY <= y + h * (1.0f - originY))
+	glGenTextures(1, &fb->Texture);
+	glBindTexture(GL_TEXTURE_2D, fb->Texture);
+#ifdef ENABLE_SRGB
+	glTexImage2D(GL_TEXTURE_2D, 0, GL_SRGB8_ALPHA8, width, height, 0, GL_RGBA, GL_UNSIGNED_BYTE, nullptr);
+#else
+	glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA8, width, height, 0, GL_RGBA, GL_UNSIGNED_BYTE, nullptr);
+#endif
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+	glBindTexture(GL_TEXTURE_2D, 0);
+
+	// nanovg needs a stencil buffer to fill paths
+	glGenRenderbuffers(1, &fb->Stencil);
+	glBindRenderbuffer(GL_RENDERBUFFER, fb->Stencil);
+	glRenderbufferStorage(GL_RENDERBUFFER, GL_DEPTH24_STENCIL8, width, height);
+	glBindRenderbuffer(GL_RENDERBUFFER, 0);
+
+	glGenFramebuffers(1, &fb->FBO);
+	glBindFramebuffer(GL_FRAMEBUFFER, fb->FBO);
+	glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, fb->Texture, 0);
+	glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_DEPTH_STENCIL_ATTACHMENT, GL_RENDERBUFFER, fb->Stencil);
+	bool complete = glCheckFramebufferStatus(GL_FRAMEBUFFER) == GL_FRAMEBUFFER_COMPLETE;
+	glBindFramebuffer(GL_FRAMEBUFFER, 0);
+
+	if (complete == false)
 	{
-		if (c->LButtonDown == false && c->LButtonTransitionCount > 0)
-		{
-			return true;
-		}
+		destroyFramebuffer(fb);
+		return false;
 	}
 
-	return false;
+	fb->Width = width;
+	fb->Height = height;
+	return true;
 }
 
-bool doMessageBox(Context* c, const char* message)
+// Runs the UI once. Only what was damaged before this frame gets drawn; anything this frame
+// changes adds to the damage, and the main loop comes straight back around to draw it.
+void refresh(SDL_Window* window, Context* c, ListBoxData* data, int font)
 {
-	c->Modal = (void*)message;
+	c->FrameArena->Reset();
 
-	const float buttonHeight = 30.0f;
-	const float buttonPadding = 15.0f;
+	if (g_framebuffer.Width != g_screenWidth || g_framebuffer.Height != g_screenHeight)
+	{
+		createFramebuffer(&g_framebuffer, g_screenWidth, g_screenHeight);
+		damageAll(c);
+	}
 
-	float ascender, descender, height;
-	nvgTextMetrics(c->NVG, &ascender, &descender, &height);
+	// without a framebuffer to keep things in, everything has to be drawn every time
+	Rect dirty = c->Damage;
+	if (g_framebuffer.FBO == 0 && isEmpty(dirty) == false)
+	{
+		dirty.X0 = 0;
+		dirty.Y0 = 0;
+		dirty.X1 = (float)g_screenWidth;
+		dirty.Y1 = (float)g_screenHeight;
+	}
+	c->Damage.X0 = c->Damage.Y0 = c->Damage.X1 = c->Damage.Y1 = 0;
+
+	// round out to whole pixels, plus one for antialiasing
+	int x0 = (int)floorf(dirty.X0) - 1, y0 = (int)floorf(dirty.Y0) - 1;
+	int x1 = (int)ceilf(dirty.X1) + 1, y1 = (int)ceilf(dirty.Y1) + 1;
+	if (x0 < 0) x0 = 0;
+	if (y0 < 0) y0 = 0;
+	if (x1 > g_screenWidth) x1 = g_screenWidth;
+	if (y1 > g_screenHeight) y1 = g_screenHeight;
+	bool draw = isEmpty(dirty) == false && x0 < x1 && y0 < y1;
+
+	if (draw)
+	{
+		glBindFramebuffer(GL_FRAMEBUFFER, g_framebuffer.FBO);
+		glViewport(0, 0, g_screenWidth, g_screenHeight);
 
-	float maxTextboxWidth = g_screenWidth * 0.8f;
-	float minWidth = 200.0f;
+		glEnable(GL_SCISSOR_TEST);
+		glScissor(x0, g_screenHeight - y1, x1 - x0, y1 - y0);
+		glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT | GL_STENCIL_BUFFER_BIT);
+		glDisable(GL_SCISSOR_TEST);
+	}
 
-	float bounds[4];
-	nvgTextBoxBounds(c->NVG, 0, 0, maxTextboxWidth, message, nullptr, bounds);
+	nvgBeginFrame(c->NVG, g_screenWidth, g_screenHeight, 1.0f);
+	nvgScissor(c->NVG, (float)x0, (float)y0, (float)(x1 - x0), (float)(y1 - y0));
 
-	float screenCenterX = (float)(g_screenWidth / 2);
-	float screenCenterY = (float)(g_screenHeight / 2);
+	MenuItem* openMenu = getOpenMenu(c);
+	const char* message = c->MsgBoxMessage;
 
-	float textWidth = bounds[2] - bounds[0];
-	float textHeight = bounds[3] - bounds[1];
+	updateArchive(c);
 
-	const float padding = 5.0f;
-	float boxWidth = textWidth + padding * 2.0f;
-	float boxHeight = textHeight + padding * 2.0f + buttonHeight + buttonPadding;
-	if (boxWidth < minWidth) boxWidth = minWidth;
-	
-	drawBox(c->NVG, screenCenterX, screenCenterY, boxWidth, boxHeight, srgb(100, 100, 100));
+	if (c->Modal == nullptr && c->KeyDown == SDLK_a && (c->KeyMods & (KMOD_CTRL | KMOD_GUI)) && g_archive.State != ArchiveState_Closed)
+		selectAllRows(c);
 
-	nvgFillColor(c->NVG, nvgRGB(255, 255, 255));
-	nvgTextBox(c->NVG, screenCenterX - textWidth / 2, screenCenterY - boxHeight * 0.5f + padding + height, maxTextboxWidth, message, nullptr);
+	if (c->Modal == nullptr && doTextInput(c, g_filterText, sizeof(g_filterText)))
+	{
+		int selectedFile = getSelectedFile();
+		g_archive.View.SetFilter(g_filterText);
+		viewChanged(c, selectedFile);
+	}
 
-	if (doButton(c, screenCenterX, screenCenterY + boxHeight * 0.5f - padding, 100.0f, 30.0f, "Got it!", 0.5f, 1.0f))
+	int previewFile = g_preview.File;
+	selectPreview(getSelectedFile());
+
+	// the loader, the extractor and the benchmark never run at the same time, so there's only ever one bar
+	bool showBar = g_archive.State == ArchiveState_Loading || g_extracting || g_benchmarking;
+
+	float listHeight = (float)(g_screenHeight - 30);
+	if (showBar)
+		listHeight -= 30.0f;
+
+	// the preview gets the bottom part of the window
+	float previewHeight = 0;
+	if (g_preview.File >= 0 && g_mainView == MainView_Files)
 	{
-		c->Modal = nullptr;
-		return true;
+		previewHeight = floorf(listHeight * 0.45f);
+		listHeight -= previewHeight;
 	}
 
-	return false;
-}
+	// if anything moved, everything gets redrawn
+	if (listHeight != c->ListHeight)
+	{
+		damageAll(c);
+		c->ListHeight = listHeight;
+	}
+	else if (g_preview.File != previewFile)
+		damage(c, 0, 30 + listHeight, (float)g_screenWidth, previewHeight);
+
+	int clickedColumn = -1;
+	if (g_mainView == MainView_Layout)
+		doLayoutMap(c, 0, 30, (float)g_screenWidth, listHeight);
+	else if (g_mainView == MainView_Benchmark)
+		doBenchmarkPanel(c, 0, 30, (float)g_screenWidth, listHeight);
+	else
+	{
+		clickedColumn = doListbox(c, data, 0, 30, (float)g_screenWidth, listHeight);
 
-void drawFileMenu(Context* c, int font)
-{
-	auto clickedItem = doMenuBar(c, font, menu, 3);
+		// a new selection shows up next frame
+		if (getSelectedFile() != g_preview.File)
+			c->Invalidated = true;
 
-	if (clickedItem != nullptr)
-		menuClicked(c, clickedItem);
-}
+		if (g_preview.File >= 0)
+			doPreview(c, 0, 30 + listHeight, (float)g_screenWidth, previewHeight);
+	}
 
-void refresh(SDL_Window* window, Context* c, ListBoxData* data, int font)
-{
-	glViewport(0, 0, g_screenWidth, g_screenHeight);
-	glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT | GL_STENCIL_BUFFER_BIT);
+	if (g_archive.State == ArchiveState_Loading)
+	{
+		// keep the list usable while the rest of it shows up
+		if (doLoadingBar(c, 0, (float)(g_screenHeight - 30), (float)g_screenWidth, 30, g_archive.NumLoaded, g_archive.NumFiles))
+			g_archive.CancelRequested = true;
+	}
+	else if (g_extracting)
+		doExtractingBar(c, 0, (float)(g_screenHeight - 30), (float)g_screenWidth, 30);
+	else if (g_benchmarking)
+		doBenchmarkingBar(c, 0, (float)(g_screenHeight - 30), (float)g_screenWidth, 30);
 
-	nvgBeginFrame(c->NVG, g_screenWidth, g_screenHeight, 1.0f);
+	if (clickedColumn >= 0)
+	{
+		// clicking the sorted column again flips it
+		bool descending = clickedColumn == g_archive.View.GetSortColumn() && g_archive.View.IsSortDescending() == false;
+
+		int selectedFile = getSelectedFile();
+		g_archive.View.SetSort((ArchiveColumn)clickedColumn, descending);
+		viewChanged(c, selectedFile);
+		c->Invalidated = true;
+	}
 
-	doListbox(c, data, 0, 30, (float)g_screenWidth, (float)(g_screenHeight - 30));
 	drawFileMenu(c, font);
+	drawFilterBox(c);
 
 	if (c->MsgBoxMessage)
 		if (doMessageBox(c, c->MsgBoxMessage))
@@ -476,8 +2246,31 @@ void refresh(SDL_Window* window, Context* c, ListBoxData* data, int font)
 			c->Invalidated = true;
 		}
 
+	// menus and message boxes cover up other things, so whatever was under them needs redrawing
+	if (getOpenMenu(c) != openMenu)
+	{
+		damageMenu(c, openMenu);
+		damageMenu(c, getOpenMenu(c));
+	}
+	if (c->MsgBoxMessage != message)
+		damageAll(c);
+
+	if (draw == false)
+	{
+		nvgCancelFrame(c->NVG);
+		return;
+	}
+
 	nvgEndFrame(c->NVG);
 
+	if (g_framebuffer.FBO != 0)
+	{
+		glBindFramebuffer(GL_READ_FRAMEBUFFER, g_framebuffer.FBO);
+		glBindFramebuffer(GL_DRAW_FRAMEBUFFER, 0);
+		glBlitFramebuffer(0, 0, g_screenWidth, g_screenHeight, 0, 0, g_screenWidth, g_screenHeight, GL_COLOR_BUFFER_BIT, GL_NEAREST);
+		glBindFramebuffer(GL_FRAMEBUFFER, 0);
+	}
+
 	SDL_GL_SwapWindow(window);
 }
 
@@ -485,6 +2278,8 @@ void refresh(SDL_Window* window, Context* c, ListBoxData* data, int font)
 int main(int argc, char* argv[])
 {
 	SDL_Init(SDL_INIT_VIDEO);
+	g_wakeEvent = SDL_RegisterEvents(1);
+	SDL_StartTextInput();
 
 	auto window = SDL_CreateWindow("EGG archive browser", SDL_WINDOWPOS_UNDEFINED, SDL_WINDOWPOS_UNDEFINED, g_screenWidth, g_screenHeight, SDL_WINDOW_OPENGL | SDL_WINDOW_RESIZABLE);
 	if (window == nullptr)
@@ -513,59 +2308,107 @@ int main(int argc, char* argv[])
 
 	int font = nvgCreateFont(vg, "Roboto", "Roboto-regular.ttf");
 
+	Arena frameArena;
+
 	Context c = {};
 	c.NVG = vg;
+	c.FrameArena = &frameArena;
 	
 	const char* headerNames[] = {
 		"File name",
+		"Size",
 		"Compressed size",
-		"Type",
+		"Ratio",
 		"Compression"
 	};
 	int columnWidths[] = {
-		300, 150, 100, 50
+		300, 100, 150, 60, 100
 	};
 	data.HeaderNames = headerNames;
 	data.ColumnWidths = columnWidths;
-	data.NumColumns = 4;
+	data.NumColumns = ArchiveColumn_Count;
 	data.FirstVisibleRow = 0;
+	data.SelectedRowIndex = -1;
+	data.SortColumn = ArchiveColumn_Name;
+	data.SortDescending = false;
 	data.NumRows = 0;
+	data.GetCell = getArchiveCell;
+	data.Select = selectArchiveRows;
+	data.IsSelected = isArchiveRowSelected;
+	data.AnchorRow = -1;
+	data.UserData = &g_archive;
+
+	g_preview.File = -1;
+	g_preview.Mode = PreviewMode_Hex;
+	g_layout.ShownState = -1;
+	g_layout.HoveredFile = -1;
+	data.Cache = nullptr;
+	data.CacheSize = 0;
+	data.MetricsValid = false;
+
+	c.HoveredMenu = -1;
+	c.ListHeight = -1;
+	damageAll(&c);
 
 	while (!g_quitRequested)
 	{
-		c.Invalidated = false;
 		c.LButtonTransitionCount = 0;
 		c.MouseWheel = 0;
+		c.TextInput[0] = 0;
+		c.KeyDown = 0;
+
+		// Sleep until something happens, unless the last frame left something to do.
+		// Background threads push g_wakeEvent when they have something new to show.
+		bool update = c.Invalidated || isEmpty(c.Damage) == false;
+		c.Invalidated = false;
 
-		bool awake = false;
 		SDL_Event e;
-		while (SDL_PollEvent(&e))
+		bool haveEvent = update ? SDL_PollEvent(&e) != 0 : SDL_WaitEvent(&e) != 0;
+		while (haveEvent)
 		{
 			switch (e.type)
 			{
 			case SDL_QUIT:
 				g_quitRequested = true;
-				awake = true;
 				break;
 			case SDL_MOUSEMOTION:
 				c.MouseX = e.motion.x;
 				c.MouseY = e.motion.y;
-				awake = true;
+
+				// Only the menu bar and the layout map react to the mouse just passing
+				// over them. Otherwise moving only matters while something's being dragged.
+				if (c.LButtonDown || menuBarItemAt(c.MouseX, c.MouseY) != c.HoveredMenu || g_mainView == MainView_Layout)
+					update = true;
+				break;
+			case SDL_KEYDOWN:
+				if (e.key.keysym.sym == SDLK_ESCAPE && g_archive.State == ArchiveState_Loading)
+					g_archive.CancelRequested = true;
+				else if (e.key.keysym.sym == SDLK_ESCAPE && g_extracting)
+					g_extractor.Cancel();
+				else if (e.key.keysym.sym == SDLK_ESCAPE && g_benchmarking)
+					g_benchmark.Cancel();
+				else
+					c.KeyDown = e.key.keysym.sym;
+				update = true;
+				break;
+			case SDL_TEXTINPUT:
+				strncat(c.TextInput, e.text.text, sizeof(c.TextInput) - strlen(c.TextInput) - 1);
+				update = true;
 				break;
 			case SDL_MOUSEWHEEL:
 				c.MouseWheel = e.wheel.y;
-				awake = true;
+				update = true;
 				break;
 			case SDL_MOUSEBUTTONUP:
 				c.LButtonDown = false;
 				c.LButtonTransitionCount++;
-				awake = true;
+				update = true;
 				SDL_CaptureMouse(SDL_FALSE);
 				break;
 			case SDL_MOUSEBUTTONDOWN:
 				c.LButtonDown = true;
 				c.LButtonTransitionCount++;
-				awake = true;
+				update = true;
 				SDL_CaptureMouse(SDL_TRUE);
 				break;
 			case SDL_WINDOWEVENT:
@@ -575,24 +2418,41 @@ int main(int argc, char* argv[])
 				case SDL_WINDOWEVENT_SIZE_CHANGED:
 					g_screenWidth = e.window.data1;
 					g_screenHeight = e.window.data2;
+					damageAll(&c);
+					update = true;
+					break;
+				case SDL_WINDOWEVENT_EXPOSED:
+					damageAll(&c);
+					update = true;
+					break;
 				}
 				break;
+			default:
+				if (e.type == g_wakeEvent)
+					update = true;
+				break;
 			}
-		}
 
-		refresh(window, &c, &data, font);
+			haveEvent = SDL_PollEvent(&e) != 0;
+		}
 
 		if (g_quitRequested)
 			break;
 
-		if (c.Invalidated)
-			continue;
+		c.KeyMods = SDL_GetModState();
 
-		SDL_WaitEventTimeout(nullptr, 1000);
+		if (update)
+			refresh(window, &c, &data, font);
 	}
 
+	destroyFramebuffer(&g_framebuffer);
+	if (g_layout.Image != 0)
+		nvgDeleteImage(vg, g_layout.Image);
+
+	closeArchive();
+
 	return 0;
 }
 
 #define MONDEGREENGAMES_EGG_IMPLEMENTATION
-#include "egg.h"
\ No newline at end of file
+#include "egg.h"
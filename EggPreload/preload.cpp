@@ -0,0 +1,1106 @@
+// EggPreload is an LD_PRELOAD library for programs that load their files with plain
+// open()/fopen()/stat() and can't be changed to use egg.h. Paths under EGG_PRELOAD_PREFIX
+// get looked up in the eggs listed in EGG_PRELOAD_EGGS, and files that are in one of them
+// come back as a memfd with the file's contents in it. Everything else (including files
+// that aren't in any egg) goes to the real functions, so loose files still work.
+//
+//   EGG_PRELOAD_EGGS     eggs to look in, separated by ':'. The first one that has a file wins.
+//   EGG_PRELOAD_PREFIX   the directory the names in the eggs are relative to
+//   EGG_PRELOAD_VERBOSE  set to 1 to print what got served when the program exits
+//
+// A memfd is a real file descriptor, so read(), pread(), lseek(), fstat(), mmap(), dup(),
+// fdopen() and everything that uses them (including stdio's own reads) work without having
+// to be intercepted. Files are only decompressed when they're opened.
+//
+// Directories that are only in an egg (from its DIRS section) can be stat()ed, but not
+// listed: opendir() and getdents() aren't intercepted, so they only see what's on disk.
+//
+// Linux only, since it needs memfd_create().
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <cstdint>
+#include <cerrno>
+#include <cstdarg>
+#include <vector>
+#include <string>
+#include <mutex>
+#include <atomic>
+#include <algorithm>
+
+#include <dlfcn.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/sysmacros.h>
+#include <sys/types.h>
+
+#define MONDEGREENGAMES_EGG_IMPLEMENTATION
+#include "egg.h"
+
+#define EXPORT extern "C" __attribute__((visibility("default")))
+
+namespace
+{
+	typedef int (*OpenFunction)(const char*, int, ...);
+	typedef int (*OpenAtFunction)(int, const char*, int, ...);
+	typedef int (*FortifiedOpenFunction)(const char*, int);
+	typedef int (*FortifiedOpenAtFunction)(int, const char*, int);
+	typedef FILE* (*FopenFunction)(const char*, const char*);
+	typedef int (*StatFunction)(const char*, struct stat*);
+	typedef int (*Stat64Function)(const char*, struct stat64*);
+	typedef int (*StatAtFunction)(int, const char*, struct stat*, int);
+	typedef int (*StatAt64Function)(int, const char*, struct stat64*, int);
+	typedef int (*VersionedStatFunction)(int, const char*, struct stat*);
+	typedef int (*VersionedStat64Function)(int, const char*, struct stat64*);
+	typedef int (*VersionedStatAtFunction)(int, int, const char*, struct stat*, int);
+	typedef int (*VersionedStatAt64Function)(int, int, const char*, struct stat64*, int);
+	typedef int (*FstatFunction)(int, struct stat*);
+	typedef int (*Fstat64Function)(int, struct stat64*);
+	typedef int (*VersionedFstatFunction)(int, int, struct stat*);
+	typedef int (*VersionedFstat64Function)(int, int, struct stat64*);
+	typedef int (*StatxFunction)(int, const char*, int, unsigned int, struct statx*);
+	typedef int (*AccessFunction)(const char*, int);
+	typedef int (*AccessAtFunction)(int, const char*, int, int);
+
+	struct RealFunctions
+	{
+		OpenFunction Open, Open64;
+		OpenAtFunction OpenAt, OpenAt64;
+		FortifiedOpenFunction Open2, Open64_2;
+		FortifiedOpenAtFunction OpenAt2, OpenAt64_2;
+		FopenFunction Fopen, Fopen64;
+		StatFunction Stat, Lstat;
+		Stat64Function Stat64, Lstat64;
+		StatAtFunction StatAt;
+		StatAt64Function StatAt64;
+		VersionedStatFunction Xstat, Lxstat;
+		VersionedStat64Function Xstat64, Lxstat64;
+		VersionedStatAtFunction FxstatAt;
+		VersionedStatAt64Function FxstatAt64;
+		FstatFunction Fstat;
+		Fstat64Function Fstat64;
+		VersionedFstatFunction Fxstat;
+		VersionedFstat64Function Fxstat64;
+		StatxFunction Statx;
+		AccessFunction Access;
+		AccessAtFunction AccessAt;
+	};
+
+	struct MappedEgg
+	{
+		std::string Path;
+		unsigned char* Bytes;
+		unsigned int Length;
+		megg_info Info;
+		std::vector<unsigned int> FilenameOffsets;
+		bool HasDirectories;
+
+		// stat() results for the files inside borrow the egg's owner and times
+		struct stat Stat;
+
+		// Files in solid blocks share a cache, so reading the neighbours of a file
+		// doesn't decompress the block all over again
+		std::mutex BlockLock;
+		megg_block_cache Blocks;
+	};
+
+	// What a path turned out to be
+	struct Entry
+	{
+		MappedEgg* Egg;
+		int File;
+		int Directory;
+	};
+
+	const int FileSeals = F_SEAL_SHRINK | F_SEAL_GROW | F_SEAL_WRITE | F_SEAL_SEAL;
+
+	// Compressed files at least this big get decompressed straight into the memfd through a
+	// mapping. Setting up the mapping costs more than the copy for anything smaller, so those
+	// get decompressed into memory and written.
+	const unsigned int MapThreshold = 1024 * 1024;
+
+	// The memfds that have been handed out, by fd, so fstat() can tell which file one holds
+	// without asking /proc. An fd can be closed and reused without us knowing, so a slot
+	// only counts if the inode still matches.
+	struct OpenedFile
+	{
+		std::atomic<uint64_t> Inode;
+		std::atomic<uint64_t> Entry;
+	};
+
+	const int MaxTrackedFiles = 65536;
+
+	RealFunctions s_real;
+	pthread_once_t s_findRealOnce = PTHREAD_ONCE_INIT;
+	pthread_once_t s_loadOnce = PTHREAD_ONCE_INIT;
+
+	// Set up by load() and never changed after that. Other libraries' constructors can
+	// open files before this library's own constructors run, so nothing out here can have
+	// a constructor, or it would throw away what load() did.
+	MappedEgg** s_eggs = nullptr;
+	size_t s_numEggs = 0;
+	char s_prefix[PATH_MAX];
+	size_t s_prefixLength = 0;
+	bool s_verbose = false;
+
+	OpenedFile s_openedFiles[MaxTrackedFiles];
+
+	// the device every memfd is on
+	std::atomic<uint64_t> s_memfdDevice(0);
+
+	std::atomic<uint64_t> s_numOpened(0);
+	std::atomic<uint64_t> s_bytesOpened(0);
+	std::atomic<uint64_t> s_numStats(0);
+	std::atomic<uint64_t> s_numPassedOn(0);
+
+	template<typename T>
+	void findReal(T* function, const char* name)
+	{
+		*function = (T)dlsym(RTLD_NEXT, name);
+	}
+
+	// for the functions glibc doesn't have
+	int missing()
+	{
+		errno = ENOSYS;
+		return -1;
+	}
+
+	int realFstat(int fd, struct stat* buffer)
+	{
+		if (s_real.Fstat != nullptr)
+			return s_real.Fstat(fd, buffer);
+#ifdef _STAT_VER
+		if (s_real.Fxstat != nullptr)
+			return s_real.Fxstat(_STAT_VER, fd, buffer);
+#endif
+		return missing();
+	}
+
+	// Collapses "//", "." and ".." without looking at the file system, since the
+	// directories under the prefix might only exist inside an egg. Returns false
+	// if the result wouldn't fit.
+	bool normalizePath(const char* path, char* result)
+	{
+		size_t length = 0;
+		const char* cursor = path;
+		while (*cursor != 0)
+		{
+			while (*cursor == '/')
+				cursor++;
+
+			const char* end = cursor;
+			while (*end != 0 && *end != '/')
+				end++;
+
+			size_t partLength = end - cursor;
+			bool isDot = partLength == 1 && cursor[0] == '.';
+			if (partLength == 2 && cursor[0] == '.' && cursor[1] == '.')
+			{
+				while (length > 0 && result[length - 1] != '/')
+					length--;
+				if (length > 0)
+					length--;
+			}
+			else if (partLength > 0 && isDot == false)
+			{
+				if (length + 1 + partLength >= PATH_MAX)
+					return false;
+				result[length++] = '/';
+				memcpy(result + length, cursor, partLength);
+				length += partLength;
+			}
+
+			cursor = end;
+		}
+
+		if (length == 0)
+			result[length++] = '/';
+		result[length] = 0;
+		return true;
+	}
+
+	// Turns a path (relative to dirfd, if it isn't absolute) into the name it would have
+	// inside an egg. Returns false if it isn't under the prefix.
+	bool getEggName(int dirfd, const char* path, char* name)
+	{
+		if (path == nullptr || s_numEggs == 0)
+			return false;
+
+		char full[PATH_MAX];
+		if (path[0] == '/')
+		{
+			if (normalizePath(path, name) == false)
+				return false;
+		}
+		else
+		{
+			size_t length;
+			if (dirfd == AT_FDCWD)
+			{
+				if (getcwd(full, sizeof(full)) == nullptr)
+					return false;
+				length = strlen(full);
+			}
+			else
+			{
+				char link[64];
+				snprintf(link, sizeof(link), "/proc/self/fd/%d", dirfd);
+				ssize_t r = readlink(link, full, sizeof(full) - 1);
+				if (r <= 0)
+					return false;
+				length = (size_t)r;
+			}
+
+			size_t pathLength = strlen(path);
+			if (length + 1 + pathLength >= sizeof(full))
+				return false;
+			full[length] = '/';
+			memcpy(full + length + 1, path, pathLength + 1);
+
+			if (normalizePath(full, name) == false)
+				return false;
+		}
+
+		// the prefix itself is the top directory of the eggs
+		size_t prefixLength = s_prefixLength;
+		if (strncmp(name, s_prefix, prefixLength) != 0)
+			return false;
+		if (prefixLength == 1)
+			prefixLength = 0;
+		if (name[prefixLength] != 0 && name[prefixLength] != '/')
+			return false;
+
+		const char* rest = name + prefixLength + (name[prefixLength] == '/' ? 1 : 0);
+		memmove(name, rest, strlen(rest) + 1);
+		return true;
+	}
+
+	// Files win over directories, and earlier eggs over later ones
+	bool findEntry(const char* name, Entry* entry)
+	{
+		if (strlen(name) >= MEGG_MAX_FILENAME)
+			return false;
+
+		for (size_t i = 0; i < s_numEggs; i++)
+		{
+			int index = name[0] != 0 ? megg_findFile(&s_eggs[i]->Info, name) : -1;
+			if (index >= 0)
+			{
+				entry->Egg = s_eggs[i];
+				entry->File = index;
+				entry->Directory = -1;
+				return true;
+			}
+		}
+
+		for (size_t i = 0; i < s_numEggs; i++)
+		{
+			if (s_eggs[i]->HasDirectories == false)
+				continue;
+
+			int index = megg_findDirectory(s_eggs[i]->Bytes, &s_eggs[i]->Info, name);
+			if (index >= 0)
+			{
+				entry->Egg = s_eggs[i];
+				entry->File = -1;
+				entry->Directory = index;
+				return true;
+			}
+		}
+
+		return false;
+	}
+
+	// Maps an egg and checks all of it up front, so nothing it serves later can point outside
+	// the mapping. Says why on stderr if it can't be used.
+	bool mapEgg(const char* path, MappedEgg* egg)
+	{
+		int fd = s_real.Open(path, O_RDONLY | O_CLOEXEC);
+		if (fd == -1)
+		{
+			fprintf(stderr, "eggpreload: unable to open %s\n", path);
+			return false;
+		}
+
+		if (realFstat(fd, &egg->Stat) != 0 || egg->Stat.st_size == 0 || (uint64_t)egg->Stat.st_size > 0xffffffffULL)
+		{
+			fprintf(stderr, "eggpreload: %s isn't a valid egg, skipping it\n", path);
+			close(fd);
+			return false;
+		}
+
+		egg->Length = (unsigned int)egg->Stat.st_size;
+		egg->Bytes = (unsigned char*)mmap(nullptr, egg->Length, PROT_READ, MAP_PRIVATE, fd, 0);
+		close(fd);
+		if (egg->Bytes == MAP_FAILED)
+		{
+			fprintf(stderr, "eggpreload: unable to map %s\n", path);
+			return false;
+		}
+
+		// every name and TOC entry gets checked while the names are indexed
+		bool valid = megg_getEggHeader(egg->Bytes, egg->Length, &egg->Info) == 0;
+		if (valid)
+		{
+			egg->FilenameOffsets.resize(egg->Info.NumFiles);
+			valid = megg_validateAndIndex(egg->Bytes, egg->Length, &egg->Info, egg->FilenameOffsets.data(), 0, egg->Info.NumFiles) == 0;
+		}
+
+		if (valid == false)
+		{
+			fprintf(stderr, "eggpreload: %s isn't a valid egg, skipping it\n", path);
+			munmap(egg->Bytes, egg->Length);
+			return false;
+		}
+
+		egg->Path = path;
+		egg->HasDirectories = megg_getNumDirectories(egg->Bytes, &egg->Info) > 0;
+		megg_initBlockCache(&egg->Blocks);
+		return true;
+	}
+
+	void findRealFunctions()
+	{
+		findReal(&s_real.Open, "open");
+		findReal(&s_real.Open64, "open64");
+		findReal(&s_real.OpenAt, "openat");
+		findReal(&s_real.OpenAt64, "openat64");
+		findReal(&s_real.Open2, "__open_2");
+		findReal(&s_real.Open64_2, "__open64_2");
+		findReal(&s_real.OpenAt2, "__openat_2");
+		findReal(&s_real.OpenAt64_2, "__openat64_2");
+		findReal(&s_real.Fopen, "fopen");
+		findReal(&s_real.Fopen64, "fopen64");
+		findReal(&s_real.Stat, "stat");
+		findReal(&s_real.Lstat, "lstat");
+		findReal(&s_real.Stat64, "stat64");
+		findReal(&s_real.Lstat64, "lstat64");
+		findReal(&s_real.StatAt, "fstatat");
+		findReal(&s_real.StatAt64, "fstatat64");
+		findReal(&s_real.Xstat, "__xstat");
+		findReal(&s_real.Lxstat, "__lxstat");
+		findReal(&s_real.Xstat64, "__xstat64");
+		findReal(&s_real.Lxstat64, "__lxstat64");
+		findReal(&s_real.FxstatAt, "__fxstatat");
+		findReal(&s_real.FxstatAt64, "__fxstatat64");
+		findReal(&s_real.Fstat, "fstat");
+		findReal(&s_real.Fstat64, "fstat64");
+		findReal(&s_real.Fxstat, "__fxstat");
+		findReal(&s_real.Fxstat64, "__fxstat64");
+		findReal(&s_real.Statx, "statx");
+		findReal(&s_real.Access, "access");
+		findReal(&s_real.AccessAt, "faccessat");
+	}
+
+	// The fstat() family only needs the real functions, and load() uses them itself
+	void ensureRealFunctions()
+	{
+		pthread_once(&s_findRealOnce, findRealFunctions);
+	}
+
+	void load()
+	{
+		const char* verbose = getenv("EGG_PRELOAD_VERBOSE");
+		s_verbose = verbose != nullptr && verbose[0] != 0 && strcmp(verbose, "0") != 0;
+
+		const char* eggs = getenv("EGG_PRELOAD_EGGS");
+		const char* prefix = getenv("EGG_PRELOAD_PREFIX");
+		if (eggs == nullptr || eggs[0] == 0)
+			return;
+
+		if (prefix == nullptr || prefix[0] == 0)
+		{
+			fprintf(stderr, "eggpreload: EGG_PRELOAD_EGGS is set but EGG_PRELOAD_PREFIX isn't, so nothing will be served\n");
+			return;
+		}
+
+		// a relative prefix is relative to wherever the program started
+		std::string absolute = prefix;
+		if (prefix[0] != '/')
+		{
+			char cwd[PATH_MAX];
+			if (getcwd(cwd, sizeof(cwd)) == nullptr)
+				return;
+			absolute = std::string(cwd) + "/" + prefix;
+		}
+		if (normalizePath(absolute.c_str(), s_prefix) == false)
+			return;
+		s_prefixLength = strlen(s_prefix);
+
+		std::vector<MappedEgg*> mapped;
+		std::string list = eggs;
+		size_t start = 0;
+		while (start <= list.size())
+		{
+			size_t end = list.find(':', start);
+			if (end == std::string::npos)
+				end = list.size();
+
+			std::string path = list.substr(start, end - start);
+			start = end + 1;
+			if (path.empty())
+				continue;
+
+			MappedEgg* egg = new MappedEgg;
+			if (mapEgg(path.c_str(), egg) == false)
+			{
+				delete egg;
+				continue;
+			}
+
+			mapped.push_back(egg);
+		}
+
+		s_eggs = new MappedEgg*[mapped.size() + 1];
+		std::copy(mapped.begin(), mapped.end(), s_eggs);
+		s_numEggs = mapped.size();
+	}
+
+	void ensureLoaded()
+	{
+		ensureRealFunctions();
+		pthread_once(&s_loadOnce, load);
+	}
+
+	// Open flags that only read, and don't need the file system to do anything special
+	bool isPlainRead(int flags)
+	{
+		return (flags & O_ACCMODE) == O_RDONLY && (flags & (O_CREAT | O_TRUNC | O_DIRECTORY | O_PATH)) == 0;
+	}
+
+	size_t getEggNumber(const MappedEgg* egg)
+	{
+		size_t number = 0;
+		while (s_eggs[number] != egg)
+			number++;
+		return number;
+	}
+
+	// pwrite(), so the file's position is still at the start afterwards
+	bool writeAll(int fd, const unsigned char* bytes, size_t size)
+	{
+		off_t offset = 0;
+		while (size > 0)
+		{
+			ssize_t r = pwrite(fd, bytes + offset, size, offset);
+			if (r <= 0)
+				return false;
+			offset += r;
+			size -= r;
+		}
+		return true;
+	}
+
+	// Puts the file's contents in the memfd
+	bool fillFile(int fd, const Entry& entry)
+	{
+		MappedEgg* egg = entry.Egg;
+		const megg_info::TOC& toc = egg->Info.TableOfContents[entry.File];
+		unsigned int size = toc.UncompressedSize;
+		if (size == 0)
+			return true;
+
+		// megg_getEggInfo() checked that stored files fit in the egg, so they can be written as they are
+		if ((toc.Flags & 0x03) == 0)
+			return writeAll(fd, egg->Bytes + toc.FileContentOffset, size);
+
+		unsigned char* contents;
+		void* mapped = nullptr;
+		if (size >= MapThreshold)
+		{
+			if (ftruncate(fd, size) != 0)
+				return false;
+			mapped = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+			if (mapped == MAP_FAILED)
+				return false;
+			contents = (unsigned char*)mapped;
+		}
+		else
+		{
+			contents = (unsigned char*)malloc(size);
+			if (contents == nullptr)
+				return false;
+		}
+
+		int r;
+		if (toc.Flags & 0x02)
+		{
+			std::lock_guard<std::mutex> lock(egg->BlockLock);
+			r = megg_readFileCached(egg->Bytes, &egg->Info, &egg->Blocks, entry.File, contents, size);
+		}
+		else
+			r = megg_readFile(egg->Bytes, &egg->Info, entry.File, contents, size);
+
+		bool written = r == (int)size && (mapped != nullptr || writeAll(fd, contents, size));
+		if (mapped != nullptr)
+			munmap(mapped, size);
+		else
+			free(contents);
+		return written;
+	}
+
+	// Makes a sealed memfd with the file in it. Returns -1 and sets errno if it can't.
+	int openFile(const Entry& entry, int flags)
+	{
+		MappedEgg* egg = entry.Egg;
+		unsigned int size = egg->Info.TableOfContents[entry.File].UncompressedSize;
+		size_t eggNumber = getEggNumber(egg);
+
+		// The name says which file it is, for fstat() on a dup() of it (see fixFileStat()). After
+		// that it only shows up in /proc/<pid>/fd, so it can be cut short to fit in the 249
+		// characters memfd_create() allows.
+		char buffer[MEGG_MAX_FILENAME], name[200];
+		const char* filename = megg_getFilename(&egg->Info, entry.File, buffer);
+		snprintf(name, sizeof(name), "egg%u:%d:%s", (unsigned int)eggNumber, entry.File, filename != nullptr ? filename : "");
+		int fd = memfd_create(name, MFD_ALLOW_SEALING | ((flags & O_CLOEXEC) ? MFD_CLOEXEC : 0));
+		if (fd == -1)
+			return -1;
+
+		struct stat sb;
+		if (fillFile(fd, entry) == false || realFstat(fd, &sb) != 0)
+		{
+			close(fd);
+			errno = EIO;
+			return -1;
+		}
+
+		// nobody gets to change what's in the egg
+		fcntl(fd, F_ADD_SEALS, FileSeals);
+
+		s_memfdDevice = sb.st_dev;
+		if (fd < MaxTrackedFiles)
+		{
+			s_openedFiles[fd].Entry = (eggNumber << 32) | (uint64_t)entry.File;
+			s_openedFiles[fd].Inode = sb.st_ino;
+		}
+
+		s_numOpened++;
+		s_bytesOpened += size;
+		return fd;
+	}
+
+	// Returns 1 if the path is in an egg (with result set to the fd or -1 and errno),
+	// or 0 if it should go to the real function
+	int tryOpen(int dirfd, const char* path, int flags, int* result)
+	{
+		ensureLoaded();
+		if (isPlainRead(flags) == false)
+			return 0;
+
+		char name[PATH_MAX];
+		Entry entry;
+		if (getEggName(dirfd, path, name) == false || findEntry(name, &entry) == false || entry.File < 0)
+		{
+			if (s_numEggs > 0)
+				s_numPassedOn++;
+			return 0;
+		}
+
+		*result = openFile(entry, flags);
+		return 1;
+	}
+
+	// makes up an inode number that won't be the same as a real file's on the egg's device
+	uint64_t getInode(const Entry& entry)
+	{
+		uint64_t egg = getEggNumber(entry.Egg);
+		uint64_t index = entry.File >= 0 ? (uint64_t)entry.File : (uint64_t)entry.Directory | (1ULL << 31);
+		return (1ULL << 63) | (egg << 32) | index;
+	}
+
+	template<typename StatType>
+	void fillStat(const Entry& entry, StatType* result)
+	{
+		const struct stat& eggStat = entry.Egg->Stat;
+		memset(result, 0, sizeof(*result));
+
+		result->st_dev = eggStat.st_dev;
+		result->st_ino = getInode(entry);
+		result->st_uid = eggStat.st_uid;
+		result->st_gid = eggStat.st_gid;
+		result->st_blksize = 4096;
+		result->st_atim = eggStat.st_atim;
+		result->st_mtim = eggStat.st_mtim;
+		result->st_ctim = eggStat.st_ctim;
+
+		if (entry.File >= 0)
+		{
+			uint64_t size = entry.Egg->Info.TableOfContents[entry.File].UncompressedSize;
+			result->st_mode = S_IFREG | 0444;
+			result->st_nlink = 1;
+			result->st_size = size;
+			result->st_blocks = (size + 511) / 512;
+		}
+		else
+		{
+			result->st_mode = S_IFDIR | 0555;
+			result->st_nlink = 2;
+		}
+	}
+
+	statx_timestamp toStatxTimestamp(const timespec& time)
+	{
+		statx_timestamp result = {};
+		result.tv_sec = time.tv_sec;
+		result.tv_nsec = (uint32_t)time.tv_nsec;
+		return result;
+	}
+
+	void fillStat(const Entry& entry, struct statx* result)
+	{
+		struct stat converted;
+		fillStat(entry, &converted);
+
+		memset(result, 0, sizeof(*result));
+		result->stx_mask = STATX_BASIC_STATS;
+		result->stx_blksize = (uint32_t)converted.st_blksize;
+		result->stx_nlink = (uint32_t)converted.st_nlink;
+		result->stx_uid = converted.st_uid;
+		result->stx_gid = converted.st_gid;
+		result->stx_mode = (uint16_t)converted.st_mode;
+		result->stx_ino = converted.st_ino;
+		result->stx_size = converted.st_size;
+		result->stx_blocks = converted.st_blocks;
+		result->stx_atime = toStatxTimestamp(converted.st_atim);
+		result->stx_ctime = toStatxTimestamp(converted.st_ctim);
+		result->stx_mtime = toStatxTimestamp(converted.st_mtim);
+		result->stx_dev_major = major(converted.st_dev);
+		result->stx_dev_minor = minor(converted.st_dev);
+	}
+
+	template<typename StatType>
+	void getIdentity(const StatType& buffer, uint64_t* device, uint64_t* inode)
+	{
+		*device = buffer.st_dev;
+		*inode = buffer.st_ino;
+	}
+
+	void getIdentity(const struct statx& buffer, uint64_t* device, uint64_t* inode)
+	{
+		*device = makedev(buffer.stx_dev_major, buffer.stx_dev_minor);
+		*inode = buffer.stx_ino;
+	}
+
+	// fstat() on a file that came from an egg would describe the memfd, with a different
+	// device and inode to what stat() said, and programs like cp take that to mean the file
+	// was swapped while they opened it. So this makes it say the same as stat() did.
+	template<typename StatType>
+	void fixFileStat(int fd, StatType* buffer)
+	{
+		uint64_t device, inode;
+		getIdentity(*buffer, &device, &inode);
+		if (s_numOpened == 0 || device != s_memfdDevice)
+			return;
+
+		if (fd >= 0 && fd < MaxTrackedFiles && s_openedFiles[fd].Inode == inode)
+		{
+			uint64_t opened = s_openedFiles[fd].Entry;
+			Entry entry = { s_eggs[opened >> 32], (int)(uint32_t)opened, -1 };
+			fillStat(entry, buffer);
+			return;
+		}
+
+		// a dup() of one, or some other memfd
+		if (fcntl(fd, F_GET_SEALS) != FileSeals)
+			return;
+
+		char link[64], target[256];
+		snprintf(link, sizeof(link), "/proc/self/fd/%d", fd);
+		ssize_t length = readlink(link, target, sizeof(target) - 1);
+		if (length <= 0)
+			return;
+		target[length] = 0;
+
+		unsigned int egg;
+		int index;
+		if (sscanf(target, "/memfd:egg%u:%d:", &egg, &index) != 2 || egg >= s_numEggs ||
+			index < 0 || (unsigned int)index >= s_eggs[egg]->Info.NumFiles)
+			return;
+
+		Entry entry = { s_eggs[egg], index, -1 };
+		fillStat(entry, buffer);
+	}
+
+	// whether a *at() call is about dirfd itself
+	bool isEmptyPath(const char* path, int flags)
+	{
+		return (flags & AT_EMPTY_PATH) && (path == nullptr || path[0] == 0);
+	}
+
+	// Like tryOpen(), for the stat family. An empty path means dirfd itself is being
+	// looked at, which is already a real file (or one of our memfds).
+	template<typename StatType>
+	int tryStat(int dirfd, const char* path, StatType* buffer, int flags, int* result)
+	{
+		ensureLoaded();
+		if (isEmptyPath(path, flags))
+			return 0;
+
+		char name[PATH_MAX];
+		Entry entry;
+		if (getEggName(dirfd, path, name) == false || findEntry(name, &entry) == false)
+			return 0;
+
+		fillStat(entry, buffer);
+		s_numStats++;
+		*result = 0;
+		return 1;
+	}
+
+	int tryAccess(int dirfd, const char* path, int mode, int* result)
+	{
+		ensureLoaded();
+
+		char name[PATH_MAX];
+		Entry entry;
+		if (getEggName(dirfd, path, name) == false || findEntry(name, &entry) == false)
+			return 0;
+
+		if (mode & W_OK)
+		{
+			errno = EROFS;
+			*result = -1;
+		}
+		else if ((mode & X_OK) && entry.File >= 0)
+		{
+			errno = EACCES;
+			*result = -1;
+		}
+		else
+			*result = 0;
+		return 1;
+	}
+
+	bool isReadMode(const char* mode)
+	{
+		return mode != nullptr && mode[0] == 'r' && strchr(mode, '+') == nullptr;
+	}
+
+	FILE* tryFopen(const char* path, const char* mode, bool* handled)
+	{
+		ensureLoaded();
+		*handled = false;
+		if (isReadMode(mode) == false)
+			return nullptr;
+
+		int fd;
+		if (tryOpen(AT_FDCWD, path, O_RDONLY | (strchr(mode, 'e') != nullptr ? O_CLOEXEC : 0), &fd) == 0)
+			return nullptr;
+
+		*handled = true;
+		if (fd == -1)
+			return nullptr;
+
+		FILE* file = fdopen(fd, mode);
+		if (file == nullptr)
+		{
+			int error = errno;
+			close(fd);
+			errno = error;
+		}
+		return file;
+	}
+
+	int getMode(int flags, va_list args)
+	{
+		if ((flags & O_CREAT) || (flags & O_TMPFILE) == O_TMPFILE)
+			return va_arg(args, int);
+		return 0;
+	}
+
+	__attribute__((destructor))
+	void printSummary()
+	{
+		if (s_verbose == false)
+			return;
+
+		fprintf(stderr, "eggpreload: served %llu opens (%.1f MB) and %llu stats from %u egg(s), passed %llu on\n",
+			(unsigned long long)s_numOpened, s_bytesOpened / (1024.0 * 1024.0), (unsigned long long)s_numStats,
+			(unsigned int)s_numEggs, (unsigned long long)s_numPassedOn);
+	}
+}
+
+EXPORT int open(const char* path, int flags, ...)
+{
+	va_list args;
+	va_start(args, flags);
+	int mode = getMode(flags, args);
+	va_end(args);
+
+	int result;
+	if (tryOpen(AT_FDCWD, path, flags, &result))
+		return result;
+	return s_real.Open(path, flags, mode);
+}
+
+EXPORT int open64(const char* path, int flags, ...)
+{
+	va_list args;
+	va_start(args, flags);
+	int mode = getMode(flags, args);
+	va_end(args);
+
+	int result;
+	if (tryOpen(AT_FDCWD, path, flags, &result))
+		return result;
+	return s_real.Open64(path, flags, mode);
+}
+
+EXPORT int openat(int dirfd, const char* path, int flags, ...)
+{
+	va_list args;
+	va_start(args, flags);
+	int mode = getMode(flags, args);
+	va_end(args);
+
+	int result;
+	if (tryOpen(dirfd, path, flags, &result))
+		return result;
+	return s_real.OpenAt(dirfd, path, flags, mode);
+}
+
+EXPORT int openat64(int dirfd, const char* path, int flags, ...)
+{
+	va_list args;
+	va_start(args, flags);
+	int mode = getMode(flags, args);
+	va_end(args);
+
+	int result;
+	if (tryOpen(dirfd, path, flags, &result))
+		return result;
+	return s_real.OpenAt64(dirfd, path, flags, mode);
+}
+
+// what open() turns into when it's built with _FORTIFY_SOURCE
+EXPORT int __open_2(const char* path, int flags)
+{
+	int result;
+	if (tryOpen(AT_FDCWD, path, flags, &result))
+		return result;
+	return s_real.Open2 ? s_real.Open2(path, flags) : missing();
+}
+
+EXPORT int __open64_2(const char* path, int flags)
+{
+	int result;
+	if (tryOpen(AT_FDCWD, path, flags, &result))
+		return result;
+	return s_real.Open64_2 ? s_real.Open64_2(path, flags) : missing();
+}
+
+EXPORT int __openat_2(int dirfd, const char* path, int flags)
+{
+	int result;
+	if (tryOpen(dirfd, path, flags, &result))
+		return result;
+	return s_real.OpenAt2 ? s_real.OpenAt2(dirfd, path, flags) : missing();
+}
+
+EXPORT int __openat64_2(int dirfd, const char* path, int flags)
+{
+	int result;
+	if (tryOpen(dirfd, path, flags, &result))
+		return result;
+	return s_real.OpenAt64_2 ? s_real.OpenAt64_2(dirfd, path, flags) : missing();
+}
+
+// stdio opens files without going through open(), so it needs catching separately
+EXPORT FILE* fopen(const char* path, const char* mode)
+{
+	bool handled;
+	FILE* file = tryFopen(path, mode, &handled);
+	return handled ? file : s_real.Fopen(path, mode);
+}
+
+EXPORT FILE* fopen64(const char* path, const char* mode)
+{
+	bool handled;
+	FILE* file = tryFopen(path, mode, &handled);
+	return handled ? file : s_real.Fopen64(path, mode);
+}
+
+// Programs built against glibc 2.33 or later call stat() and friends, older ones call
+// __xstat() and friends. The files in an egg aren't symlinks, so lstat() is the same as stat().
+EXPORT int stat(const char* path, struct stat* buffer)
+{
+	int result;
+	if (tryStat(AT_FDCWD, path, buffer, 0, &result))
+		return result;
+	return s_real.Stat ? s_real.Stat(path, buffer) : missing();
+}
+
+EXPORT int lstat(const char* path, struct stat* buffer)
+{
+	int result;
+	if (tryStat(AT_FDCWD, path, buffer, 0, &result))
+		return result;
+	return s_real.Lstat ? s_real.Lstat(path, buffer) : missing();
+}
+
+EXPORT int stat64(const char* path, struct stat64* buffer)
+{
+	int result;
+	if (tryStat(AT_FDCWD, path, buffer, 0, &result))
+		return result;
+	return s_real.Stat64 ? s_real.Stat64(path, buffer) : missing();
+}
+
+EXPORT int lstat64(const char* path, struct stat64* buffer)
+{
+	int result;
+	if (tryStat(AT_FDCWD, path, buffer, 0, &result))
+		return result;
+	return s_real.Lstat64 ? s_real.Lstat64(path, buffer) : missing();
+}
+
+EXPORT int fstatat(int dirfd, const char* path, struct stat* buffer, int flags)
+{
+	int result;
+	if (tryStat(dirfd, path, buffer, flags, &result))
+		return result;
+
+	result = s_real.StatAt ? s_real.StatAt(dirfd, path, buffer, flags) : missing();
+	if (result == 0 && isEmptyPath(path, flags))
+		fixFileStat(dirfd, buffer);
+	return result;
+}
+
+EXPORT int fstatat64(int dirfd, const char* path, struct stat64* buffer, int flags)
+{
+	int result;
+	if (tryStat(dirfd, path, buffer, flags, &result))
+		return result;
+
+	result = s_real.StatAt64 ? s_real.StatAt64(dirfd, path, buffer, flags) : missing();
+	if (result == 0 && isEmptyPath(path, flags))
+		fixFileStat(dirfd, buffer);
+	return result;
+}
+
+EXPORT int __xstat(int version, const char* path, struct stat* buffer)
+{
+	int result;
+	if (tryStat(AT_FDCWD, path, buffer, 0, &result))
+		return result;
+	return s_real.Xstat ? s_real.Xstat(version, path, buffer) : missing();
+}
+
+EXPORT int __lxstat(int version, const char* path, struct stat* buffer)
+{
+	int result;
+	if (tryStat(AT_FDCWD, path, buffer, 0, &result))
+		return result;
+	return s_real.Lxstat ? s_real.Lxstat(version, path, buffer) : missing();
+}
+
+EXPORT int __xstat64(int version, const char* path, struct stat64* buffer)
+{
+	int result;
+	if (tryStat(AT_FDCWD, path, buffer, 0, &result))
+		return result;
+	return s_real.Xstat64 ? s_real.Xstat64(version, path, buffer) : missing();
+}
+
+EXPORT int __lxstat64(int version, const char* path, struct stat64* buffer)
+{
+	int result;
+	if (tryStat(AT_FDCWD, path, buffer, 0, &result))
+		return result;
+	return s_real.Lxstat64 ? s_real.Lxstat64(version, path, buffer) : missing();
+}
+
+EXPORT int __fxstatat(int version, int dirfd, const char* path, struct stat* buffer, int flags)
+{
+	int result;
+	if (tryStat(dirfd, path, buffer, flags, &result))
+		return result;
+
+	result = s_real.FxstatAt ? s_real.FxstatAt(version, dirfd, path, buffer, flags) : missing();
+	if (result == 0 && isEmptyPath(path, flags))
+		fixFileStat(dirfd, buffer);
+	return result;
+}
+
+EXPORT int __fxstatat64(int version, int dirfd, const char* path, struct stat64* buffer, int flags)
+{
+	int result;
+	if (tryStat(dirfd, path, buffer, flags, &result))
+		return result;
+
+	result = s_real.FxstatAt64 ? s_real.FxstatAt64(version, dirfd, path, buffer, flags) : missing();
+	if (result == 0 && isEmptyPath(path, flags))
+		fixFileStat(dirfd, buffer);
+	return result;
+}
+
+// coreutils and other newer programs use statx() instead
+EXPORT int statx(int dirfd, const char* path, int flags, unsigned int mask, struct statx* buffer)
+{
+	int result;
+	if (tryStat(dirfd, path, buffer, flags, &result))
+		return result;
+
+	result = s_real.Statx ? s_real.Statx(dirfd, path, flags, mask, buffer) : missing();
+	if (result == 0 && isEmptyPath(path, flags))
+		fixFileStat(dirfd, buffer);
+	return result;
+}
+
+EXPORT int fstat(int fd, struct stat* buffer)
+{
+	ensureRealFunctions();
+	int result = s_real.Fstat ? s_real.Fstat(fd, buffer) : missing();
+	if (result == 0)
+		fixFileStat(fd, buffer);
+	return result;
+}
+
+EXPORT int fstat64(int fd, struct stat64* buffer)
+{
+	ensureRealFunctions();
+	int result = s_real.Fstat64 ? s_real.Fstat64(fd, buffer) : missing();
+	if (result == 0)
+		fixFileStat(fd, buffer);
+	return result;
+}
+
+EXPORT int __fxstat(int version, int fd, struct stat* buffer)
+{
+	ensureRealFunctions();
+	int result = s_real.Fxstat ? s_real.Fxstat(version, fd, buffer) : missing();
+	if (result == 0)
+		fixFileStat(fd, buffer);
+	return result;
+}
+
+EXPORT int __fxstat64(int version, int fd, struct stat64* buffer)
+{
+	ensureRealFunctions();
+	int result = s_real.Fxstat64 ? s_real.Fxstat64(version, fd, buffer) : missing();
+	if (result == 0)
+		fixFileStat(fd, buffer);
+	return result;
+}
+
+EXPORT int access(const char* path, int mode)
+{
+	int result;
+	if (tryAccess(AT_FDCWD, path, mode, &result))
+		return result;
+	return s_real.Access(path, mode);
+}
+
+EXPORT int faccessat(int dirfd, const char* path, int mode, int flags)
+{
+	int result;
+	if (tryAccess(dirfd, path, mode, &result))
+		return result;
+	return s_real.AccessAt(dirfd, path, mode, flags);
+}